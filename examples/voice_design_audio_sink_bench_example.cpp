@@ -0,0 +1,205 @@
+#include "audio_sink.h"
+
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double Sec(const Clock::time_point& a, const Clock::time_point& b) {
+  return std::chrono::duration_cast<std::chrono::duration<double>>(b - a).count();
+}
+
+bool ParseInt(const std::string& s, int* out) {
+  auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), *out);
+  return ec == std::errc{} && ptr == s.data() + s.size();
+}
+
+// Speech-like test signal: a gliding harmonic source with syllable-rate envelope and noise.
+std::vector<float> MakeSignal(int sample_rate, int seconds) {
+  std::mt19937 rng(1234);
+  std::normal_distribution<float> noise(0.0f, 0.01f);
+  std::vector<float> x(static_cast<size_t>(sample_rate) * static_cast<size_t>(seconds));
+  constexpr double kPi = 3.14159265358979323846;
+  double phase = 0.0;
+  for (size_t i = 0; i < x.size(); ++i) {
+    const double t = static_cast<double>(i) / sample_rate;
+    const double f0 = 140.0 + 40.0 * std::sin(2.0 * kPi * 0.7 * t);
+    phase += 2.0 * kPi * f0 / sample_rate;
+    double v = 0.0;
+    for (int h = 1; h <= 12; ++h) v += std::sin(h * phase) / h;
+    const double env = 0.5 + 0.5 * std::sin(2.0 * kPi * 4.0 * t);
+    x[i] = static_cast<float>(0.25 * env * v) + noise(rng);
+  }
+  return x;
+}
+
+uint8_t FlacCrc8(const uint8_t* data, size_t n) {
+  uint8_t crc = 0;
+  for (size_t i = 0; i < n; ++i) {
+    crc ^= data[i];
+    for (int b = 0; b < 8; ++b) crc = static_cast<uint8_t>((crc & 0x80) ? ((crc << 1) ^ 0x07) : (crc << 1));
+  }
+  return crc;
+}
+
+uint16_t FlacCrc16Update(uint16_t crc, uint8_t byte) {
+  crc ^= static_cast<uint16_t>(byte << 8);
+  for (int b = 0; b < 8; ++b) crc = static_cast<uint16_t>((crc & 0x8000) ? ((crc << 1) ^ 0x8005) : (crc << 1));
+  return crc;
+}
+
+// Walks a FLAC stream frame by frame: every header must carry a valid UTF-8 coded frame number
+// equal to its index and a matching CRC-8, every frame must end in a matching CRC-16 right
+// before the next sync code, and the block sizes must add up to the samples written.
+bool ValidateFlac(const std::vector<uint8_t>& d, uint64_t expected_samples, std::string* error) {
+  auto fail = [&](const std::string& msg) {
+    *error = msg;
+    return false;
+  };
+  if (d.size() < 4 || d[0] != 'f' || d[1] != 'L' || d[2] != 'a' || d[3] != 'C') return fail("missing fLaC marker");
+  size_t pos = 4;
+  for (bool last = false; !last;) {
+    if (pos + 4 > d.size()) return fail("truncated metadata");
+    last = (d[pos] & 0x80) != 0;
+    pos += 4 + ((size_t{d[pos + 1]} << 16) | (size_t{d[pos + 2]} << 8) | d[pos + 3]);
+  }
+  uint64_t frame = 0;
+  uint64_t samples = 0;
+  while (pos < d.size()) {
+    const std::string where = "frame " + std::to_string(frame) + ": ";
+    if (pos + 4 > d.size() || d[pos] != 0xFF || d[pos + 1] != 0xF8) return fail(where + "missing sync code");
+    const int bs_code = d[pos + 2] >> 4;
+    const int sr_code = d[pos + 2] & 0x0F;
+    size_t h = pos + 4;
+    int extra = 0;
+    while (extra < 7 && (d[pos + 4] & (0x80 >> extra))) ++extra;
+    if (extra == 1 || extra > 6) return fail(where + "invalid UTF-8 lead byte");
+    const size_t len = extra == 0 ? 1 : static_cast<size_t>(extra);
+    if (h + len > d.size()) return fail(where + "truncated header");
+    uint64_t number = d[h] & (0x7F >> extra);
+    for (size_t i = 1; i < len; ++i) {
+      if ((d[h + i] & 0xC0) != 0x80) return fail(where + "invalid UTF-8 continuation byte");
+      number = (number << 6) | (d[h + i] & 0x3F);
+    }
+    if (number != frame) return fail(where + "header carries frame number " + std::to_string(number));
+    h += len;
+    uint32_t block = 0;
+    if (bs_code == 6) {
+      block = d[h++] + 1u;
+    } else if (bs_code == 7) {
+      block = ((uint32_t{d[h]} << 8) | d[h + 1]) + 1u;
+      h += 2;
+    } else {
+      return fail(where + "unexpected block size code");
+    }
+    h += sr_code == 12 ? 1 : (sr_code == 13 || sr_code == 14) ? 2 : 0;
+    if (h >= d.size() || FlacCrc8(d.data() + pos, h - pos) != d[h]) return fail(where + "header CRC-8 mismatch");
+    // The frame ends at the first later sync code (or the stream end) preceded by a matching CRC-16.
+    uint16_t crc = 0;
+    size_t end = 0;
+    for (size_t q = pos; q + 2 <= d.size(); ++q) {
+      const bool at_end = q + 2 == d.size();
+      const bool at_sync = q + 4 <= d.size() && d[q + 2] == 0xFF && d[q + 3] == 0xF8;
+      if ((at_end || at_sync) && crc == ((uint16_t{d[q]} << 8) | d[q + 1])) {
+        end = q + 2;
+        break;
+      }
+      crc = FlacCrc16Update(crc, d[q]);
+    }
+    if (end == 0) return fail(where + "no matching CRC-16");
+    samples += block;
+    pos = end;
+    ++frame;
+  }
+  if (samples != expected_samples) {
+    return fail("frames hold " + std::to_string(samples) + " samples, expected " + std::to_string(expected_samples));
+  }
+  return true;
+}
+
+}  // namespace
+
+// Encodes a synthetic signal through every AudioSink format in vocoder-sized blocks and
+// reports encode cost per second of audio, real-time factor and output bitrate. The FLAC
+// output of the first repeat is checked with ValidateFlac.
+int main(int argc, char** argv) {
+  int seconds = 30;
+  int repeats = 3;
+  int block = 1920;  // one codec frame at 24 kHz
+  if ((argc > 1 && !ParseInt(argv[1], &seconds)) || (argc > 2 && !ParseInt(argv[2], &repeats)) ||
+      (argc > 3 && !ParseInt(argv[3], &block)) || seconds <= 0 || repeats <= 0 || block <= 0) {
+    std::cerr << "Usage:\n  " << argv[0] << " [seconds=30] [repeats=3] [block_samples=1920]\n";
+    return 2;
+  }
+
+  constexpr int kSampleRate = 24000;
+  const std::vector<float> signal = MakeSignal(kSampleRate, seconds);
+  const std::string wav_path = (std::filesystem::temp_directory_path() / "qwen3_tts_sink_bench.wav").string();
+
+  std::cout << "[bench] " << seconds << " s of audio, " << repeats << " repeats, block " << block << " samples\n";
+  std::cout << std::left << std::setw(8) << "format" << std::right << std::setw(14) << "ms/audio_s"
+            << std::setw(12) << "x_realtime" << std::setw(12) << "kbit/s" << std::setw(10) << "rate" << "\n";
+
+  const QWEN3TTSUTILS::AudioFormat formats[] = {
+      QWEN3TTSUTILS::AudioFormat::Wav,   QWEN3TTSUTILS::AudioFormat::PcmS16, QWEN3TTSUTILS::AudioFormat::PcmF32,
+      QWEN3TTSUTILS::AudioFormat::MuLaw, QWEN3TTSUTILS::AudioFormat::ALaw,   QWEN3TTSUTILS::AudioFormat::Flac,
+  };
+  for (const auto fmt : formats) {
+    double best = 1e30;
+    uint64_t bytes = 0;
+    int out_rate = 0;
+    for (int r = 0; r < repeats; ++r) {
+      std::string err;
+      uint64_t counted = 0;
+      std::vector<uint8_t> flac_bytes;
+      std::unique_ptr<QWEN3TTSUTILS::AudioSink> sink;
+      const auto t0 = Clock::now();
+      if (fmt == QWEN3TTSUTILS::AudioFormat::Wav) {
+        sink = QWEN3TTSUTILS::OpenAudioSink(fmt, wav_path, kSampleRate, &err);
+      } else {
+        sink = QWEN3TTSUTILS::CreateAudioSink(
+            fmt,
+            [&](const uint8_t* p, size_t n) {
+              counted += n;
+              if (fmt == QWEN3TTSUTILS::AudioFormat::Flac && r == 0) flac_bytes.insert(flac_bytes.end(), p, p + n);
+              return true;
+            },
+            kSampleRate, &err);
+      }
+      if (!sink) {
+        std::cerr << "Error: " << err << "\n";
+        return 3;
+      }
+      for (size_t off = 0; off < signal.size(); off += static_cast<size_t>(block)) {
+        sink->Write(signal.data() + off, std::min(signal.size() - off, static_cast<size_t>(block)));
+      }
+      if (!sink->Close(&err)) {
+        std::cerr << "Error: " << err << "\n";
+        return 3;
+      }
+      best = std::min(best, Sec(t0, Clock::now()));
+      if (fmt == QWEN3TTSUTILS::AudioFormat::Flac && r == 0 && !ValidateFlac(flac_bytes, signal.size(), &err)) {
+        std::cerr << "Error: invalid FLAC stream: " << err << "\n";
+        return 1;
+      }
+      bytes = sink->bytesWritten();
+      out_rate = sink->outputSampleRate();
+    }
+    const double ms_per_s = best * 1000.0 / seconds;
+    std::cout << std::left << std::setw(8) << QWEN3TTSUTILS::AudioFormatName(fmt) << std::right << std::fixed
+              << std::setprecision(3) << std::setw(14) << ms_per_s << std::setprecision(0) << std::setw(12)
+              << (seconds / std::max(best, 1e-9)) << std::setprecision(1) << std::setw(12)
+              << (static_cast<double>(bytes) * 8.0 / 1000.0 / seconds) << std::setw(10) << out_rate << "\n";
+  }
+  std::filesystem::remove(wav_path);
+  return 0;
+}
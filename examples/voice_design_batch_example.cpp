@@ -0,0 +1,362 @@
+#include "audio_sink.h"
+#include "logger.h"
+#include "request_queue.h"
+#include "utils.h"
+
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+void PrintUsage(const char* exe) {
+  std::cerr
+      << "Usage:\n  " << exe << " <onnx_dir> <manifest.jsonl|manifest.tsv> <out_dir>"
+      << " [--engines N] [--intra-threads N] [--in-flight N] [--vocoder-batch N] [--vocoder-wait-ms MS] [--format wav|s16le|f32le|mulaw|alaw|flac]"
+      << " [--instruct TEXT] [--lang LANG] [--log-level debug|info|warn|error|off]\n"
+      << "JSONL: {\"id\": \"...\", \"text\": \"...\", \"instruct\": \"...\", \"lang\": \"english\","
+      << " \"params\": {\"max_steps\": 400, \"seed\": 1, \"temperature\": 0.8, ...}}\n"
+      << "TSV:   id<TAB>text[<TAB>instruct[<TAB>lang[<TAB>key=value,key=value]]]\n";
+}
+
+bool ParseInt(const std::string& s, int* out) {
+  auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), *out);
+  return ec == std::errc{} && ptr == s.data() + s.size();
+}
+
+int ParseLangStr(const std::string& s) {
+  static const std::unordered_map<std::string, int> langMap = {
+      {"chinese", 2055}, {"english", 2050}, {"german", 2053}, {"italian", 2070},
+      {"portuguese", 2071}, {"spanish", 2054}, {"japanese", 2058}, {"korean", 2064},
+      {"french", 2061}, {"russian", 2069}, {"beijing_dialect", 2074}, {"sichuan_dialect", 2062}};
+  auto it = langMap.find(s);
+  if (it != langMap.end()) return it->second;
+  int id = 0;
+  return ParseInt(s, &id) ? id : -1;
+}
+
+bool HasKey(const std::string& src, const char* key) {
+  return src.find(std::string("\"") + key + "\"") != std::string::npos;
+}
+
+struct Item {
+  std::string id;
+  QWEN3TTS::GenerationParams params;
+};
+
+// Per-request overrides; TSV key=value lists are rewritten as "key":value to share this path.
+bool ApplyParams(const std::string& src, QWEN3TTS::GenerationParams* p, std::string* error) {
+  using QWEN3TTSUTILS::ParseFloatScalar;
+  using QWEN3TTSUTILS::ParseIntScalar;
+  const std::pair<const char*, int*> ints[] = {
+      {"steps", &p->steps}, {"max_steps", &p->max_steps}, {"top_k", &p->top_k},
+      {"eos_min_steps", &p->eos_min_steps}, {"cp_groups", &p->cp_groups},
+      {"tail_stop_repeat_frames", &p->tail_stop_repeat_frames}, {"trim_tail_repeat_min", &p->trim_tail_repeat_min},
+      {"silence_stop_frames", &p->silence_stop_frames}, {"vocoder_window_frames", &p->vocoder_window_frames}};
+  for (const auto& [key, dst] : ints) {
+    if (HasKey(src, key)) *dst = static_cast<int>(ParseIntScalar(src, key));
+  }
+  if (HasKey(src, "seed")) p->seed = ParseIntScalar(src, "seed");
+  if (HasKey(src, "temperature")) p->temperature = static_cast<float>(ParseFloatScalar(src, "temperature"));
+  if (HasKey(src, "do_sample")) {
+    const size_t v = src.find_first_not_of(" \t:", src.find("\"do_sample\"") + 11);
+    p->do_sample = v != std::string::npos && (src[v] == 't' || src[v] == '1');
+  }
+  if (p->max_steps < 0 || p->steps < 0 || p->top_k < 0 || p->temperature < 0.0f) {
+    *error = "negative parameter";
+    return false;
+  }
+  return true;
+}
+
+bool ParseJsonLine(const std::string& line, Item* item, std::string* error) {
+  using QWEN3TTSUTILS::ParseStringScalar;
+  item->id = ParseStringScalar(line, "id");
+  if (item->id.empty() && HasKey(line, "id")) item->id = std::to_string(QWEN3TTSUTILS::ParseIntScalar(line, "id"));
+  item->params.text = ParseStringScalar(line, "text");
+  if (HasKey(line, "instruct")) item->params.instruct = ParseStringScalar(line, "instruct");
+  if (HasKey(line, "lang")) {
+    const std::string lang = ParseStringScalar(line, "lang");
+    const int id = lang.empty() ? static_cast<int>(QWEN3TTSUTILS::ParseIntScalar(line, "lang")) : ParseLangStr(lang);
+    if (id < 0) {
+      *error = "unknown lang: " + lang;
+      return false;
+    }
+    item->params.codec_lang = {id};
+  }
+  return ApplyParams(line, &item->params, error);
+}
+
+bool ParseTsvLine(const std::string& line, Item* item, std::string* error) {
+  std::vector<std::string> cols;
+  std::stringstream ss(line);
+  std::string col;
+  while (std::getline(ss, col, '\t')) cols.push_back(col);
+  if (cols.size() < 2) {
+    *error = "expected at least id and text columns";
+    return false;
+  }
+  item->id = cols[0];
+  item->params.text = cols[1];
+  if (cols.size() > 2 && !cols[2].empty()) item->params.instruct = cols[2];
+  if (cols.size() > 3 && !cols[3].empty()) {
+    const int id = ParseLangStr(cols[3]);
+    if (id < 0) {
+      *error = "unknown lang: " + cols[3];
+      return false;
+    }
+    item->params.codec_lang = {id};
+  }
+  if (cols.size() > 4) {
+    std::string json;
+    std::stringstream kvs(cols[4]);
+    std::string kv;
+    while (std::getline(kvs, kv, ',')) {
+      const size_t eq = kv.find('=');
+      if (eq == std::string::npos) continue;
+      json += "\"" + kv.substr(0, eq) + "\":" + kv.substr(eq + 1) + ",";
+    }
+    return ApplyParams(json, &item->params, error);
+  }
+  return true;
+}
+
+// Output file names come from ids; keep them inside out_dir.
+std::string SafeFileName(const std::string& id) {
+  std::string out = id;
+  for (char& c : out) {
+    if (c == '/' || c == '\\' || c == ':' || static_cast<unsigned char>(c) < 0x20) c = '_';
+  }
+  if (out.empty() || out == "." || out == "..") out = "_" + out;
+  return out;
+}
+
+struct Pending {
+  std::string id;
+  std::filesystem::path part_path;
+  std::filesystem::path final_path;
+  std::unique_ptr<QWEN3TTSUTILS::AudioSink> sink;
+  std::atomic<uint64_t> samples{0};
+  std::future<std::vector<float>> result;
+};
+
+}  // namespace
+
+// Offline bulk rendering: loads the model once into a RequestQueue of N engines, streams each
+// utterance straight to <out_dir>/<id>.<format> (at most --in-flight requests are open, so
+// memory does not grow with the manifest), records finished ids in <out_dir>/done.tsv and
+// skips them on the next run, and reports audio-seconds rendered per wall-second.
+int main(int argc, char** argv) {
+  if (argc < 4) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+  const std::string manifest_path = argv[2];
+  const std::filesystem::path out_dir = argv[3];
+
+  QWEN3TTS::RequestQueueConfig qcfg;
+  qcfg.tts.model.path = argv[1];
+  qcfg.tts.device = "cpu";
+  qcfg.tts.intra_threads = 2;
+  qcfg.tts.inter_threads = 1;
+  qcfg.engines = 2;
+  int in_flight = 0;
+  QWEN3TTSUTILS::AudioFormat format = QWEN3TTSUTILS::AudioFormat::Wav;
+  std::string default_instruct = "Speak clearly and naturally.";
+  std::vector<int64_t> default_lang = {-1};
+  QWEN3TTS::Logger::instance().setLevel(QWEN3TTS::LogLevel::Warn);
+
+  for (int i = 4; i < argc; ++i) {
+    const std::string flag = argv[i];
+    if (i + 1 >= argc) {
+      std::cerr << "Error: missing value for " << flag << "\n";
+      return 2;
+    }
+    const std::string value = argv[++i];
+    int v = 0;
+    const bool is_int = ParseInt(value, &v) && v > 0;
+    QWEN3TTS::LogLevel level = QWEN3TTS::LogLevel::Warn;
+    if (flag == "--engines" && is_int) {
+      qcfg.engines = v;
+    } else if (flag == "--vocoder-batch" && is_int) {
+      qcfg.batch_vocoder = true;
+      qcfg.vocoder_batch.max_batch = v;
+    } else if (flag == "--vocoder-wait-ms" && ParseInt(value, &v) && v >= 0) {
+      qcfg.vocoder_batch.max_wait_ms = v;
+    } else if (flag == "--intra-threads" && is_int) {
+      qcfg.tts.intra_threads = v;
+    } else if (flag == "--in-flight" && is_int) {
+      in_flight = v;
+    } else if (flag == "--format" && QWEN3TTSUTILS::ParseAudioFormat(value, &format)) {
+    } else if (flag == "--instruct") {
+      default_instruct = value;
+    } else if (flag == "--lang" && ParseLangStr(value) >= 0) {
+      default_lang = {ParseLangStr(value)};
+    } else if (flag == "--log-level" && QWEN3TTS::ParseLogLevel(value, &level)) {
+      QWEN3TTS::Logger::instance().setLevel(level);
+    } else {
+      std::cerr << "Error: invalid flag or value: " << flag << " " << value << "\n";
+      return 2;
+    }
+  }
+  if (in_flight <= 0) in_flight = qcfg.engines * 2;
+  qcfg.capacity = static_cast<size_t>(in_flight);
+
+  std::ifstream manifest(manifest_path);
+  if (!manifest) {
+    std::cerr << "Error: failed to open manifest: " << manifest_path << "\n";
+    return 2;
+  }
+  std::error_code ec;
+  std::filesystem::create_directories(out_dir, ec);
+  if (ec) {
+    std::cerr << "Error: cannot create output directory: " << ec.message() << "\n";
+    return 2;
+  }
+
+  // Resume: ids in done.tsv (id, samples, sample_rate) were fully written and renamed.
+  const std::filesystem::path done_path = out_dir / "done.tsv";
+  std::unordered_set<std::string> done;
+  {
+    std::ifstream in(done_path);
+    std::string line;
+    while (std::getline(in, line)) {
+      const size_t tab = line.find('\t');
+      if (tab != std::string::npos) done.insert(line.substr(0, tab));
+    }
+  }
+  std::ofstream done_log(done_path, std::ios::app);
+  if (!done_log) {
+    std::cerr << "Error: cannot open " << done_path.string() << "\n";
+    return 2;
+  }
+
+  QWEN3TTS::RequestQueue queue;
+  const auto load_t0 = Clock::now();
+  if (!queue.start(qcfg)) {
+    std::cerr << "Load failed with error code: " << queue.lastErrorCode() << " (" << queue.lastErrorMessage() << ")\n";
+    return 3;
+  }
+  const int sample_rate = queue.dims().sample_rate;
+  std::cout << "[batch] " << qcfg.engines << " engines ready in " << std::fixed << std::setprecision(1)
+            << std::chrono::duration<double>(Clock::now() - load_t0).count() << " s, in-flight=" << in_flight << "\n";
+
+  const bool tsv = std::filesystem::path(manifest_path).extension() == ".tsv";
+  const std::string ext = QWEN3TTSUTILS::AudioFormatName(format);
+  std::unordered_set<std::string> seen;
+  std::deque<std::unique_ptr<Pending>> pending;
+  int64_t rendered = 0, failed = 0, skipped = 0, bad_lines = 0;
+  double audio_sec = 0.0;
+  const auto t0 = Clock::now();
+
+  auto complete_front = [&]() {
+    std::unique_ptr<Pending> job = std::move(pending.front());
+    pending.pop_front();
+    const std::vector<float> pcm = job->result.get();
+    std::string err;
+    const bool gen_ok = !(pcm.size() == 1 && pcm[0] < 0.0f);
+    const bool close_ok = job->sink->Close(&err);
+    if (!gen_ok || !close_ok) {
+      std::filesystem::remove(job->part_path, ec);
+      std::cerr << "[batch] " << job->id << " failed: "
+                << (gen_ok ? err : "error code " + std::to_string(static_cast<int>(pcm[0]))) << "\n";
+      ++failed;
+      return;
+    }
+    std::filesystem::rename(job->part_path, job->final_path, ec);
+    if (ec) {
+      std::cerr << "[batch] " << job->id << " rename failed: " << ec.message() << "\n";
+      ++failed;
+      return;
+    }
+    const uint64_t samples = job->samples.load();
+    done_log << job->id << '\t' << samples << '\t' << sample_rate << '\n';
+    done_log.flush();
+    ++rendered;
+    audio_sec += static_cast<double>(samples) / sample_rate;
+    if (rendered % 100 == 0) {
+      const double wall = std::chrono::duration<double>(Clock::now() - t0).count();
+      std::cout << "[batch] rendered=" << rendered << " failed=" << failed << " audio=" << std::setprecision(1)
+                << audio_sec << " s throughput=" << std::setprecision(2) << audio_sec / std::max(1e-9, wall)
+                << " audio-s/s\n";
+    }
+  };
+
+  std::string line;
+  int64_t line_no = 0;
+  while (std::getline(manifest, line)) {
+    ++line_no;
+    if (line.empty() || line[0] == '#' || line.find_first_not_of(" \t\r") == std::string::npos) continue;
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    Item item;
+    item.params.instruct = default_instruct;
+    item.params.codec_lang = default_lang;
+    item.params.trim_tail_repeat_min = 24;
+    item.params.vocoder_window_frames = 48;
+    std::string err;
+    if (!(tsv ? ParseTsvLine(line, &item, &err) : ParseJsonLine(line, &item, &err)) || item.id.empty() ||
+        item.params.text.empty()) {
+      std::cerr << "[batch] " << manifest_path << ":" << line_no << " skipped: " << (err.empty() ? "missing id or text" : err)
+                << "\n";
+      ++bad_lines;
+      continue;
+    }
+    const std::string file = SafeFileName(item.id) + "." + ext;
+    auto job = std::make_unique<Pending>();
+    job->id = item.id;
+    job->final_path = out_dir / file;
+    job->part_path = out_dir / (file + ".part");
+    if (done.count(item.id) || std::filesystem::exists(job->final_path) || !seen.insert(item.id).second) {
+      ++skipped;
+      continue;
+    }
+
+    while (static_cast<int>(pending.size()) >= in_flight) complete_front();
+
+    job->sink = QWEN3TTSUTILS::OpenAudioSink(format, job->part_path.string(), sample_rate, &err);
+    if (!job->sink) {
+      std::cerr << "[batch] " << item.id << " failed: " << err << "\n";
+      ++failed;
+      continue;
+    }
+    Pending* raw = job.get();
+    item.params.request_id = static_cast<uint64_t>(line_no);
+    item.params.wav_out.clear();
+    item.params.on_audio = [raw](const float* samples, size_t n) {
+      raw->samples.fetch_add(n, std::memory_order_relaxed);
+      return raw->sink->Write(samples, n);
+    };
+    const int rc = queue.submit(item.params, &job->result);
+    if (rc != 0) {
+      job->sink->Close(nullptr);
+      std::filesystem::remove(job->part_path, ec);
+      std::cerr << "[batch] " << item.id << " rejected with error code: " << rc << "\n";
+      ++failed;
+      continue;
+    }
+    pending.push_back(std::move(job));
+  }
+  while (!pending.empty()) complete_front();
+  queue.stop();
+  QWEN3TTS::Logger::instance().flush();
+
+  const double wall = std::chrono::duration<double>(Clock::now() - t0).count();
+  std::cout << "[batch] done: rendered=" << rendered << " failed=" << failed << " skipped=" << skipped
+            << " bad_lines=" << bad_lines << "\n";
+  std::cout << "[batch] audio=" << std::setprecision(1) << audio_sec << " s wall=" << wall << " s throughput="
+            << std::setprecision(2) << (wall > 0.0 ? audio_sec / wall : 0.0) << " audio-s/s\n";
+  return failed > 0 ? 4 : 0;
+}
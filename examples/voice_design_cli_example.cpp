@@ -1,11 +1,14 @@
 #include "voice.h"
 #include "utils.h"
+#include "audio_sink.h"
+#include "logger.h"
 
 #include <charconv>
 #include <cerrno>
 #include <cstdlib>
 #include <filesystem>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <vector>
 #include <unordered_map>
@@ -20,13 +23,16 @@ void PrintUsage(const char* exe) {
       << " [--speech-tokenizer-file NAME] [--cp-dynamic-file NAME] [--cp-step-pattern PATTERN]"
       << " [--tokenizer-vocab-file NAME] [--tokenizer-merges-file NAME] [--tokenizer-config-file NAME]"
       << " [--ort-opt disable|basic|extended|all] [--intra-threads N] [--inter-threads N]"
-      << " [--device cpu|cuda] [--prefill-device auto|cpu|cuda] [--talker-device auto|cpu|cuda]"
-      << " [--cp-device auto|cpu|cuda] [--vocoder-device auto|cpu|cuda]"
-      << " [--gpu-device-id N] [--gpu-mem-limit-mb N]"
+      << " [--device cpu|cuda|xnnpack|dnnl|openvino] [--prefill-device auto|DEVICE] [--talker-device auto|DEVICE]"
+      << " [--cp-device auto|DEVICE] [--vocoder-device auto|DEVICE]"
+      << " [--gpu-device-id N] [--gpu-mem-limit-mb N] [--xnnpack-threads N]"
+      << " [--openvino-device-type TYPE] [--openvino-threads N] [--openvino-precision FP32|FP16|ACCURACY]"
       << " [--auto-stop-first-code-run N] [--auto-stop-min-steps N]"
       << " [--tail-stop-repeat-frames N] [--tail-stop-min-steps N]"
       << " [--trim-tail-repeat-min N] [--trim-tail-keep N] [--eos-min-steps N]"
-      << " [--do-sample] [--temperature F] [--top-k N] [--sample-seed N]\n";
+      << " [--silence-stop-frames N] [--silence-rms-db F] [--cp-groups N]"
+      << " [--do-sample] [--temperature F] [--top-k N] [--sample-seed N]"
+      << " [--log-level debug|info|warn|error|off] [--vocoder-window-frames N] [--output-format wav|s16le|f32le|mulaw|alaw|flac]\n"
       << " [--lang LANG] (e.g. chinese, english, german, italian, portuguese, spanish, japanese, korean, french, russian, beijing_dialect, sichuan_dialect)\n";
 }
 
@@ -112,6 +118,7 @@ int main(int argc, char** argv) {
   QWEN3TTS::TtsConfig cfg;
   QWEN3TTS::GenerationParams gen;
   gen.wav_out = "./output.wav";
+  QWEN3TTSUTILS::AudioFormat out_format = QWEN3TTSUTILS::AudioFormat::Wav;
 
   auto require_value = [&](int& i, const std::string& flag, std::string* out) -> bool {
     if (i + 1 >= argc) {
@@ -213,6 +220,17 @@ int main(int argc, char** argv) {
         return 2;
       }
       cfg.gpu_mem_limit_mb = v;
+    } else if (flag == "--xnnpack-threads" || flag == "--openvino-threads") {
+      int v = 0;
+      if (!require_value(i, flag, &value) || !ParseInt(value, &v) || v < 0) {
+        std::cerr << "Error: invalid int for " << flag << ": " << value << "\n";
+        return 2;
+      }
+      (flag == "--xnnpack-threads" ? cfg.xnnpack_threads : cfg.openvino_threads) = v;
+    } else if (flag == "--openvino-device-type") {
+      if (!require_value(i, flag, &cfg.openvino_device_type)) return 2;
+    } else if (flag == "--openvino-precision") {
+      if (!require_value(i, flag, &cfg.openvino_precision)) return 2;
     } else if (flag == "--auto-stop-first-code-run") {
       int v = 0;
       if (!require_value(i, flag, &value) || !ParseInt(value, &v)) {
@@ -262,6 +280,46 @@ int main(int argc, char** argv) {
         return 2;
       }
       gen.eos_min_steps = v;
+    } else if (flag == "--silence-stop-frames") {
+      int v = 0;
+      if (!require_value(i, flag, &value) || !ParseInt(value, &v)) {
+        std::cerr << "Error: invalid int for " << flag << ": " << value << "\n";
+        return 2;
+      }
+      gen.silence_stop_frames = v;
+    } else if (flag == "--silence-rms-db") {
+      float v = 0.0f;
+      if (!require_value(i, flag, &value) || !ParseFloat(value, &v)) {
+        std::cerr << "Error: invalid float for " << flag << ": " << value << "\n";
+        return 2;
+      }
+      gen.silence_rms_db = v;
+    } else if (flag == "--cp-groups") {
+      int v = 0;
+      if (!require_value(i, flag, &value) || !ParseInt(value, &v) || v < 0) {
+        std::cerr << "Error: invalid int for " << flag << ": " << value << "\n";
+        return 2;
+      }
+      gen.cp_groups = v;
+    } else if (flag == "--vocoder-window-frames") {
+      int v = 0;
+      if (!require_value(i, flag, &value) || !ParseInt(value, &v)) {
+        std::cerr << "Error: invalid int for " << flag << ": " << value << "\n";
+        return 2;
+      }
+      gen.vocoder_window_frames = v;
+    } else if (flag == "--log-level") {
+      QWEN3TTS::LogLevel level = QWEN3TTS::LogLevel::Info;
+      if (!require_value(i, flag, &value) || !QWEN3TTS::ParseLogLevel(value, &level)) {
+        std::cerr << "Error: invalid value for " << flag << ": " << value << "\n";
+        return 2;
+      }
+      QWEN3TTS::Logger::instance().setLevel(level);
+    } else if (flag == "--output-format") {
+      if (!require_value(i, flag, &value) || !QWEN3TTSUTILS::ParseAudioFormat(value, &out_format)) {
+        std::cerr << "Error: invalid value for " << flag << ": " << value << "\n";
+        return 2;
+      }
     } else if (flag == "--do-sample") {
       gen.do_sample = true;
     } else if (flag == "--temperature") {
@@ -321,21 +379,50 @@ int main(int argc, char** argv) {
     delete voice;
     return 3;
   }
+
+  // Stream decoded audio straight into the output file instead of buffering the utterance.
+  std::string sink_err;
+  std::unique_ptr<QWEN3TTSUTILS::AudioSink> sink = QWEN3TTSUTILS::OpenAudioSink(out_format, gen.wav_out, voice->dims().sample_rate, &sink_err);
+  if (!sink) {
+    std::cerr << "Audio write failed: " << sink_err << "\n";
+    delete voice;
+    return 4;
+  }
+  gen.on_audio = [&](const float* samples, size_t n) { return sink->Write(samples, n); };
   std::vector<float> pcm = voice->generateVoice(gen);
+  const int gen_code = voice->lastErrorCode();
+  const QWEN3TTS::GenerationStats stats = voice->lastStats();
   voice->unload();
   delete voice;
+  // Library lines go through the async logger; print them before the summary below.
+  QWEN3TTS::Logger::instance().flush();
 
   float err_code = 0.0f;
   if (IsErrorPcm(pcm, &err_code)) {
+    sink->Close(nullptr);
+    std::filesystem::remove(gen.wav_out);
+    if (gen_code == -1304) {
+      std::cerr << "Audio write failed: " << gen.wav_out << "\n";
+      return 4;
+    }
     std::cerr << "Generation failed with error code: " << static_cast<int>(err_code) << "\n";
     return 3;
   }
 
-  std::string wav_err;
-  if (!QWEN3TTSUTILS::WriteWavPcm16Safe(gen.wav_out, pcm, 24000, &wav_err)) {
-    std::cerr << "WAV write failed: " << wav_err << "\n";
+  if (!sink->Close(&sink_err)) {
+    std::cerr << "Audio write failed: " << sink_err << "\n";
     return 4;
   }
-  std::cout << "Saved wav: " << gen.wav_out << "\n";
+  std::cout << "[stop] reason=" << QWEN3TTS::StopReasonName(stats.stop_reason) << " frames=" << stats.frames_generated
+            << "/" << stats.frame_budget;
+  if (stats.stop_reason == QWEN3TTS::StopReason::Silence) {
+    std::cout << " budget_left=" << stats.budget_frames_left << " trimmed=" << stats.silence_trimmed_frames;
+  }
+  if (stats.silence_probes > 0) {
+    std::cout << " probes=" << stats.silence_probes << " probe_ms=" << stats.silence_probe_ms;
+  }
+  std::cout << "\n";
+  std::cout << "Saved " << QWEN3TTSUTILS::AudioFormatName(out_format) << " (" << sink->outputSampleRate()
+            << " Hz): " << gen.wav_out << "\n";
   return 0;
 }
@@ -0,0 +1,200 @@
+#include "generation_state.h"
+#include "voice.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double Sec(const Clock::time_point& a, const Clock::time_point& b) {
+  return std::chrono::duration_cast<std::chrono::duration<double>>(b - a).count();
+}
+
+bool ParseIntList(const std::string& s, std::vector<int>* out) {
+  std::stringstream ss(s);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    int v = 0;
+    auto [ptr, ec] = std::from_chars(item.data(), item.data() + item.size(), v);
+    if (ec != std::errc{} || ptr != item.data() + item.size() || v < 0) return false;
+    out->push_back(v);
+  }
+  return !out->empty();
+}
+
+// Log-magnitude spectra (dB) of 512-sample Hann frames, hop 256.
+std::vector<std::vector<float>> LogSpectra(const std::vector<float>& x) {
+  constexpr int kN = 512;
+  constexpr int kHop = 256;
+  constexpr int kBins = kN / 2 + 1;
+  static std::vector<float> cos_t, sin_t, win;
+  if (win.empty()) {
+    const double pi = 3.14159265358979323846;
+    win.resize(kN);
+    cos_t.resize(kN);
+    sin_t.resize(kN);
+    for (int i = 0; i < kN; ++i) {
+      win[i] = static_cast<float>(0.5 - 0.5 * std::cos(2.0 * pi * i / kN));
+      cos_t[i] = static_cast<float>(std::cos(2.0 * pi * i / kN));
+      sin_t[i] = static_cast<float>(std::sin(2.0 * pi * i / kN));
+    }
+  }
+  std::vector<std::vector<float>> out;
+  std::vector<float> seg(kN);
+  for (size_t off = 0; off + kN <= x.size(); off += kHop) {
+    for (int i = 0; i < kN; ++i) seg[i] = x[off + i] * win[i];
+    std::vector<float> spec(kBins);
+    for (int k = 0; k < kBins; ++k) {
+      float re = 0.0f, im = 0.0f;
+      for (int i = 0, idx = 0; i < kN; ++i, idx = (idx + k) & (kN - 1)) {
+        re += seg[i] * cos_t[idx];
+        im -= seg[i] * sin_t[idx];
+      }
+      spec[k] = 10.0f * std::log10(re * re + im * im + 1e-10f);
+    }
+    out.push_back(std::move(spec));
+  }
+  return out;
+}
+
+// Root-mean-square log-spectral distance in dB over the frames both signals have.
+double LogSpectralDistance(const std::vector<std::vector<float>>& a, const std::vector<std::vector<float>>& b) {
+  const size_t n = std::min(a.size(), b.size());
+  if (n == 0) return 0.0;
+  double total = 0.0;
+  for (size_t f = 0; f < n; ++f) {
+    double se = 0.0;
+    for (size_t k = 0; k < a[f].size(); ++k) {
+      const double d = a[f][k] - b[f][k];
+      se += d * d;
+    }
+    total += std::sqrt(se / static_cast<double>(a[f].size()));
+  }
+  return total / static_cast<double>(n);
+}
+
+struct RunResult {
+  bool ok = false;
+  double gen_sec = 0.0;
+  double vocoder_sec = 0.0;
+  int frames = 0;
+  std::vector<int64_t> codes;
+  std::vector<float> pcm;
+};
+
+RunResult Run(QWEN3TTS::Voice& voice, QWEN3TTS::GenerationParams params) {
+  RunResult r;
+  QWEN3TTS::GenerationState state;
+  const auto t0 = Clock::now();
+  if (!voice.beginGeneration(params, &state) || voice.stepGeneration(&state, 0) < 0) return r;
+  const auto t1 = Clock::now();
+  r.codes = state.codes();
+  r.frames = state.framesGenerated();
+  r.pcm = voice.finishGeneration(&state);
+  const auto t2 = Clock::now();
+  r.ok = !(r.pcm.size() == 1 && r.pcm[0] < 0.0f);
+  r.gen_sec = Sec(t0, t1);
+  r.vocoder_sec = Sec(t1, t2);
+  return r;
+}
+
+}  // namespace
+
+// Speed/quality of the cp_groups preview tier. Runs the same greedy prompt at full quality,
+// derives a learned fill (per-group most frequent code), then each requested tier with that fill.
+// Reports generation ms per frame, speedup, log-spectral distance to the full run and
+// first-code agreement.
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    std::cerr << "Usage:\n  " << argv[0]
+              << " <onnx_dir> [tiers=1,3,7,11] [text] [max_steps=200] [intra_threads=4]\n";
+    return 1;
+  }
+  std::vector<int> tiers;
+  if (!ParseIntList(argc > 2 ? argv[2] : "1,3,7,11", &tiers)) {
+    std::cerr << "Error: invalid tier list\n";
+    return 2;
+  }
+  const std::string text = argc > 3 ? argv[3] : "The quick brown fox jumps over the lazy dog, then rests in the shade.";
+  const int max_steps = argc > 4 ? std::atoi(argv[4]) : 200;
+  const int threads = argc > 5 ? std::atoi(argv[5]) : 4;
+
+  QWEN3TTS::TtsConfig cfg;
+  cfg.model.path = argv[1];
+  cfg.device = "cpu";
+  cfg.intra_threads = threads;
+  cfg.inter_threads = 1;
+  QWEN3TTS::Voice voice;
+  if (!voice.load(cfg)) {
+    std::cerr << "Load failed with error code: " << voice.lastErrorCode() << " (" << voice.lastErrorMessage() << ")\n";
+    return 3;
+  }
+  const int groups = static_cast<int>(voice.dims().code_groups);
+
+  QWEN3TTS::GenerationParams base;
+  base.text = text;
+  base.instruct = "Speak clearly and naturally.";
+  base.max_steps = max_steps;
+  base.codec_lang = {2050};
+  base.seed = 1234;
+  base.trim_tail_repeat_min = 0;
+
+  const RunResult full = Run(voice, base);
+  if (!full.ok || full.frames <= 0) {
+    std::cerr << "Full-quality run failed with error code: " << voice.lastErrorCode() << "\n";
+    return 3;
+  }
+  const auto full_spec = LogSpectra(full.pcm);
+
+  // Learned fill: the most frequent code of each residual group in the full run.
+  std::vector<int64_t> fill(static_cast<size_t>(groups - 1), 0);
+  for (int g = 1; g < groups; ++g) {
+    std::map<int64_t, int> counts;
+    for (int f = 0; f < full.frames; ++f) ++counts[full.codes[static_cast<size_t>(f) * groups + g]];
+    fill[static_cast<size_t>(g - 1)] =
+        std::max_element(counts.begin(), counts.end(), [](const auto& a, const auto& b) { return a.second < b.second; })->first;
+  }
+  std::cout << "[bench] frames=" << full.frames << " learned cp_fill_codes=[";
+  for (size_t i = 0; i < fill.size(); ++i) std::cout << (i ? "," : "") << fill[i];
+  std::cout << "]\n";
+
+  std::cout << std::setw(10) << "cp_groups" << std::setw(12) << "ms/frame" << std::setw(10) << "speedup"
+            << std::setw(12) << "vocoder_ms" << std::setw(10) << "lsd_db" << std::setw(12) << "first_code%" << "\n";
+  const double full_ms = full.gen_sec * 1000.0 / full.frames;
+  std::cout << std::fixed << std::setw(10) << (groups - 1) << std::setprecision(2) << std::setw(12) << full_ms
+            << std::setw(10) << 1.0 << std::setprecision(1) << std::setw(12) << full.vocoder_sec * 1000.0
+            << std::setprecision(2) << std::setw(10) << 0.0 << std::setprecision(1) << std::setw(12) << 100.0 << "\n";
+  for (int n : tiers) {
+    if (n <= 0 || n >= groups - 1) continue;
+    QWEN3TTS::GenerationParams p = base;
+    p.cp_groups = n;
+    p.cp_fill_codes = fill;
+    const RunResult r = Run(voice, p);
+    if (!r.ok || r.frames <= 0) {
+      std::cerr << "cp_groups=" << n << " failed with error code: " << voice.lastErrorCode() << "\n";
+      continue;
+    }
+    const int common = std::min(r.frames, full.frames);
+    int same_first = 0;
+    for (int f = 0; f < common; ++f) {
+      same_first += r.codes[static_cast<size_t>(f) * groups] == full.codes[static_cast<size_t>(f) * groups] ? 1 : 0;
+    }
+    const double ms = r.gen_sec * 1000.0 / r.frames;
+    std::cout << std::setw(10) << n << std::setprecision(2) << std::setw(12) << ms << std::setw(10) << (full_ms / ms)
+              << std::setprecision(1) << std::setw(12) << r.vocoder_sec * 1000.0 << std::setprecision(2)
+              << std::setw(10) << LogSpectralDistance(full_spec, LogSpectra(r.pcm)) << std::setprecision(1)
+              << std::setw(12) << (100.0 * same_first / std::max(1, common)) << "\n";
+  }
+  return 0;
+}
@@ -0,0 +1,131 @@
+#include "utils.h"
+#include "voice.h"
+
+#include <algorithm>
+#include <charconv>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+bool ParseInt(const std::string& s, int* out) {
+  auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), *out);
+  return ec == std::errc{} && ptr == s.data() + s.size();
+}
+
+std::vector<std::string> SplitList(const std::string& s) {
+  std::vector<std::string> out;
+  std::stringstream ss(s);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    if (!item.empty()) out.push_back(item);
+  }
+  return out;
+}
+
+const char* ProviderName(const std::string& device) {
+  if (device == "xnnpack") return "XnnpackExecutionProvider";
+  if (device == "dnnl") return "DnnlExecutionProvider";
+  if (device == "openvino") return "OpenVINOExecutionProvider";
+  if (device == "cuda") return "CUDAExecutionProvider";
+  return "CPUExecutionProvider";
+}
+
+struct StageTimes {
+  double prefill = std::numeric_limits<double>::max();
+  double talker = std::numeric_limits<double>::max();  // per frame
+  double cp = std::numeric_limits<double>::max();      // per frame
+  double vocoder = std::numeric_limits<double>::max(); // per frame
+};
+
+}  // namespace
+
+// Places every stage on one execution provider at a time, runs the same greedy prompt and
+// reports per-stage wall time (best of N runs, talker/cp/vocoder per frame), then the fastest
+// provider for each stage, i.e. the --prefill/--talker/--cp/--vocoder-device to use.
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    std::cerr << "Usage:\n  " << argv[0] << " <onnx_dir> [devices=cpu,xnnpack,dnnl,openvino] [intra_threads=4] [runs=3]\n";
+    return 1;
+  }
+  const std::vector<std::string> devices = SplitList(argc > 2 ? argv[2] : "cpu,xnnpack,dnnl,openvino");
+  int threads = 4;
+  int runs = 3;
+  if ((argc > 3 && !ParseInt(argv[3], &threads)) || (argc > 4 && !ParseInt(argv[4], &runs)) || threads <= 0 || runs <= 0) {
+    std::cerr << "Error: invalid integer argument\n";
+    return 2;
+  }
+
+  QWEN3TTS::GenerationParams p;
+  p.text = "Benchmarking execution providers for every stage of the pipeline.";
+  p.instruct = "Speak clearly and naturally.";
+  p.codec_lang = {2050};
+  p.steps = 64;
+  p.eos_min_steps = 64;
+  p.tail_stop_repeat_frames = 0;
+  p.trim_tail_repeat_min = 0;
+  p.seed = 1;
+
+  std::vector<std::pair<std::string, StageTimes>> results;
+  for (const std::string& device : devices) {
+    if (!QWEN3TTSUTILS::HasExecutionProvider(ProviderName(device))) {
+      std::cout << "[ep-bench] skip " << device << ": " << ProviderName(device) << " not in this onnxruntime build\n";
+      continue;
+    }
+    QWEN3TTS::TtsConfig cfg;
+    cfg.model.path = argv[1];
+    cfg.device = device;
+    cfg.intra_threads = threads;
+    cfg.inter_threads = 1;
+    QWEN3TTS::Voice voice;
+    if (!voice.load(cfg)) {
+      std::cout << "[ep-bench] skip " << device << ": load failed " << voice.lastErrorCode() << " ("
+                << voice.lastErrorMessage() << ")\n";
+      continue;
+    }
+    StageTimes best;
+    bool ok = true;
+    // First run warms up kernels and arenas and is not counted.
+    for (int r = 0; r <= runs && ok; ++r) {
+      const std::vector<float> pcm = voice.generateVoice(p);
+      if (pcm.size() == 1 && pcm[0] < 0.0f) {
+        std::cout << "[ep-bench] " << device << ": generation failed " << voice.lastErrorCode() << "\n";
+        ok = false;
+        break;
+      }
+      if (r == 0) continue;
+      const QWEN3TTS::GenerationStats& st = voice.lastStats();
+      const double frames = std::max(1, st.frames_generated);
+      best.prefill = std::min(best.prefill, st.prefill_ms);
+      best.talker = std::min(best.talker, st.talker_ms / frames);
+      best.cp = std::min(best.cp, st.cp_ms / frames);
+      best.vocoder = std::min(best.vocoder, st.vocoder_ms / frames);
+    }
+    if (ok) results.emplace_back(device, best);
+  }
+  if (results.empty()) {
+    std::cerr << "Error: no execution provider could run the model\n";
+    return 3;
+  }
+
+  std::cout << std::left << std::setw(10) << "device" << std::right << std::setw(13) << "prefill_ms" << std::setw(18)
+            << "talker_ms/frame" << std::setw(14) << "cp_ms/frame" << std::setw(19) << "vocoder_ms/frame" << "\n";
+  for (const auto& [device, t] : results) {
+    std::cout << std::left << std::setw(10) << device << std::right << std::fixed << std::setprecision(2)
+              << std::setw(13) << t.prefill << std::setw(18) << t.talker << std::setw(14) << t.cp << std::setw(19)
+              << t.vocoder << "\n";
+  }
+  auto best_of = [&](double StageTimes::*field) {
+    const auto it = std::min_element(results.begin(), results.end(),
+                                     [&](const auto& a, const auto& b) { return a.second.*field < b.second.*field; });
+    return it->first;
+  };
+  std::cout << "[ep-bench] fastest: --prefill-device " << best_of(&StageTimes::prefill) << " --talker-device "
+            << best_of(&StageTimes::talker) << " --cp-device " << best_of(&StageTimes::cp) << " --vocoder-device "
+            << best_of(&StageTimes::vocoder) << "\n";
+  return 0;
+}
@@ -1,8 +1,10 @@
 #include "voice.h"
+#include "profile_report.h"
 #include "utils.h"
 
 #include <chrono>
 #include <filesystem>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <string>
@@ -33,7 +35,17 @@ bool IsErrorPcm(const std::vector<float>& pcm, float* code) {
 int main(int argc, char** argv) {
   std::cout.setf(std::ios::unitbuf);
 
-  const std::string onnx_dir = (argc > 1) ? argv[1] : "onnx_out_v11_min";
+  // Usage: voice_design_full_profile_example [onnx_dir] [--ort-profile DIR]
+  std::string onnx_dir = "onnx_out_v11_min";
+  std::string ort_profile_dir;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--ort-profile" && i + 1 < argc) {
+      ort_profile_dir = argv[++i];
+    } else {
+      onnx_dir = arg;
+    }
+  }
   const std::filesystem::path out_wav = std::filesystem::path("artifacts") / "audio" / "full_profile_example.wav";
   std::error_code mkerr;
   std::filesystem::create_directories(out_wav.parent_path(), mkerr);
@@ -47,6 +59,7 @@ int main(int argc, char** argv) {
   cfg.device = "cpu";
   cfg.intra_threads = 6;
   cfg.inter_threads = 1;
+  cfg.profile_dir = ort_profile_dir;
 
   QWEN3TTS::Voice* voice = new QWEN3TTS::Voice();
 
@@ -86,6 +99,32 @@ int main(int argc, char** argv) {
     return 4;
   }
 
+  if (!ort_profile_dir.empty()) {
+    QWEN3TTS::ProfileAggregator aggregator;
+    for (const QWEN3TTS::ProfileTrace& trace : voice->endProfiling()) {
+      std::string trace_err;
+      if (!aggregator.addTrace(trace.session, trace.path, &trace_err)) {
+        std::cerr << "Profile trace skipped: " << trace_err << "\n";
+      }
+    }
+    const std::filesystem::path report = std::filesystem::path(ort_profile_dir) / "report.tsv";
+    std::ofstream(report) << aggregator.formatTsv();
+    std::cout << "[profile] top op types per session (total ms, share):\n";
+    std::string session;
+    int shown = 0;
+    for (const QWEN3TTS::OpProfileRow& row : aggregator.byOpType()) {
+      if (row.session != session) {
+        session = row.session;
+        shown = 0;
+      }
+      if (shown++ >= 5) continue;
+      std::cout << "  " << std::left << std::setw(22) << row.session << std::setw(24) << row.op_type << std::right
+                << std::fixed << std::setprecision(3) << std::setw(10) << row.total_ms << std::setprecision(1)
+                << std::setw(7) << row.share * 100.0 << "%\n";
+    }
+    std::cout << "[profile] report: " << report.string() << "\n";
+  }
+
   const auto t_unload_0 = Clock::now();
   voice->unload();
   delete voice;
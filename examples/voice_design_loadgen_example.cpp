@@ -0,0 +1,478 @@
+#include "logger.h"
+#include "metrics.h"
+#include "request_queue.h"
+#include "step_scheduler.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+void PrintUsage(const char* exe) {
+  std::cerr
+      << "Usage:\n  " << exe << " <onnx_dir> (--trace FILE | --synthetic N) [--qps X] [--engines N]"
+      << " [--intra-threads N] [--interleave N] [--prefill-chunk K] [--vocoder-batch N] [--vocoder-wait-ms X] [--capacity N] [--max-pending-cost N] [--max-pending-mb N] [--reload-at-ms T [--reload-onnx-dir DIR]] [--metrics-socket PATH] [--max-steps N] [--window N]"
+      << " [--words N] [--seed N] [--write-trace FILE] [--slo-ttfa-ms X] [--slo-total-ms X]"
+      << " [--warmup 0|1] [--log-level debug|info|warn|error|off]\n"
+      << "Trace: offset_ms<TAB>text|word_count[<TAB>instruct]; offsets are arrival times from the start.\n";
+}
+
+bool ParseInt(const std::string& s, int* out) {
+  auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), *out);
+  return ec == std::errc{} && ptr == s.data() + s.size();
+}
+
+bool ParseDouble(const std::string& s, double* out) {
+  char* end = nullptr;
+  *out = std::strtod(s.c_str(), &end);
+  return !s.empty() && end == s.c_str() + s.size();
+}
+
+struct TraceEntry {
+  double offset_ms = 0.0;
+  std::string text;
+  std::string instruct;
+};
+
+const char* const kWords[] = {
+    "the", "morning", "train", "was", "late", "again", "so", "we", "walked", "along", "river", "to",
+    "old", "market", "where", "vendors", "sold", "bread", "cheese", "and", "fresh", "flowers", "every",
+    "weekend", "people", "talked", "about", "weather", "news", "their", "plans", "for", "summer", "quiet",
+    "city", "lights", "slowly", "came", "on", "as", "evening", "settled", "over", "hills"};
+
+std::string FillerText(int words, std::mt19937_64* rng) {
+  std::uniform_int_distribution<size_t> pick(0, sizeof(kWords) / sizeof(kWords[0]) - 1);
+  std::string out;
+  for (int i = 0; i < words; ++i) {
+    if (i) out += ' ';
+    out += kWords[pick(*rng)];
+  }
+  if (!out.empty()) {
+    out[0] = static_cast<char>(std::toupper(static_cast<unsigned char>(out[0])));
+    out += '.';
+  }
+  return out;
+}
+
+// Poisson arrivals at `qps`, lognormal utterance length around `median_words`.
+std::vector<TraceEntry> SyntheticTrace(int count, double qps, int median_words, std::mt19937_64* rng) {
+  static const char* const instructs[] = {
+      "Speak clearly and naturally.", "A calm, warm female voice reading an audiobook.",
+      "An energetic young male narrator.", "A news anchor with a steady, neutral tone."};
+  std::exponential_distribution<double> gap(qps);
+  std::lognormal_distribution<double> len(std::log(static_cast<double>(median_words)), 0.6);
+  std::uniform_int_distribution<int> instr(0, 3);
+  std::vector<TraceEntry> out;
+  double t = 0.0;
+  for (int i = 0; i < count; ++i) {
+    TraceEntry e;
+    e.offset_ms = t;
+    e.text = FillerText(std::clamp(static_cast<int>(std::lround(len(*rng))), 1, 200), rng);
+    e.instruct = instructs[instr(*rng)];
+    out.push_back(std::move(e));
+    t += gap(*rng) * 1000.0;
+  }
+  return out;
+}
+
+bool ReadTrace(const std::string& path, std::mt19937_64* rng, std::vector<TraceEntry>* out) {
+  std::ifstream in(path);
+  if (!in) {
+    std::cerr << "Error: failed to open trace: " << path << "\n";
+    return false;
+  }
+  std::string line;
+  int line_no = 0;
+  while (std::getline(in, line)) {
+    ++line_no;
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (line.empty() || line[0] == '#') continue;
+    std::vector<std::string> cols;
+    std::stringstream ss(line);
+    std::string col;
+    while (std::getline(ss, col, '\t')) cols.push_back(col);
+    TraceEntry e;
+    int words = 0;
+    if (cols.size() < 2 || !ParseDouble(cols[0], &e.offset_ms) || e.offset_ms < 0.0 || cols[1].empty()) {
+      std::cerr << "Error: " << path << ":" << line_no << ": expected offset_ms<TAB>text\n";
+      return false;
+    }
+    // Recorded traces often keep only the length; synthesize text of that many words.
+    e.text = ParseInt(cols[1], &words) && words > 0 ? FillerText(words, rng) : cols[1];
+    if (cols.size() > 2) e.instruct = cols[2];
+    out->push_back(std::move(e));
+  }
+  std::stable_sort(out->begin(), out->end(),
+                   [](const TraceEntry& a, const TraceEntry& b) { return a.offset_ms < b.offset_ms; });
+  return !out->empty();
+}
+
+bool WriteTrace(const std::string& path, const std::vector<TraceEntry>& trace) {
+  std::ofstream out(path);
+  for (const TraceEntry& e : trace) {
+    out << std::fixed << std::setprecision(3) << e.offset_ms << '\t' << e.text << '\t' << e.instruct << '\n';
+  }
+  return static_cast<bool>(out);
+}
+
+// Per-request measurements; written by the worker/audio callbacks, read after the run.
+struct Record {
+  Clock::time_point arrival;
+  Clock::time_point first_audio;
+  Clock::time_point done;
+  std::atomic<bool> has_audio{false};
+  std::atomic<uint64_t> samples{0};
+  double dispatch_lag_ms = 0.0;
+  double queue_ms = 0.0;
+  double service_ms = 0.0;
+  int submit_code = 0;
+  int error_code = 0;
+};
+
+double Ms(const Clock::time_point& a, const Clock::time_point& b) {
+  return std::chrono::duration<double, std::milli>(b - a).count();
+}
+
+double Percentile(const std::vector<double>& sorted, double q) {
+  if (sorted.empty()) return 0.0;
+  const size_t idx = static_cast<size_t>(std::ceil(q * static_cast<double>(sorted.size())));
+  return sorted[std::min(sorted.size(), std::max<size_t>(idx, 1)) - 1];
+}
+
+void PrintRow(const char* name, std::vector<double> v) {
+  std::sort(v.begin(), v.end());
+  double mean = 0.0;
+  for (double x : v) mean += x;
+  mean = v.empty() ? 0.0 : mean / static_cast<double>(v.size());
+  std::cout << std::left << std::setw(16) << name << std::right << std::fixed << std::setprecision(2)
+            << std::setw(7) << v.size() << std::setw(11) << mean << std::setw(11) << Percentile(v, 0.50)
+            << std::setw(11) << Percentile(v, 0.90) << std::setw(11) << Percentile(v, 0.99) << std::setw(11)
+            << (v.empty() ? 0.0 : v.back()) << "\n";
+}
+
+double Attainment(const std::vector<double>& v, double slo) {
+  if (v.empty()) return 0.0;
+  return 100.0 * static_cast<double>(std::count_if(v.begin(), v.end(), [&](double x) { return x <= slo; })) /
+         static_cast<double>(v.size());
+}
+
+}  // namespace
+
+// Open-loop load generator for latency SLO testing. Replays a recorded trace (or a synthetic
+// Poisson one) against an in-process RequestQueue: each request is submitted at its scheduled
+// arrival time whether or not earlier ones have finished, and latencies are measured from that
+// scheduled time, so a backed-up server shows up as queueing instead of a slower arrival rate.
+// Reports p50/p90/p99 of time-to-first-audio, total latency, queueing delay and real-time factor.
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+  QWEN3TTS::RequestQueueConfig qcfg;
+  qcfg.tts.model.path = argv[1];
+  qcfg.tts.device = "cpu";
+  qcfg.tts.intra_threads = 2;
+  qcfg.tts.inter_threads = 1;
+  qcfg.engines = 2;
+  std::string trace_path, write_trace_path;
+  int synthetic = 0, max_steps = 400, window = 24, median_words = 14, seed = 1;
+  int interleave = 0, prefill_chunk = 64, reload_at_ms = 0;
+  std::string reload_dir, metrics_socket;
+  double qps = 0.0, slo_ttfa_ms = 0.0, slo_total_ms = 0.0;
+  QWEN3TTS::Logger::instance().setLevel(QWEN3TTS::LogLevel::Warn);
+
+  for (int i = 2; i < argc; ++i) {
+    const std::string flag = argv[i];
+    if (i + 1 >= argc) {
+      std::cerr << "Error: missing value for " << flag << "\n";
+      return 2;
+    }
+    const std::string value = argv[++i];
+    int v = 0;
+    double d = 0.0;
+    const bool is_int = ParseInt(value, &v) && v >= 0;
+    const bool is_pos = ParseDouble(value, &d) && d > 0.0;
+    QWEN3TTS::LogLevel level = QWEN3TTS::LogLevel::Warn;
+    if (flag == "--trace") {
+      trace_path = value;
+    } else if (flag == "--synthetic" && is_int && v > 0) {
+      synthetic = v;
+    } else if (flag == "--qps" && is_pos) {
+      qps = d;
+    } else if (flag == "--engines" && is_int && v > 0) {
+      qcfg.engines = v;
+    } else if (flag == "--interleave" && is_int) {
+      interleave = v;
+    } else if (flag == "--prefill-chunk" && is_int) {
+      prefill_chunk = v;
+    } else if (flag == "--vocoder-batch" && is_int && v > 0) {
+      qcfg.batch_vocoder = true;
+      qcfg.vocoder_batch.max_batch = v;
+    } else if (flag == "--vocoder-wait-ms" && ParseDouble(value, &d) && d >= 0.0) {
+      qcfg.vocoder_batch.max_wait_ms = d;
+    } else if (flag == "--intra-threads" && is_int && v > 0) {
+      qcfg.tts.intra_threads = v;
+    } else if (flag == "--capacity" && is_int && v > 0) {
+      qcfg.capacity = static_cast<size_t>(v);
+    } else if (flag == "--max-pending-cost" && is_int) {
+      qcfg.max_pending_cost = v;
+    } else if (flag == "--max-pending-mb" && is_int) {
+      qcfg.max_pending_bytes = static_cast<int64_t>(v) << 20;
+    } else if (flag == "--reload-at-ms" && is_int && v > 0) {
+      reload_at_ms = v;
+    } else if (flag == "--reload-onnx-dir") {
+      reload_dir = value;
+    } else if (flag == "--metrics-socket") {
+      metrics_socket = value;
+    } else if (flag == "--max-steps" && is_int && v > 0) {
+      max_steps = v;
+    } else if (flag == "--window" && is_int && v > 0) {
+      window = v;
+    } else if (flag == "--words" && is_int && v > 0) {
+      median_words = v;
+    } else if (flag == "--seed" && is_int) {
+      seed = v;
+    } else if (flag == "--write-trace") {
+      write_trace_path = value;
+    } else if (flag == "--slo-ttfa-ms" && is_pos) {
+      slo_ttfa_ms = d;
+    } else if (flag == "--slo-total-ms" && is_pos) {
+      slo_total_ms = d;
+    } else if (flag == "--warmup" && (value == "0" || value == "1")) {
+      qcfg.warmup = value == "1";
+    } else if (flag == "--log-level" && QWEN3TTS::ParseLogLevel(value, &level)) {
+      QWEN3TTS::Logger::instance().setLevel(level);
+    } else {
+      std::cerr << "Error: invalid flag or value: " << flag << " " << value << "\n";
+      return 2;
+    }
+  }
+  if (trace_path.empty() == (synthetic == 0)) {
+    std::cerr << "Error: pass exactly one of --trace or --synthetic\n";
+    return 2;
+  }
+
+  std::mt19937_64 rng(static_cast<uint64_t>(seed));
+  std::vector<TraceEntry> trace;
+  if (synthetic > 0) {
+    trace = SyntheticTrace(synthetic, qps > 0.0 ? qps : 1.0, median_words, &rng);
+  } else {
+    if (!ReadTrace(trace_path, &rng, &trace)) return 2;
+    // --qps rescales the recorded inter-arrival gaps to the requested mean rate.
+    const double span_ms = trace.back().offset_ms - trace.front().offset_ms;
+    const double base_ms = trace.front().offset_ms;
+    if (qps > 0.0 && trace.size() > 1 && span_ms > 0.0) {
+      const double scale = (static_cast<double>(trace.size() - 1) / qps * 1000.0) / span_ms;
+      for (TraceEntry& e : trace) e.offset_ms = (e.offset_ms - base_ms) * scale;
+    } else {
+      for (TraceEntry& e : trace) e.offset_ms -= base_ms;
+    }
+  }
+  if (!write_trace_path.empty() && !WriteTrace(write_trace_path, trace)) {
+    std::cerr << "Error: failed to write trace: " << write_trace_path << "\n";
+    return 2;
+  }
+
+  const size_t n = trace.size();
+  std::vector<std::unique_ptr<Record>> records;
+  records.reserve(n);
+  for (size_t i = 0; i < n; ++i) records.push_back(std::make_unique<Record>());
+  // request_id = trace index + 1, so the completion hook can find its record.
+  qcfg.on_complete = [&records](const QWEN3TTS::RequestTiming& t) {
+    if (t.request_id == 0 || t.request_id > records.size()) return;
+    Record& r = *records[t.request_id - 1];
+    r.done = Clock::now();
+    r.queue_ms = t.queue_ms;
+    r.service_ms = t.service_ms;
+    r.error_code = t.error_code;
+  };
+
+  // Scrape during the replay: curl --unix-socket PATH http://localhost/metrics
+  QWEN3TTS::MetricsServer metrics_server;
+  std::string metrics_err;
+  if (!metrics_socket.empty() && !metrics_server.start(metrics_socket, &metrics_err)) {
+    std::cerr << "Error: " << metrics_err << "\n";
+    return 2;
+  }
+
+  // --interleave N shares one engine between N requests through the step scheduler instead.
+  QWEN3TTS::RequestQueue queue;
+  QWEN3TTS::StepScheduler scheduler;
+  const auto load_t0 = Clock::now();
+  if (interleave > 0) {
+    QWEN3TTS::StepSchedulerConfig scfg;
+    scfg.tts = qcfg.tts;
+    scfg.max_active = interleave;
+    scfg.prefill_chunk_tokens = prefill_chunk;
+    scfg.capacity = qcfg.capacity;
+    scfg.warmup = qcfg.warmup;
+    scfg.on_complete = qcfg.on_complete;
+    qcfg.engines = 1;
+    if (!scheduler.start(scfg)) {
+      std::cerr << "Load failed with error code: " << scheduler.lastErrorCode() << " (" << scheduler.lastErrorMessage()
+                << ")\n";
+      return 3;
+    }
+  } else if (!queue.start(qcfg)) {
+    std::cerr << "Load failed with error code: " << queue.lastErrorCode() << " (" << queue.lastErrorMessage() << ")\n";
+    return 3;
+  }
+  auto submit = [&](const QWEN3TTS::GenerationParams& p, std::future<std::vector<float>>* result) {
+    return interleave > 0 ? scheduler.submit(p, result) : queue.submit(p, result);
+  };
+  const int sample_rate = interleave > 0 ? scheduler.dims().sample_rate : queue.dims().sample_rate;
+  const double trace_sec = trace.back().offset_ms / 1000.0;
+  std::cout << "[loadgen] " << qcfg.engines << " engines ready in " << std::fixed << std::setprecision(1)
+            << Ms(load_t0, Clock::now()) / 1000.0 << " s; replaying " << n << " requests over " << trace_sec
+            << " s (offered " << std::setprecision(2) << (trace_sec > 0.0 ? (n - 1) / trace_sec : 0.0) << " qps)\n";
+
+  std::vector<std::future<std::vector<float>>> results(n);
+  QWEN3TTS::RequestQueueStats qs;
+  QWEN3TTS::VocoderBatcherStats vb;
+  QWEN3TTS::StepSchedulerStats ss;
+  const auto t0 = Clock::now();
+  // --reload-at-ms swaps in a freshly loaded engine set mid-replay; failed/rejected counts and
+  // the latency tail show whether any request noticed.
+  QWEN3TTS::ReloadReport reload_report;
+  bool reload_ok = false;
+  std::thread reloader;
+  if (reload_at_ms > 0 && interleave == 0) {
+    QWEN3TTS::TtsConfig reload_tts = qcfg.tts;
+    if (!reload_dir.empty()) reload_tts.model.path = reload_dir;
+    reloader = std::thread([&, reload_tts] {
+      std::this_thread::sleep_until(t0 + std::chrono::milliseconds(reload_at_ms));
+      reload_ok = queue.reload(reload_tts, &reload_report);
+    });
+  }
+  for (size_t i = 0; i < n; ++i) {
+    Record& r = *records[i];
+    r.arrival = t0 + std::chrono::microseconds(static_cast<int64_t>(trace[i].offset_ms * 1000.0));
+    std::this_thread::sleep_until(r.arrival);
+    r.dispatch_lag_ms = Ms(r.arrival, Clock::now());
+
+    QWEN3TTS::GenerationParams p;
+    p.request_id = static_cast<uint64_t>(i + 1);
+    p.text = trace[i].text;
+    if (!trace[i].instruct.empty()) p.instruct = trace[i].instruct;
+    p.codec_lang = {2050};
+    p.max_steps = max_steps;
+    p.seed = seed + static_cast<int64_t>(i);
+    p.trim_tail_repeat_min = 24;
+    p.vocoder_window_frames = window;
+    Record* raw = &r;
+    // With vocoder windows on_audio fires from the decode loop, so ttfa is the first window's
+    // arrival, not the end of the talker run.
+    p.on_audio = [raw](const float*, size_t count) {
+      if (!raw->has_audio.load(std::memory_order_relaxed)) {
+        raw->first_audio = Clock::now();
+        raw->has_audio.store(true, std::memory_order_release);
+      }
+      raw->samples.fetch_add(count, std::memory_order_relaxed);
+      return true;
+    };
+    r.submit_code = submit(p, &results[i]);
+  }
+  for (size_t i = 0; i < n; ++i) {
+    if (records[i]->submit_code == 0) results[i].wait();
+  }
+  const double wall_sec = Ms(t0, Clock::now()) / 1000.0;
+  if (reloader.joinable()) reloader.join();
+  qs = queue.stats();
+  vb = qs.vocoder_batch;
+  ss = scheduler.stats();
+  queue.stop();
+  scheduler.stop();
+  QWEN3TTS::Logger::instance().flush();
+
+  std::vector<double> ttfa, total, queued, rtf, lag;
+  std::map<int, int> rejected, failed;
+  double audio_sec = 0.0;
+  for (size_t i = 0; i < n; ++i) {
+    const Record& r = *records[i];
+    lag.push_back(r.dispatch_lag_ms);
+    if (r.submit_code != 0) {
+      ++rejected[r.submit_code];
+      continue;
+    }
+    if (r.error_code != 0) {
+      ++failed[r.error_code];
+      continue;
+    }
+    const double audio_ms = 1000.0 * static_cast<double>(r.samples.load()) / sample_rate;
+    audio_sec += audio_ms / 1000.0;
+    if (r.has_audio.load(std::memory_order_acquire)) ttfa.push_back(Ms(r.arrival, r.first_audio));
+    total.push_back(Ms(r.arrival, r.done));
+    queued.push_back(r.queue_ms);
+    if (audio_ms > 0.0) rtf.push_back(r.service_ms / audio_ms);
+  }
+
+  std::cout << std::left << std::setw(16) << "metric" << std::right << std::setw(7) << "n" << std::setw(11) << "mean"
+            << std::setw(11) << "p50" << std::setw(11) << "p90" << std::setw(11) << "p99" << std::setw(11) << "max"
+            << "\n";
+  PrintRow("ttfa_ms", ttfa);
+  PrintRow("total_ms", total);
+  PrintRow("queue_ms", queued);
+  PrintRow("rtf", rtf);
+  PrintRow("dispatch_lag_ms", lag);
+
+  std::cout << "[loadgen] completed=" << total.size() << " wall=" << std::setprecision(1) << wall_sec
+            << " s achieved=" << std::setprecision(2) << (wall_sec > 0.0 ? total.size() / wall_sec : 0.0)
+            << " qps audio=" << std::setprecision(1) << audio_sec << " s\n";
+  if (interleave > 0) {
+    std::cout << "[loadgen] interleave=" << interleave << " prefill_chunks=" << ss.prefill_chunks << " decode_turns="
+              << ss.decode_turns << " max_decode_gap=" << ss.max_decode_gap_ms << " ms\n";
+  }
+  if (vb.runs > 0) {
+    std::cout << "[loadgen] vocoder batches=" << vb.runs << " windows=" << vb.windows << " avg_batch="
+              << static_cast<double>(vb.windows) / vb.runs << " max_batch=" << vb.max_batch_seen << " padding="
+              << 100.0 * (1.0 - static_cast<double>(vb.frames) / std::max<uint64_t>(1, vb.padded_frames))
+              << "% avg_wait=" << vb.avg_wait_ms << " ms\n";
+  }
+  if (reload_at_ms > 0 && interleave == 0) {
+    if (reload_ok) {
+      std::cout << "[loadgen] reload load=" << std::setprecision(1) << reload_report.load_ms
+                << " ms warmup=" << reload_report.warmup_ms << " ms swap=" << std::setprecision(3)
+                << reload_report.swap_ms << " ms drain=" << std::setprecision(1) << reload_report.drain_ms
+                << " ms" << (reload_report.drained ? "" : " (timed out)")
+                << " rss before/overlap/after=" << (reload_report.rss_before_bytes >> 20) << "/"
+                << (reload_report.rss_overlap_bytes >> 20) << "/" << (reload_report.rss_after_bytes >> 20) << " MiB\n";
+    } else {
+      std::cout << "[loadgen] reload failed: " << queue.lastErrorCode() << " (" << queue.lastErrorMessage() << ")\n";
+    }
+  }
+  if (qcfg.max_pending_bytes > 0) {
+    std::cout << "[loadgen] memory budget=" << (qcfg.max_pending_bytes >> 20) << " MiB downgraded=" << qs.downgraded
+              << " shed=" << qs.shed_over_memory << " peak_rss=" << (QWEN3TTSUTILS::ProcessPeakRssBytes() >> 20)
+              << " MiB\n";
+  }
+  for (const auto& [code, count] : rejected) std::cout << "[loadgen] rejected code=" << code << " count=" << count << "\n";
+  for (const auto& [code, count] : failed) std::cout << "[loadgen] failed code=" << code << " count=" << count << "\n";
+  if (slo_ttfa_ms > 0.0) {
+    std::cout << "[loadgen] ttfa<=" << std::setprecision(0) << slo_ttfa_ms << " ms: " << std::setprecision(2)
+              << Attainment(ttfa, slo_ttfa_ms) << "% of completed\n";
+  }
+  if (slo_total_ms > 0.0) {
+    std::cout << "[loadgen] total<=" << std::setprecision(0) << slo_total_ms << " ms: " << std::setprecision(2)
+              << Attainment(total, slo_total_ms) << "% of completed\n";
+  }
+  return 0;
+}
@@ -0,0 +1,208 @@
+#include "tokenizer.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double Sec(const Clock::time_point& a, const Clock::time_point& b) {
+  return std::chrono::duration_cast<std::chrono::duration<double>>(b - a).count();
+}
+
+bool ParseInt(const std::string& s, int* out) {
+  auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), *out);
+  return ec == std::errc{} && ptr == s.data() + s.size();
+}
+
+// Mixed-script document: English with contractions, Russian, CJK, digits, tabs and blank lines.
+std::string MakeDocument(size_t min_bytes) {
+  static const char* kParts[] = {
+      "The quick brown fox didn't jump over 13 lazy dogs; they'll RE-check it at 09:45.\n",
+      "Съешь же ещё этих мягких французских булок, да выпей чаю — 2024 год!\n",
+      "今天天气很好，我们去公园散步吧。東京は晴れです。\n",
+      "  Indented line\twith\ttabs   and trailing spaces   \n\n\n",
+      "Symbols: ((a+b)*c) -> [x] {y} <z> \"quoted\" 'single' ... ?!\r\n",
+  };
+  std::string doc;
+  size_t k = 0;
+  while (doc.size() < min_bytes) doc += kParts[k++ % (sizeof(kParts) / sizeof(kParts[0]))];
+  return doc;
+}
+
+// Short strings over an alphabet that stresses class boundaries, including malformed UTF-8.
+std::string MakeFuzzString(std::mt19937& rng) {
+  static const char* kPieces[] = {
+      "a", "Z", "7", " ", "  ", "\t", "\n", "\r", "'", "'s", "'LL", "'re", "'v", ".", "!", "-",
+      "\xD0\x96", "\xE4\xB8\xAD", "\xF0\x9F\x98\x80", "\xC0\x8A", "\xC1\x81", "\xE0\x80\xA0",
+      "\xF0\x80\x81\xB1", "\x80", "\xBF", "\xFF", "\xC3", "\xE2\x82", "\xF0\x9F", "\x00",
+  };
+  std::uniform_int_distribution<size_t> piece(0, sizeof(kPieces) / sizeof(kPieces[0]) - 1);
+  std::uniform_int_distribution<int> len(0, 40);
+  std::string s;
+  const int n = len(rng);
+  for (int i = 0; i < n; ++i) {
+    const size_t p = piece(rng);
+    s.append(kPieces[p], p == sizeof(kPieces) / sizeof(kPieces[0]) - 1 ? 1 : std::char_traits<char>::length(kPieces[p]));
+  }
+  return s;
+}
+
+bool SameSplit(const std::string& s, std::vector<std::string_view>* spans) {
+  const std::vector<std::string> ref = QWEN3TTS::VoiceTokenizer::RegexLikeSplit(s);
+  QWEN3TTS::VoiceTokenizer::PreTokenize(s, spans);
+  if (ref.size() != spans->size()) return false;
+  for (size_t i = 0; i < ref.size(); ++i) {
+    if (ref[i] != (*spans)[i]) return false;
+  }
+  return true;
+}
+
+// Encodes every line of doc as a separate request and doc as one long input with 1, 2, 4 ...
+// threads, checking EncodeBatchSafe against serial EncodeSafe.
+int BenchEncode(const std::string& onnx_dir, const std::string& doc) {
+  std::string err;
+  auto tok = QWEN3TTS::VoiceTokenizer::LoadShared(onnx_dir, "vocab.json", "merges.txt", "tokenizer_config.json", &err);
+  if (!tok) {
+    std::cerr << "Error: " << err << "\n";
+    return 3;
+  }
+  std::vector<std::string> lines;
+  std::istringstream in(doc);
+  for (std::string line; std::getline(in, line);) lines.push_back(line);
+  const std::vector<std::string> whole = {doc};
+
+  std::vector<std::vector<int64_t>> expected(lines.size());
+  for (size_t i = 0; i < lines.size(); ++i) {
+    if (!tok->EncodeSafe(lines[i], &expected[i], &err)) {
+      std::cerr << "Error: " << err << "\n";
+      return 3;
+    }
+  }
+  std::vector<int64_t> expected_whole;
+  tok->EncodeSafe(doc, &expected_whole, &err);
+
+  const double mb = static_cast<double>(doc.size()) / (1024.0 * 1024.0);
+  const int max_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  double base_lines = 0.0;
+  double base_whole = 0.0;
+  std::cout << "[encode] " << lines.size() << " lines, " << expected_whole.size() << " tokens (warm BPE cache)\n";
+  for (int threads = 1;; threads = std::min(threads * 2, max_threads)) {
+    std::vector<std::vector<int64_t>> ids;
+    double best_lines = 1e30;
+    double best_whole = 1e30;
+    for (int r = 0; r < 3; ++r) {
+      auto t0 = Clock::now();
+      const bool ok_lines = tok->EncodeBatchSafe(lines, &ids, threads, &err);
+      auto t1 = Clock::now();
+      if (!ok_lines || ids != expected) {
+        std::cerr << "MISMATCH: batch encode of lines with " << threads << " threads\n";
+        return 1;
+      }
+      best_lines = std::min(best_lines, Sec(t0, t1));
+      t0 = Clock::now();
+      const bool ok_whole = tok->EncodeBatchSafe(whole, &ids, threads, &err);
+      t1 = Clock::now();
+      if (!ok_whole || ids.size() != 1 || ids[0] != expected_whole) {
+        std::cerr << "MISMATCH: batch encode of the whole document with " << threads << " threads\n";
+        return 1;
+      }
+      best_whole = std::min(best_whole, Sec(t0, t1));
+    }
+    if (threads == 1) {
+      base_lines = best_lines;
+      base_whole = best_whole;
+    }
+    std::cout << "[encode] threads " << std::setw(3) << threads << std::fixed << std::setprecision(2) << ": lines "
+              << mb / best_lines << " MB/s (" << base_lines / best_lines << "x), one document " << mb / best_whole
+              << " MB/s (" << base_whole / best_whole << "x)\n";
+    if (threads == max_threads) break;
+  }
+  return 0;
+}
+
+}  // namespace
+
+// Checks that VoiceTokenizer::PreTokenize splits exactly like RegexLikeSplit (a mixed-script
+// document, an optional text file and random strings with malformed UTF-8), then times both.
+// --encode ONNX_DIR also times EncodeBatchSafe over a growing number of threads.
+int main(int argc, char** argv) {
+  int doc_kb = 1024;
+  int fuzz_cases = 200000;
+  std::string text_file;
+  std::string encode_dir;
+  std::vector<std::string> positional;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--encode" && i + 1 < argc) {
+      encode_dir = argv[++i];
+    } else {
+      positional.push_back(arg);
+    }
+  }
+  if ((positional.size() > 0 && !ParseInt(positional[0], &doc_kb)) ||
+      (positional.size() > 1 && !ParseInt(positional[1], &fuzz_cases)) || doc_kb <= 0 || fuzz_cases < 0) {
+    std::cerr << "Usage:\n  " << argv[0] << " [doc_kb=1024] [fuzz_cases=200000] [text_file] [--encode ONNX_DIR]\n";
+    return 2;
+  }
+  if (positional.size() > 2) text_file = positional[2];
+
+  std::vector<std::string> docs = {MakeDocument(static_cast<size_t>(doc_kb) * 1024)};
+  if (!text_file.empty()) {
+    docs.push_back(QWEN3TTSUTILS::ReadAll(text_file));
+    if (docs.back().empty()) {
+      std::cerr << "Error: failed to read " << text_file << "\n";
+      return 2;
+    }
+  }
+
+  std::vector<std::string_view> spans;
+  for (const std::string& doc : docs) {
+    if (!SameSplit(doc, &spans)) {
+      std::cerr << "MISMATCH on document of " << doc.size() << " bytes\n";
+      return 1;
+    }
+  }
+  std::mt19937 rng(42);
+  for (int c = 0; c < fuzz_cases; ++c) {
+    const std::string s = MakeFuzzString(rng);
+    if (!SameSplit(s, &spans)) {
+      std::cerr << "MISMATCH on fuzz case " << c << " (" << s.size() << " bytes)\n";
+      return 1;
+    }
+  }
+  std::cout << "[check] identical splits: " << docs.size() << " document(s), " << fuzz_cases << " fuzz cases\n";
+
+  for (const std::string& doc : docs) {
+    const double mb = static_cast<double>(doc.size()) / (1024.0 * 1024.0);
+    double best_ref = 1e30;
+    double best_fast = 1e30;
+    size_t chunks = 0;
+    for (int r = 0; r < 3; ++r) {
+      auto t0 = Clock::now();
+      chunks = QWEN3TTS::VoiceTokenizer::RegexLikeSplit(doc).size();
+      auto t1 = Clock::now();
+      best_ref = std::min(best_ref, Sec(t0, t1));
+      t0 = Clock::now();
+      QWEN3TTS::VoiceTokenizer::PreTokenize(doc, &spans);
+      t1 = Clock::now();
+      best_fast = std::min(best_fast, Sec(t0, t1));
+    }
+    std::cout << "[bench] " << std::fixed << std::setprecision(2) << mb << " MB, " << chunks << " chunks: "
+              << "RegexLikeSplit " << mb / best_ref << " MB/s, PreTokenize " << mb / best_fast << " MB/s ("
+              << best_ref / best_fast << "x)\n";
+  }
+  if (!encode_dir.empty()) return BenchEncode(encode_dir, docs.back());
+  return 0;
+}
@@ -0,0 +1,60 @@
+#include "profile_report.h"
+
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+// Compares two report.tsv files written by voice_design_full_profile_example --ort-profile,
+// e.g. before and after re-exporting or re-quantizing a bundle.
+int main(int argc, char** argv) {
+  std::cout.setf(std::ios::unitbuf);
+
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0] << " base/report.tsv new/report.tsv [top_n]\n";
+    return 2;
+  }
+  const size_t top_n = argc > 3 ? static_cast<size_t>(std::stoul(argv[3])) : 30;
+
+  std::vector<QWEN3TTS::OpProfileRow> base;
+  std::vector<QWEN3TTS::OpProfileRow> next;
+  std::string err;
+  if (!QWEN3TTS::ReadProfileReport(argv[1], &base, &err) || !QWEN3TTS::ReadProfileReport(argv[2], &next, &err)) {
+    std::cerr << "Error: " << err << "\n";
+    return 3;
+  }
+
+  const auto deltas = QWEN3TTS::DiffProfileReports(base, next);
+  std::cout << std::left << std::setw(22) << "session" << std::setw(24) << "op_type" << std::right << std::setw(11)
+            << "base_ms" << std::setw(11) << "new_ms" << std::setw(11) << "delta_ms" << std::setw(9) << "delta%"
+            << std::setw(14) << "calls" << "\n";
+  std::map<std::string, std::pair<double, double>> totals;
+  size_t shown = 0;
+  for (const QWEN3TTS::OpProfileDelta& d : deltas) {
+    auto& t = totals[d.session];
+    t.first += d.base_ms;
+    t.second += d.new_ms;
+    if (shown++ >= top_n) continue;
+    const double delta = d.new_ms - d.base_ms;
+    std::cout << std::left << std::setw(22) << d.session << std::setw(24) << d.op_type << std::right << std::fixed
+              << std::setprecision(3) << std::setw(11) << d.base_ms << std::setw(11) << d.new_ms << std::setw(11)
+              << delta << std::setprecision(1) << std::setw(8);
+    if (d.base_ms > 0.0) {
+      std::cout << delta * 100.0 / d.base_ms << "%";
+    } else {
+      std::cout << "new" << " ";
+    }
+    std::cout << std::setw(14) << (std::to_string(d.base_calls) + "->" + std::to_string(d.new_calls)) << "\n";
+  }
+
+  std::cout << "\nSession totals (ms):\n";
+  for (const auto& [session, t] : totals) {
+    const double delta = t.second - t.first;
+    std::cout << "  " << std::left << std::setw(22) << session << std::right << std::fixed << std::setprecision(3)
+              << std::setw(11) << t.first << std::setw(11) << t.second << std::setw(11) << delta;
+    if (t.first > 0.0) std::cout << std::setprecision(1) << std::setw(8) << delta * 100.0 / t.first << "%";
+    std::cout << "\n";
+  }
+  return 0;
+}
@@ -0,0 +1,133 @@
+#include "logger.h"
+#include "worker_server.h"
+#include "utils.h"
+
+#include <charconv>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+void PrintUsage(const char* exe) {
+  std::cerr
+      << "Usage:\n"
+      << "  " << exe << " serve --onnx-dir <onnx_dir> [--socket PATH] [--workers N]"
+      << " [--intra-threads N] [--inter-threads N] [--pcm-chunk-ms N] [--warmup 0|1] [--share-weights 0|1]"
+      << " [--log-level debug|info|warn|error|off]\n"
+      << "  " << exe << " request --text <text> --instruct <instruct> [--socket PATH]"
+      << " [--output-wav PATH] [--max-steps N] [--lang-id N]\n";
+}
+
+bool ParseInt(const std::string& s, int* out) {
+  const char* b = s.data();
+  const char* e = s.data() + s.size();
+  auto [ptr, ec] = std::from_chars(b, e, *out);
+  return ec == std::errc{} && ptr == e;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+  const std::string mode = argv[1];
+
+  QWEN3TTS::WorkerServerConfig server_cfg;
+  server_cfg.tts.device = "cpu";
+  server_cfg.tts.intra_threads = 2;
+  server_cfg.tts.inter_threads = 1;
+  QWEN3TTS::WorkerRequest req;
+  std::string wav_out = "./server_output.wav";
+
+  for (int i = 2; i < argc; ++i) {
+    const std::string flag = argv[i];
+    if (i + 1 >= argc) {
+      std::cerr << "Error: missing value for " << flag << "\n";
+      return 2;
+    }
+    const std::string value = argv[++i];
+    int v = 0;
+    const bool is_int = ParseInt(value, &v);
+    if (flag == "--onnx-dir") {
+      server_cfg.tts.model.path = value;
+    } else if (flag == "--socket") {
+      server_cfg.socket_path = value;
+    } else if (flag == "--workers" && is_int) {
+      server_cfg.workers = v;
+    } else if (flag == "--intra-threads" && is_int) {
+      server_cfg.tts.intra_threads = v;
+    } else if (flag == "--inter-threads" && is_int) {
+      server_cfg.tts.inter_threads = v;
+    } else if (flag == "--pcm-chunk-ms" && is_int) {
+      server_cfg.pcm_chunk_ms = v;
+    } else if (flag == "--log-level") {
+      QWEN3TTS::LogLevel level = QWEN3TTS::LogLevel::Info;
+      if (!QWEN3TTS::ParseLogLevel(value, &level)) {
+        std::cerr << "Error: invalid value for " << flag << ": " << value << "\n";
+        return 2;
+      }
+      QWEN3TTS::Logger::instance().setLevel(level);
+    } else if (flag == "--warmup" && is_int) {
+      server_cfg.warmup = v != 0;
+    } else if (flag == "--share-weights" && is_int) {
+      server_cfg.share_model_weights = v != 0;
+    } else if (flag == "--text") {
+      req.text = value;
+    } else if (flag == "--instruct") {
+      req.instruct = value;
+    } else if (flag == "--output-wav") {
+      wav_out = value;
+    } else if (flag == "--max-steps" && is_int) {
+      req.max_steps = v;
+    } else if (flag == "--lang-id" && is_int) {
+      req.lang = v;
+    } else {
+      std::cerr << "Error: invalid flag or value: " << flag << " " << value << "\n";
+      return 2;
+    }
+  }
+
+  if (mode == "serve") {
+    if (server_cfg.tts.model.path.empty()) {
+      std::cerr << "Error: --onnx-dir is required\n";
+      return 2;
+    }
+    QWEN3TTS::WorkerServer server;
+    if (!server.run(server_cfg)) {
+      std::cerr << "Server failed with error code: " << server.lastErrorCode()
+                << " (" << server.lastErrorMessage() << ")\n";
+      return 3;
+    }
+    return 0;
+  }
+
+  if (mode == "request") {
+    if (req.text.empty() || req.instruct.empty()) {
+      std::cerr << "Error: --text and --instruct are required\n";
+      return 2;
+    }
+    std::vector<int16_t> pcm;
+    int sample_rate = 24000;
+    std::string err;
+    const int rc = QWEN3TTS::RequestSpeech(server_cfg.socket_path, req, &pcm, &sample_rate, &err);
+    if (rc != 0) {
+      std::cerr << "Request failed with error code: " << rc << " (" << err << ")\n";
+      return 3;
+    }
+    std::vector<float> wav(pcm.size());
+    for (size_t i = 0; i < pcm.size(); ++i) wav[i] = static_cast<float>(pcm[i]) / 32767.0f;
+    std::string wav_err;
+    if (!QWEN3TTSUTILS::WriteWavPcm16Safe(wav_out, wav, sample_rate, &wav_err)) {
+      std::cerr << "WAV write failed: " << wav_err << "\n";
+      return 4;
+    }
+    std::cout << "Saved wav: " << wav_out << " (" << pcm.size() << " samples)\n";
+    return 0;
+  }
+
+  PrintUsage(argv[0]);
+  return 1;
+}
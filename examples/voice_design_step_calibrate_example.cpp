@@ -0,0 +1,128 @@
+#include "step_predictor.h"
+#include "tokenizer.h"
+
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+bool ParseInt64(const std::string& s, int64_t* out) {
+  auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), *out);
+  return ec == std::errc{} && ptr == s.data() + s.size();
+}
+
+bool ParseInt(const std::string& s, int* out) {
+  auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), *out);
+  return ec == std::errc{} && ptr == s.data() + s.size();
+}
+
+}  // namespace
+
+// Fits a StepPredictor from a log of finished requests and writes it next to the model.
+// Log format (TSV, one request per line): <codec_lang_id>\t<generated_frames>\t<text>
+// where generated_frames is the `frames=` value of the CLI `[stop]` line.
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    std::cerr << "Usage:\n  " << argv[0] << " <onnx_dir> <log.tsv> [out=<onnx_dir>/step_predictor.txt] [min_samples=8]\n";
+    return 1;
+  }
+  const std::string onnx_dir = argv[1];
+  const std::string log_path = argv[2];
+  const std::string out_path = argc > 3 ? argv[3] : onnx_dir + "/step_predictor.txt";
+  int min_samples = 8;
+  if (argc > 4 && (!ParseInt(argv[4], &min_samples) || min_samples < 2)) {
+    std::cerr << "Error: invalid min_samples: " << argv[4] << "\n";
+    return 2;
+  }
+
+  QWEN3TTS::VoiceTokenizer tok;
+  std::string err;
+  if (!tok.LoadSafe(onnx_dir, "vocab.json", "merges.txt", "tokenizer_config.json", &err)) {
+    std::cerr << "Error: " << err << "\n";
+    return 3;
+  }
+
+  std::ifstream in(log_path);
+  if (!in) {
+    std::cerr << "Error: failed to open log: " << log_path << "\n";
+    return 3;
+  }
+  std::vector<QWEN3TTS::StepSample> samples;
+  std::vector<std::string> texts;
+  std::string line;
+  int line_no = 0;
+  int skipped = 0;
+  while (std::getline(in, line)) {
+    ++line_no;
+    if (line.empty() || line[0] == '#') continue;
+    const size_t t1 = line.find('\t');
+    const size_t t2 = t1 == std::string::npos ? t1 : line.find('\t', t1 + 1);
+    QWEN3TTS::StepSample s;
+    if (t2 == std::string::npos || !ParseInt64(line.substr(0, t1), &s.lang) ||
+        !ParseInt(line.substr(t1 + 1, t2 - t1 - 1), &s.frames)) {
+      ++skipped;
+      continue;
+    }
+    samples.push_back(s);
+    texts.push_back(line.substr(t2 + 1));
+  }
+  // Plain text ids: the same count BuildVoiceDesignIds gives minus the template tokens.
+  std::vector<std::vector<int64_t>> text_ids;
+  if (!tok.EncodeBatchSafe(texts, &text_ids, 0, &err)) {
+    std::cerr << "Error: " << err << "\n";
+    return 3;
+  }
+  for (size_t i = 0; i < samples.size(); ++i) {
+    samples[i].text_tokens = std::max<int64_t>(1, static_cast<int64_t>(text_ids[i].size()));
+  }
+  if (samples.empty()) {
+    std::cerr << "Error: no usable samples in " << log_path << " (" << skipped << " skipped)\n";
+    return 3;
+  }
+
+  const QWEN3TTS::StepPredictor predictor = QWEN3TTS::StepPredictor::Fit(samples, min_samples);
+  if (!predictor.calibrated) {
+    std::cerr << "Error: " << samples.size() << " samples are fewer than min_samples=" << min_samples << "\n";
+    return 3;
+  }
+
+  // Coverage on the calibration set: how often the cap would have cut a real utterance,
+  // and how much budget it reserves compared with the fixed 2000-frame cap.
+  struct LangReport { int n = 0; int over_cap = 0; double cap_sum = 0.0; double frames_sum = 0.0; double abs_err = 0.0; };
+  std::map<int64_t, LangReport> report;
+  for (const auto& s : samples) {
+    const QWEN3TTS::StepEstimate e = predictor.predict(s.text_tokens, s.lang);
+    LangReport& r = report[s.lang];
+    ++r.n;
+    r.over_cap += s.frames > e.cap ? 1 : 0;
+    r.cap_sum += e.cap;
+    r.frames_sum += s.frames;
+    r.abs_err += std::abs(e.expected - s.frames);
+  }
+
+  std::cout << "[calibrate] " << samples.size() << " samples, " << skipped << " skipped\n";
+  std::cout << std::setw(8) << "lang" << std::setw(8) << "n" << std::setw(11) << "intercept" << std::setw(9) << "slope"
+            << std::setw(9) << "rel_sd" << std::setw(10) << "mae" << std::setw(10) << "cut%" << std::setw(12)
+            << "cap/frames" << "\n";
+  for (const auto& [lang, r] : report) {
+    const QWEN3TTS::StepModel& m = predictor.model(lang);
+    std::cout << std::fixed << std::setw(8) << lang << std::setw(8) << r.n << std::setprecision(2) << std::setw(11)
+              << m.intercept << std::setprecision(3) << std::setw(9) << m.slope << std::setw(9) << m.rel_sd
+              << std::setprecision(1) << std::setw(10) << (r.abs_err / r.n) << std::setprecision(2) << std::setw(10)
+              << (100.0 * r.over_cap / r.n) << std::setw(12) << (r.cap_sum / std::max(1.0, r.frames_sum))
+              << (predictor.per_lang.count(lang) ? "" : "  (pooled)") << "\n";
+  }
+
+  if (!predictor.saveFile(out_path, &err)) {
+    std::cerr << "Error: " << err << "\n";
+    return 4;
+  }
+  std::cout << "Saved: " << out_path << "\n";
+  return 0;
+}
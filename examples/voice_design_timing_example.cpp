@@ -34,6 +34,7 @@ bool IsErrorPcm(const std::vector<float>& pcm, float* code) {
 int main(int argc, char** argv) {
   std::cout.setf(std::ios::unitbuf);
   const std::string onnx_dir = (argc > 1) ? argv[1] : "onnx_out_v11_min";
+  const bool warmup = argc > 2 && std::string(argv[2]) == "--warmup";
   const std::filesystem::path out_dir = std::filesystem::path("artifacts") / "audio";
   std::error_code mkerr;
   std::filesystem::create_directories(out_dir, mkerr);
@@ -61,6 +62,26 @@ int main(int argc, char** argv) {
   const auto load_end = Clock::now();
   PrintStepTime("load", load_start, load_end);
 
+  if (warmup) {
+    QWEN3TTS::WarmupReport report;
+    const auto warmup_start = Clock::now();
+    if (!voice->warmup(QWEN3TTS::WarmupProfile{}, &report)) {
+      std::cerr << "Warmup failed with error code: " << voice->lastErrorCode()
+                << " (" << voice->lastErrorMessage() << ")\n";
+      delete voice;
+      return 3;
+    }
+    PrintStepTime("warmup", warmup_start, Clock::now());
+    std::cout << std::setw(22) << std::left << "session" << std::right << std::setw(8) << "size" << std::setw(8)
+              << "cache" << std::setw(12) << "first_ms" << std::setw(12) << "steady_ms" << std::setw(8) << "ratio" << "\n";
+    for (const auto& t : report.timings) {
+      std::cout << std::setw(22) << std::left << t.session << std::right << std::setw(8) << t.size << std::setw(8)
+                << t.cache_length
+                << std::setprecision(2) << std::setw(12) << t.first_ms << std::setw(12) << t.steady_ms
+                << std::setw(8) << (t.steady_ms > 0.0 ? t.first_ms / t.steady_ms : 0.0) << "\n";
+    }
+  }
+
   auto run_generation = [&](const std::string& step_name,
                             const std::string& text,
                             const std::string& instruct,
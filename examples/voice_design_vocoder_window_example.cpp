@@ -0,0 +1,198 @@
+#include "utils.h"
+#include "vocoder_batcher.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double Sec(const Clock::time_point& a, const Clock::time_point& b) {
+  return std::chrono::duration_cast<std::chrono::duration<double>>(b - a).count();
+}
+
+// Peak resident set size of this process (VmHWM), in MiB.
+double PeakRssMb() {
+  std::ifstream in("/proc/self/status");
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.rfind("VmHWM:", 0) == 0) return std::stod(line.substr(6)) / 1024.0;
+  }
+  return 0.0;
+}
+
+bool ParseInt(const std::string& s, int* out) {
+  auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), *out);
+  return ec == std::errc{} && ptr == s.data() + s.size();
+}
+
+struct Diff {
+  double max_abs = 0.0;
+  double snr_db = INFINITY;
+};
+
+// Difference of `got` against `ref` over samples [begin, end).
+Diff Compare(const std::vector<float>& ref, const std::vector<float>& got, size_t begin, size_t end) {
+  Diff d;
+  double sig = 0.0;
+  double noise = 0.0;
+  end = std::min({end, ref.size(), got.size()});
+  for (size_t i = begin; i < end; ++i) {
+    const double e = static_cast<double>(got[i]) - static_cast<double>(ref[i]);
+    d.max_abs = std::max(d.max_abs, std::fabs(e));
+    sig += static_cast<double>(ref[i]) * ref[i];
+    noise += e * e;
+  }
+  if (noise > 0.0) d.snr_db = sig > 0.0 ? 10.0 * std::log10(sig / noise) : -INFINITY;
+  return d;
+}
+
+// Batched rows below this SNR against their solo decode mean the batcher's padding leaks
+// into real frames.
+constexpr double kMinBatchSnrDb = 40.0;
+
+// Decodes `rows` prefixes of different lengths through one VocoderBatcher run (the shorter
+// ones padded to the longest) and checks every row against a solo decode of the same prefix,
+// over the whole row and over its last right_ctx frames, next to the padding.
+bool CheckBatchPadding(Ort::Session& vocoder, const Ort::MemoryInfo& mi, const std::vector<int64_t>& codes, int steps,
+                       int groups, int rows, const QWEN3TTSUTILS::VocoderWindowConfig& win_cfg) {
+  const int span = std::min(steps, win_cfg.window_frames + win_cfg.left_context_frames + win_cfg.right_context_frames);
+  const int stride = std::max(1, span / (2 * rows));
+  std::vector<int> lengths;
+  for (int i = 0; i < rows; ++i) lengths.push_back(std::max(1, span - i * stride));
+
+  QWEN3TTS::VocoderBatcherConfig bcfg;
+  bcfg.max_batch = rows;
+  bcfg.max_wait_ms = 200.0;
+  bcfg.max_padding = 1.0;
+  QWEN3TTS::VocoderBatcher batcher(vocoder, mi, groups, bcfg);
+  std::vector<std::vector<float>> batched(static_cast<size_t>(rows));
+  std::vector<std::string> errors(static_cast<size_t>(rows));
+  std::vector<char> ok(static_cast<size_t>(rows), 0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < rows; ++i) {
+    threads.emplace_back([&, i] {
+      ok[i] = batcher.decode(codes.data(), lengths[i], &batched[i], &errors[i]);
+    });
+  }
+  for (auto& t : threads) t.join();
+  const QWEN3TTS::VocoderBatcherStats st = batcher.stats();
+  std::cout << "[batch] rows=" << rows << " runs=" << st.runs << " max_batch_seen=" << st.max_batch_seen
+            << " padded_frames=" << st.padded_frames << " real_frames=" << st.frames << "\n";
+
+  bool pass = true;
+  for (int i = 0; i < rows; ++i) {
+    if (!ok[i]) {
+      std::cerr << "Batched decode failed: " << errors[i] << "\n";
+      return false;
+    }
+    std::vector<int64_t> prefix(codes.begin(), codes.begin() + static_cast<size_t>(lengths[i]) * groups);
+    std::vector<float> solo;
+    std::string err;
+    if (!QWEN3TTSUTILS::DecodeAudioCodesSafe(vocoder, mi, prefix, lengths[i], groups, &solo, &err)) {
+      std::cerr << "Solo decode failed: " << err << "\n";
+      return false;
+    }
+    const size_t spf = solo.size() / static_cast<size_t>(lengths[i]);
+    const size_t tail = std::min(solo.size(), static_cast<size_t>(std::max(1, win_cfg.right_context_frames)) * spf);
+    const Diff whole = Compare(solo, batched[i], 0, solo.size());
+    const Diff edge = Compare(solo, batched[i], solo.size() - tail, solo.size());
+    const bool row_ok = batched[i].size() == solo.size() && edge.snr_db >= kMinBatchSnrDb;
+    pass = pass && row_ok;
+    std::cout << "[batch] row=" << i << " frames=" << lengths[i] << " padded=" << (lengths[0] - lengths[i])
+              << " samples solo=" << solo.size() << " batched=" << batched[i].size() << " max_abs="
+              << std::setprecision(6) << whole.max_abs << " snr_db=" << std::setprecision(2) << whole.snr_db
+              << " tail_snr_db=" << edge.snr_db << (row_ok ? "" : " FAIL") << "\n";
+  }
+  std::cout << "[batch] " << (pass ? "pass" : "FAIL") << " (tail snr >= " << kMinBatchSnrDb << " dB)\n";
+  return pass;
+}
+
+}  // namespace
+
+// Decodes a codes file (see --save-codes-file) windowed first, then in one call,
+// and reports the difference plus time and peak RSS after each pass. With batch_rows > 1
+// it also checks VocoderBatcher padding against solo decodes and exits 4 on a mismatch.
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    std::cerr << "Usage:\n  " << argv[0]
+              << " <onnx_dir> <codes.txt> [window_frames=64] [left_ctx=16] [right_ctx=4] [batch_rows=0]\n";
+    return 1;
+  }
+  const std::string onnx_dir = argv[1];
+  const std::string codes_path = argv[2];
+  QWEN3TTSUTILS::VocoderWindowConfig win_cfg;
+  int batch_rows = 0;
+  if ((argc > 3 && !ParseInt(argv[3], &win_cfg.window_frames)) ||
+      (argc > 4 && !ParseInt(argv[4], &win_cfg.left_context_frames)) ||
+      (argc > 5 && !ParseInt(argv[5], &win_cfg.right_context_frames)) ||
+      (argc > 6 && !ParseInt(argv[6], &batch_rows))) {
+    std::cerr << "Error: invalid integer argument\n";
+    return 2;
+  }
+
+  constexpr int kGroups = 16;
+  std::vector<int64_t> codes;
+  const int steps = QWEN3TTSUTILS::ReadCodesTxt(codes_path, kGroups, &codes);
+  if (steps <= 0) {
+    std::cerr << "Error: failed to read codes file: " << codes_path << "\n";
+    return 2;
+  }
+
+  Ort::Env env(ORT_LOGGING_LEVEL_WARNING, "qwen3_tts_vocoder_window");
+  Ort::SessionOptions so;
+  so.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
+  const std::string vocoder_path = (std::filesystem::path(onnx_dir) / "speech_tokenizer_decode.onnx").string();
+  Ort::Session vocoder(env, vocoder_path.c_str(), so);
+  auto mi = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
+  std::cout << "[vocoder] frames=" << steps << " rss_after_load=" << std::fixed << std::setprecision(1)
+            << PeakRssMb() << " MiB\n";
+
+  std::vector<float> windowed;
+  std::string err;
+  const auto t0 = Clock::now();
+  if (!QWEN3TTSUTILS::DecodeAudioCodesWindowedSafe(vocoder, mi, codes, steps, kGroups, win_cfg, &windowed, &err)) {
+    std::cerr << "Windowed decode failed: " << err << "\n";
+    return 3;
+  }
+  const auto t1 = Clock::now();
+  std::cout << "[windowed] window=" << win_cfg.window_frames << " ctx=" << win_cfg.left_context_frames << "/"
+            << win_cfg.right_context_frames << " time=" << std::setprecision(3) << Sec(t0, t1)
+            << " sec peak_rss=" << std::setprecision(1) << PeakRssMb() << " MiB\n";
+
+  std::vector<float> full;
+  if (!QWEN3TTSUTILS::DecodeAudioCodesSafe(vocoder, mi, codes, steps, kGroups, &full, &err)) {
+    std::cerr << "Full decode failed: " << err << "\n";
+    return 3;
+  }
+  const auto t2 = Clock::now();
+  std::cout << "[full] time=" << std::setprecision(3) << Sec(t1, t2) << " sec peak_rss=" << std::setprecision(1)
+            << PeakRssMb() << " MiB\n";
+
+  const size_t n = std::min(full.size(), windowed.size());
+  double max_abs = 0.0;
+  double sig = 0.0;
+  double noise = 0.0;
+  for (size_t i = 0; i < n; ++i) {
+    const double d = static_cast<double>(windowed[i]) - static_cast<double>(full[i]);
+    max_abs = std::max(max_abs, std::fabs(d));
+    sig += static_cast<double>(full[i]) * full[i];
+    noise += d * d;
+  }
+  const double snr_db = noise > 0.0 ? 10.0 * std::log10(sig / noise) : INFINITY;
+  std::cout << "[diff] samples full=" << full.size() << " windowed=" << windowed.size()
+            << " max_abs=" << std::setprecision(6) << max_abs << " snr_db=" << std::setprecision(2) << snr_db << "\n";
+
+  if (batch_rows > 1 && !CheckBatchPadding(vocoder, mi, codes, steps, kGroups, batch_rows, win_cfg)) return 4;
+  return 0;
+}
@@ -0,0 +1,784 @@
+#include "audio_sink.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define QWEN3TTS_HAVE_SSE2 1
+#endif
+
+namespace QWEN3TTSUTILS {
+
+namespace {
+
+constexpr size_t kConvertBlock = 4096;
+constexpr int kMaxFadeMs = 80;
+constexpr int kPadMs = 30;
+
+bool WriteWavHeader(std::FILE* f, int sample_rate, uint32_t data_bytes) {
+    const uint32_t riff_size = 36u + data_bytes;
+    const uint16_t audio_format = 1;
+    const uint16_t num_channels = 1;
+    const uint16_t bits_per_sample = 16;
+    const uint32_t byte_rate = sample_rate * num_channels * bits_per_sample / 8;
+    const uint16_t block_align = num_channels * bits_per_sample / 8;
+    const uint32_t fmt_size = 16;
+    bool ok = std::fwrite("RIFF", 1, 4, f) == 4;
+    ok = ok && std::fwrite(&riff_size, sizeof(riff_size), 1, f) == 1;
+    ok = ok && std::fwrite("WAVE", 1, 4, f) == 4;
+    ok = ok && std::fwrite("fmt ", 1, 4, f) == 4;
+    ok = ok && std::fwrite(&fmt_size, sizeof(fmt_size), 1, f) == 1;
+    ok = ok && std::fwrite(&audio_format, sizeof(audio_format), 1, f) == 1;
+    ok = ok && std::fwrite(&num_channels, sizeof(num_channels), 1, f) == 1;
+    ok = ok && std::fwrite(&sample_rate, sizeof(sample_rate), 1, f) == 1;
+    ok = ok && std::fwrite(&byte_rate, sizeof(byte_rate), 1, f) == 1;
+    ok = ok && std::fwrite(&block_align, sizeof(block_align), 1, f) == 1;
+    ok = ok && std::fwrite(&bits_per_sample, sizeof(bits_per_sample), 1, f) == 1;
+    ok = ok && std::fwrite("data", 1, 4, f) == 4;
+    ok = ok && std::fwrite(&data_bytes, sizeof(data_bytes), 1, f) == 1;
+    return ok;
+}
+
+double BesselI0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    const double q = x * x / 4.0;
+    for (int k = 1; k < 64 && term > sum * 1e-12; ++k) {
+        term *= q / (static_cast<double>(k) * k);
+        sum += term;
+    }
+    return sum;
+}
+
+// Sun g711.c segment encoders on the full 16-bit range, tabulated once.
+uint8_t MuLawFromLinear14(int v) {
+    static const int kSegEnd[8] = {0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF, 0x1FFF};
+    int mask = 0xFF;
+    if (v < 0) {
+        v = -v;
+        mask = 0x7F;
+    }
+    v = std::min(v, 8159) + 33;
+    int seg = 0;
+    while (seg < 8 && v > kSegEnd[seg]) ++seg;
+    if (seg >= 8) return static_cast<uint8_t>(0x7F ^ mask);
+    return static_cast<uint8_t>(((seg << 4) | ((v >> (seg + 1)) & 0xF)) ^ mask);
+}
+
+uint8_t ALawFromLinear13(int v) {
+    static const int kSegEnd[8] = {0x1F, 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF};
+    int mask = 0xD5;
+    if (v < 0) {
+        mask = 0x55;
+        v = -v - 1;
+    }
+    int seg = 0;
+    while (seg < 8 && v > kSegEnd[seg]) ++seg;
+    if (seg >= 8) return static_cast<uint8_t>(0x7F ^ mask);
+    const int aval = (seg << 4) | ((seg < 2 ? (v >> 1) : (v >> seg)) & 0xF);
+    return static_cast<uint8_t>(aval ^ mask);
+}
+
+class ByteSinkBase : public AudioSink {
+ public:
+  ByteSinkBase(ByteOutput out, int rate) : out_(std::move(out)), rate_(rate) {}
+  int outputSampleRate() const override { return rate_; }
+  uint64_t bytesWritten() const override { return bytes_; }
+
+ protected:
+  bool Emit(const void* data, size_t size) {
+    if (failed_) return false;
+    if (size == 0) return true;
+    failed_ = !out_(static_cast<const uint8_t*>(data), size);
+    if (!failed_) bytes_ += size;
+    return !failed_;
+  }
+  bool Finish(std::string* error) {
+    if (failed_) {
+      if (error) *error = "audio sink output failed";
+      return false;
+    }
+    if (error) error->clear();
+    return true;
+  }
+
+  ByteOutput out_;
+  int rate_ = 0;
+  uint64_t bytes_ = 0;
+  bool failed_ = false;
+};
+
+class RawPcmSink : public ByteSinkBase {
+ public:
+  RawPcmSink(ByteOutput out, int rate, bool f32) : ByteSinkBase(std::move(out), rate), f32_(f32) {}
+
+  bool Write(const float* samples, size_t n) override {
+    if (f32_) return Emit(samples, n * sizeof(float));
+    pcm_.resize(std::min(n, kConvertBlock));
+    for (size_t off = 0; off < n; off += kConvertBlock) {
+      const size_t m = std::min(kConvertBlock, n - off);
+      FloatToPcm16(samples + off, pcm_.data(), m);
+      if (!Emit(pcm_.data(), m * sizeof(int16_t))) return false;
+    }
+    return !failed_;
+  }
+  bool Close(std::string* error) override { return Finish(error); }
+
+ private:
+  bool f32_ = false;
+  std::vector<int16_t> pcm_;
+};
+
+class G711Sink : public ByteSinkBase {
+ public:
+  static constexpr int kRate = 8000;
+
+  G711Sink(ByteOutput out, int in_rate, bool alaw)
+      : ByteSinkBase(std::move(out), kRate), alaw_(alaw), resampler_(in_rate, kRate) {}
+
+  bool Write(const float* samples, size_t n) override {
+    resampled_.clear();
+    resampler_.Process(samples, n, &resampled_);
+    return EncodeResampled();
+  }
+  bool Close(std::string* error) override {
+    resampled_.clear();
+    resampler_.Flush(&resampled_);
+    EncodeResampled();
+    return Finish(error);
+  }
+
+ private:
+  bool EncodeResampled() {
+    pcm_.resize(resampled_.size());
+    bytes_out_.resize(resampled_.size());
+    FloatToPcm16(resampled_.data(), pcm_.data(), resampled_.size());
+    for (size_t i = 0; i < pcm_.size(); ++i) {
+      bytes_out_[i] = alaw_ ? LinearToALaw(pcm_[i]) : LinearToMuLaw(pcm_[i]);
+    }
+    return Emit(bytes_out_.data(), bytes_out_.size());
+  }
+
+  bool alaw_ = false;
+  PolyphaseResampler resampler_;
+  std::vector<float> resampled_;
+  std::vector<int16_t> pcm_;
+  std::vector<uint8_t> bytes_out_;
+};
+
+// MSB-first bit packer used by the FLAC frame writer (64-bit accumulator).
+class BitWriter {
+ public:
+  void Put(uint32_t value, int bits) {
+    if (bits == 0) return;
+    if (bits > 32 - 8) {
+      Put(value >> 16, bits - 16);
+      Put(value & 0xFFFFu, 16);
+      return;
+    }
+    acc_ = (acc_ << bits) | (value & ((1u << bits) - 1u));
+    nbits_ += bits;
+    while (nbits_ >= 8) {
+      nbits_ -= 8;
+      bytes_.push_back(static_cast<uint8_t>(acc_ >> nbits_));
+    }
+  }
+  void PutSigned(int32_t value, int bits) { Put(static_cast<uint32_t>(value), bits); }
+  void PutZeros(uint32_t count) {
+    while (count > 16) {
+      Put(0, 16);
+      count -= 16;
+    }
+    Put(0, static_cast<int>(count));
+  }
+  void PutRice(int32_t r, int k) {
+    const uint32_t u = (static_cast<uint32_t>(r) << 1) ^ static_cast<uint32_t>(r >> 31);
+    const uint32_t q = u >> k;
+    if (q + 1 + static_cast<uint32_t>(k) <= 24) {
+      Put((1u << k) | (u & ((1u << k) - 1u)), static_cast<int>(q) + 1 + k);
+      return;
+    }
+    PutZeros(q);
+    Put(1, 1);
+    Put(u & ((1u << k) - 1u), k);
+  }
+  void AlignToByte() {
+    if (nbits_ > 0) Put(0, 8 - nbits_);
+  }
+  void Clear() {
+    bytes_.clear();
+    acc_ = 0;
+    nbits_ = 0;
+  }
+  const std::vector<uint8_t>& bytes() const { return bytes_; }
+
+ private:
+  std::vector<uint8_t> bytes_;
+  uint64_t acc_ = 0;
+  int nbits_ = 0;
+};
+
+uint8_t Crc8(const uint8_t* data, size_t n) {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < n; ++i) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; ++b) crc = static_cast<uint8_t>((crc & 0x80) ? ((crc << 1) ^ 0x07) : (crc << 1));
+    }
+    return crc;
+}
+
+uint16_t Crc16(const uint8_t* data, size_t n) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < n; ++i) {
+        crc ^= static_cast<uint16_t>(data[i] << 8);
+        for (int b = 0; b < 8; ++b) crc = static_cast<uint16_t>((crc & 0x8000) ? ((crc << 1) ^ 0x8005) : (crc << 1));
+    }
+    return crc;
+}
+
+// Minimal 16-bit mono FLAC encoder: fixed-size blocks, per-block choice of
+// CONSTANT / FIXED(0..4) / VERBATIM subframes, partitioned Rice residuals.
+// STREAMINFO leaves total samples and MD5 unset since the output is not seekable.
+class FlacSink : public ByteSinkBase {
+ public:
+  static constexpr int kBlockSize = 4096;
+  static constexpr int kMaxOrder = 4;
+  static constexpr int kMaxPartitionOrder = 6;
+  static constexpr int kMaxRiceParam = 14;
+
+  FlacSink(ByteOutput out, int rate) : ByteSinkBase(std::move(out), rate) { block_.reserve(kBlockSize); }
+
+  bool Write(const float* samples, size_t n) override {
+    if (!header_written_ && !WriteStreamHeader()) return false;
+    int16_t pcm[256];
+    for (size_t off = 0; off < n;) {
+      const size_t m = std::min<size_t>({sizeof(pcm) / sizeof(pcm[0]), n - off, kBlockSize - block_.size()});
+      FloatToPcm16(samples + off, pcm, m);
+      block_.insert(block_.end(), pcm, pcm + m);
+      off += m;
+      if (block_.size() == static_cast<size_t>(kBlockSize) && !WriteFrame()) return false;
+    }
+    return !failed_;
+  }
+
+  bool Close(std::string* error) override {
+    if (!header_written_) WriteStreamHeader();
+    if (!block_.empty()) WriteFrame();
+    return Finish(error);
+  }
+
+ private:
+  bool WriteStreamHeader() {
+    header_written_ = true;
+    BitWriter bw;
+    bw.Put('f', 8);
+    bw.Put('L', 8);
+    bw.Put('a', 8);
+    bw.Put('C', 8);
+    bw.Put(1, 1);    // last metadata block
+    bw.Put(0, 7);    // STREAMINFO
+    bw.Put(34, 24);
+    bw.Put(kBlockSize, 16);
+    bw.Put(kBlockSize, 16);
+    bw.Put(0, 24);   // min frame size unknown
+    bw.Put(0, 24);   // max frame size unknown
+    bw.Put(static_cast<uint32_t>(rate_), 20);
+    bw.Put(0, 3);    // channels - 1
+    bw.Put(15, 5);   // bits per sample - 1
+    bw.Put(0, 4);    // total samples (36 bits) unknown
+    bw.Put(0, 32);
+    for (int i = 0; i < 4; ++i) bw.Put(0, 32);  // MD5 unset
+    return Emit(bw.bytes().data(), bw.bytes().size());
+  }
+
+  uint32_t SampleRateCode() const {
+    switch (rate_) {
+      case 8000: return 4;
+      case 16000: return 5;
+      case 22050: return 6;
+      case 24000: return 7;
+      case 32000: return 8;
+      case 44100: return 9;
+      case 48000: return 10;
+      case 96000: return 11;
+      default: return 0;  // from STREAMINFO
+    }
+  }
+
+  static void ComputeResidual(const int32_t* x, int n, int order, int32_t* res) {
+    for (int i = order; i < n; ++i) {
+      switch (order) {
+        case 0: res[i] = x[i]; break;
+        case 1: res[i] = x[i] - x[i - 1]; break;
+        case 2: res[i] = x[i] - 2 * x[i - 1] + x[i - 2]; break;
+        case 3: res[i] = x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3]; break;
+        default: res[i] = x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4]; break;
+      }
+    }
+  }
+
+  // Rice parameter for a partition from its sum of folded residuals, using the usual
+  // estimate n*(k+1) + sum/2^k for the coded size.
+  static int BestRiceParam(uint64_t sum, int n, uint64_t* bits) {
+    int best_k = 0;
+    uint64_t best = UINT64_MAX;
+    for (int k = 0; k <= kMaxRiceParam; ++k) {
+      const uint64_t b = static_cast<uint64_t>(n) * static_cast<uint64_t>(k + 1) + (sum >> k);
+      if (b < best) {
+        best = b;
+        best_k = k;
+      }
+    }
+    *bits = best;
+    return best_k;
+  }
+
+  struct ResidualPlan {
+    int partition_order = 0;
+    std::vector<int> params;
+    uint64_t bits = 0;
+  };
+
+  // Sums folded residuals at the finest partition level once, then merges pairs upward.
+  static ResidualPlan PlanResidual(const int32_t* res, int n, int order) {
+    int max_po = 0;
+    while (max_po < kMaxPartitionOrder && n % (2 << max_po) == 0 && n / (2 << max_po) > order) ++max_po;
+    std::vector<uint64_t> sums(static_cast<size_t>(1) << max_po, 0);
+    const int fine = n >> max_po;
+    for (int p = 0; p < (1 << max_po); ++p) {
+      uint64_t sum = 0;
+      for (int i = std::max(order, p * fine); i < (p + 1) * fine; ++i) {
+        sum += (static_cast<uint32_t>(res[i]) << 1) ^ static_cast<uint32_t>(res[i] >> 31);
+      }
+      sums[p] = sum;
+    }
+    ResidualPlan best;
+    best.bits = UINT64_MAX;
+    for (int po = max_po; po >= 0; --po) {
+      const int parts = 1 << po;
+      const int psize = n / parts;
+      ResidualPlan plan;
+      plan.partition_order = po;
+      plan.bits = 6;
+      for (int p = 0; p < parts; ++p) {
+        uint64_t bits = 0;
+        const int count = psize - (p == 0 ? order : 0);
+        plan.params.push_back(BestRiceParam(sums[p], count, &bits));
+        plan.bits += 4 + bits;
+      }
+      if (plan.bits < best.bits) best = std::move(plan);
+      for (int p = 0; p < parts / 2; ++p) sums[p] = sums[2 * p] + sums[2 * p + 1];
+    }
+    return best;
+  }
+
+  bool WriteFrame() {
+    const int n = static_cast<int>(block_.size());
+    samples_.assign(block_.begin(), block_.end());
+    block_.clear();
+
+    BitWriter& bw = frame_;
+    bw.Clear();
+    bw.Put(0x3FFE, 14);  // sync
+    bw.Put(0, 1);
+    bw.Put(0, 1);        // fixed block size stream
+    bw.Put(7, 4);        // block size - 1 follows as 16 bits
+    bw.Put(SampleRateCode(), 4);
+    bw.Put(0, 4);        // mono
+    bw.Put(4, 3);        // 16 bits per sample
+    bw.Put(0, 1);
+    PutUtf8(bw, frame_number_++);
+    bw.Put(static_cast<uint32_t>(n - 1), 16);
+    bw.Put(Crc8(bw.bytes().data(), bw.bytes().size()), 8);
+
+    bool constant = true;
+    for (int i = 1; i < n && constant; ++i) constant = samples_[i] == samples_[0];
+    if (constant) {
+      bw.Put(0, 1);
+      bw.Put(0, 6);  // CONSTANT
+      bw.Put(0, 1);
+      bw.PutSigned(samples_[0], 16);
+    } else {
+      residual_.assign(n, 0);
+      int best_order = -1;
+      ResidualPlan best_plan;
+      std::vector<int32_t>& best_res = best_residual_;
+      for (int order = 0; order <= std::min(kMaxOrder, n - 1); ++order) {
+        ComputeResidual(samples_.data(), n, order, residual_.data());
+        ResidualPlan plan = PlanResidual(residual_.data(), n, order);
+        plan.bits += static_cast<uint64_t>(order) * 16;
+        if (best_order < 0 || plan.bits < best_plan.bits) {
+          best_order = order;
+          best_plan = std::move(plan);
+          best_res.swap(residual_);
+          residual_.assign(n, 0);
+        }
+      }
+      bw.Put(0, 1);
+      if (best_plan.bits >= static_cast<uint64_t>(n) * 16) {
+        bw.Put(1, 6);  // VERBATIM
+        bw.Put(0, 1);
+        for (int i = 0; i < n; ++i) bw.PutSigned(samples_[i], 16);
+      } else {
+        bw.Put(8 | static_cast<uint32_t>(best_order), 6);  // FIXED
+        bw.Put(0, 1);
+        for (int i = 0; i < best_order; ++i) bw.PutSigned(samples_[i], 16);
+        bw.Put(0, 2);  // 4-bit Rice parameters
+        bw.Put(static_cast<uint32_t>(best_plan.partition_order), 4);
+        const int parts = 1 << best_plan.partition_order;
+        const int psize = n / parts;
+        for (int p = 0; p < parts; ++p) {
+          const int k = best_plan.params[p];
+          bw.Put(static_cast<uint32_t>(k), 4);
+          const int begin = (p == 0) ? best_order : p * psize;
+          for (int i = begin; i < (p + 1) * psize; ++i) bw.PutRice(best_res[i], k);
+        }
+      }
+    }
+    bw.AlignToByte();
+    const uint16_t crc = Crc16(bw.bytes().data(), bw.bytes().size());
+    bw.Put(crc, 16);
+    return Emit(bw.bytes().data(), bw.bytes().size());
+  }
+
+  static void PutUtf8(BitWriter& bw, uint32_t v) {
+    if (v < 0x80) {
+      bw.Put(v, 8);
+      return;
+    }
+    int extra = 1;
+    while (extra < 6 && v >= (1u << (6 + 5 * extra))) ++extra;
+    bw.Put(((0xFF00u >> (extra + 1)) & 0xFFu) | (v >> (6 * extra)), 8);
+    for (int i = extra - 1; i >= 0; --i) bw.Put(0x80u | ((v >> (6 * i)) & 0x3Fu), 8);
+  }
+
+  std::vector<int16_t> block_;
+  std::vector<int32_t> samples_;
+  std::vector<int32_t> residual_;
+  std::vector<int32_t> best_residual_;
+  BitWriter frame_;
+  uint32_t frame_number_ = 0;
+  bool header_written_ = false;
+};
+
+// Owns the FILE* behind a byte-stream sink and closes it with the sink.
+class FileAudioSink : public AudioSink {
+ public:
+  FileAudioSink(std::FILE* f, std::unique_ptr<AudioSink> inner) : file_(f), inner_(std::move(inner)) {}
+  ~FileAudioSink() override {
+    if (file_) Close(nullptr);
+  }
+  bool Write(const float* samples, size_t n) override { return inner_->Write(samples, n); }
+  bool Close(std::string* error) override {
+    if (!file_) {
+      if (error) *error = "audio file is not open";
+      return false;
+    }
+    bool ok = inner_->Close(error);
+    ok = (std::fclose(file_) == 0) && ok;
+    file_ = nullptr;
+    if (!ok && error && error->empty()) *error = "Failed to write audio file";
+    return ok;
+  }
+  int outputSampleRate() const override { return inner_->outputSampleRate(); }
+  uint64_t bytesWritten() const override { return inner_->bytesWritten(); }
+
+ private:
+  std::FILE* file_ = nullptr;
+  std::unique_ptr<AudioSink> inner_;
+};
+
+}  // namespace
+
+bool ParseAudioFormat(const std::string& s, AudioFormat* out) {
+    static const std::pair<const char*, AudioFormat> kNames[] = {
+        {"wav", AudioFormat::Wav},     {"s16le", AudioFormat::PcmS16}, {"f32le", AudioFormat::PcmF32},
+        {"mulaw", AudioFormat::MuLaw}, {"alaw", AudioFormat::ALaw},    {"flac", AudioFormat::Flac},
+    };
+    for (const auto& [name, fmt] : kNames) {
+        if (s == name) {
+            *out = fmt;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* AudioFormatName(AudioFormat fmt) {
+    switch (fmt) {
+        case AudioFormat::Wav: return "wav";
+        case AudioFormat::PcmS16: return "s16le";
+        case AudioFormat::PcmF32: return "f32le";
+        case AudioFormat::MuLaw: return "mulaw";
+        case AudioFormat::ALaw: return "alaw";
+        case AudioFormat::Flac: return "flac";
+    }
+    return "unknown";
+}
+
+uint8_t LinearToMuLaw(int16_t pcm) {
+    static const std::array<uint8_t, 1 << 14> kTable = [] {
+        std::array<uint8_t, 1 << 14> t{};
+        for (int i = 0; i < (1 << 14); ++i) t[i] = MuLawFromLinear14(i - (1 << 13));
+        return t;
+    }();
+    return kTable[(pcm >> 2) + (1 << 13)];
+}
+
+uint8_t LinearToALaw(int16_t pcm) {
+    static const std::array<uint8_t, 1 << 13> kTable = [] {
+        std::array<uint8_t, 1 << 13> t{};
+        for (int i = 0; i < (1 << 13); ++i) t[i] = ALawFromLinear13(i - (1 << 12));
+        return t;
+    }();
+    return kTable[(pcm >> 3) + (1 << 12)];
+}
+
+PolyphaseResampler::PolyphaseResampler(int in_rate, int out_rate, int zero_crossings, double rolloff) {
+    const int g = std::gcd(std::max(1, in_rate), std::max(1, out_rate));
+    up_ = std::max(1, out_rate) / g;
+    down_ = std::max(1, in_rate) / g;
+    const int factor = std::max(up_, down_);
+    // Cutoff in cycles per sample on the upsampled grid.
+    const double fc = 0.5 * rolloff / static_cast<double>(factor);
+    const int half = static_cast<int>(std::ceil(zero_crossings * factor / rolloff));
+    const int len = 2 * half + 1;
+    taps_per_phase_ = static_cast<size_t>((len + up_ - 1) / up_);
+    constexpr double kPi = 3.14159265358979323846;
+    constexpr double kBeta = 8.0;
+    const double i0_beta = BesselI0(kBeta);
+
+    phases_.assign(static_cast<size_t>(up_) * taps_per_phase_, 0.0f);
+    for (int n = 0; n < len; ++n) {
+        const double t = static_cast<double>(n - half);
+        const double x = 2.0 * fc * t;
+        const double sinc = (t == 0.0) ? 1.0 : std::sin(kPi * x) / (kPi * x);
+        const double r = t / static_cast<double>(half);
+        const double win = BesselI0(kBeta * std::sqrt(std::max(0.0, 1.0 - r * r))) / i0_beta;
+        // Gain of `up_` compensates for the zeros inserted by upsampling.
+        phases_[static_cast<size_t>(n % up_) * taps_per_phase_ + (taps_per_phase_ - 1 - static_cast<size_t>(n / up_))] =
+            static_cast<float>(up_ * 2.0 * fc * sinc * win);
+    }
+    // Zero history so the first outputs see silence before the stream; start at the
+    // filter's group delay so output sample 0 lines up with input sample 0.
+    history_.assign(taps_per_phase_, 0.0f);
+    history_start_ = -static_cast<int64_t>(taps_per_phase_);
+    next_pos_ = half;
+}
+
+void PolyphaseResampler::Process(const float* in, size_t n, std::vector<float>* out) {
+    input_count_ += static_cast<int64_t>(n);
+    history_.insert(history_.end(), in, in + n);
+    const int64_t available = history_start_ + static_cast<int64_t>(history_.size());
+    const size_t taps = taps_per_phase_;
+    while (true) {
+        const int64_t newest = next_pos_ / up_;  // newest input sample this output touches
+        if (newest >= available) break;
+        const size_t phase = static_cast<size_t>(next_pos_ % up_);
+        const float* h = phases_.data() + phase * taps;
+        const float* x = history_.data() + (newest - history_start_) + 1 - taps;
+        float acc[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        size_t k = 0;
+        for (; k + 4 <= taps; k += 4) {
+            acc[0] += h[k] * x[k];
+            acc[1] += h[k + 1] * x[k + 1];
+            acc[2] += h[k + 2] * x[k + 2];
+            acc[3] += h[k + 3] * x[k + 3];
+        }
+        for (; k < taps; ++k) acc[0] += h[k] * x[k];
+        out->push_back((acc[0] + acc[1]) + (acc[2] + acc[3]));
+        ++output_count_;
+        next_pos_ += down_;
+    }
+    // Keep only what the next output can still reach.
+    const int64_t keep_from = next_pos_ / up_ - static_cast<int64_t>(taps) + 1;
+    if (keep_from > history_start_) {
+        const size_t drop = static_cast<size_t>(std::min<int64_t>(keep_from - history_start_, static_cast<int64_t>(history_.size())));
+        history_.erase(history_.begin(), history_.begin() + static_cast<std::ptrdiff_t>(drop));
+        history_start_ += static_cast<int64_t>(drop);
+    }
+}
+
+void PolyphaseResampler::Flush(std::vector<float>* out) {
+    // Output length is ceil(input * L / M); the zero tail only pushes the last ones out.
+    const int64_t expected = (input_count_ * up_ + down_ - 1) / down_;
+    const int64_t pending = std::max<int64_t>(0, expected - output_count_);
+    const size_t before = out->size();
+    const std::vector<float> zeros(taps_per_phase_, 0.0f);
+    const int64_t in_count = input_count_;
+    Process(zeros.data(), zeros.size(), out);
+    input_count_ = in_count;
+    out->resize(before + static_cast<size_t>(std::min<int64_t>(pending, static_cast<int64_t>(out->size() - before))));
+    output_count_ = expected;
+}
+
+void FloatToPcm16(const float* in, int16_t* out, size_t n) {
+    size_t i = 0;
+#if QWEN3TTS_HAVE_SSE2
+    // min first, then max: a NaN input ends up at +1 exactly like the scalar path.
+    const __m128 hi = _mm_set1_ps(1.0f);
+    const __m128 lo = _mm_set1_ps(-1.0f);
+    const __m128 scale = _mm_set1_ps(32767.0f);
+    for (; i + 8 <= n; i += 8) {
+        __m128 a = _mm_loadu_ps(in + i);
+        __m128 b = _mm_loadu_ps(in + i + 4);
+        a = _mm_max_ps(_mm_min_ps(a, hi), lo);
+        b = _mm_max_ps(_mm_min_ps(b, hi), lo);
+        const __m128i ia = _mm_cvttps_epi32(_mm_mul_ps(a, scale));
+        const __m128i ib = _mm_cvttps_epi32(_mm_mul_ps(b, scale));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packs_epi32(ia, ib));
+    }
+#endif
+    for (; i < n; ++i) {
+        const float v = std::max(-1.0f, std::min(1.0f, in[i]));
+        out[i] = static_cast<int16_t>(v * 32767.0f);
+    }
+}
+
+WavStreamWriter::~WavStreamWriter() {
+    if (file_) Close(nullptr);
+}
+
+bool WavStreamWriter::Open(const std::string& path, int sample_rate, std::string* error) {
+    if (file_) Close(nullptr);
+    file_ = std::fopen(path.c_str(), "wb");
+    if (!file_) {
+        if (error) *error = "Failed to open output wav: " + path;
+        return false;
+    }
+    sample_rate_ = sample_rate;
+    holdback_ = static_cast<size_t>((sample_rate * kMaxFadeMs) / 1000);
+    tail_.clear();
+    tail_.reserve(holdback_);
+    samples_written_ = 0;
+    failed_ = !WriteWavHeader(file_, sample_rate_, 0);
+    if (failed_) {
+        if (error) *error = "Failed to write wav header: " + path;
+        return false;
+    }
+    if (error) error->clear();
+    return true;
+}
+
+bool WavStreamWriter::WritePcm(const float* samples, size_t n) {
+    pcm_.resize(std::min(n, kConvertBlock));
+    for (size_t off = 0; off < n && !failed_; off += kConvertBlock) {
+        const size_t m = std::min(kConvertBlock, n - off);
+        FloatToPcm16(samples + off, pcm_.data(), m);
+        const size_t written = std::fwrite(pcm_.data(), sizeof(int16_t), m, file_);
+        samples_written_ += written;
+        failed_ = written != m;
+    }
+    return !failed_;
+}
+
+bool WavStreamWriter::Write(const float* samples, size_t n) {
+    if (!file_ || failed_) return false;
+    const size_t total = tail_.size() + n;
+    if (total <= holdback_) {
+        tail_.insert(tail_.end(), samples, samples + n);
+        return true;
+    }
+    // Everything except the last `holdback_` samples is final and can be written now.
+    const size_t emit = total - holdback_;
+    const size_t from_tail = std::min(emit, tail_.size());
+    if (!WritePcm(tail_.data(), from_tail)) return false;
+    if (!WritePcm(samples, emit - from_tail)) return false;
+    tail_.erase(tail_.begin(), tail_.begin() + static_cast<std::ptrdiff_t>(from_tail));
+    tail_.insert(tail_.end(), samples + (emit - from_tail), samples + n);
+    return true;
+}
+
+bool WavStreamWriter::Close(std::string* error) {
+    if (!file_) {
+        if (error) *error = "wav stream is not open";
+        return false;
+    }
+    // tail_ holds min(total, holdback_) samples, except after a failed Write() left it short;
+    // bounding by it keeps the fade inside the buffer either way.
+    const uint64_t total = tail_.size();
+    const size_t tail_probe = static_cast<size_t>(std::min<uint64_t>(total, static_cast<uint64_t>(sample_rate_ / 100)));  // 10 ms
+    float tail_peak = 0.0f;
+    for (size_t i = 0; i < tail_probe; ++i) {
+        const float v = std::abs(tail_[tail_.size() - tail_probe + i]);
+        if (v > tail_peak) tail_peak = v;
+    }
+
+    // Stronger default fade to suppress end-clicks.
+    size_t fade_ms = 40;
+    // If tail is still hot, apply an even stronger fade window.
+    if (tail_peak > 0.35f) fade_ms = kMaxFadeMs;
+    const size_t fade_samples = static_cast<size_t>(
+        std::min<uint64_t>(total, static_cast<uint64_t>((sample_rate_ * fade_ms) / 1000)));
+    if (fade_samples > 1) {
+        const size_t start = tail_.size() - fade_samples;
+        for (size_t i = 0; i < fade_samples; ++i) {
+            const float t = static_cast<float>(i) / static_cast<float>(fade_samples - 1);
+            const float gain = (1.0f - t) * (1.0f - t);  // Quadratic fade-out.
+            tail_[start + i] *= gain;
+        }
+    }
+
+    // Add a short silence pad so players don't cut exactly on a non-zero edge.
+    tail_.insert(tail_.end(), static_cast<size_t>((sample_rate_ * kPadMs) / 1000), 0.0f);
+    WritePcm(tail_.data(), tail_.size());
+    tail_.clear();
+
+    const uint32_t data_bytes = static_cast<uint32_t>(samples_written_ * sizeof(int16_t));
+    if (!failed_) {
+        failed_ = std::fseek(file_, 0, SEEK_SET) != 0 || !WriteWavHeader(file_, sample_rate_, data_bytes);
+    }
+    failed_ = (std::fclose(file_) != 0) || failed_;
+    file_ = nullptr;
+    if (failed_) {
+        if (error) *error = "Failed to write wav data";
+        return false;
+    }
+    if (error) error->clear();
+    return true;
+}
+
+std::unique_ptr<AudioSink> CreateAudioSink(AudioFormat fmt, ByteOutput out, int sample_rate, std::string* error) {
+    if (!out || sample_rate <= 0) {
+        if (error) *error = "audio sink needs an output and a positive sample rate";
+        return nullptr;
+    }
+    if (error) error->clear();
+    switch (fmt) {
+        case AudioFormat::PcmS16: return std::make_unique<RawPcmSink>(std::move(out), sample_rate, false);
+        case AudioFormat::PcmF32: return std::make_unique<RawPcmSink>(std::move(out), sample_rate, true);
+        case AudioFormat::MuLaw: return std::make_unique<G711Sink>(std::move(out), sample_rate, false);
+        case AudioFormat::ALaw: return std::make_unique<G711Sink>(std::move(out), sample_rate, true);
+        case AudioFormat::Flac: return std::make_unique<FlacSink>(std::move(out), sample_rate);
+        case AudioFormat::Wav: break;
+    }
+    if (error) *error = "wav output needs a seekable file, use OpenAudioSink";
+    return nullptr;
+}
+
+std::unique_ptr<AudioSink> OpenAudioSink(AudioFormat fmt, const std::string& path, int sample_rate, std::string* error) {
+    if (fmt == AudioFormat::Wav) {
+        auto wav = std::make_unique<WavStreamWriter>();
+        if (!wav->Open(path, sample_rate, error)) return nullptr;
+        return wav;
+    }
+    std::FILE* f = std::fopen(path.c_str(), "wb");
+    if (!f) {
+        if (error) *error = "Failed to open output audio: " + path;
+        return nullptr;
+    }
+    auto inner = CreateAudioSink(fmt, [f](const uint8_t* data, size_t size) {
+        return std::fwrite(data, 1, size, f) == size;
+    }, sample_rate, error);
+    if (!inner) {
+        std::fclose(f);
+        return nullptr;
+    }
+    return std::make_unique<FileAudioSink>(f, std::move(inner));
+}
+
+}  // namespace QWEN3TTSUTILS
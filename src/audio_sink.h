@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace QWEN3TTSUTILS {
+
+// Clamps to [-1, 1] and converts to int16 (truncating, like WriteWavPcm16), SIMD where available.
+void FloatToPcm16(const float* in, int16_t* out, size_t n);
+
+// Output encodings understood by OpenAudioSink / CreateAudioSink.
+enum class AudioFormat {
+  Wav,     // 16-bit PCM RIFF/WAVE, needs a seekable file
+  PcmS16,  // headerless signed 16-bit little-endian
+  PcmF32,  // headerless 32-bit float little-endian
+  MuLaw,   // G.711 mu-law, resampled to 8 kHz
+  ALaw,    // G.711 A-law, resampled to 8 kHz
+  Flac,    // 16-bit FLAC stream (fixed predictors, Rice residuals)
+};
+
+// Accepts: wav, s16le, f32le, mulaw, alaw, flac.
+bool ParseAudioFormat(const std::string& s, AudioFormat* out);
+const char* AudioFormatName(AudioFormat fmt);
+
+// Destination for encoded bytes (file, socket, memory). Returning false aborts the sink.
+using ByteOutput = std::function<bool(const uint8_t* data, size_t size)>;
+
+// Incremental mono audio encoder. Write() takes float samples at the rate the sink
+// was created with; Close() flushes buffered state and finalizes the stream.
+class AudioSink {
+ public:
+  virtual ~AudioSink() = default;
+  virtual bool Write(const float* samples, size_t n) = 0;
+  virtual bool Close(std::string* error) = 0;
+  virtual int outputSampleRate() const = 0;
+  virtual uint64_t bytesWritten() const = 0;
+};
+
+// Streaming sink for any format except Wav, which needs to seek back to patch its header.
+std::unique_ptr<AudioSink> CreateAudioSink(AudioFormat fmt, ByteOutput out, int sample_rate, std::string* error);
+// Sink writing to `path`; the file is closed together with the sink.
+std::unique_ptr<AudioSink> OpenAudioSink(AudioFormat fmt, const std::string& path, int sample_rate, std::string* error);
+
+// Streaming rational-ratio resampler (in_rate * L / M) with a Kaiser-windowed sinc
+// prototype split into L polyphase branches; only the kept outputs are computed.
+class PolyphaseResampler {
+ public:
+  // zero_crossings: sinc lobes per side at the lower of the two rates.
+  // rolloff: cutoff as a fraction of the lower Nyquist frequency.
+  PolyphaseResampler(int in_rate, int out_rate, int zero_crossings = 24, double rolloff = 0.92);
+
+  // Appends resampled output for `n` new input samples to `out`.
+  void Process(const float* in, size_t n, std::vector<float>* out);
+  // Drains the filter delay line; call once at end of stream.
+  void Flush(std::vector<float>* out);
+
+  int upFactor() const { return up_; }
+  int downFactor() const { return down_; }
+  size_t tapsPerPhase() const { return taps_per_phase_; }
+
+ private:
+  int up_ = 1;
+  int down_ = 1;
+  size_t taps_per_phase_ = 0;
+  std::vector<float> phases_;   // [up_][taps_per_phase_], taps stored oldest-sample first
+  std::vector<float> history_;  // input samples still referenced by future outputs
+  int64_t history_start_ = 0;   // absolute input index of history_[0]
+  int64_t next_pos_ = 0;        // next output position on the upsampled grid
+  int64_t input_count_ = 0;
+  int64_t output_count_ = 0;
+};
+
+uint8_t LinearToMuLaw(int16_t pcm);
+uint8_t LinearToALaw(int16_t pcm);
+
+// Streaming 16-bit mono WAV writer. Writes a placeholder RIFF header on Open(),
+// converts and appends blocks as they arrive, and patches the sizes on Close().
+// The end-click fade and silence pad of WriteWavPcm16 are applied to the tail
+// only, so output is identical to WriteWavPcm16 on the concatenated samples.
+class WavStreamWriter : public AudioSink {
+ public:
+  WavStreamWriter() = default;
+  ~WavStreamWriter() override;
+  WavStreamWriter(const WavStreamWriter&) = delete;
+  WavStreamWriter& operator=(const WavStreamWriter&) = delete;
+
+  bool Open(const std::string& path, int sample_rate, std::string* error);
+  bool Write(const float* samples, size_t n) override;
+  bool Close(std::string* error) override;
+  int outputSampleRate() const override { return sample_rate_; }
+  uint64_t bytesWritten() const override { return 44 + samples_written_ * sizeof(int16_t); }
+
+  bool isOpen() const { return file_ != nullptr; }
+  uint64_t samplesWritten() const { return samples_written_; }
+
+ private:
+  bool WritePcm(const float* samples, size_t n);
+
+ private:
+  std::FILE* file_ = nullptr;
+  int sample_rate_ = 0;
+  size_t holdback_ = 0;           // longest possible fade window, kept back until Close()
+  std::vector<float> tail_;       // last `holdback_` samples not yet written
+  std::vector<int16_t> pcm_;      // conversion scratch, bounded by block size
+  uint64_t samples_written_ = 0;
+  bool failed_ = false;
+};
+
+}  // namespace QWEN3TTSUTILS
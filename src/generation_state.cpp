@@ -0,0 +1,369 @@
+#include "generation_state.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace QWEN3TTS {
+
+namespace {
+
+constexpr uint32_t kStateMagic = 0x53473351;  // "Q3GS"
+constexpr uint32_t kStateVersion = 5;
+
+class Writer {
+public:
+    explicit Writer(std::vector<uint8_t>* out) : _out(out) {}
+
+    template <typename T>
+    void pod(const T& v)
+    {
+        const auto* p = reinterpret_cast<const uint8_t*>(&v);
+        _out->insert(_out->end(), p, p + sizeof(T));
+    }
+    template <typename T>
+    void vec(const std::vector<T>& v)
+    {
+        pod(static_cast<uint64_t>(v.size()));
+        const auto* p = reinterpret_cast<const uint8_t*>(v.data());
+        _out->insert(_out->end(), p, p + v.size() * sizeof(T));
+    }
+    void str(const std::string& s)
+    {
+        pod(static_cast<uint64_t>(s.size()));
+        _out->insert(_out->end(), s.begin(), s.end());
+    }
+
+private:
+    std::vector<uint8_t>* _out;
+};
+
+class Reader {
+public:
+    Reader(const uint8_t* data, size_t size) : _data(data), _size(size) {}
+
+    template <typename T>
+    bool pod(T* v)
+    {
+        if (_size - _pos < sizeof(T)) return false;
+        std::memcpy(v, _data + _pos, sizeof(T));
+        _pos += sizeof(T);
+        return true;
+    }
+    template <typename T>
+    bool vec(std::vector<T>* v)
+    {
+        uint64_t n = 0;
+        if (!pod(&n) || n > (_size - _pos) / sizeof(T)) return false;
+        v->resize(static_cast<size_t>(n));
+        std::memcpy(v->data(), _data + _pos, static_cast<size_t>(n) * sizeof(T));
+        _pos += static_cast<size_t>(n) * sizeof(T);
+        return true;
+    }
+    bool str(std::string* s)
+    {
+        uint64_t n = 0;
+        if (!pod(&n) || n > _size - _pos) return false;
+        s->assign(reinterpret_cast<const char*>(_data + _pos), static_cast<size_t>(n));
+        _pos += static_cast<size_t>(n);
+        return true;
+    }
+    bool done() const { return _pos == _size; }
+
+private:
+    const uint8_t* _data;
+    size_t _size;
+    size_t _pos = 0;
+};
+
+size_t ElementSize(int32_t elem_type)
+{
+    switch (static_cast<ONNXTensorElementDataType>(elem_type)) {
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT: return 4;
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16: return 2;
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_BFLOAT16: return 2;
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_DOUBLE: return 8;
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64: return 8;
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT32: return 4;
+        default: return 0;
+    }
+}
+
+void WriteParams(Writer& w, const GenerationParams& p)
+{
+    w.pod(p.request_id);
+    w.str(p.text);
+    w.str(p.instruct);
+    w.vec(p.codec_lang);
+    w.vec(p.cp_fill_codes);
+    w.str(p.wav_out);
+    w.str(p.codes_out);
+    const int32_t ints[] = {p.steps, p.max_steps, p.auto_stop_first_code_run, p.auto_stop_min_steps,
+                            p.tail_stop_repeat_frames, p.tail_stop_min_steps, p.trim_tail_repeat_min,
+                            p.trim_tail_keep, p.eos_min_steps, p.top_k, p.vocoder_window_frames,
+                            p.vocoder_left_context_frames, p.vocoder_right_context_frames,
+                            p.silence_stop_frames, p.silence_stop_min_steps, p.silence_probe_frames,
+                            p.silence_probe_context_frames, p.silence_keep_frames, p.cp_groups};
+    for (int32_t v : ints) w.pod(v);
+    w.pod(static_cast<uint8_t>(p.do_sample ? 1 : 0));
+    w.pod(p.temperature);
+    w.pod(p.silence_rms_db);
+    w.pod(p.silence_flatness);
+    w.pod(p.seed);
+}
+
+bool ReadParams(Reader& r, GenerationParams* p)
+{
+    bool ok = r.pod(&p->request_id) && r.str(&p->text) && r.str(&p->instruct) && r.vec(&p->codec_lang) && r.vec(&p->cp_fill_codes) && r.str(&p->wav_out) && r.str(&p->codes_out);
+    int* ints[] = {&p->steps, &p->max_steps, &p->auto_stop_first_code_run, &p->auto_stop_min_steps,
+                   &p->tail_stop_repeat_frames, &p->tail_stop_min_steps, &p->trim_tail_repeat_min,
+                   &p->trim_tail_keep, &p->eos_min_steps, &p->top_k, &p->vocoder_window_frames,
+                   &p->vocoder_left_context_frames, &p->vocoder_right_context_frames,
+                   &p->silence_stop_frames, &p->silence_stop_min_steps, &p->silence_probe_frames,
+                   &p->silence_probe_context_frames, &p->silence_keep_frames, &p->cp_groups};
+    for (int* dst : ints) {
+        int32_t v = 0;
+        ok = ok && r.pod(&v);
+        *dst = v;
+    }
+    uint8_t do_sample = 0;
+    ok = ok && r.pod(&do_sample) && r.pod(&p->temperature) && r.pod(&p->silence_rms_db) &&
+         r.pod(&p->silence_flatness) && r.pod(&p->seed);
+    p->do_sample = do_sample != 0;
+    return ok;
+}
+
+// Element count of `shape`, or -1 when a dimension is negative or the count exceeds `limit`.
+int64_t ShapeElements(const std::vector<int64_t>& shape, uint64_t limit)
+{
+    uint64_t n = 1;
+    for (int64_t d : shape) {
+        if (d < 0) return -1;
+        if (d > 0 && n > limit / static_cast<uint64_t>(d)) return -1;
+        n *= static_cast<uint64_t>(d);
+    }
+    return n > limit ? -1 : static_cast<int64_t>(n);
+}
+
+}  // namespace
+
+void GenerationState::reset()
+{
+    *this = GenerationState();
+}
+
+int GenerationState::framesGenerated() const
+{
+    const size_t groups = static_cast<size_t>(std::max<int64_t>(1, _dims.code_groups));
+    return static_cast<int>(_all_codes.size() / groups);
+}
+
+int64_t GenerationState::kvCacheBytes() const
+{
+    int64_t total = 0;
+    for (const Ort::Value* v : {&_past_k, &_past_v}) {
+        if (!*v) continue;
+        const auto info = v->GetTensorTypeAndShapeInfo();
+        total += static_cast<int64_t>(info.GetElementCount() * ElementSize(info.GetElementType()));
+    }
+    total += static_cast<int64_t>(_past_k_host.bytes.size() + _past_v_host.bytes.size());
+    return total;
+}
+
+bool GenerationState::CopyToHost(const Ort::Value& value, HostTensor* out)
+{
+    out->shape.clear();
+    out->bytes.clear();
+    out->elem_type = 0;
+    if (!value) return true;
+    const auto info = value.GetTensorTypeAndShapeInfo();
+    out->elem_type = static_cast<int32_t>(info.GetElementType());
+    out->shape = info.GetShape();
+    const size_t elem = ElementSize(out->elem_type);
+    if (elem == 0) return false;
+    const size_t bytes = info.GetElementCount() * elem;
+    const auto* p = static_cast<const uint8_t*>(value.GetTensorRawData());
+    out->bytes.assign(p, p + bytes);
+    return true;
+}
+
+bool GenerationState::serialize(std::vector<uint8_t>* out, std::string* error) const
+{
+    if (!out) return false;
+    if (!_started) {
+        if (error) *error = "generation state is empty";
+        return false;
+    }
+    if (prefilling()) {
+        if (error) *error = "prompt prefill is not finished";
+        return false;
+    }
+    HostTensor k = _past_k_host;
+    HostTensor v = _past_v_host;
+    if (_past_k && (!CopyToHost(_past_k, &k) || !CopyToHost(_past_v, &v))) {
+        if (error) *error = "unsupported KV cache element type";
+        return false;
+    }
+
+    out->clear();
+    Writer w(out);
+    w.pod(kStateMagic);
+    w.pod(kStateVersion);
+    WriteParams(w, _params);
+    const int64_t dims[] = {_dims.hidden, _dims.talker_vocab, _dims.cp_vocab, _dims.code_groups, _dims.codec_eos_id,
+                            static_cast<int64_t>(_dims.sample_rate)};
+    for (int64_t d : dims) w.pod(d);
+    w.pod(static_cast<uint8_t>(_use_kv_cache ? 1 : 0));
+    w.pod(static_cast<uint8_t>(_finished ? 1 : 0));
+    w.pod(_seed);
+    w.pod(static_cast<int32_t>(_steps));
+    w.pod(static_cast<int32_t>(_expected_frames));
+    w.pod(static_cast<int32_t>(_next_step));
+    w.pod(_prefill_len);
+    w.vec(_prefill_shape);
+    w.vec(_prefill_embeds);
+    w.vec(_trailing_step);
+    w.vec(_past_hidden);
+    w.pod(_current_first_code);
+    w.pod(_prev_generated_first_code);
+    w.pod(static_cast<int32_t>(_same_first_code_run));
+    w.pod(static_cast<int32_t>(_same_frame_run));
+    w.vec(_prev_frame);
+    w.vec(_all_codes);
+    w.pod(static_cast<int32_t>(_stop_reason));
+    w.pod(static_cast<int32_t>(_silence.trailingSilentFrames()));
+    w.pod(static_cast<int32_t>(_probed_frames));
+    w.pod(static_cast<int32_t>(_silence_trimmed));
+    w.pod(static_cast<int32_t>(_silence_probes));
+    w.pod(_silence_probe_ms);
+    for (const HostTensor* t : {&k, &v}) {
+        w.pod(t->elem_type);
+        w.vec(t->shape);
+        w.vec(t->bytes);
+    }
+    if (error) error->clear();
+    return true;
+}
+
+bool GenerationState::deserialize(const uint8_t* data, size_t size, std::string* error)
+{
+    auto fail = [&](const char* msg) {
+        if (error) *error = msg;
+        reset();
+        return false;
+    };
+    reset();
+    Reader r(data, size);
+    uint32_t magic = 0;
+    uint32_t version = 0;
+    if (!r.pod(&magic) || magic != kStateMagic) return fail("not a generation state snapshot");
+    if (!r.pod(&version) || version != kStateVersion) return fail("unsupported generation state version");
+    if (!ReadParams(r, &_params)) return fail("truncated generation state (params)");
+    int64_t sample_rate = 0;
+    uint8_t use_kv = 0;
+    uint8_t finished = 0;
+    int32_t steps = 0;
+    int32_t expected = 0;
+    int32_t next_step = 0;
+    int32_t same_first = 0;
+    int32_t same_frame = 0;
+    int32_t stop_reason = 0;
+    int32_t trailing_silent = 0;
+    int32_t probed = 0;
+    int32_t trimmed = 0;
+    int32_t probes = 0;
+    bool ok = r.pod(&_dims.hidden) && r.pod(&_dims.talker_vocab) && r.pod(&_dims.cp_vocab) && r.pod(&_dims.code_groups) &&
+              r.pod(&_dims.codec_eos_id) && r.pod(&sample_rate) && r.pod(&use_kv) && r.pod(&finished) && r.pod(&_seed) &&
+              r.pod(&steps) && r.pod(&expected) && r.pod(&next_step) && r.pod(&_prefill_len) && r.vec(&_prefill_shape) &&
+              r.vec(&_prefill_embeds) && r.vec(&_trailing_step) && r.vec(&_past_hidden) && r.pod(&_current_first_code) &&
+              r.pod(&_prev_generated_first_code) && r.pod(&same_first) && r.pod(&same_frame) && r.vec(&_prev_frame) &&
+              r.vec(&_all_codes) && r.pod(&stop_reason) && r.pod(&trailing_silent) && r.pod(&probed) &&
+              r.pod(&trimmed) && r.pod(&probes) && r.pod(&_silence_probe_ms);
+    for (HostTensor* t : {&_past_k_host, &_past_v_host}) {
+        ok = ok && r.pod(&t->elem_type) && r.vec(&t->shape) && r.vec(&t->bytes);
+    }
+    if (!ok || !r.done()) return fail("truncated or corrupt generation state");
+    _dims.sample_rate = static_cast<int>(sample_rate);
+    _use_kv_cache = use_kv != 0;
+    _finished = finished != 0;
+    _steps = steps;
+    _expected_frames = expected;
+    _next_step = next_step;
+    _same_first_code_run = same_first;
+    _same_frame_run = same_frame;
+    _stop_reason = static_cast<StopReason>(stop_reason);
+    _silence.configure(_params);
+    _silence.setTrailingSilentFrames(trailing_silent);
+    _probed_frames = probed;
+    _silence_trimmed = trimmed;
+    _silence_probes = probes;
+    _prefill_done = _prefill_len;
+    _started = true;
+    if (_dims.code_groups < 2 || _past_hidden.size() != static_cast<size_t>(_dims.hidden) ||
+        _trailing_step.size() != static_cast<size_t>(_dims.hidden) ||
+        _all_codes.size() % static_cast<size_t>(_dims.code_groups) != 0 ||
+        _params.cp_fill_codes.size() != static_cast<size_t>(_dims.code_groups - 1) || _next_step < 0 || _next_step > _steps ||
+        stop_reason < 0 || stop_reason > static_cast<int32_t>(StopReason::Silence)) {
+        return fail("inconsistent generation state");
+    }
+    // Resuming indexes the code history by _next_step; only a silence stop drops frames after it.
+    const int dropped = _stop_reason == StopReason::Silence ? _silence_trimmed : 0;
+    if (_dims.hidden <= 0 || _dims.talker_vocab <= 0 || _dims.cp_vocab <= 0 || dropped < 0 ||
+        framesGenerated() + dropped != _next_step || (!_finished && dropped != 0) ||
+        _prev_frame.size() != static_cast<size_t>(_dims.code_groups) || _current_first_code < 0 ||
+        _current_first_code >= _dims.talker_vocab) {
+        return fail("inconsistent generation state (frame history)");
+    }
+    const size_t groups = static_cast<size_t>(_dims.code_groups);
+    for (size_t i = 0; i < _all_codes.size(); ++i) {
+        const int64_t vocab = i % groups == 0 ? _dims.talker_vocab : _dims.cp_vocab;
+        if (_all_codes[i] < 0 || _all_codes[i] >= vocab) return fail("generation state holds out-of-range codes");
+    }
+    if (!_use_kv_cache && ShapeElements(_prefill_shape, _prefill_embeds.size()) != static_cast<int64_t>(_prefill_embeds.size())) {
+        return fail("generation state prompt does not match its shape");
+    }
+    for (const HostTensor* t : {&_past_k_host, &_past_v_host}) {
+        if (t->elem_type == 0 && t->shape.empty() && t->bytes.empty()) continue;
+        const size_t elem = ElementSize(t->elem_type);
+        const int64_t count = elem == 0 ? -1 : ShapeElements(t->shape, t->bytes.size() / elem);
+        if (count < 0 || static_cast<size_t>(count) * elem != t->bytes.size()) {
+            return fail("generation state KV cache does not match its shape");
+        }
+    }
+    if (_use_kv_cache && !_finished && (_past_k_host.bytes.empty() || _past_v_host.bytes.empty())) {
+        return fail("generation state has no KV cache");
+    }
+    if (error) error->clear();
+    return true;
+}
+
+bool GenerationState::saveToFile(const std::string& path, std::string* error) const
+{
+    std::vector<uint8_t> bytes;
+    if (!serialize(&bytes, error)) return false;
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        if (error) *error = "Failed to open state file: " + path;
+        return false;
+    }
+    out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    if (!out.good()) {
+        if (error) *error = "Failed to write state file: " + path;
+        return false;
+    }
+    return true;
+}
+
+bool GenerationState::loadFromFile(const std::string& path, std::string* error)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        if (error) *error = "Failed to open state file: " + path;
+        return false;
+    }
+    const std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    return deserialize(bytes.data(), bytes.size(), error);
+}
+
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "voice.h"
+#include "stop_policy.h"
+#include "utils.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace QWEN3TTS {
+
+  // Everything the decode loop carries between frames: talker KV cache, last hidden
+  // state, generated codes, stop-heuristic counters and the sampling seed. Produced by
+  // Voice::beginGeneration, advanced by Voice::stepGeneration and consumed by
+  // Voice::finishGeneration. It can be serialized between steps and resumed on any
+  // Voice loaded with a model of the same dimensions; sampling is keyed by
+  // (seed, frame, group), so a resumed run produces the same codes as an uninterrupted one.
+  class GenerationState {
+  public:
+      GenerationState() = default;
+      GenerationState(GenerationState&&) = default;
+      GenerationState& operator=(GenerationState&&) = default;
+      GenerationState(const GenerationState&) = delete;
+      GenerationState& operator=(const GenerationState&) = delete;
+
+      void reset();
+
+      bool started() const { return _started; }
+      bool finished() const { return _finished; }
+      // True until Voice::prefillGeneration has pushed the whole prompt into the KV cache.
+      bool prefilling() const { return _started && _prefill_done < _prefill_len; }
+      int framesGenerated() const;
+      int frameBudget() const { return _steps; }
+      const std::vector<int64_t>& codes() const { return _all_codes; }
+      StopReason stopReason() const { return _stop_reason; }
+      // Bytes of the talker KV cache currently held (live tensors or host copies).
+      int64_t kvCacheBytes() const;
+
+      // Request parameters; on_audio is not serialized and can be re-attached after a restore.
+      GenerationParams& params() { return _params; }
+      const GenerationParams& params() const { return _params; }
+
+      // Host snapshot. Live KV tensors are copied out; the state stays usable afterwards.
+      bool serialize(std::vector<uint8_t>* out, std::string* error) const;
+      bool deserialize(const uint8_t* data, size_t size, std::string* error);
+      bool saveToFile(const std::string& path, std::string* error) const;
+      bool loadFromFile(const std::string& path, std::string* error);
+
+  private:
+      friend class Voice;
+
+      struct HostTensor {
+          int32_t                 elem_type = 0;
+          std::vector<int64_t>    shape;
+          std::vector<uint8_t>    bytes;
+      };
+
+      static bool CopyToHost(const Ort::Value& value, HostTensor* out);
+
+      GenerationParams        _params;
+      ModelDims               _dims;
+      bool                    _use_kv_cache = false;
+      bool                    _started = false;
+      bool                    _finished = false;
+      uint64_t                _seed = 0;
+      int                     _steps = 0;           // frame budget
+      int                     _expected_frames = 0; // StepPredictor estimate
+      int                     _next_step = 0;       // index of the next frame to generate
+      int64_t                 _prefill_len = 0;
+      int64_t                 _prefill_done = 0;    // prompt tokens already in the KV cache
+      int                     _prefill_chunk = 0;   // tokens per prefillGeneration call, 0 = rest of the prompt
+      std::vector<int64_t>    _prefill_shape;
+      std::vector<float>      _prefill_embeds;      // pending prompt; kept only for the no-KV-cache talker
+      std::vector<float>      _trailing_step;
+      std::vector<float>      _past_hidden;
+      int64_t                 _current_first_code = 0;
+      int64_t                 _prev_generated_first_code = 0;
+      int                     _same_first_code_run = 0;
+      int                     _same_frame_run = 0;
+      std::vector<int64_t>    _prev_frame;
+      std::vector<int64_t>    _all_codes;
+      StopReason              _stop_reason = StopReason::None;
+
+      // Trailing-silence policy: frames already scored and probe accounting.
+      SilenceStopPolicy       _silence;
+      int                     _probed_frames = 0;
+      int                     _silence_trimmed = 0;
+      int                     _silence_probes = 0;
+      double                  _silence_probe_ms = 0.0;
+
+      // Streaming on_audio: windows already delivered by stepGeneration. Not part of the
+      // snapshot, so a restored run streams again from its first frame.
+      std::unique_ptr<QWEN3TTSUTILS::VocoderWindowStream> _audio_stream;
+      size_t                  _streamed_samples = 0;
+      double                  _stream_vocoder_ms = 0.0;
+
+      // KV cache: live ORT outputs while running, host copies after deserialize().
+      Ort::Value              _past_k{nullptr};
+      Ort::Value              _past_v{nullptr};
+      HostTensor              _past_k_host;
+      HostTensor              _past_v_host;
+
+      // Stage timings of this process; not part of the snapshot.
+      double                  _prefill_ms = 0.0;
+      double                  _talker_ms = 0.0;
+      double                  _cp_ms = 0.0;
+
+      // Scratch buffers backing per-run input tensors; not part of the snapshot.
+      std::vector<int64_t>    _allow_eos_vec = std::vector<int64_t>(1, 0);
+      std::vector<float>      _temperature_vec = std::vector<float>(1, 1.0f);
+  };
+
+}
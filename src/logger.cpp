@@ -0,0 +1,279 @@
+#include "logger.h"
+
+#include <pthread.h>
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace QWEN3TTS {
+
+namespace {
+
+uint32_t ThisThreadId()
+{
+    static std::atomic<uint32_t> next{1};
+    thread_local const uint32_t id = next.fetch_add(1, std::memory_order_relaxed);
+    return id;
+}
+
+int64_t UnixMicros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+}  // namespace
+
+const char* LogLevelName(LogLevel level)
+{
+    switch (level) {
+        case LogLevel::Debug: return "debug";
+        case LogLevel::Info: return "info";
+        case LogLevel::Warn: return "warn";
+        case LogLevel::Error: return "error";
+        case LogLevel::Off: return "off";
+    }
+    return "unknown";
+}
+
+bool ParseLogLevel(const std::string& s, LogLevel* out)
+{
+    for (LogLevel level : {LogLevel::Debug, LogLevel::Info, LogLevel::Warn, LogLevel::Error, LogLevel::Off}) {
+        if (s == LogLevelName(level)) {
+            *out = level;
+            return true;
+        }
+    }
+    return false;
+}
+
+void StreamLogSink::write(const LogRecord& record)
+{
+    FILE* out = record.level >= LogLevel::Warn ? stderr : stdout;
+    if (_prefix) {
+        std::fprintf(out, "%lld.%03lld %s t%u ", static_cast<long long>(record.unix_us / 1000000),
+                     static_cast<long long>(record.unix_us / 1000 % 1000), LogLevelName(record.level), record.thread_id);
+    }
+    std::fwrite(record.text, 1, record.len, out);
+    std::fputc('\n', out);
+}
+
+void StreamLogSink::flush()
+{
+    std::fflush(stdout);
+    std::fflush(stderr);
+}
+
+Logger& Logger::instance()
+{
+    // Never destroyed: objects torn down after main() may still log; atexit drains the ring.
+    static Logger* logger = new Logger();
+    return *logger;
+}
+
+Logger::Logger() : _sink(std::make_shared<StreamLogSink>())
+{
+    ::pthread_atfork(&Logger::AtForkPrepare, &Logger::AtForkParent, &Logger::AtForkChild);
+    std::atexit([] { Logger::instance().shutdown(); });
+}
+
+void Logger::setLevel(LogLevel level)
+{
+    _level.store(static_cast<int>(level), std::memory_order_relaxed);
+}
+
+LogLevel Logger::level() const
+{
+    return static_cast<LogLevel>(_level.load(std::memory_order_relaxed));
+}
+
+void Logger::setSink(std::shared_ptr<LogSink> sink)
+{
+    std::lock_guard<std::mutex> lock(_consume_mutex);
+    drainLocked();
+    _sink->flush();
+    _sink = sink ? std::move(sink) : std::make_shared<NullLogSink>();
+}
+
+void Logger::submit(const LogRecord& record)
+{
+    if (_stopped.load(std::memory_order_acquire)) {
+        // After shutdown there is no worker; late records are written inline.
+        std::lock_guard<std::mutex> lock(_consume_mutex);
+        _sink->write(record);
+        _sink->flush();
+        return;
+    }
+    if (!_started.load(std::memory_order_acquire)) startWorker();
+    if (!_ring.tryPush(record)) _dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Logger::flush()
+{
+    std::lock_guard<std::mutex> lock(_consume_mutex);
+    drainLocked();
+    _sink->flush();
+}
+
+void Logger::startWorker()
+{
+    std::lock_guard<std::mutex> lock(_start_mutex);
+    if (_started.load(std::memory_order_relaxed)) return;
+    _worker = new std::thread(&Logger::workerLoop, this);
+    _started.store(true, std::memory_order_release);
+}
+
+void Logger::workerLoop()
+{
+    constexpr auto kIdlePoll = std::chrono::milliseconds(2);
+    while (!_stopped.load(std::memory_order_acquire)) {
+        size_t written = 0;
+        {
+            std::lock_guard<std::mutex> lock(_consume_mutex);
+            written = drainLocked();
+            if (written > 0) _sink->flush();
+        }
+        if (written == 0) {
+            // Producers never signal; the worker polls so submit() stays lock-free.
+            std::unique_lock<std::mutex> lock(_wake_mutex);
+            _wake_cv.wait_for(lock, kIdlePoll, [&] { return _stopped.load(std::memory_order_acquire); });
+        }
+    }
+}
+
+size_t Logger::drainLocked()
+{
+    size_t n = 0;
+    LogRecord record;
+    while (_ring.tryPop(&record)) {
+        _sink->write(record);
+        ++n;
+    }
+    return n;
+}
+
+void Logger::shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(_wake_mutex);
+        _stopped.store(true, std::memory_order_release);
+    }
+    _wake_cv.notify_all();
+    std::thread* worker = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(_start_mutex);
+        worker = _worker;
+        _worker = nullptr;
+    }
+    if (worker && worker->joinable()) worker->join();
+    delete worker;
+    flush();
+}
+
+// The worker thread does not survive fork(). Hold the logger's locks across the fork so the
+// child never inherits one held mid-drain or mid-wait, then let the child start a fresh
+// worker on demand.
+void Logger::AtForkPrepare()
+{
+    Logger& l = instance();
+    l._start_mutex.lock();
+    l._consume_mutex.lock();
+    l._wake_mutex.lock();
+    // Written once here so the child does not repeat the parent's pending records.
+    l.drainLocked();
+    l._sink->flush();
+}
+
+void Logger::AtForkParent()
+{
+    Logger& l = instance();
+    l._wake_mutex.unlock();
+    l._consume_mutex.unlock();
+    l._start_mutex.unlock();
+}
+
+void Logger::AtForkChild()
+{
+    Logger& l = instance();
+    l._worker = nullptr;  // the parent's thread object; not ours to join
+    l._started.store(false, std::memory_order_relaxed);
+    l._wake_mutex.unlock();
+    l._consume_mutex.unlock();
+    l._start_mutex.unlock();
+}
+
+LogLine::LogLine(LogLevel level, const char* tag)
+{
+    _record.level = level;
+    _record.thread_id = ThisThreadId();
+    _record.unix_us = UnixMicros();
+    append("[", 1);
+    append(tag, std::strlen(tag));
+    append("] ", 2);
+}
+
+LogLine::~LogLine()
+{
+    Logger::instance().submit(_record);
+}
+
+void LogLine::append(const char* s, size_t n)
+{
+    const size_t room = LogRecord::kMaxText - _record.len;
+    n = std::min(n, room);
+    std::memcpy(_record.text + _record.len, s, n);
+    _record.len = static_cast<uint16_t>(_record.len + n);
+}
+
+LogLine& LogLine::operator<<(const char* s)
+{
+    append(s, std::strlen(s));
+    return *this;
+}
+
+LogLine& LogLine::operator<<(const std::string& s)
+{
+    append(s.data(), s.size());
+    return *this;
+}
+
+LogLine& LogLine::operator<<(char c)
+{
+    append(&c, 1);
+    return *this;
+}
+
+LogLine& LogLine::operator<<(bool v)
+{
+    return *this << (v ? "true" : "false");
+}
+
+LogLine& LogLine::operator<<(double v)
+{
+    char buf[32];
+    const int n = std::snprintf(buf, sizeof(buf), "%.6g", v);
+    append(buf, n > 0 ? static_cast<size_t>(n) : 0);
+    return *this;
+}
+
+LogLine& LogLine::appendInt(int64_t v)
+{
+    char buf[24];
+    const auto res = std::to_chars(buf, buf + sizeof(buf), v);
+    append(buf, static_cast<size_t>(res.ptr - buf));
+    return *this;
+}
+
+LogLine& LogLine::appendUint(uint64_t v)
+{
+    char buf[24];
+    const auto res = std::to_chars(buf, buf + sizeof(buf), v);
+    append(buf, static_cast<size_t>(res.ptr - buf));
+    return *this;
+}
+
+}
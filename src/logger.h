@@ -0,0 +1,178 @@
+#pragma once
+
+#include "mpmc_queue.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+// -DQWEN3TTS_NULL_LOG compiles every QWEN3TTS_LOG call site away; otherwise records below
+// QWEN3TTS_LOG_MIN_LEVEL (0 = debug .. 4 = off) are dropped at compile time.
+#if defined(QWEN3TTS_NULL_LOG)
+#undef QWEN3TTS_LOG_MIN_LEVEL
+#define QWEN3TTS_LOG_MIN_LEVEL 4
+#elif !defined(QWEN3TTS_LOG_MIN_LEVEL)
+#define QWEN3TTS_LOG_MIN_LEVEL 0
+#endif
+
+namespace QWEN3TTS {
+
+  enum class LogLevel : int {
+    Debug = 0,
+    Info = 1,
+    Warn = 2,
+    Error = 3,
+    Off = 4,
+  };
+
+  const char* LogLevelName(LogLevel level);
+  bool ParseLogLevel(const std::string& s, LogLevel* out);
+
+  // One formatted line: "[tag] message key=value ...", truncated to kMaxText bytes.
+  struct LogRecord {
+    static constexpr size_t kMaxText = 240;
+    LogLevel                level = LogLevel::Info;
+    uint32_t                thread_id = 0;
+    int64_t                 unix_us = 0;
+    uint16_t                len = 0;
+    char                    text[kMaxText];
+  };
+
+  // Receives records on the logger thread only, so sinks need no locking of their own.
+  class LogSink {
+  public:
+      virtual ~LogSink() = default;
+      virtual void write(const LogRecord& record) = 0;
+      virtual void flush() {}
+  };
+
+  // Debug/Info to stdout, Warn/Error to stderr; optional "<unix_ms> <LEVEL> t<thread>" prefix.
+  class StreamLogSink : public LogSink {
+  public:
+      explicit StreamLogSink(bool prefix = false) : _prefix(prefix) {}
+      void write(const LogRecord& record) override;
+      void flush() override;
+
+  private:
+      bool _prefix;
+  };
+
+  class NullLogSink : public LogSink {
+  public:
+      void write(const LogRecord&) override {}
+  };
+
+  // Process-wide asynchronous logger. Producers format into a fixed-size record and push it
+  // to a lock-free ring; a background thread drains the ring into the sink. A full ring
+  // drops the record and counts it instead of blocking the caller.
+  class Logger {
+  public:
+      static Logger& instance();
+
+      void setLevel(LogLevel level);
+      LogLevel level() const;
+      bool enabled(LogLevel level) const
+      {
+          return static_cast<int>(level) >= _level.load(std::memory_order_relaxed);
+      }
+      // nullptr installs a NullLogSink.
+      void setSink(std::shared_ptr<LogSink> sink);
+
+      void submit(const LogRecord& record);
+      // Writes everything submitted so far; call before fork() or _exit().
+      void flush();
+      uint64_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+  private:
+      Logger();
+      ~Logger() = default;
+
+      void startWorker();
+      void workerLoop();
+      size_t drainLocked();
+      void shutdown();
+      static void AtForkPrepare();
+      static void AtForkParent();
+      static void AtForkChild();
+
+      static constexpr size_t kRingCapacity = 4096;
+
+      MpmcQueue<LogRecord>    _ring{kRingCapacity};
+      std::atomic<int>        _level{static_cast<int>(LogLevel::Info)};
+      std::atomic<bool>       _started{false};
+      std::atomic<bool>       _stopped{false};
+      std::atomic<uint64_t>   _dropped{0};
+      std::shared_ptr<LogSink> _sink;
+      std::mutex              _consume_mutex;   // single consumer: worker, flush() or setSink()
+      std::mutex              _start_mutex;
+      std::mutex              _wake_mutex;
+      std::condition_variable _wake_cv;
+      std::thread*            _worker = nullptr;
+  };
+
+  // Structured field, appended as " key=value": QWEN3TTS_LOG_INFO("x") << "msg" << Kv("step", s);
+  template <typename T>
+  struct LogField {
+    const char*             key;
+    const T&                value;
+  };
+
+  template <typename T>
+  LogField<T> Kv(const char* key, const T& value)
+  {
+      return LogField<T>{key, value};
+  }
+
+  // Formats one record without allocating and submits it when destroyed.
+  class LogLine {
+  public:
+      LogLine(LogLevel level, const char* tag);
+      ~LogLine();
+      LogLine(const LogLine&) = delete;
+      LogLine& operator=(const LogLine&) = delete;
+
+      LogLine& operator<<(const char* s);
+      LogLine& operator<<(const std::string& s);
+      LogLine& operator<<(char c);
+      LogLine& operator<<(bool v);
+      LogLine& operator<<(double v);
+      LogLine& operator<<(float v) { return *this << static_cast<double>(v); }
+      template <typename T, typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+      LogLine& operator<<(T v)
+      {
+          if (std::is_signed<T>::value) return appendInt(static_cast<int64_t>(v));
+          return appendUint(static_cast<uint64_t>(v));
+      }
+
+      template <typename T>
+      LogLine& operator<<(const LogField<T>& f)
+      {
+          return *this << ' ' << f.key << '=' << f.value;
+      }
+
+  private:
+      void append(const char* s, size_t n);
+      LogLine& appendInt(int64_t v);
+      LogLine& appendUint(uint64_t v);
+
+      LogRecord _record;
+  };
+
+}
+
+// Statement form: QWEN3TTS_LOG_INFO("cp") << "using model " << path << ...;
+#define QWEN3TTS_LOG(level)                                                                    \
+    if (static_cast<int>(level) < QWEN3TTS_LOG_MIN_LEVEL ||                                    \
+        !::QWEN3TTS::Logger::instance().enabled(level)) {                                      \
+    } else                                                                                     \
+        ::QWEN3TTS::LogLine
+
+#define QWEN3TTS_LOG_DEBUG(tag) QWEN3TTS_LOG(::QWEN3TTS::LogLevel::Debug)(::QWEN3TTS::LogLevel::Debug, tag)
+#define QWEN3TTS_LOG_INFO(tag) QWEN3TTS_LOG(::QWEN3TTS::LogLevel::Info)(::QWEN3TTS::LogLevel::Info, tag)
+#define QWEN3TTS_LOG_WARN(tag) QWEN3TTS_LOG(::QWEN3TTS::LogLevel::Warn)(::QWEN3TTS::LogLevel::Warn, tag)
+#define QWEN3TTS_LOG_ERROR(tag) QWEN3TTS_LOG(::QWEN3TTS::LogLevel::Error)(::QWEN3TTS::LogLevel::Error, tag)
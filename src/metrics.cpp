@@ -0,0 +1,207 @@
+#include "metrics.h"
+#include "logger.h"
+#include "voice.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace QWEN3TTS {
+
+namespace {
+
+void WriteHelp(std::ostringstream& out, const char* name, const char* type, const char* help)
+{
+    out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+}
+
+void WriteCounter(std::ostringstream& out, const char* name, const char* help, uint64_t value)
+{
+    WriteHelp(out, name, "counter", help);
+    out << name << " " << value << "\n";
+}
+
+void WriteGauge(std::ostringstream& out, const char* name, const char* help, int64_t value)
+{
+    WriteHelp(out, name, "gauge", help);
+    out << name << " " << value << "\n";
+}
+
+void WriteHistogram(std::ostringstream& out, const char* name, const char* help, const MetricHistogram& h)
+{
+    WriteHelp(out, name, "histogram", help);
+    // Buckets are stored per range; the exposition format wants them cumulative.
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < h.bucketCount(); ++i) {
+        cumulative += h.bucket(i);
+        out << name << "_bucket{le=\"" << h.upperBound(i) << "\"} " << cumulative << "\n";
+    }
+    cumulative += h.bucket(h.bucketCount());
+    out << name << "_bucket{le=\"+Inf\"} " << cumulative << "\n";
+    out << name << "_sum " << h.sum() << "\n";
+    out << name << "_count " << cumulative << "\n";
+}
+
+bool SendAll(int fd, const std::string& data)
+{
+    const char* p = data.data();
+    size_t len = data.size();
+    while (len > 0) {
+        const ssize_t n = ::send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+}  // namespace
+
+MetricHistogram::MetricHistogram(std::initializer_list<double> upper_bounds)
+{
+    for (double b : upper_bounds) {
+        if (_size == kMaxBuckets) break;
+        _bounds[_size++] = b;
+    }
+}
+
+void MetricHistogram::observe(double v)
+{
+    size_t i = 0;
+    while (i < _size && v > _bounds[i]) ++i;
+    _buckets[i].fetch_add(1, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+    _sum_micro.fetch_add(static_cast<uint64_t>(std::max(0.0, v) * 1e6), std::memory_order_relaxed);
+}
+
+Metrics& Metrics::instance()
+{
+    static Metrics metrics;
+    return metrics;
+}
+
+void Metrics::recordError(int code)
+{
+    const size_t cls = code < 0 ? static_cast<size_t>(-code) / 100 : 0;
+    errors[std::min(cls, kErrorClasses - 1)].inc();
+}
+
+void Metrics::recordStop(int reason)
+{
+    if (reason >= 0 && static_cast<size_t>(reason) < kStopReasons) stop_reasons[static_cast<size_t>(reason)].inc();
+}
+
+std::string Metrics::renderPrometheus() const
+{
+    std::ostringstream out;
+    WriteCounter(out, "qwen3tts_requests_completed_total", "Generations that returned audio.", requests_completed.value());
+    WriteCounter(out, "qwen3tts_frames_generated_total", "Codec frames decoded by the talker.", frames_generated.value());
+    WriteCounter(out, "qwen3tts_audio_samples_total", "Output samples delivered.", audio_samples.value());
+
+    WriteHelp(out, "qwen3tts_stop_reason_total", "counter", "Finished generations by stop reason.");
+    for (size_t i = 0; i < kStopReasons; ++i) {
+        const uint64_t v = stop_reasons[i].value();
+        if (v == 0) continue;
+        out << "qwen3tts_stop_reason_total{reason=\"" << StopReasonName(static_cast<StopReason>(i)) << "\"} " << v << "\n";
+    }
+    WriteHelp(out, "qwen3tts_errors_total", "counter", "Failures by error code class (-15xx = request shed, -3xxx = load).");
+    for (size_t i = 0; i < kErrorClasses; ++i) {
+        const uint64_t v = errors[i].value();
+        if (v == 0) continue;
+        out << "qwen3tts_errors_total{class=\"-" << i << "xx\"} " << v << "\n";
+    }
+
+    WriteHistogram(out, "qwen3tts_prefill_ms", "Prompt builder plus talker prefill per request.", prefill_ms);
+    WriteHistogram(out, "qwen3tts_talker_step_ms", "Talker decode per frame.", talker_step_ms);
+    WriteHistogram(out, "qwen3tts_cp_step_ms", "Code predictor per frame, all residual groups.", cp_step_ms);
+    WriteHistogram(out, "qwen3tts_vocoder_ms", "Vocoder per request, including on_audio.", vocoder_ms);
+    WriteHistogram(out, "qwen3tts_rtf", "Generation time over audio duration per request.", rtf);
+
+    WriteGauge(out, "qwen3tts_queue_depth", "Admitted requests waiting for an engine.", queue_depth.value());
+    WriteGauge(out, "qwen3tts_in_flight", "Requests being generated.", in_flight.value());
+    WriteCounter(out, "qwen3tts_tokenizer_cache_hits_total", "BPE cache hits.", tokenizer_cache_hits.value());
+    WriteCounter(out, "qwen3tts_tokenizer_cache_misses_total", "BPE cache misses.", tokenizer_cache_misses.value());
+    return out.str();
+}
+
+MetricsServer::~MetricsServer()
+{
+    stop();
+}
+
+bool MetricsServer::start(const std::string& socket_path, std::string* error)
+{
+    if (_running.load()) return true;
+    sockaddr_un addr{};
+    if (socket_path.empty() || socket_path.size() >= sizeof(addr.sun_path)) {
+        if (error) *error = "invalid unix socket path: " + socket_path;
+        return false;
+    }
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        if (error) *error = std::string("socket() failed: ") + std::strerror(errno);
+        return false;
+    }
+    ::unlink(socket_path.c_str());
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(fd, 16) != 0) {
+        if (error) *error = "bind/listen failed on " + socket_path + ": " + std::strerror(errno);
+        ::close(fd);
+        return false;
+    }
+    _socket_path = socket_path;
+    _listen_fd = fd;
+    _running.store(true);
+    _thread = std::thread(&MetricsServer::loop, this);
+    QWEN3TTS_LOG_INFO("metrics") << "serving on " << _socket_path;
+    return true;
+}
+
+void MetricsServer::stop()
+{
+    if (!_running.exchange(false)) return;
+    if (_thread.joinable()) _thread.join();
+    ::close(_listen_fd);
+    _listen_fd = -1;
+    ::unlink(_socket_path.c_str());
+}
+
+void MetricsServer::loop()
+{
+    while (_running.load()) {
+        // Short poll so stop() never waits on a blocking accept.
+        pollfd pfd{_listen_fd, POLLIN, 0};
+        if (::poll(&pfd, 1, 200) <= 0) continue;
+        const int conn = ::accept(_listen_fd, nullptr, nullptr);
+        if (conn < 0) continue;
+        // The request line is not parsed: every path gets the metrics. Read what the client
+        // sent so closing the socket does not reset the connection before it reads the reply.
+        timeval timeout{1, 0};
+        ::setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        char buf[1024];
+        std::string request;
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+            const ssize_t n = ::recv(conn, buf, sizeof(buf), 0);
+            if (n <= 0) break;
+            request.append(buf, static_cast<size_t>(n));
+        }
+        const std::string body = Metrics::instance().renderPrometheus();
+        char header[160];
+        std::snprintf(header, sizeof(header),
+                      "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n",
+                      body.size());
+        SendAll(conn, header + body);
+        ::close(conn);
+    }
+}
+
+}
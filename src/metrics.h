@@ -0,0 +1,112 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <thread>
+
+namespace QWEN3TTS {
+
+  // Monotonic counter; a relaxed atomic add, safe from any thread.
+  class MetricCounter {
+  public:
+      void inc(uint64_t n = 1) { _value.fetch_add(n, std::memory_order_relaxed); }
+      uint64_t value() const { return _value.load(std::memory_order_relaxed); }
+
+  private:
+      std::atomic<uint64_t>   _value{0};
+  };
+
+  class MetricGauge {
+  public:
+      void add(int64_t n) { _value.fetch_add(n, std::memory_order_relaxed); }
+      void set(int64_t v) { _value.store(v, std::memory_order_relaxed); }
+      int64_t value() const { return _value.load(std::memory_order_relaxed); }
+
+  private:
+      std::atomic<int64_t>    _value{0};
+  };
+
+  // Fixed-bucket histogram. observe() is a short linear bucket search and three relaxed adds;
+  // no locks and no allocation. The sum is kept in millionths of the observed unit.
+  class MetricHistogram {
+  public:
+      static constexpr size_t kMaxBuckets = 15;
+
+      explicit MetricHistogram(std::initializer_list<double> upper_bounds);
+      void observe(double v);
+
+      size_t bucketCount() const { return _size; }
+      double upperBound(size_t i) const { return _bounds[i]; }
+      uint64_t bucket(size_t i) const { return _buckets[i].load(std::memory_order_relaxed); }  // i == bucketCount(): +Inf
+      uint64_t count() const { return _count.load(std::memory_order_relaxed); }
+      double sum() const { return static_cast<double>(_sum_micro.load(std::memory_order_relaxed)) / 1e6; }
+
+  private:
+      std::array<double, kMaxBuckets> _bounds{};
+      size_t                  _size = 0;
+      std::array<std::atomic<uint64_t>, kMaxBuckets + 1> _buckets{};
+      std::atomic<uint64_t>   _count{0};
+      std::atomic<uint64_t>   _sum_micro{0};
+  };
+
+  // Process-wide registry written by Voice, RequestQueue, StepScheduler and the tokenizer.
+  // Fixed members instead of name lookups keep recording to one atomic op per field.
+  class Metrics {
+  public:
+      static constexpr size_t kStopReasons = 8;      // indexed by StopReason
+      static constexpr size_t kErrorClasses = 40;    // indexed by -code / 100: -1502 -> 15
+
+      static Metrics& instance();
+
+      void recordError(int code);
+      void recordStop(int reason);
+
+      // Prometheus text exposition format (version 0.0.4).
+      std::string renderPrometheus() const;
+
+      MetricCounter           requests_completed;    // generations that returned audio
+      MetricCounter           frames_generated;
+      MetricCounter           audio_samples;
+      std::array<MetricCounter, kStopReasons> stop_reasons;
+      std::array<MetricCounter, kErrorClasses> errors;
+      MetricHistogram         prefill_ms{5, 10, 25, 50, 100, 250, 500, 1000, 2500};
+      MetricHistogram         talker_step_ms{1, 2, 5, 10, 20, 35, 50, 100, 200, 500};
+      MetricHistogram         cp_step_ms{0.5, 1, 2, 5, 10, 20, 35, 50, 100, 200};
+      MetricHistogram         vocoder_ms{5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000};
+      MetricHistogram         rtf{0.05, 0.1, 0.2, 0.3, 0.5, 0.75, 1, 1.5, 2, 4};
+      MetricGauge             queue_depth;           // admitted requests not yet picked up
+      MetricGauge             in_flight;             // requests being generated
+      MetricCounter           tokenizer_cache_hits;
+      MetricCounter           tokenizer_cache_misses;
+
+  private:
+      Metrics() = default;
+  };
+
+  // Answers every connection on a Unix socket with one HTTP/1.0 response holding
+  // Metrics::renderPrometheus(), e.g. `curl --unix-socket PATH http://localhost/metrics`.
+  class MetricsServer {
+  public:
+      MetricsServer() = default;
+      ~MetricsServer();
+      MetricsServer(const MetricsServer&) = delete;
+      MetricsServer& operator=(const MetricsServer&) = delete;
+
+      bool start(const std::string& socket_path, std::string* error);
+      void stop();
+
+  private:
+      void loop();
+
+  private:
+      std::string             _socket_path;
+      int                     _listen_fd = -1;
+      std::thread             _thread;
+      std::atomic<bool>       _running{false};
+  };
+
+}
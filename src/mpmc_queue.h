@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace QWEN3TTS {
+
+  // Bounded multi-producer/multi-consumer queue (Vyukov). Push and pop are a
+  // single CAS on the happy path; no lock is taken by producers or consumers.
+  template <typename T>
+  class MpmcQueue {
+  public:
+      explicit MpmcQueue(size_t capacity)
+      {
+          size_t cap = 2;
+          while (cap < capacity) cap <<= 1;
+          _mask = cap - 1;
+          _cells = std::make_unique<Cell[]>(cap);
+          for (size_t i = 0; i < cap; ++i) _cells[i].seq.store(i, std::memory_order_relaxed);
+      }
+
+      bool tryPush(const T& value)
+      {
+          size_t pos = _tail.load(std::memory_order_relaxed);
+          while (true) {
+              Cell& cell = _cells[pos & _mask];
+              const size_t seq = cell.seq.load(std::memory_order_acquire);
+              const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+              if (diff == 0) {
+                  if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                      cell.value = value;
+                      cell.seq.store(pos + 1, std::memory_order_release);
+                      return true;
+                  }
+              } else if (diff < 0) {
+                  return false;
+              } else {
+                  pos = _tail.load(std::memory_order_relaxed);
+              }
+          }
+      }
+
+      bool tryPop(T* value)
+      {
+          size_t pos = _head.load(std::memory_order_relaxed);
+          while (true) {
+              Cell& cell = _cells[pos & _mask];
+              const size_t seq = cell.seq.load(std::memory_order_acquire);
+              const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+              if (diff == 0) {
+                  if (_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                      *value = cell.value;
+                      cell.seq.store(pos + _mask + 1, std::memory_order_release);
+                      return true;
+                  }
+              } else if (diff < 0) {
+                  return false;
+              } else {
+                  pos = _head.load(std::memory_order_relaxed);
+              }
+          }
+      }
+
+      size_t capacity() const { return _mask + 1; }
+      size_t sizeApprox() const
+      {
+          const size_t tail = _tail.load(std::memory_order_relaxed);
+          const size_t head = _head.load(std::memory_order_relaxed);
+          return tail >= head ? tail - head : 0;
+      }
+
+  private:
+      struct Cell {
+          std::atomic<size_t> seq{0};
+          T value{};
+      };
+      static constexpr size_t kCacheLine = 64;
+
+      std::unique_ptr<Cell[]> _cells;
+      size_t _mask = 0;
+      alignas(kCacheLine) std::atomic<size_t> _head{0};
+      alignas(kCacheLine) std::atomic<size_t> _tail{0};
+  };
+
+}
@@ -0,0 +1,229 @@
+#include "profile_report.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+using namespace QWEN3TTSUTILS;
+
+namespace QWEN3TTS {
+
+namespace {
+
+constexpr const char* kKernelSuffix = "_kernel_time";
+
+// Pipeline order for reports; other session names follow alphabetically.
+int SessionRank(const std::string& session)
+{
+    static const char* kOrder[] = {"prefill_builder", "talker_prefill", "talker_prefill_chunk", "talker_decode",
+                                   "code_predictor", "vocoder"};
+    for (int i = 0; i < static_cast<int>(sizeof(kOrder) / sizeof(kOrder[0])); ++i) {
+        if (session == kOrder[i]) return i;
+    }
+    return static_cast<int>(sizeof(kOrder) / sizeof(kOrder[0]));
+}
+
+bool RowBefore(const OpProfileRow& a, const OpProfileRow& b)
+{
+    const int ra = SessionRank(a.session);
+    const int rb = SessionRank(b.session);
+    if (ra != rb) return ra < rb;
+    if (a.session != b.session) return a.session < b.session;
+    if (a.total_ms != b.total_ms) return a.total_ms > b.total_ms;
+    if (a.op_type != b.op_type) return a.op_type < b.op_type;
+    return a.node < b.node;
+}
+
+// Calls fn(object_text) for every top-level object of the trace's event array; nested
+// objects (args, thread stats) stay inside their event.
+template <typename Fn>
+void ForEachEvent(const std::string& json, Fn fn)
+{
+    int depth = 0;
+    bool in_string = false;
+    size_t start = std::string::npos;
+    for (size_t i = 0; i < json.size(); ++i) {
+        const char c = json[i];
+        if (in_string) {
+            if (c == '\\') {
+                ++i;
+            } else if (c == '"') {
+                in_string = false;
+            }
+            continue;
+        }
+        if (c == '"') {
+            in_string = true;
+        } else if (c == '{') {
+            if (depth++ == 0) start = i;
+        } else if (c == '}' && depth > 0) {
+            if (--depth == 0 && start != std::string::npos) {
+                fn(json.substr(start, i - start + 1));
+                start = std::string::npos;
+            }
+        }
+    }
+}
+
+void AppendRow(std::ostringstream& out, const char* kind, const OpProfileRow& row)
+{
+    char nums[128];
+    std::snprintf(nums, sizeof(nums), "%llu\t%.3f\t%.1f\t%.4f", static_cast<unsigned long long>(row.calls), row.total_ms,
+                  row.mean_us, row.share);
+    out << kind << '\t' << row.session << '\t' << row.op_type << '\t' << row.node << '\t' << nums << '\n';
+}
+
+}  // namespace
+
+bool ProfileAggregator::addTrace(const std::string& session, const std::string& json_path, std::string* error)
+{
+    if (!std::filesystem::exists(json_path)) {
+        if (error) *error = "profile trace not found: " + json_path;
+        return false;
+    }
+    const std::string json = ReadAll(json_path);
+    auto& nodes = _nodes[session];
+    size_t events = 0;
+    ForEachEvent(json, [&](const std::string& ev) {
+        if (ParseStringScalar(ev, "cat") != "Node") return;
+        std::string name = ParseStringScalar(ev, "name");
+        const size_t suffix_len = std::char_traits<char>::length(kKernelSuffix);
+        if (name.size() <= suffix_len || name.compare(name.size() - suffix_len, suffix_len, kKernelSuffix) != 0) return;
+        name.resize(name.size() - suffix_len);
+        Acc& acc = nodes[name];
+        if (acc.op_type.empty()) acc.op_type = ParseStringScalar(ev, "op_name");
+        acc.calls += 1;
+        acc.total_us += ParseFloatScalar(ev, "dur");
+        ++events;
+    });
+    if (events == 0) {
+        if (error) *error = "no kernel events in " + json_path;
+        return false;
+    }
+    return true;
+}
+
+std::vector<OpProfileRow> ProfileAggregator::byOpType() const
+{
+    std::vector<OpProfileRow> rows;
+    for (const auto& [session, nodes] : _nodes) {
+        std::map<std::string, OpProfileRow> by_op;
+        double session_us = 0.0;
+        for (const auto& [node, acc] : nodes) {
+            OpProfileRow& row = by_op[acc.op_type];
+            row.calls += acc.calls;
+            row.total_ms += acc.total_us / 1000.0;
+            session_us += acc.total_us;
+        }
+        for (auto& [op_type, row] : by_op) {
+            row.session = session;
+            row.op_type = op_type;
+            row.mean_us = row.calls > 0 ? row.total_ms * 1000.0 / static_cast<double>(row.calls) : 0.0;
+            row.share = session_us > 0.0 ? row.total_ms * 1000.0 / session_us : 0.0;
+            rows.push_back(row);
+        }
+    }
+    std::sort(rows.begin(), rows.end(), RowBefore);
+    return rows;
+}
+
+std::vector<OpProfileRow> ProfileAggregator::byNode(size_t top_per_session) const
+{
+    std::vector<OpProfileRow> rows;
+    for (const auto& [session, nodes] : _nodes) {
+        double session_us = 0.0;
+        for (const auto& [node, acc] : nodes) session_us += acc.total_us;
+        std::vector<OpProfileRow> session_rows;
+        for (const auto& [node, acc] : nodes) {
+            OpProfileRow row;
+            row.session = session;
+            row.op_type = acc.op_type;
+            row.node = node;
+            row.calls = acc.calls;
+            row.total_ms = acc.total_us / 1000.0;
+            row.mean_us = acc.calls > 0 ? acc.total_us / static_cast<double>(acc.calls) : 0.0;
+            row.share = session_us > 0.0 ? acc.total_us / session_us : 0.0;
+            session_rows.push_back(std::move(row));
+        }
+        std::sort(session_rows.begin(), session_rows.end(), RowBefore);
+        if (top_per_session > 0 && session_rows.size() > top_per_session) session_rows.resize(top_per_session);
+        rows.insert(rows.end(), session_rows.begin(), session_rows.end());
+    }
+    std::sort(rows.begin(), rows.end(), RowBefore);
+    return rows;
+}
+
+std::string ProfileAggregator::formatTsv(size_t top_nodes) const
+{
+    std::ostringstream out;
+    out << "# kind\tsession\top_type\tnode\tcalls\ttotal_ms\tmean_us\tshare\n";
+    for (const OpProfileRow& row : byOpType()) AppendRow(out, "op", row);
+    for (const OpProfileRow& row : byNode(top_nodes)) AppendRow(out, "node", row);
+    return out.str();
+}
+
+bool ReadProfileReport(const std::string& path, std::vector<OpProfileRow>* rows, std::string* error)
+{
+    std::ifstream in(path);
+    if (!in) {
+        if (error) *error = "failed to open profile report: " + path;
+        return false;
+    }
+    rows->clear();
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::vector<std::string> cols;
+        std::stringstream ss(line);
+        std::string col;
+        while (std::getline(ss, col, '\t')) cols.push_back(col);
+        if (cols.size() < 8) {
+            if (error) *error = "malformed profile report line: " + line;
+            return false;
+        }
+        if (cols[0] != "op") continue;
+        OpProfileRow row;
+        row.session = cols[1];
+        row.op_type = cols[2];
+        row.node = cols[3];
+        row.calls = std::strtoull(cols[4].c_str(), nullptr, 10);
+        row.total_ms = std::strtod(cols[5].c_str(), nullptr);
+        row.mean_us = std::strtod(cols[6].c_str(), nullptr);
+        row.share = std::strtod(cols[7].c_str(), nullptr);
+        rows->push_back(std::move(row));
+    }
+    return true;
+}
+
+std::vector<OpProfileDelta> DiffProfileReports(const std::vector<OpProfileRow>& base, const std::vector<OpProfileRow>& next)
+{
+    std::map<std::pair<std::string, std::string>, OpProfileDelta> joined;
+    for (const OpProfileRow& row : base) {
+        OpProfileDelta& d = joined[{row.session, row.op_type}];
+        d.base_ms += row.total_ms;
+        d.base_calls += row.calls;
+    }
+    for (const OpProfileRow& row : next) {
+        OpProfileDelta& d = joined[{row.session, row.op_type}];
+        d.new_ms += row.total_ms;
+        d.new_calls += row.calls;
+    }
+    std::vector<OpProfileDelta> out;
+    out.reserve(joined.size());
+    for (auto& [key, d] : joined) {
+        d.session = key.first;
+        d.op_type = key.second;
+        out.push_back(std::move(d));
+    }
+    std::stable_sort(out.begin(), out.end(), [](const OpProfileDelta& a, const OpProfileDelta& b) {
+        return std::fabs(a.new_ms - a.base_ms) > std::fabs(b.new_ms - b.base_ms);
+    });
+    return out;
+}
+
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace QWEN3TTS {
+
+  // One line of an operator hotspot table.
+  struct OpProfileRow {
+    std::string             session;       // prefill_builder, talker_prefill, talker_decode, code_predictor, vocoder
+    std::string             op_type;
+    std::string             node;          // empty in per-op-type rows
+    uint64_t                calls = 0;
+    double                  total_ms = 0.0;
+    double                  mean_us = 0.0;
+    double                  share = 0.0;   // of the session's total kernel time, 0..1
+  };
+
+  // Aggregates ORT profiling traces (SessionOptions::EnableProfiling JSON) into per-session
+  // hotspot tables. Only "Node" events of kind *_kernel_time are counted; fences and
+  // session-level events are skipped. Several traces may share a session name (the code
+  // predictor step models, or repeated runs) and are summed.
+  class ProfileAggregator {
+  public:
+      bool addTrace(const std::string& session, const std::string& json_path, std::string* error);
+
+      // Sorted by session (pipeline order), then total time descending.
+      std::vector<OpProfileRow> byOpType() const;
+      std::vector<OpProfileRow> byNode(size_t top_per_session = 0) const;
+
+      // Tab-separated report: "op" rows (every op type) then "node" rows (top_nodes per
+      // session, 0 = all). Order and formatting are stable, so two bundles' reports can be
+      // compared with ReadProfileReport/DiffProfileReports or plain diff.
+      std::string formatTsv(size_t top_nodes = 20) const;
+
+  private:
+      struct Acc {
+          std::string op_type;
+          uint64_t calls = 0;
+          double total_us = 0.0;
+      };
+      // session -> node -> accumulated kernel time
+      std::map<std::string, std::map<std::string, Acc>> _nodes;
+  };
+
+  // Reads the "op" rows of a formatTsv report.
+  bool ReadProfileReport(const std::string& path, std::vector<OpProfileRow>* rows, std::string* error);
+
+  struct OpProfileDelta {
+    std::string             session;
+    std::string             op_type;
+    double                  base_ms = 0.0;
+    double                  new_ms = 0.0;
+    uint64_t                base_calls = 0;
+    uint64_t                new_calls = 0;
+  };
+
+  // Joins two reports on (session, op_type), including op types present in only one of them;
+  // sorted by |new_ms - base_ms| descending.
+  std::vector<OpProfileDelta> DiffProfileReports(const std::vector<OpProfileRow>& base, const std::vector<OpProfileRow>& next);
+
+}
@@ -0,0 +1,397 @@
+#include "request_queue.h"
+#include "logger.h"
+#include "metrics.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+using namespace QWEN3TTSUTILS;
+
+namespace QWEN3TTS {
+
+RequestQueue::~RequestQueue()
+{
+    stop();
+}
+
+RequestQueue::EngineSet::~EngineSet()
+{
+    // The batcher borrows engine 0's vocoder session; drop it before the engines go.
+    for (auto& voice : engines) voice->setVocoderBatcher(nullptr);
+    vocoder_batcher.reset();
+}
+
+bool RequestQueue::start(const RequestQueueConfig& cfg)
+{
+    std::lock_guard<std::mutex> reload_lock(_reload_mutex);
+    _last_error_code = 0;
+    _last_error_message.clear();
+    if (_running.load()) return true;
+    _config = cfg;
+    if (_config.engines <= 0) _config.engines = 1;
+    if (_config.capacity == 0) _config.capacity = 1;
+
+    auto engines = loadEngines(_config.tts, nullptr, nullptr);
+    if (!engines) return false;
+    std::atomic_store(&_engines, std::move(engines));
+
+    _queue = std::make_unique<MpmcQueue<Job*>>(_config.capacity);
+    _pending_cost.store(0);
+    _pending_bytes.store(0);
+    _running.store(true);
+    for (int i = 0; i < _config.engines; ++i) {
+        _workers.emplace_back(&RequestQueue::workerLoop, this, static_cast<size_t>(i));
+    }
+    return true;
+}
+
+void RequestQueue::stop()
+{
+    std::lock_guard<std::mutex> reload_lock(_reload_mutex);
+    if (!_running.exchange(false)) return;
+    // A submit() that saw _running == true may still push; wait for it before draining and
+    // freeing the queue. Both sides are seq_cst, so a later submit() sees _running == false.
+    while (_submitting.load() > 0) std::this_thread::yield();
+    {
+        std::lock_guard<std::mutex> lock(_park_mutex);
+        _park_cv.notify_all();
+    }
+    for (auto& t : _workers) {
+        if (t.joinable()) t.join();
+    }
+    _workers.clear();
+    Job* late = nullptr;
+    while (_queue && _queue->tryPop(&late)) {
+        Metrics::instance().queue_depth.add(-1);
+        late->done.set_value(std::vector<float>{-1503.0f});
+        delete late;
+    }
+    std::atomic_store(&_engines, std::shared_ptr<EngineSet>());
+    _queue.reset();
+}
+
+std::shared_ptr<RequestQueue::EngineSet> RequestQueue::loadEngines(const TtsConfig& tts, double* load_ms, double* warmup_ms)
+{
+    auto drain = std::make_shared<EngineSet::Drain>();
+    std::shared_ptr<EngineSet> set(new EngineSet(), [drain](EngineSet* released) {
+        {
+            std::lock_guard<std::mutex> lock(drain->mutex);
+            if (drain->awaited) {
+                drain->released = released;
+                drain->cv.notify_all();
+                return;
+            }
+        }
+        delete released;
+    });
+    set->drain = drain;
+    double load_total = 0.0;
+    double warmup_total = 0.0;
+    for (int i = 0; i < _config.engines; ++i) {
+        auto voice = std::make_unique<Voice>();
+        auto t0 = std::chrono::steady_clock::now();
+        bool ok = voice->load(tts);
+        load_total += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        if (ok && _config.warmup) {
+            t0 = std::chrono::steady_clock::now();
+            ok = voice->warmup();
+            warmup_total += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        }
+        if (!ok) {
+            _last_error_code = voice->lastErrorCode();
+            _last_error_message = voice->lastErrorMessage();
+            return nullptr;
+        }
+        set->engines.push_back(std::move(voice));
+    }
+    if (_config.batch_vocoder) {
+        // Engine 0's vocoder session serves everyone; the others keep theirs for silence probes.
+        set->vocoder_batcher = set->engines.front()->makeVocoderBatcher(_config.vocoder_batch);
+        for (auto& voice : set->engines) voice->setVocoderBatcher(set->vocoder_batcher);
+    }
+    if (load_ms) *load_ms = load_total;
+    if (warmup_ms) *warmup_ms = warmup_total;
+    return set;
+}
+
+bool RequestQueue::reload(const TtsConfig& tts, ReloadReport* report)
+{
+    std::lock_guard<std::mutex> reload_lock(_reload_mutex);
+    if (!_running.load()) {
+        _last_error_code = -1503;
+        _last_error_message = "request queue is not running";
+        return false;
+    }
+    ReloadReport r;
+    r.rss_before_bytes = ProcessRssBytes();
+    auto fresh = loadEngines(tts, &r.load_ms, &r.warmup_ms);
+    if (!fresh) {
+        QWEN3TTS_LOG_ERROR("reload") << "new engines failed to load; keeping the current ones"
+                                     << Kv("code", _last_error_code) << Kv("error", _last_error_message);
+        return false;
+    }
+
+    const auto swap_t0 = std::chrono::steady_clock::now();
+    std::shared_ptr<EngineSet> old = std::atomic_exchange(&_engines, std::move(fresh));
+    r.swap_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - swap_t0).count();
+    r.rss_overlap_bytes = ProcessRssBytes();
+    _config.tts = tts;
+    _reloads.fetch_add(1, std::memory_order_relaxed);
+
+    // Once unpublished, the old set is only referenced by workers finishing jobs picked up
+    // before the swap (and momentarily by submit() estimates); its deleter wakes us when the
+    // last of them lets go, and the set is freed here rather than on a worker.
+    const auto drain_t0 = std::chrono::steady_clock::now();
+    const std::shared_ptr<EngineSet::Drain> drain = old->drain;
+    EngineSet* released = nullptr;
+    {
+        std::unique_lock<std::mutex> lock(drain->mutex);
+        drain->awaited = true;
+        lock.unlock();
+        old.reset();
+        lock.lock();
+        const auto timeout = std::chrono::duration<double, std::milli>(std::max(0.0, _config.reload_drain_timeout_ms));
+        r.drained = drain->cv.wait_for(lock, timeout, [&] { return drain->released != nullptr; });
+        released = drain->released;
+        drain->awaited = false;
+    }
+    delete released;
+    r.drain_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - drain_t0).count();
+    r.rss_after_bytes = ProcessRssBytes();
+    if (!r.drained) {
+        QWEN3TTS_LOG_WARN("reload") << "old engines still busy; their last request will free them"
+                                    << Kv("timeout_ms", _config.reload_drain_timeout_ms);
+    }
+
+    QWEN3TTS_LOG_INFO("reload") << "engine set swapped" << Kv("load_ms", r.load_ms) << Kv("warmup_ms", r.warmup_ms)
+                                << Kv("swap_ms", r.swap_ms) << Kv("drain_ms", r.drain_ms) << Kv("drained", r.drained)
+                                << Kv("rss_before_mb", r.rss_before_bytes >> 20)
+                                << Kv("rss_overlap_mb", r.rss_overlap_bytes >> 20)
+                                << Kv("rss_after_mb", r.rss_after_bytes >> 20);
+    if (report) *report = r;
+    _last_error_code = 0;
+    _last_error_message.clear();
+    return true;
+}
+
+int64_t RequestQueue::EstimateCost(const GenerationParams& params, const StepPredictor& predictor)
+{
+    if (params.steps > 0) return params.steps;
+    const int64_t tokens = EstimateTokenCount(params.text);
+    const int64_t lang = params.codec_lang.empty() ? -1 : params.codec_lang[0];
+    int64_t frames = predictor.predict(tokens, lang).expected;
+    if (params.max_steps > 0) frames = std::min<int64_t>(frames, params.max_steps);
+    return std::max<int64_t>(1, frames);
+}
+
+int RequestQueue::submit(const GenerationParams& params, std::future<std::vector<float>>* result)
+{
+    auto shed = [&](int code) {
+        Metrics::instance().recordError(code);
+        std::promise<std::vector<float>> p;
+        p.set_value(std::vector<float>{static_cast<float>(code)});
+        if (result) *result = p.get_future();
+        return code;
+    };
+    struct SubmitGuard {
+        std::atomic<int>& count;
+        explicit SubmitGuard(std::atomic<int>& c) : count(c) { count.fetch_add(1); }
+        ~SubmitGuard() { count.fetch_sub(1); }
+    } guard(_submitting);
+    if (!_running.load()) return shed(-1503);
+    _submitted.fetch_add(1, std::memory_order_relaxed);
+
+    const std::shared_ptr<EngineSet> set = std::atomic_load(&_engines);
+    if (!set) return shed(-1503);
+    const Voice& estimator = *set->engines.front();
+    const int64_t cost = EstimateCost(params, estimator.stepPredictor());
+    if (_config.max_pending_cost > 0) {
+        const int64_t before = _pending_cost.fetch_add(cost, std::memory_order_acq_rel);
+        // A request larger than the whole budget is still admitted into an idle queue.
+        if (before > 0 && before + cost > _config.max_pending_cost) {
+            _pending_cost.fetch_sub(cost, std::memory_order_acq_rel);
+            _shed_budget.fetch_add(1, std::memory_order_relaxed);
+            return shed(-1502);
+        }
+    } else {
+        _pending_cost.fetch_add(cost, std::memory_order_acq_rel);
+    }
+
+    auto* job = new Job();
+    job->params = params;
+    job->bytes = estimator.estimateMemory(job->params).peak_bytes;
+    if (_config.max_pending_bytes > 0) {
+        auto reserve = [&](int64_t bytes) {
+            const int64_t before = _pending_bytes.fetch_add(bytes, std::memory_order_acq_rel);
+            if (before > 0 && before + bytes > _config.max_pending_bytes) {
+                _pending_bytes.fetch_sub(bytes, std::memory_order_acq_rel);
+                return false;
+            }
+            return true;
+        };
+        bool admitted = reserve(job->bytes);
+        // Whole-utterance vocoding dominates long requests; windows bound it to a constant.
+        if (!admitted && job->params.vocoder_window_frames <= 0 && _config.downgrade_window_frames > 0) {
+            job->params.vocoder_window_frames = _config.downgrade_window_frames;
+            job->bytes = estimator.estimateMemory(job->params).peak_bytes;
+            admitted = reserve(job->bytes);
+            if (admitted) _downgraded.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (!admitted) {
+            _pending_cost.fetch_sub(cost, std::memory_order_acq_rel);
+            _shed_memory.fetch_add(1, std::memory_order_relaxed);
+            delete job;
+            return shed(-1504);
+        }
+    } else {
+        _pending_bytes.fetch_add(job->bytes, std::memory_order_acq_rel);
+    }
+    if (job->params.request_id == 0) job->params.request_id = _next_request_id.fetch_add(1, std::memory_order_relaxed);
+    job->cost = cost;
+    job->enqueued = std::chrono::steady_clock::now();
+    if (result) *result = job->done.get_future();
+    if (!_queue->tryPush(job)) {
+        _pending_cost.fetch_sub(cost, std::memory_order_acq_rel);
+        _pending_bytes.fetch_sub(job->bytes, std::memory_order_acq_rel);
+        _shed_full.fetch_add(1, std::memory_order_relaxed);
+        Metrics::instance().recordError(-1501);
+        job->done.set_value(std::vector<float>{-1501.0f});
+        delete job;
+        return -1501;
+    }
+    Metrics::instance().queue_depth.add(1);
+    if (_parked.load() > 0) {
+        std::lock_guard<std::mutex> lock(_park_mutex);
+        _park_cv.notify_one();
+    }
+    return 0;
+}
+
+bool RequestQueue::popWait(Job** job)
+{
+    constexpr int kSpinRounds = 64;
+    while (true) {
+        for (int i = 0; i < kSpinRounds; ++i) {
+            if (_queue->tryPop(job)) return true;
+            std::this_thread::yield();
+        }
+        std::unique_lock<std::mutex> lock(_park_mutex);
+        _parked.fetch_add(1);
+        // Re-check after announcing ourselves so a concurrent submit cannot be missed.
+        if (_queue->tryPop(job)) {
+            _parked.fetch_sub(1);
+            return true;
+        }
+        if (!_running.load()) {
+            _parked.fetch_sub(1);
+            return false;
+        }
+        _park_cv.wait(lock);
+        _parked.fetch_sub(1);
+    }
+}
+
+void RequestQueue::recordQueueWait(double ms)
+{
+    const uint64_t us = static_cast<uint64_t>(std::max(0.0, ms) * 1000.0);
+    _wait_count.fetch_add(1, std::memory_order_relaxed);
+    _wait_sum_us.fetch_add(us, std::memory_order_relaxed);
+    uint64_t prev_max = _wait_max_us.load(std::memory_order_relaxed);
+    while (us > prev_max && !_wait_max_us.compare_exchange_weak(prev_max, us, std::memory_order_relaxed)) {
+    }
+    int bucket = kWaitBuckets;
+    for (int i = 0; i < kWaitBuckets; ++i) {
+        if (ms <= kWaitBucketLeMs[i]) {
+            bucket = i;
+            break;
+        }
+    }
+    _wait_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+void RequestQueue::workerLoop(size_t index)
+{
+    Job* job = nullptr;
+    while (popWait(&job)) {
+        const auto picked = std::chrono::steady_clock::now();
+        const double queue_ms = std::chrono::duration<double, std::milli>(picked - job->enqueued).count();
+        recordQueueWait(queue_ms);
+        Metrics& metrics = Metrics::instance();
+        metrics.queue_depth.add(-1);
+        metrics.in_flight.add(1);
+        std::vector<float> pcm;
+        {
+            // Pin the current engine set for this job; a concurrent reload() waits for it.
+            const std::shared_ptr<EngineSet> set = std::atomic_load(&_engines);
+            try {
+                pcm = set->engines[index]->generateVoice(job->params);
+            } catch (...) {
+                pcm = {-2000.0f};
+            }
+        }
+        if (_config.on_complete) {
+            RequestTiming timing;
+            timing.request_id = job->params.request_id;
+            timing.queue_ms = queue_ms;
+            timing.service_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - picked).count();
+            timing.error_code = (pcm.size() == 1 && pcm[0] < 0.0f) ? static_cast<int>(pcm[0]) : 0;
+            _config.on_complete(timing);
+        }
+        _pending_cost.fetch_sub(job->cost, std::memory_order_acq_rel);
+        _pending_bytes.fetch_sub(job->bytes, std::memory_order_acq_rel);
+        metrics.in_flight.add(-1);
+        _completed.fetch_add(1, std::memory_order_relaxed);
+        job->done.set_value(std::move(pcm));
+        delete job;
+    }
+}
+
+RequestQueueStats RequestQueue::stats() const
+{
+    RequestQueueStats st;
+    st.submitted = _submitted.load(std::memory_order_relaxed);
+    st.completed = _completed.load(std::memory_order_relaxed);
+    st.shed_queue_full = _shed_full.load(std::memory_order_relaxed);
+    st.shed_over_budget = _shed_budget.load(std::memory_order_relaxed);
+    st.shed_over_memory = _shed_memory.load(std::memory_order_relaxed);
+    st.downgraded = _downgraded.load(std::memory_order_relaxed);
+    st.depth = _queue ? _queue->sizeApprox() : 0;
+    st.pending_cost = _pending_cost.load(std::memory_order_relaxed);
+    st.pending_bytes = _pending_bytes.load(std::memory_order_relaxed);
+    st.queue_wait_count = _wait_count.load(std::memory_order_relaxed);
+    if (st.queue_wait_count > 0) {
+        st.queue_wait_avg_ms = static_cast<double>(_wait_sum_us.load(std::memory_order_relaxed)) / 1000.0 /
+                               static_cast<double>(st.queue_wait_count);
+    }
+    st.queue_wait_max_ms = static_cast<double>(_wait_max_us.load(std::memory_order_relaxed)) / 1000.0;
+    uint64_t cumulative = 0;
+    for (int i = 0; i <= kWaitBuckets; ++i) {
+        cumulative += _wait_buckets[i].load(std::memory_order_relaxed);
+        st.queue_wait_bucket_le_ms.push_back(i < kWaitBuckets ? kWaitBucketLeMs[i] : INFINITY);
+        st.queue_wait_buckets.push_back(cumulative);
+    }
+    const std::shared_ptr<EngineSet> set = std::atomic_load(&_engines);
+    if (set && set->vocoder_batcher) st.vocoder_batch = set->vocoder_batcher->stats();
+    st.reloads = _reloads.load(std::memory_order_relaxed);
+    return st;
+}
+
+ModelDims RequestQueue::dims() const
+{
+    const std::shared_ptr<EngineSet> set = std::atomic_load(&_engines);
+    return set ? set->engines.front()->dims() : ModelDims{};
+}
+
+int RequestQueue::lastErrorCode() const
+{
+    return _last_error_code;
+}
+
+const std::string& RequestQueue::lastErrorMessage() const
+{
+    return _last_error_message;
+}
+
+}
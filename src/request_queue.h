@@ -0,0 +1,183 @@
+#pragma once
+
+#include "mpmc_queue.h"
+#include "vocoder_batcher.h"
+#include "voice.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace QWEN3TTS {
+
+  // Per-request outcome passed to RequestQueueConfig::on_complete.
+  struct RequestTiming {
+    uint64_t                request_id = 0;
+    double                  queue_ms = 0.0;      // submit() until a worker picked it up
+    double                  service_ms = 0.0;    // generateVoice on the worker
+    int                     error_code = 0;      // 0 or the negative generateVoice code
+  };
+
+  struct RequestQueueConfig {
+    TtsConfig               tts;
+    int                     engines = 1;             // Voice instances, one worker thread each
+    size_t                  capacity = 256;          // rounded up to a power of two
+    int64_t                 max_pending_cost = 0;    // admission budget in estimated frames, 0 = unlimited
+    // Memory budget over the Voice::estimateMemory peaks of admitted requests, 0 = unlimited.
+    // A request that does not fit and would vocode in one run is retried with windowed
+    // vocoding of downgrade_window_frames before it is shed.
+    int64_t                 max_pending_bytes = 0;
+    int                     downgrade_window_frames = 48;  // 0 = shed without downgrading
+    bool                    warmup = true;           // Voice::warmup each engine before accepting requests
+    // Share one vocoder across the engines and pack concurrent windows into batched runs.
+    bool                    batch_vocoder = false;
+    VocoderBatcherConfig    vocoder_batch;
+    // reload() waits this long for the old engines' last request; after that it returns and
+    // the old set is freed by whichever thread drops the last reference.
+    double                  reload_drain_timeout_ms = 60000.0;
+    // Called on the worker thread after each request, before its future becomes ready.
+    std::function<void(const RequestTiming&)> on_complete;
+  };
+
+  // Outcome of RequestQueue::reload. The old engines serve traffic during load and warmup,
+  // so the only pause new requests see is the pointer swap itself.
+  struct ReloadReport {
+    double                  load_ms = 0.0;
+    double                  warmup_ms = 0.0;
+    double                  swap_ms = 0.0;           // publishing the new engine set
+    double                  drain_ms = 0.0;          // swap until the old set's last request finished
+    bool                    drained = true;          // false when the drain hit reload_drain_timeout_ms
+    int64_t                 rss_before_bytes = 0;
+    int64_t                 rss_overlap_bytes = 0;   // both engine sets resident, right after the swap
+    int64_t                 rss_after_bytes = 0;     // once the old set was released
+  };
+
+  struct RequestQueueStats {
+    uint64_t                submitted = 0;
+    uint64_t                completed = 0;
+    uint64_t                shed_queue_full = 0;
+    uint64_t                shed_over_budget = 0;
+    uint64_t                shed_over_memory = 0;
+    uint64_t                downgraded = 0;          // admitted only after switching to windowed vocoding
+    size_t                  depth = 0;
+    int64_t                 pending_cost = 0;
+    int64_t                 pending_bytes = 0;
+    // Queue wait: time from submit() until a worker picked the request up.
+    uint64_t                queue_wait_count = 0;
+    double                  queue_wait_avg_ms = 0.0;
+    double                  queue_wait_max_ms = 0.0;
+    std::vector<double>     queue_wait_bucket_le_ms;  // upper bounds, last is +inf
+    std::vector<uint64_t>   queue_wait_buckets;       // cumulative counts
+    VocoderBatcherStats     vocoder_batch;            // zeros unless batch_vocoder
+    uint64_t                reloads = 0;              // successful reload() swaps
+  };
+
+  // Admission-controlled front end over a pool of Voice engines.
+  class RequestQueue {
+  public:
+      RequestQueue() = default;
+      ~RequestQueue();
+      RequestQueue(const RequestQueue&) = delete;
+      RequestQueue& operator=(const RequestQueue&) = delete;
+
+      bool start(const RequestQueueConfig& cfg);
+      // Drains already-admitted requests, then joins the workers.
+      void stop();
+
+      // Returns 0 and a future with the generateVoice result, or a negative
+      // fast-fail code (-1501 queue full, -1502 over cost budget, -1503 not running,
+      // -1504 over memory budget) without blocking. On fast-fail the future is ready with the error PCM.
+      int submit(const GenerationParams& params, std::future<std::vector<float>>* result);
+
+      // Zero-downtime model swap: loads `tts` into a fresh engine set next to the running one
+      // and warms it (when cfg.warmup) while the old set keeps serving. New requests then
+      // switch over atomically. Requests already picked up finish on the old engines, which
+      // are released once they drain; returns after that, or after reload_drain_timeout_ms
+      // with report->drained = false. On failure the old set stays live.
+      bool reload(const TtsConfig& tts, ReloadReport* report = nullptr);
+
+      RequestQueueStats stats() const;
+      // Dimensions of the current engines; valid after a successful start().
+      ModelDims dims() const;
+      int lastErrorCode() const;
+      const std::string& lastErrorMessage() const;
+
+      // Expected frames from the engines' StepPredictor, bounded by steps/max_steps.
+      static int64_t EstimateCost(const GenerationParams& params, const StepPredictor& predictor);
+
+  private:
+      // One generation of engines. Worker i runs engines[i] of whichever set is current when
+      // it picks up a job and keeps the set alive until that job is done.
+      struct EngineSet {
+          // Signalled by the set's deleter when the last reference goes. While reload() waits,
+          // the set is handed over to be freed there; otherwise the deleter frees it.
+          struct Drain {
+              std::mutex mutex;
+              std::condition_variable cv;
+              bool awaited = false;
+              EngineSet* released = nullptr;
+          };
+          std::vector<std::unique_ptr<Voice>> engines;
+          std::shared_ptr<VocoderBatcher> vocoder_batcher;
+          std::shared_ptr<Drain> drain;
+          ~EngineSet();
+      };
+
+      struct Job {
+          GenerationParams params;
+          int64_t cost = 0;
+          int64_t bytes = 0;
+          std::chrono::steady_clock::time_point enqueued;
+          std::promise<std::vector<float>> done;
+      };
+
+      std::shared_ptr<EngineSet> loadEngines(const TtsConfig& tts, double* load_ms, double* warmup_ms);
+      void workerLoop(size_t index);
+      bool popWait(Job** job);
+      void recordQueueWait(double ms);
+
+  private:
+      static constexpr int kWaitBuckets = 10;
+      static constexpr double kWaitBucketLeMs[kWaitBuckets] = {1, 5, 10, 25, 50, 100, 250, 500, 1000, 5000};
+
+      RequestQueueConfig      _config;
+      std::unique_ptr<MpmcQueue<Job*>> _queue;
+      std::shared_ptr<EngineSet> _engines;       // std::atomic_load / atomic_store only
+      std::mutex              _reload_mutex;      // serializes start/stop/reload
+      std::vector<std::thread> _workers;
+      std::atomic<bool>       _running{false};
+      std::atomic<int>        _submitting{0};     // submit() calls that may still touch _queue
+      std::atomic<int64_t>    _pending_cost{0};
+      std::atomic<int64_t>    _pending_bytes{0};
+
+      // Parking for idle workers only; the submit path touches it when someone sleeps.
+      std::mutex              _park_mutex;
+      std::condition_variable _park_cv;
+      std::atomic<int>        _parked{0};
+
+      std::atomic<uint64_t>   _next_request_id{1};
+      std::atomic<uint64_t>   _submitted{0};
+      std::atomic<uint64_t>   _completed{0};
+      std::atomic<uint64_t>   _shed_full{0};
+      std::atomic<uint64_t>   _shed_budget{0};
+      std::atomic<uint64_t>   _shed_memory{0};
+      std::atomic<uint64_t>   _downgraded{0};
+      std::atomic<uint64_t>   _reloads{0};
+      std::atomic<uint64_t>   _wait_count{0};
+      std::atomic<uint64_t>   _wait_sum_us{0};
+      std::atomic<uint64_t>   _wait_max_us{0};
+      std::atomic<uint64_t>   _wait_buckets[kWaitBuckets + 1] = {};
+
+      int                     _last_error_code = 0;
+      std::string             _last_error_message;
+  };
+
+}
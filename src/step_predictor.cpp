@@ -0,0 +1,168 @@
+#include "step_predictor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace QWEN3TTS {
+
+namespace {
+
+StepModel FitLinear(const std::vector<const StepSample*>& xs)
+{
+    StepModel m;
+    m.samples = static_cast<int64_t>(xs.size());
+    if (xs.empty()) return m;
+    const double n = static_cast<double>(xs.size());
+    double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+    for (const StepSample* s : xs) {
+        const double x = static_cast<double>(s->text_tokens);
+        const double y = static_cast<double>(s->frames);
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+    const double den = n * sxx - sx * sx;
+    if (std::abs(den) > 1e-9) {
+        m.slope = (n * sxy - sx * sy) / den;
+        m.intercept = (sy - m.slope * sx) / n;
+    } else {
+        // All prompts the same length: keep the default intercept, scale the slope.
+        m.slope = std::max(0.0, (sy / n - m.intercept) / std::max(1.0, sx / n));
+    }
+    if (m.slope < 0.0) {
+        m.slope = 0.0;
+        m.intercept = sy / n;
+    }
+    double se = 0.0;
+    for (const StepSample* s : xs) {
+        const double pred = std::max(1.0, m.intercept + m.slope * static_cast<double>(s->text_tokens));
+        const double r = (static_cast<double>(s->frames) - pred) / pred;
+        se += r * r;
+    }
+    m.rel_sd = std::sqrt(se / n);
+    return m;
+}
+
+}  // namespace
+
+const StepModel& StepPredictor::model(int64_t lang) const
+{
+    auto it = per_lang.find(lang);
+    return it != per_lang.end() ? it->second : pooled;
+}
+
+StepEstimate StepPredictor::predict(int64_t text_tokens, int64_t lang) const
+{
+    const StepModel& m = model(lang);
+    const double mean = std::max(1.0, m.intercept + m.slope * static_cast<double>(std::max<int64_t>(0, text_tokens)));
+    const double cap = mean * (1.0 + cap_sigmas * std::max(0.0, m.rel_sd)) + cap_pad_frames;
+    const int limit = std::max(1, max_frames);
+    StepEstimate e;
+    e.expected = std::min(limit, static_cast<int>(std::ceil(mean)));
+    e.cap = calibrated ? std::min(limit, std::max(e.expected, static_cast<int>(std::ceil(cap)))) : limit;
+    return e;
+}
+
+StepPredictor StepPredictor::Fit(const std::vector<StepSample>& samples, int min_samples)
+{
+    StepPredictor p;
+    std::vector<const StepSample*> all;
+    std::map<int64_t, std::vector<const StepSample*>> by_lang;
+    for (const StepSample& s : samples) {
+        if (s.frames <= 0 || s.text_tokens <= 0) continue;
+        all.push_back(&s);
+        by_lang[s.lang].push_back(&s);
+    }
+    // Too few observations leave the built-in guess, which must not become a cap.
+    if (static_cast<int>(all.size()) < std::max(2, min_samples)) return p;
+    p.pooled = FitLinear(all);
+    p.calibrated = true;
+    for (const auto& [lang, xs] : by_lang) {
+        if (static_cast<int>(xs.size()) >= std::max(2, min_samples)) p.per_lang[lang] = FitLinear(xs);
+    }
+    return p;
+}
+
+bool StepPredictor::loadFile(const std::string& path, std::string* error)
+{
+    std::ifstream in(path);
+    if (!in) {
+        if (error) *error = "Failed to open step predictor file: " + path;
+        return false;
+    }
+    StepPredictor p;
+    std::string line;
+    int line_no = 0;
+    while (std::getline(in, line)) {
+        ++line_no;
+        const size_t hash = line.find('#');
+        if (hash != std::string::npos) line.resize(hash);
+        std::istringstream ss(line);
+        std::string key;
+        if (!(ss >> key)) continue;
+        bool ok = true;
+        if (key == "cap_sigmas") {
+            ok = static_cast<bool>(ss >> p.cap_sigmas) && p.cap_sigmas >= 0.0;
+        } else if (key == "cap_pad_frames") {
+            ok = static_cast<bool>(ss >> p.cap_pad_frames) && p.cap_pad_frames >= 0;
+        } else if (key == "max_frames") {
+            ok = static_cast<bool>(ss >> p.max_frames) && p.max_frames > 0;
+        } else if (key == "default" || key == "lang") {
+            int64_t lang = -1;
+            StepModel m;
+            if (key == "lang") ok = static_cast<bool>(ss >> lang);
+            ok = ok && static_cast<bool>(ss >> m.intercept >> m.slope >> m.rel_sd) && m.slope >= 0.0 && m.rel_sd >= 0.0;
+            if (ok && !(ss >> m.samples)) m.samples = 0;
+            if (ok && key == "lang") p.per_lang[lang] = m;
+            if (ok && key == "default") p.pooled = m;
+            p.calibrated = p.calibrated || ok;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            if (error) *error = "Invalid step predictor entry at " + path + ":" + std::to_string(line_no);
+            return false;
+        }
+    }
+    if (!p.calibrated) {
+        if (error) *error = "Step predictor file has no default or lang entry: " + path;
+        return false;
+    }
+    *this = std::move(p);
+    if (error) error->clear();
+    return true;
+}
+
+bool StepPredictor::saveFile(const std::string& path, std::string* error) const
+{
+    std::ofstream out(path, std::ios::trunc);
+    if (!out) {
+        if (error) *error = "Failed to open step predictor file: " + path;
+        return false;
+    }
+    auto put = [&](const StepModel& m) {
+        out << ' ' << m.intercept << ' ' << m.slope << ' ' << m.rel_sd << ' ' << m.samples << '\n';
+    };
+    out << std::setprecision(6);
+    out << "# frames = intercept + slope * text_tokens; cap = frames * (1 + cap_sigmas * rel_sd) + cap_pad_frames\n";
+    out << "cap_sigmas " << cap_sigmas << '\n';
+    out << "cap_pad_frames " << cap_pad_frames << '\n';
+    out << "max_frames " << max_frames << '\n';
+    out << "default";
+    put(pooled);
+    for (const auto& [lang, m] : per_lang) {
+        out << "lang " << lang;
+        put(m);
+    }
+    if (!out.good()) {
+        if (error) *error = "Failed to write step predictor file: " + path;
+        return false;
+    }
+    return true;
+}
+
+}
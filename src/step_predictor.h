@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace QWEN3TTS {
+
+  // VoiceTokenizer::BuildVoiceDesignIds wraps the text in 3 prefix + 5 suffix template tokens.
+  constexpr int64_t kVoiceDesignTemplateTokens = 8;
+
+  // frames ~= intercept + slope * text_tokens, with the relative residual spread of the fit.
+  struct StepModel {
+    double                  intercept = 8.0;
+    double                  slope = 2.5;
+    double                  rel_sd = 0.25;
+    int64_t                 samples = 0;
+  };
+
+  struct StepEstimate {
+    int                     expected = 0;   // mean frame count, used for reservations and admission cost
+    int                     cap = 0;        // safety cap: expected * (1 + cap_sigmas * rel_sd) + cap_pad_frames,
+                                            // max_frames until the predictor is calibrated
+  };
+
+  // One (language, prompt length, generated frames) observation from a finished request.
+  struct StepSample {
+    int64_t                 lang = -1;
+    int64_t                 text_tokens = 0;
+    int                     frames = 0;
+  };
+
+  // Per-language linear frame-count model. Languages without their own fit use the
+  // pooled model. Text format, one entry per line, '#' starts a comment:
+  //   cap_sigmas <x> | cap_pad_frames <n> | max_frames <n>
+  //   default <intercept> <slope> <rel_sd> <samples>
+  //   lang <codec_lang_id> <intercept> <slope> <rel_sd> <samples>
+  class StepPredictor {
+  public:
+      StepEstimate predict(int64_t text_tokens, int64_t lang) const;
+      const StepModel& model(int64_t lang) const;
+
+      bool loadFile(const std::string& path, std::string* error);
+      bool saveFile(const std::string& path, std::string* error) const;
+
+      // Least-squares fit per language (at least min_samples observations each) plus a pooled fit;
+      // with fewer than min_samples usable samples overall the result stays uncalibrated.
+      static StepPredictor Fit(const std::vector<StepSample>& samples, int min_samples = 8);
+
+      double                  cap_sigmas = 3.0;
+      int                     cap_pad_frames = 16;
+      int                     max_frames = 2000;
+      // Set by loadFile() and Fit(). The built-in model is only a rough guess, so until then
+      // it sizes buffers and admission cost but never cuts an utterance short.
+      bool                    calibrated = false;
+      StepModel               pooled;
+      std::map<int64_t, StepModel> per_lang;
+  };
+
+}
@@ -0,0 +1,237 @@
+#include "step_scheduler.h"
+#include "logger.h"
+#include "metrics.h"
+
+#include <algorithm>
+
+namespace QWEN3TTS {
+
+namespace {
+
+double MsBetween(std::chrono::steady_clock::time_point a, std::chrono::steady_clock::time_point b)
+{
+    return std::chrono::duration<double, std::milli>(b - a).count();
+}
+
+}  // namespace
+
+StepScheduler::~StepScheduler()
+{
+    stop();
+}
+
+bool StepScheduler::start(const StepSchedulerConfig& cfg)
+{
+    _last_error_code = 0;
+    _last_error_message.clear();
+    if (_running.load()) return true;
+    _config = cfg;
+    _config.max_active = std::max(1, _config.max_active);
+    _config.prefill_chunk_tokens = std::max(0, _config.prefill_chunk_tokens);
+    _config.decode_frames_per_turn = std::max(1, _config.decode_frames_per_turn);
+    _config.vocoder_window_frames = std::max(0, _config.vocoder_window_frames);
+    if (_config.capacity == 0) _config.capacity = 1;
+
+    auto voice = std::make_unique<Voice>();
+    if (!voice->load(_config.tts) || (_config.warmup && !voice->warmup())) {
+        _last_error_code = voice->lastErrorCode();
+        _last_error_message = voice->lastErrorMessage();
+        return false;
+    }
+    if (_config.prefill_chunk_tokens > 0 && !voice->supportsChunkedPrefill()) {
+        QWEN3TTS_LOG_WARN("scheduler") << "no talker_prefill_chunk export; prompts are prefilled in one turn";
+    }
+    _voice = std::move(voice);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = false;
+    }
+    _running.store(true);
+    _thread = std::thread(&StepScheduler::loop, this);
+    return true;
+}
+
+void StepScheduler::stop()
+{
+    if (!_running.exchange(false)) return;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _cv.notify_all();
+    if (_thread.joinable()) _thread.join();
+    _voice.reset();
+}
+
+int StepScheduler::submit(const GenerationParams& params, std::future<std::vector<float>>* result)
+{
+    auto shed = [&](int code) {
+        Metrics::instance().recordError(code);
+        std::promise<std::vector<float>> p;
+        p.set_value(std::vector<float>{static_cast<float>(code)});
+        if (result) *result = p.get_future();
+        return code;
+    };
+    if (!_running.load(std::memory_order_acquire)) return shed(-1503);
+    _submitted.fetch_add(1, std::memory_order_relaxed);
+
+    auto job = std::make_unique<Job>();
+    job->params = params;
+    if (job->params.request_id == 0) job->params.request_id = _next_request_id.fetch_add(1, std::memory_order_relaxed);
+    job->enqueued = std::chrono::steady_clock::now();
+    std::future<std::vector<float>> future = job->done.get_future();
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_stopping) return shed(-1503);
+        if (_waiting.size() >= _config.capacity) {
+            _shed_full.fetch_add(1, std::memory_order_relaxed);
+            return shed(-1501);
+        }
+        _waiting.push_back(std::move(job));
+    }
+    Metrics::instance().queue_depth.add(1);
+    _cv.notify_one();
+    if (result) *result = std::move(future);
+    return 0;
+}
+
+void StepScheduler::complete(Job* job, std::vector<float> pcm)
+{
+    if (_config.on_complete) {
+        RequestTiming timing;
+        timing.request_id = job->params.request_id;
+        timing.queue_ms = MsBetween(job->enqueued, job->admitted);
+        timing.service_ms = MsBetween(job->admitted, std::chrono::steady_clock::now());
+        timing.error_code = (pcm.size() == 1 && pcm[0] < 0.0f) ? static_cast<int>(pcm[0]) : 0;
+        _config.on_complete(timing);
+    }
+    _completed.fetch_add(1, std::memory_order_relaxed);
+    Metrics::instance().in_flight.add(-1);
+    job->done.set_value(std::move(pcm));
+}
+
+void StepScheduler::loop()
+{
+    std::vector<std::unique_ptr<Job>> active;
+    std::vector<std::unique_ptr<Job>> admitted;
+    size_t prefill_cursor = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (active.empty()) {
+                _cv.wait(lock, [&] { return _stopping || !_waiting.empty(); });
+                if (_waiting.empty()) return;
+            }
+            while (static_cast<int>(active.size() + admitted.size()) < _config.max_active && !_waiting.empty()) {
+                admitted.push_back(std::move(_waiting.front()));
+                _waiting.pop_front();
+            }
+        }
+        // beginGeneration and completion callbacks run unlocked so submit() and stats() never wait on them.
+        for (auto& slot : admitted) {
+            Metrics::instance().queue_depth.add(-1);
+            Metrics::instance().in_flight.add(1);
+            Job* job = slot.get();
+            job->admitted = std::chrono::steady_clock::now();
+            if (job->params.vocoder_window_frames <= 0 && _config.vocoder_window_frames > 0) {
+                job->params.vocoder_window_frames = _config.vocoder_window_frames;
+            }
+            if (job->params.vocoder_window_frames > 0 && !job->params.on_audio) {
+                // Windows go out from stepGeneration as frames become final; the result is
+                // assembled here instead of in one vocoder run at the end.
+                job->collect_pcm = true;
+                job->params.on_audio = [job](const float* samples, size_t n) {
+                    job->pcm.insert(job->pcm.end(), samples, samples + n);
+                    return true;
+                };
+            }
+            // Only the prompt embeddings are built here; the talker prefill runs in turns.
+            if (!_voice->beginGeneration(job->params, &job->state, _config.prefill_chunk_tokens)) {
+                complete(job, {static_cast<float>(_voice->lastErrorCode())});
+            } else {
+                active.push_back(std::move(slot));
+            }
+        }
+        admitted.clear();
+        _active.store(active.size(), std::memory_order_relaxed);
+
+        // One prefill chunk per round, rotating between prefilling requests.
+        bool prefilled = false;
+        for (size_t n = 0; n < active.size() && !prefilled; ++n) {
+            const size_t i = (prefill_cursor + n) % active.size();
+            Job* job = active[i].get();
+            if (!job->state.prefilling()) continue;
+            const int rc = _voice->prefillGeneration(&job->state);
+            _prefill_chunks.fetch_add(1, std::memory_order_relaxed);
+            prefilled = true;
+            prefill_cursor = i + 1;
+            if (rc < 0) {
+                complete(job, {static_cast<float>(rc)});
+                active[i].reset();
+            } else if (rc == 1) {
+                job->last_turn = std::chrono::steady_clock::now();
+            }
+        }
+
+        for (auto& slot : active) {
+            Job* job = slot.get();
+            if (!job || job->state.prefilling()) continue;
+            const auto now = std::chrono::steady_clock::now();
+            if (job->state.framesGenerated() > 0) {
+                const uint64_t gap_us = static_cast<uint64_t>(MsBetween(job->last_turn, now) * 1000.0);
+                uint64_t prev = _max_gap_us.load(std::memory_order_relaxed);
+                while (gap_us > prev && !_max_gap_us.compare_exchange_weak(prev, gap_us, std::memory_order_relaxed)) {
+                }
+            }
+            const int rc = _voice->stepGeneration(&job->state, _config.decode_frames_per_turn);
+            _decode_turns.fetch_add(1, std::memory_order_relaxed);
+            job->last_turn = std::chrono::steady_clock::now();
+            if (rc < 0) {
+                complete(job, {static_cast<float>(rc)});
+                slot.reset();
+            } else if (rc == 1) {
+                // Only the frames not yet streamed are vocoded here.
+                std::vector<float> pcm = _voice->finishGeneration(&job->state);
+                if (job->collect_pcm && _voice->lastErrorCode() == 0) pcm = std::move(job->pcm);
+                complete(job, std::move(pcm));
+                slot.reset();
+            }
+        }
+        active.erase(std::remove(active.begin(), active.end(), nullptr), active.end());
+        if (prefill_cursor > active.size()) prefill_cursor = 0;
+        _active.store(active.size(), std::memory_order_relaxed);
+    }
+}
+
+StepSchedulerStats StepScheduler::stats() const
+{
+    StepSchedulerStats st;
+    st.submitted = _submitted.load(std::memory_order_relaxed);
+    st.completed = _completed.load(std::memory_order_relaxed);
+    st.shed_queue_full = _shed_full.load(std::memory_order_relaxed);
+    st.prefill_chunks = _prefill_chunks.load(std::memory_order_relaxed);
+    st.decode_turns = _decode_turns.load(std::memory_order_relaxed);
+    st.active = _active.load(std::memory_order_relaxed);
+    st.max_decode_gap_ms = _max_gap_us.load(std::memory_order_relaxed) / 1000.0;
+    std::lock_guard<std::mutex> lock(_mutex);
+    st.waiting = _waiting.size();
+    return st;
+}
+
+const ModelDims& StepScheduler::dims() const
+{
+    static const ModelDims kDefault;
+    return _voice ? _voice->dims() : kDefault;
+}
+
+int StepScheduler::lastErrorCode() const
+{
+    return _last_error_code;
+}
+
+const std::string& StepScheduler::lastErrorMessage() const
+{
+    return _last_error_message;
+}
+
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "generation_state.h"
+#include "request_queue.h"
+#include "voice.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace QWEN3TTS {
+
+  struct StepSchedulerConfig {
+    TtsConfig               tts;
+    int                     max_active = 4;            // requests interleaved on the engine
+    int                     prefill_chunk_tokens = 64; // prompt tokens per prefill turn, 0 = whole prompt
+    int                     decode_frames_per_turn = 1;
+    // Vocoder window for requests that leave vocoder_window_frames at 0: their audio is then
+    // vocoded window by window between decode turns, and a finishing request only decodes its
+    // last frames. 0 keeps one whole-utterance vocoder run, which stalls every other decode.
+    int                     vocoder_window_frames = 64;
+    size_t                  capacity = 64;             // waiting requests beyond the active set
+    bool                    warmup = true;
+    std::function<void(const RequestTiming&)> on_complete;
+  };
+
+  struct StepSchedulerStats {
+    uint64_t                submitted = 0;
+    uint64_t                completed = 0;
+    uint64_t                shed_queue_full = 0;
+    uint64_t                prefill_chunks = 0;
+    uint64_t                decode_turns = 0;
+    size_t                  waiting = 0;
+    size_t                  active = 0;
+    // Longest time a decoding request waited between two of its turns: the stall a newly
+    // admitted prompt chunk (or another request's vocoder windows) imposed on running decodes.
+    double                  max_decode_gap_ms = 0.0;
+  };
+
+  // Shares one Voice between several requests through the step API. Each round gives every
+  // decoding request decode_frames_per_turn frames and at most one request a prefill chunk,
+  // so admitting a long prompt delays running decodes by one chunk instead of a whole prefill.
+  class StepScheduler {
+  public:
+      StepScheduler() = default;
+      ~StepScheduler();
+      StepScheduler(const StepScheduler&) = delete;
+      StepScheduler& operator=(const StepScheduler&) = delete;
+
+      bool start(const StepSchedulerConfig& cfg);
+      // Finishes waiting and active requests, then joins the scheduler thread.
+      void stop();
+
+      // Same contract as RequestQueue::submit: 0 and a pending future, or -1501 (full) /
+      // -1503 (not running) with the future already holding the error PCM.
+      int submit(const GenerationParams& params, std::future<std::vector<float>>* result);
+
+      StepSchedulerStats stats() const;
+      const ModelDims& dims() const;
+      int lastErrorCode() const;
+      const std::string& lastErrorMessage() const;
+
+  private:
+      struct Job {
+          GenerationParams params;
+          GenerationState state;
+          std::chrono::steady_clock::time_point enqueued;
+          std::chrono::steady_clock::time_point admitted;
+          std::chrono::steady_clock::time_point last_turn;
+          std::promise<std::vector<float>> done;
+          std::vector<float> pcm;        // streamed windows when the caller set no on_audio
+          bool collect_pcm = false;
+      };
+
+      void loop();
+      void complete(Job* job, std::vector<float> pcm);
+
+  private:
+      StepSchedulerConfig     _config;
+      std::unique_ptr<Voice>  _voice;
+      std::thread             _thread;
+      std::atomic<bool>       _running{false};
+
+      mutable std::mutex      _mutex;
+      std::condition_variable _cv;
+      std::deque<std::unique_ptr<Job>> _waiting;
+      bool                    _stopping = false;
+
+      std::atomic<uint64_t>   _next_request_id{1};
+      std::atomic<uint64_t>   _submitted{0};
+      std::atomic<uint64_t>   _completed{0};
+      std::atomic<uint64_t>   _shed_full{0};
+      std::atomic<uint64_t>   _prefill_chunks{0};
+      std::atomic<uint64_t>   _decode_turns{0};
+      std::atomic<size_t>     _active{0};
+      std::atomic<uint64_t>   _max_gap_us{0};
+
+      int                     _last_error_code = 0;
+      std::string             _last_error_message;
+  };
+
+}
@@ -0,0 +1,139 @@
+#include "stop_policy.h"
+#include "voice.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <complex>
+
+namespace QWEN3TTS {
+
+namespace {
+
+constexpr int kFftSize = 512;
+constexpr int kFftBits = 9;
+constexpr double kPi = 3.14159265358979323846;
+
+struct FftTables {
+    std::array<float, kFftSize> window;
+    std::array<std::complex<float>, kFftSize / 2> twiddle;
+    std::array<uint16_t, kFftSize> bitrev;
+
+    FftTables()
+    {
+        for (int i = 0; i < kFftSize; ++i) {
+            window[i] = static_cast<float>(0.5 - 0.5 * std::cos(2.0 * kPi * i / kFftSize));
+            uint16_t r = 0;
+            for (int b = 0; b < kFftBits; ++b) r = static_cast<uint16_t>((r << 1) | ((i >> b) & 1));
+            bitrev[i] = r;
+        }
+        for (int i = 0; i < kFftSize / 2; ++i) {
+            twiddle[i] = std::polar(1.0f, static_cast<float>(-2.0 * kPi * i / kFftSize));
+        }
+    }
+};
+
+const FftTables& Tables()
+{
+    static const FftTables tables;
+    return tables;
+}
+
+// In-place radix-2 FFT of a bit-reversal-ordered buffer.
+void Fft(std::array<std::complex<float>, kFftSize>& x)
+{
+    const FftTables& t = Tables();
+    for (int len = 2; len <= kFftSize; len <<= 1) {
+        const int half = len >> 1;
+        const int stride = kFftSize / len;
+        for (int i = 0; i < kFftSize; i += len) {
+            for (int j = 0; j < half; ++j) {
+                const std::complex<float> u = x[i + j];
+                const std::complex<float> v = x[i + j + half] * t.twiddle[j * stride];
+                x[i + j] = u + v;
+                x[i + j + half] = u - v;
+            }
+        }
+    }
+}
+
+// Spectral flatness of one Hann-windowed segment, DC bin excluded.
+float SegmentFlatness(const float* pcm, size_t n)
+{
+    const FftTables& t = Tables();
+    std::array<std::complex<float>, kFftSize> buf;
+    for (int i = 0; i < kFftSize; ++i) {
+        const float v = static_cast<size_t>(i) < n ? pcm[i] * t.window[i] : 0.0f;
+        buf[t.bitrev[i]] = std::complex<float>(v, 0.0f);
+    }
+    Fft(buf);
+    constexpr float kFloor = 1e-12f;
+    double log_sum = 0.0;
+    double sum = 0.0;
+    for (int k = 1; k <= kFftSize / 2; ++k) {
+        const float p = std::norm(buf[k]) + kFloor;
+        log_sum += std::log(p);
+        sum += p;
+    }
+    constexpr double bins = kFftSize / 2;
+    return static_cast<float>(std::exp(log_sum / bins) / (sum / bins));
+}
+
+}  // namespace
+
+void SilenceStopPolicy::configure(const GenerationParams& params)
+{
+    _stop_frames = std::max(0, params.silence_stop_frames);
+    _min_steps = std::max(0, params.silence_stop_min_steps);
+    _probe_frames = std::max(1, params.silence_probe_frames);
+    _context_frames = std::max(0, params.silence_probe_context_frames);
+    _keep_frames = std::max(0, params.silence_keep_frames);
+    _rms_db = params.silence_rms_db;
+    _flatness = params.silence_flatness;
+    _trailing_silent = 0;
+}
+
+FrameFeatures SilenceStopPolicy::Analyze(const float* pcm, size_t samples)
+{
+    FrameFeatures f;
+    if (!pcm || samples == 0) return f;
+    double energy = 0.0;
+    for (size_t i = 0; i < samples; ++i) energy += static_cast<double>(pcm[i]) * pcm[i];
+    const double rms = std::sqrt(energy / static_cast<double>(samples));
+    f.rms_db = static_cast<float>(20.0 * std::log10(rms + 1e-9));
+
+    // Average over half-overlapping segments; a frame shorter than one segment is zero-padded.
+    const size_t hop = kFftSize / 2;
+    double flat = 0.0;
+    int segments = 0;
+    for (size_t off = 0; off == 0 || off + kFftSize <= samples; off += hop) {
+        flat += SegmentFlatness(pcm + off, samples - off);
+        ++segments;
+    }
+    f.flatness = static_cast<float>(flat / segments);
+    return f;
+}
+
+bool SilenceStopPolicy::isSilent(const FrameFeatures& f) const
+{
+    constexpr float kNoiseMarginDb = 12.0f;
+    return f.rms_db <= _rms_db || (f.rms_db <= _rms_db + kNoiseMarginDb && f.flatness >= _flatness);
+}
+
+void SilenceStopPolicy::observe(const float* pcm, size_t samples, int frames)
+{
+    if (frames <= 0 || samples == 0) return;
+    const size_t per_frame = samples / static_cast<size_t>(frames);
+    if (per_frame == 0) return;
+    for (int i = 0; i < frames; ++i) {
+        const FrameFeatures f = Analyze(pcm + static_cast<size_t>(i) * per_frame, per_frame);
+        _trailing_silent = isSilent(f) ? _trailing_silent + 1 : 0;
+    }
+}
+
+bool SilenceStopPolicy::shouldStop(int generated_frames) const
+{
+    return enabled() && generated_frames >= _min_steps && _trailing_silent >= _stop_frames;
+}
+
+}
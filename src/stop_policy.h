@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace QWEN3TTS {
+
+  struct GenerationParams;
+
+  // Loudness and noisiness of one codec frame of audio.
+  struct FrameFeatures {
+      float                   rms_db = -120.0f;   // dBFS
+      float                   flatness = 0.0f;    // spectral flatness, 0 = tonal .. 1 = white noise
+  };
+
+  // Trailing-silence detector fed with incrementally vocoded audio. A frame counts as
+  // silent when it is below silence_rms_db, or within 12 dB of it and noise-like
+  // (flatness >= silence_flatness), which catches breath/hiss tails the model babbles into.
+  class SilenceStopPolicy {
+  public:
+      void configure(const GenerationParams& params);
+      bool enabled() const { return _stop_frames > 0; }
+      int probeFrames() const { return _probe_frames; }
+      int contextFrames() const { return _context_frames; }
+      int keepFrames() const { return _keep_frames; }
+
+      // Analyses `frames` consecutive codec frames held in `pcm` (equal split of `samples`).
+      void observe(const float* pcm, size_t samples, int frames);
+      bool shouldStop(int generated_frames) const;
+
+      int trailingSilentFrames() const { return _trailing_silent; }
+      void setTrailingSilentFrames(int frames) { _trailing_silent = frames; }
+
+      bool isSilent(const FrameFeatures& f) const;
+      static FrameFeatures Analyze(const float* pcm, size_t samples);
+
+  private:
+      int                     _stop_frames = 0;
+      int                     _min_steps = 0;
+      int                     _probe_frames = 8;
+      int                     _context_frames = 4;
+      int                     _keep_frames = 2;
+      float                   _rms_db = -48.0f;
+      float                   _flatness = 0.45f;
+      int                     _trailing_silent = 0;
+  };
+
+}
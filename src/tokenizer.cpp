@@ -1,16 +1,138 @@
 #include "tokenizer.h"
+#include "logger.h"
+#include "metrics.h"
 #include "utils.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cctype>
 #include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <limits>
+#include <map>
+#include <mutex>
 #include <stdexcept>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define QWEN3TTS_HAVE_SSE2 1
+#endif
 
 namespace QWEN3TTS {
 
+namespace {
+
+// Pre-tokenizer classes; PreTokenize must classify exactly like RegexLikeSplit does with
+// DecodeUtf8At + the QWEN3TTSUTILS predicates.
+enum CharClass : uint8_t { kOther = 0, kLetter, kNumber, kNewline, kSpace };
+
+uint8_t ClassOf(uint32_t cp) {
+  if (QWEN3TTSUTILS::IsLetter(cp)) return kLetter;
+  if (QWEN3TTSUTILS::IsNumber(cp)) return kNumber;
+  if (QWEN3TTSUTILS::IsNewline(cp)) return kNewline;
+  if (QWEN3TTSUTILS::IsWhitespaceNonNewline(cp)) return kSpace;
+  return kOther;
+}
+
+struct AsciiClassTable {
+  std::array<uint8_t, 128> cls{};
+  AsciiClassTable() {
+    for (uint32_t c = 0; c < 128; ++c) cls[c] = ClassOf(c);
+  }
+};
+
+const AsciiClassTable& AsciiClasses() {
+  static const AsciiClassTable table;
+  return table;
+}
+
+// Class of the code point at i and its end. Every code point >= 128 is a letter, so a
+// well-formed lead byte decides the class without decoding; overlong forms that decode
+// below 128, stray continuation bytes and truncated tails take DecodeUtf8At.
+inline uint8_t ClassAt(const std::string& s, size_t i, size_t* next) {
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(s.data());
+  const size_t n = s.size();
+  const unsigned char c0 = p[i];
+  if (c0 < 0x80) {
+    *next = i + 1;
+    return AsciiClasses().cls[c0];
+  }
+  if ((c0 >> 5) == 0x6 && i + 1 < n && c0 >= 0xC2) {
+    *next = i + 2;
+    return kLetter;
+  }
+  if ((c0 >> 4) == 0xE && i + 2 < n && (c0 != 0xE0 || (p[i + 1] & 0x3F) >= 2)) {
+    *next = i + 3;
+    return kLetter;
+  }
+  if ((c0 >> 3) == 0x1E && i + 3 < n && (c0 != 0xF0 || (p[i + 1] & 0x3F) != 0 || (p[i + 2] & 0x3F) >= 2)) {
+    *next = i + 4;
+    return kLetter;
+  }
+  return ClassOf(QWEN3TTSUTILS::DecodeUtf8At(s, i, next));
+}
+
+// Number of leading ASCII letters in the 16 bytes at p.
+inline size_t AsciiLetterPrefix16(const char* p) {
+#if QWEN3TTS_HAVE_SSE2
+  const __m128i v = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), _mm_set1_epi8(0x20));
+  const __m128i t = _mm_sub_epi8(v, _mm_set1_epi8('a'));
+  const __m128i is_letter = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(25)), t);
+  const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(is_letter));
+  size_t k = 0;
+  while (k < 16 && (mask & (1u << k))) ++k;
+  return k;
+#else
+  size_t k = 0;
+  while (k < 16 && QWEN3TTSUTILS::IsAsciiLetter(static_cast<unsigned char>(p[k]))) ++k;
+  return k;
+#endif
+}
+
+// Pre-token chunks per EncodeBatchSafe work item: a few KB of text, enough to amortize the
+// atomic fetch, small enough to balance one long document over many threads.
+constexpr size_t kBatchBlockChunks = 256;
+
+// Runs fn(i) for i in [0, n) on up to `workers` threads, the caller included. Stops handing
+// out items once fn returns false; returns false if any call did.
+template <typename Fn>
+bool ParallelFor(size_t n, size_t workers, Fn fn) {
+  std::atomic<size_t> next{0};
+  std::atomic<bool> failed{false};
+  auto run = [&]() {
+    while (!failed.load(std::memory_order_relaxed)) {
+      const size_t i = next.fetch_add(1, std::memory_order_relaxed);
+      if (i >= n) break;
+      if (!fn(i)) failed.store(true, std::memory_order_relaxed);
+    }
+  };
+  std::vector<std::thread> pool;
+  for (size_t t = 1; t < std::min(workers, n); ++t) pool.emplace_back(run);
+  run();
+  for (std::thread& t : pool) t.join();
+  return !failed.load();
+}
+
+// End of the run of `cls` code points starting at e.
+inline size_t RunEnd(const std::string& s, size_t e, uint8_t cls) {
+  const size_t n = s.size();
+  while (e < n) {
+    if (cls == kLetter && n - e >= 16) {
+      const size_t k = AsciiLetterPrefix16(s.data() + e);
+      e += k;
+      if (k > 0) continue;
+    }
+    size_t next = e;
+    if (ClassAt(s, e, &next) != cls) break;
+    e = next;
+  }
+  return e;
+}
+
+}  // namespace
+
 void VoiceTokenizer::SkipWs(const std::string& s, size_t* i) {
   while (*i < s.size() && std::isspace(static_cast<unsigned char>(s[*i]))) ++(*i);
 }
@@ -124,7 +246,9 @@ void VoiceTokenizer::InitByteEncoder() {
   for (size_t i = 0; i < bs.size(); ++i) {
     std::string ch;
     QWEN3TTSUTILS::AppendUtf8(static_cast<uint32_t>(cs[i]), ch);
-    byte_encoder_[static_cast<size_t>(bs[i])] = ch;
+    ByteCode& code = byte_encoder_[static_cast<size_t>(bs[i])];
+    code.len = static_cast<uint8_t>(ch.size());
+    std::memcpy(code.bytes, ch.data(), ch.size());
   }
 }
 
@@ -137,7 +261,7 @@ void VoiceTokenizer::Load(
   InitByteEncoder();
   vocab_.clear();
   bpe_ranks_.clear();
-  bpe_cache_.clear();
+  for (BpeCache::Shard& shard : bpe_cache_->shards) shard.map.clear();
 
   const std::string vocab_json = QWEN3TTSUTILS::ReadAll((std::filesystem::path(tokenizer_dir) / vocab_file).string());
   if (vocab_json.empty()) {
@@ -214,8 +338,9 @@ void VoiceTokenizer::Load(
   auto it_user = vocab_.find("user");
   if (it_ass != vocab_.end()) assistant_id_ = it_ass->second;
   if (it_user != vocab_.end()) user_id_ = it_user->second;
-  auto newline_ids = Encode("\n");
-  if (newline_ids.empty()) {
+  std::vector<int64_t> newline_ids;
+  std::string encode_err;
+  if (!EncodeSafe("\n", &newline_ids, &encode_err) || newline_ids.empty()) {
     last_error_ = "Failed to encode newline token";
     return;
   }
@@ -254,24 +379,26 @@ std::vector<std::string> VoiceTokenizer::SplitUtf8Chars(const std::string& s) co
   return out;
 }
 
-std::string VoiceTokenizer::ByteEncodeToken(const std::string& tok) const {
-  std::string out;
-  out.reserve(tok.size() * 2);
+void VoiceTokenizer::ByteEncodeAppend(std::string_view tok, std::string* out) const {
   for (unsigned char b : tok) {
-    out += byte_encoder_[b];
+    const ByteCode& code = byte_encoder_[b];
+    out->append(code.bytes, code.len);
   }
-  return out;
 }
 
-std::string VoiceTokenizer::Bpe(const std::string& token) {
-  auto c = bpe_cache_.find(token);
-  if (c != bpe_cache_.end()) return c->second;
-  std::vector<std::string> word = SplitUtf8Chars(token);
-  if (word.size() == 1) {
-    bpe_cache_[token] = token;
-    return token;
+std::string VoiceTokenizer::Bpe(const std::string& token) const {
+  BpeCache::Shard& shard = bpe_cache_->shards[std::hash<std::string>{}(token) % BpeCache::kShards];
+  {
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto c = shard.map.find(token);
+    if (c != shard.map.end()) {
+      Metrics::instance().tokenizer_cache_hits.inc();
+      return c->second;
+    }
   }
-  while (true) {
+  Metrics::instance().tokenizer_cache_misses.inc();
+  std::vector<std::string> word = SplitUtf8Chars(token);
+  while (word.size() > 1) {
     int best_rank = std::numeric_limits<int>::max();
     int best_i = -1;
     for (int i = 0; i + 1 < static_cast<int>(word.size()); ++i) {
@@ -294,18 +421,20 @@ std::string VoiceTokenizer::Bpe(const std::string& token) {
       }
     }
     word.swap(nw);
-    if (word.size() == 1) break;
   }
   std::string out;
   for (size_t i = 0; i < word.size(); ++i) {
     if (i) out.push_back(' ');
     out += word[i];
   }
-  bpe_cache_[token] = out;
+  // Two threads may miss on the same token; both compute the same merges and emplace keeps one.
+  std::unique_lock<std::shared_mutex> lock(shard.mutex);
+  if (shard.map.size() >= BpeCache::kShardEntries) shard.map.clear();
+  shard.map.emplace(token, out);
   return out;
 }
 
-std::vector<std::string> VoiceTokenizer::RegexLikeSplit(const std::string& s) const {
+std::vector<std::string> VoiceTokenizer::RegexLikeSplit(const std::string& s) {
   std::vector<std::string> out;
   size_t i = 0;
   auto contraction_len = [&](size_t pos) -> size_t {
@@ -449,41 +578,233 @@ std::vector<std::string> VoiceTokenizer::RegexLikeSplit(const std::string& s) co
   return out;
 }
 
-std::vector<int64_t> VoiceTokenizer::Encode(const std::string& text) {
-  std::vector<int64_t> ids;
-  const auto chunks = RegexLikeSplit(text);
-  for (const auto& ch : chunks) {
-    const std::string be = ByteEncodeToken(ch);
+void VoiceTokenizer::PreTokenize(const std::string& s, std::vector<std::string_view>* out) {
+  out->clear();
+  const std::string_view sv(s);
+  const size_t n = s.size();
+  size_t i = 0;
+  auto contraction_len = [&](size_t pos) -> size_t {
+    if (s[pos] != '\'' || pos + 1 >= n) return 0;
+    const char a = static_cast<char>(std::tolower(static_cast<unsigned char>(s[pos + 1])));
+    if (a == 's' || a == 't' || a == 'm' || a == 'd') return 2;
+    if (pos + 2 >= n) return 0;
+    const char b = static_cast<char>(std::tolower(static_cast<unsigned char>(s[pos + 2])));
+    if ((a == 'r' && b == 'e') || (a == 'v' && b == 'e') || (a == 'l' && b == 'l')) return 3;
+    return 0;
+  };
+  while (i < n) {
+    const size_t c_len = contraction_len(i);
+    if (c_len > 0) {
+      out->push_back(sv.substr(i, c_len));
+      i += c_len;
+      continue;
+    }
+    size_t j = i;
+    const uint8_t cls = ClassAt(s, i, &j);
+    size_t e = j;
+    if (cls == kOther || cls == kSpace) {
+      size_t k = j;
+      if (j < n && ClassAt(s, j, &k) == kLetter) {
+        e = RunEnd(s, k, kLetter);
+        out->push_back(sv.substr(i, e - i));
+        i = e;
+        continue;
+      }
+    }
+    switch (cls) {
+      case kLetter:
+        e = RunEnd(s, j, kLetter);
+        break;
+      case kNumber:
+        break;
+      case kSpace: {
+        e = RunEnd(s, j, kSpace);
+        if (e < n) {
+          size_t next = e;
+          const uint8_t after = ClassAt(s, e, &next);
+          if (after == kNewline) {
+            e = RunEnd(s, next, kNewline);
+          } else if ((after == kLetter || after == kOther) && e - i > 1) {
+            // Leave the last space to prefix the following word or symbol run.
+            e -= 1;
+          }
+        }
+        break;
+      }
+      case kNewline:
+        e = RunEnd(s, j, kNewline);
+        break;
+      default:
+        e = RunEnd(s, j, kOther);
+        e = RunEnd(s, e, kNewline);
+        break;
+    }
+    out->push_back(sv.substr(i, e - i));
+    i = e;
+  }
+}
+
+bool VoiceTokenizer::EncodeChunks(
+    const std::string_view* chunks,
+    size_t count,
+    std::vector<int64_t>* ids,
+    std::string* error) const {
+  std::string be;
+  std::string tok;
+  for (size_t c = 0; c < count; ++c) {
+    const std::string_view ch = chunks[c];
+    be.clear();
+    ByteEncodeAppend(ch, &be);
     const std::string bpe = Bpe(be);
     size_t i = 0;
     while (i < bpe.size()) {
       size_t j = bpe.find(' ', i);
       if (j == std::string::npos) j = bpe.size();
-      const std::string tok = bpe.substr(i, j - i);
+      tok.assign(bpe, i, j - i);
       auto it = vocab_.find(tok);
       if (it != vocab_.end()) {
-        ids.push_back(it->second);
+        ids->push_back(it->second);
       } else if (endoftext_id_ >= 0) {
-        ids.push_back(endoftext_id_);
+        ids->push_back(endoftext_id_);
       } else {
-        last_error_ = "Tokenizer OOV and no unk token id";
-        return {};
+        if (error) *error = "Tokenizer OOV and no unk token id";
+        return false;
       }
       i = j + 1;
     }
   }
-  return ids;
+  return true;
+}
+
+bool VoiceTokenizer::EncodeSafe(const std::string& text, std::vector<int64_t>* ids, std::string* error) const {
+  ids->clear();
+  std::vector<std::string_view> chunks;
+  PreTokenize(text, &chunks);
+  if (!EncodeChunks(chunks.data(), chunks.size(), ids, error)) {
+    ids->clear();
+    return false;
+  }
+  if (error) error->clear();
+  return true;
+}
+
+bool VoiceTokenizer::EncodeBatchSafe(
+    const std::vector<std::string>& texts,
+    std::vector<std::vector<int64_t>>* ids,
+    int threads,
+    std::string* error) const {
+  ids->assign(texts.size(), {});
+  if (!last_error_.empty()) {
+    if (error) *error = last_error_;
+    return false;
+  }
+  const size_t workers =
+      threads > 0 ? static_cast<size_t>(threads) : std::max<size_t>(1, std::thread::hardware_concurrency());
+
+  std::vector<std::vector<std::string_view>> chunks(texts.size());
+  ParallelFor(texts.size(), workers, [&](size_t t) {
+    PreTokenize(texts[t], &chunks[t]);
+    return true;
+  });
+
+  struct Block {
+    size_t text;
+    size_t begin;
+    size_t end;
+  };
+  std::vector<Block> blocks;
+  for (size_t t = 0; t < texts.size(); ++t) {
+    for (size_t b = 0; b < chunks[t].size(); b += kBatchBlockChunks) {
+      blocks.push_back(Block{t, b, std::min(chunks[t].size(), b + kBatchBlockChunks)});
+    }
+  }
+  std::vector<std::vector<int64_t>> block_ids(blocks.size());
+  std::mutex error_mutex;
+  std::string first_error;
+  const bool ok = ParallelFor(blocks.size(), workers, [&](size_t b) {
+    const Block& blk = blocks[b];
+    std::string err;
+    if (EncodeChunks(chunks[blk.text].data() + blk.begin, blk.end - blk.begin, &block_ids[b], &err)) return true;
+    std::lock_guard<std::mutex> lock(error_mutex);
+    if (first_error.empty()) first_error = err;
+    return false;
+  });
+  if (!ok) {
+    ids->assign(texts.size(), {});
+    if (error) *error = first_error;
+    return false;
+  }
+  for (size_t b = 0; b < blocks.size(); ++b) {
+    std::vector<int64_t>& dst = (*ids)[blocks[b].text];
+    dst.insert(dst.end(), block_ids[b].begin(), block_ids[b].end());
+  }
+  if (error) error->clear();
+  return true;
+}
+
+std::shared_ptr<const VoiceTokenizer> VoiceTokenizer::LoadShared(
+    const std::string& tokenizer_dir,
+    const std::string& vocab_file,
+    const std::string& merges_file,
+    const std::string& tokenizer_config_file,
+    std::string* error) {
+  std::string key;
+  for (const std::string* file : {&vocab_file, &merges_file, &tokenizer_config_file}) {
+    const std::filesystem::path path = std::filesystem::path(tokenizer_dir) / *file;
+    std::error_code size_err;
+    std::error_code time_err;
+    const auto size = std::filesystem::file_size(path, size_err);
+    const auto mtime = std::filesystem::last_write_time(path, time_err);
+    key += path.string() + '|' + std::to_string(size_err ? 0 : size) + '|' +
+           std::to_string(time_err ? 0 : static_cast<long long>(mtime.time_since_epoch().count())) + '\n';
+  }
+
+  // Held across the load, so engines loading together wait for the first and share its result.
+  static std::mutex registry_mutex;
+  static std::map<std::string, std::weak_ptr<const VoiceTokenizer>> registry;
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  for (auto it = registry.begin(); it != registry.end();) {
+    it = it->second.expired() ? registry.erase(it) : std::next(it);
+  }
+  auto found = registry.find(key);
+  if (found != registry.end()) {
+    if (auto shared = found->second.lock()) {
+      if (error) error->clear();
+      return shared;
+    }
+  }
+  auto tok = std::make_shared<VoiceTokenizer>();
+  if (!tok->LoadSafe(tokenizer_dir, vocab_file, merges_file, tokenizer_config_file, error)) return nullptr;
+  registry[key] = tok;
+  return tok;
 }
 
 void VoiceTokenizer::BuildVoiceDesignIds(
     const std::string& text,
     const std::string& instruct,
     std::vector<int64_t>* input_ids,
-    std::vector<int64_t>* instruct_ids) {
-  auto text_ids = Encode(text);
-  auto instr_ids = Encode(instruct);
+    std::vector<int64_t>* instruct_ids) const {
+  std::string err;
+  if (!BuildVoiceDesignIdsSafe(text, instruct, input_ids, instruct_ids, &err)) {
+    QWEN3TTS_LOG_ERROR("tokenizer") << "BuildVoiceDesignIds failed: " << err;
+  }
+}
+
+bool VoiceTokenizer::BuildVoiceDesignIdsSafe(
+    const std::string& text,
+    const std::string& instruct,
+    std::vector<int64_t>* input_ids,
+    std::vector<int64_t>* instruct_ids,
+    std::string* error) const {
   input_ids->clear();
   instruct_ids->clear();
+  if (!last_error_.empty()) {
+    if (error) *error = last_error_;
+    return false;
+  }
+  std::vector<int64_t> text_ids;
+  std::vector<int64_t> instr_ids;
+  if (!EncodeSafe(text, &text_ids, error) || !EncodeSafe(instruct, &instr_ids, error)) return false;
   *input_ids = {im_start_id_, assistant_id_, newline_id_};
   input_ids->insert(input_ids->end(), text_ids.begin(), text_ids.end());
   input_ids->push_back(im_end_id_);
@@ -496,19 +817,6 @@ void VoiceTokenizer::BuildVoiceDesignIds(
   instruct_ids->insert(instruct_ids->end(), instr_ids.begin(), instr_ids.end());
   instruct_ids->push_back(im_end_id_);
   instruct_ids->push_back(newline_id_);
-}
-
-bool VoiceTokenizer::BuildVoiceDesignIdsSafe(
-    const std::string& text,
-    const std::string& instruct,
-    std::vector<int64_t>* input_ids,
-    std::vector<int64_t>* instruct_ids,
-    std::string* error) {
-  BuildVoiceDesignIds(text, instruct, input_ids, instruct_ids);
-  if (!last_error_.empty()) {
-    if (error) *error = last_error_;
-    return false;
-  }
   if (error) error->clear();
   return true;
 }
@@ -2,14 +2,30 @@
 
 #include <array>
 #include <cstdint>
+#include <memory>
+#include <shared_mutex>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
 namespace QWEN3TTS {
 
+// Load/LoadSafe fill the vocab and merge tables and must not race with anything. After that
+// every method is const and safe to call from any number of threads: the tables are read-only,
+// the BPE cache is sharded behind reader/writer locks and errors are returned, not stored.
 class VoiceTokenizer {
  public:
+  // Process-wide tokenizer for these files, shared by every caller (e.g. all RequestQueue
+  // engines) while any of them holds it. Keyed by path, size and mtime, so a bundle replaced
+  // in place is loaded again. Returns nullptr and fills error on failure.
+  static std::shared_ptr<const VoiceTokenizer> LoadShared(
+      const std::string& tokenizer_dir,
+      const std::string& vocab_file,
+      const std::string& merges_file,
+      const std::string& tokenizer_config_file,
+      std::string* error);
+
   void Load(
       const std::string& tokenizer_dir,
       const std::string& vocab_file = "vocab.json",
@@ -26,13 +42,31 @@ class VoiceTokenizer {
       const std::string& text,
       const std::string& instruct,
       std::vector<int64_t>* input_ids,
-      std::vector<int64_t>* instruct_ids);
+      std::vector<int64_t>* instruct_ids) const;
   bool BuildVoiceDesignIdsSafe(
       const std::string& text,
       const std::string& instruct,
       std::vector<int64_t>* input_ids,
       std::vector<int64_t>* instruct_ids,
-      std::string* error);
+      std::string* error) const;
+
+  // Plain text ids, without the chat template.
+  bool EncodeSafe(const std::string& text, std::vector<int64_t>* ids, std::string* error) const;
+  // Encodes every text into (*ids)[i]. Pre-tokenization runs one text per task, then the
+  // pre-token chunks of all texts are cut into blocks that threads pick up independently, so
+  // one long document spreads over all threads as well as many short ones do. Results are
+  // identical to EncodeSafe on each text. threads <= 0: hardware concurrency.
+  bool EncodeBatchSafe(
+      const std::vector<std::string>& texts,
+      std::vector<std::vector<int64_t>>* ids,
+      int threads,
+      std::string* error) const;
+
+  // Pre-tokenizer splits of the Qwen2 pattern. RegexLikeSplit is the reference code-point
+  // walk; PreTokenize is the fast path Encode uses (lead-byte classification, SSE2 scan of
+  // ASCII letter runs, spans into s instead of copies) and must return identical chunks.
+  static std::vector<std::string> RegexLikeSplit(const std::string& s);
+  static void PreTokenize(const std::string& s, std::vector<std::string_view>* out);
 
  private:
   static void SkipWs(const std::string& s, size_t* i);
@@ -43,23 +77,38 @@ class VoiceTokenizer {
 
   void InitByteEncoder();
   std::vector<std::string> SplitUtf8Chars(const std::string& s) const;
-  std::string ByteEncodeToken(const std::string& tok) const;
-  std::string Bpe(const std::string& token);
-  std::vector<std::string> RegexLikeSplit(const std::string& s) const;
-  std::vector<int64_t> Encode(const std::string& text);
+  void ByteEncodeAppend(std::string_view tok, std::string* out) const;
+  std::string Bpe(const std::string& token) const;
+  bool EncodeChunks(const std::string_view* chunks, size_t count, std::vector<int64_t>* ids, std::string* error) const;
+
+  // Token -> space-separated merges. Each shard holds at most kShardEntries and is cleared
+  // when full, so long runs over varied text keep a bounded cache.
+  struct BpeCache {
+    static constexpr size_t kShards = 64;
+    static constexpr size_t kShardEntries = 8192;
+    struct Shard {
+      std::shared_mutex mutex;
+      std::unordered_map<std::string, std::string> map;
+    };
+    std::array<Shard, kShards> shards;
+  };
 
  private:
   std::unordered_map<std::string, int64_t> vocab_;
   std::unordered_map<std::string, int> bpe_ranks_;
-  std::unordered_map<std::string, std::string> bpe_cache_;
-  std::array<std::string, 256> byte_encoder_;
+  std::unique_ptr<BpeCache> bpe_cache_ = std::make_unique<BpeCache>();
+  struct ByteCode {
+    char bytes[2] = {0, 0};  // GPT-2 byte-to-unicode code points are below 0x800
+    uint8_t len = 0;
+  };
+  std::array<ByteCode, 256> byte_encoder_;
   int64_t im_start_id_ = -1;
   int64_t im_end_id_ = -1;
   int64_t endoftext_id_ = -1;
   int64_t assistant_id_ = -1;
   int64_t user_id_ = -1;
   int64_t newline_id_ = -1;
-  std::string last_error_;
+  std::string last_error_;  // Load only
 };
 
 }  // namespace QWEN3TTS
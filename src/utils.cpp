@@ -1,23 +1,26 @@
 #include "utils.h"
+#include "audio_sink.h"
+#include "logger.h"
 
 
 #include <algorithm>
 #include <cstdint>
+#include <cstdlib>
 // #include <cctype>
 // #include <cstring>
-// #include <cmath>
+#include <cmath>
 // #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <iterator>
-// #include <limits>
+#include <limits>
 // #include <numeric>
 // #include <optional>
 // #include <random>
 
 #include <stdexcept>
 #include <string>
-// #include <memory>
+#include <memory>
 // #include <chrono>
 // #include <thread>
 #include <set>
@@ -25,13 +28,25 @@
 #include <vector>
 // #include <array>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace QWEN3TTSUTILS {
 
 
-int64_t Argmax(const float* data, int64_t size) {
+namespace {
+
+// kVocab > 0 fixes the loop bound at compile time; 0 uses the runtime `size`.
+template <int64_t kVocab>
+int64_t ArgmaxImpl(const float* data, int64_t size) {
+    const int64_t n = (kVocab > 0) ? kVocab : size;
     int64_t best = 0;
     float best_val = data[0];
-    for (int64_t i = 1; i < size; ++i) {
+    for (int64_t i = 1; i < n; ++i) {
         if (data[i] > best_val) {
             best_val = data[i];
             best = i;
@@ -40,33 +55,112 @@ int64_t Argmax(const float* data, int64_t size) {
     return best;
 }
 
+// Every id below cp_vocab is allowed and only EOS above it, so the masked argmax is the
+// plain argmax over [0, cp_vocab) compared against EOS (EOS wins only when strictly greater).
+template <int64_t kCpVocab>
+int64_t ArgmaxTalkerFirstCodeImpl(const float* data, int64_t talker_vocab, int64_t cp_vocab, int64_t codec_eos_id, bool allow_eos) {
+    const int64_t n = (kCpVocab > 0) ? kCpVocab : std::min(cp_vocab, talker_vocab);
+    const bool eos_allowed = allow_eos && codec_eos_id >= n && codec_eos_id < talker_vocab;
+    if (n <= 0) return eos_allowed ? codec_eos_id : -1;
+    const int64_t best = ArgmaxImpl<kCpVocab>(data, n);
+    if (eos_allowed && data[codec_eos_id] > data[best]) return codec_eos_id;
+    return best;
+}
+
+template <int64_t kCpVocab>
+void CollectTalkerCandidates(const float* data, int64_t talker_vocab, int64_t cp_vocab, int64_t codec_eos_id, bool allow_eos,
+                             std::vector<std::pair<float, int64_t>>* candidates) {
+    const int64_t n = (kCpVocab > 0) ? kCpVocab : std::min(cp_vocab, talker_vocab);
+    candidates->clear();
+    candidates->reserve(static_cast<size_t>(n + 1));
+    for (int64_t i = 0; i < n; ++i) candidates->emplace_back(data[i], i);
+    if (allow_eos && codec_eos_id >= n && codec_eos_id < talker_vocab) candidates->emplace_back(data[codec_eos_id], codec_eos_id);
+}
+
+template <int64_t kCpVocab>
+void CollectCpCandidates(const float* data, int64_t cp_vocab, std::vector<std::pair<float, int64_t>>* candidates) {
+    const int64_t n = (kCpVocab > 0) ? kCpVocab : cp_vocab;
+    candidates->clear();
+    candidates->reserve(static_cast<size_t>(n));
+    for (int64_t i = 0; i < n; ++i) candidates->emplace_back(data[i], i);
+}
+
+int64_t FindSessionIo(const Ort::Session& session, bool output, const std::string& name) {
+    Ort::AllocatorWithDefaultOptions alloc;
+    const size_t count = output ? session.GetOutputCount() : session.GetInputCount();
+    for (size_t i = 0; i < count; ++i) {
+        auto io_name = output ? session.GetOutputNameAllocated(i, alloc) : session.GetInputNameAllocated(i, alloc);
+        if (io_name.get() && name == io_name.get()) return static_cast<int64_t>(i);
+    }
+    return -1;
+}
+
+int64_t GetSessionDim(const Ort::Session& session, bool output, const std::string& name, int axis) {
+    const int64_t i = FindSessionIo(session, output, name);
+    if (i < 0) return -1;
+    const size_t idx_io = static_cast<size_t>(i);
+    const auto shape = (output ? session.GetOutputTypeInfo(idx_io) : session.GetInputTypeInfo(idx_io)).GetTensorTypeAndShapeInfo().GetShape();
+    const int rank = static_cast<int>(shape.size());
+    const int idx = axis < 0 ? rank + axis : axis;
+    if (idx < 0 || idx >= rank) return -1;
+    return shape[static_cast<size_t>(idx)] > 0 ? shape[static_cast<size_t>(idx)] : -1;
+}
+
+}  // namespace
+
+int64_t Argmax(const float* data, int64_t size) {
+    switch (size) {
+        case 2048: return ArgmaxImpl<2048>(data, size);
+        case 3072: return ArgmaxImpl<3072>(data, size);
+        default: return ArgmaxImpl<0>(data, size);
+    }
+}
+
 int64_t ArgmaxTalkerFirstCode(
     const float* data,
     int64_t talker_vocab,
     int64_t cp_vocab,
     int64_t codec_eos_id,
     bool allow_eos) {
-    bool has_best = false;
-    int64_t best = 0;
-    float best_val = 0.0f;
-    for (int64_t i = 0; i < talker_vocab; ++i) {
-        const bool is_eos = (i == codec_eos_id);
-        const bool suppressed = (i >= cp_vocab) && (!is_eos || !allow_eos);
-        if (suppressed) continue;
-        if (!has_best || data[i] > best_val) {
-            best_val = data[i];
-            best = i;
-            has_best = true;
-        }
+    if (cp_vocab == 2048 && talker_vocab >= 2048) {
+        return ArgmaxTalkerFirstCodeImpl<2048>(data, talker_vocab, cp_vocab, codec_eos_id, allow_eos);
+    }
+    return ArgmaxTalkerFirstCodeImpl<0>(data, talker_vocab, cp_vocab, codec_eos_id, allow_eos);
+}
+
+std::array<uint32_t, 4> Philox4x32(const std::array<uint32_t, 4>& counter, const std::array<uint32_t, 2>& key) {
+    constexpr uint64_t kMul0 = 0xD2511F53u;
+    constexpr uint64_t kMul1 = 0xCD9E8D57u;
+    constexpr uint32_t kWeyl0 = 0x9E3779B9u;
+    constexpr uint32_t kWeyl1 = 0xBB67AE85u;
+    std::array<uint32_t, 4> c = counter;
+    uint32_t k0 = key[0];
+    uint32_t k1 = key[1];
+    for (int round = 0; round < 10; ++round) {
+        const uint64_t p0 = kMul0 * c[0];
+        const uint64_t p1 = kMul1 * c[2];
+        c = {static_cast<uint32_t>(p1 >> 32) ^ c[1] ^ k0, static_cast<uint32_t>(p1),
+             static_cast<uint32_t>(p0 >> 32) ^ c[3] ^ k1, static_cast<uint32_t>(p0)};
+        k0 += kWeyl0;
+        k1 += kWeyl1;
     }
-    return has_best ? best : -1;
+    return c;
+}
+
+double PhiloxUniform(const SampleKey& key) {
+    const std::array<uint32_t, 4> counter = {
+        static_cast<uint32_t>(key.step), static_cast<uint32_t>(key.step >> 32), key.group, 0u};
+    const std::array<uint32_t, 2> k = {static_cast<uint32_t>(key.seed), static_cast<uint32_t>(key.seed >> 32)};
+    const std::array<uint32_t, 4> r = Philox4x32(counter, k);
+    const uint64_t bits = ((static_cast<uint64_t>(r[0]) << 32) | r[1]) >> 11;
+    return static_cast<double>(bits) * (1.0 / 9007199254740992.0);  // 2^-53
 }
 
 int64_t SampleFromCandidates(
     const std::vector<std::pair<float, int64_t>>& candidates,
     float temperature,
     int top_k,
-    std::mt19937_64* rng) {
+    const SampleKey& key) {
     if (candidates.empty()) return -1;
     if (temperature <= 0.0f) {
         float best_val = candidates[0].first;
@@ -80,32 +174,38 @@ int64_t SampleFromCandidates(
         return best_idx;
     }
 
-    std::vector<std::pair<float, int64_t>> filtered = candidates;
-    if (top_k > 0 && top_k < static_cast<int>(filtered.size())) {
+    // Only copy when top-k actually narrows the set.
+    std::vector<std::pair<float, int64_t>> narrowed;
+    const std::vector<std::pair<float, int64_t>>* pool = &candidates;
+    if (top_k > 0 && top_k < static_cast<int>(candidates.size())) {
+        narrowed = candidates;
         std::nth_element(
-            filtered.begin(),
-            filtered.begin() + top_k,
-            filtered.end(),
+            narrowed.begin(),
+            narrowed.begin() + top_k,
+            narrowed.end(),
             [](const auto& a, const auto& b) { return a.first > b.first; });
-        filtered.resize(static_cast<size_t>(top_k));
+        narrowed.resize(static_cast<size_t>(top_k));
+        pool = &narrowed;
     }
+    const std::vector<std::pair<float, int64_t>>& filtered = *pool;
 
     float max_scaled = -std::numeric_limits<float>::infinity();
     for (const auto& item : filtered) {
         const float scaled = item.first / temperature;
         if (scaled > max_scaled) max_scaled = scaled;
     }
-    std::vector<double> weights;
-    weights.reserve(filtered.size());
+    std::vector<double> cdf;
+    cdf.reserve(filtered.size());
+    double total = 0.0;
     for (const auto& item : filtered) {
-        const double scaled = static_cast<double>(item.first / temperature - max_scaled);
-        weights.push_back(std::exp(scaled));
+        total += std::exp(static_cast<double>(item.first / temperature - max_scaled));
+        cdf.push_back(total);
     }
 
-    if (!rng) return -1;
-    std::discrete_distribution<size_t> dist(weights.begin(), weights.end());
-    const size_t sampled = dist(*rng);
-    return filtered[sampled].second;
+    // Inverse CDF over the running sums: one uniform per draw, no distribution object.
+    const double target = PhiloxUniform(key) * total;
+    const size_t sampled = static_cast<size_t>(std::upper_bound(cdf.begin(), cdf.end(), target) - cdf.begin());
+    return filtered[std::min(sampled, filtered.size() - 1)].second;
 }
 
 int64_t SelectTalkerFirstCode(
@@ -117,19 +217,17 @@ int64_t SelectTalkerFirstCode(
     bool do_sample,
     float temperature,
     int top_k,
-    std::mt19937_64* rng) {
+    const SampleKey& key) {
     if (!do_sample || temperature <= 0.0f) {
         return ArgmaxTalkerFirstCode(data, talker_vocab, cp_vocab, codec_eos_id, allow_eos);
     }
     std::vector<std::pair<float, int64_t>> candidates;
-    candidates.reserve(static_cast<size_t>(cp_vocab + 1));
-    for (int64_t i = 0; i < talker_vocab; ++i) {
-        const bool is_eos = (i == codec_eos_id);
-        const bool suppressed = (i >= cp_vocab) && (!is_eos || !allow_eos);
-        if (suppressed) continue;
-        candidates.emplace_back(data[i], i);
+    if (cp_vocab == 2048 && talker_vocab >= 2048) {
+        CollectTalkerCandidates<2048>(data, talker_vocab, cp_vocab, codec_eos_id, allow_eos, &candidates);
+    } else {
+        CollectTalkerCandidates<0>(data, talker_vocab, cp_vocab, codec_eos_id, allow_eos, &candidates);
     }
-    return SampleFromCandidates(candidates, temperature, top_k, rng);
+    return SampleFromCandidates(candidates, temperature, top_k, key);
 }
 
 int64_t SelectCpCode(
@@ -138,80 +236,53 @@ int64_t SelectCpCode(
     bool do_sample,
     float temperature,
     int top_k,
-    std::mt19937_64* rng) {
+    const SampleKey& key) {
     if (!do_sample || temperature <= 0.0f) {
         return Argmax(data, cp_vocab);
     }
     std::vector<std::pair<float, int64_t>> candidates;
-    candidates.reserve(static_cast<size_t>(cp_vocab));
-    for (int64_t i = 0; i < cp_vocab; ++i) {
-        candidates.emplace_back(data[i], i);
+    if (cp_vocab == 2048) {
+        CollectCpCandidates<2048>(data, cp_vocab, &candidates);
+    } else {
+        CollectCpCandidates<0>(data, cp_vocab, &candidates);
     }
-    return SampleFromCandidates(candidates, temperature, top_k, rng);
+    return SampleFromCandidates(candidates, temperature, top_k, key);
 }
 
-void WriteWavPcm16(const std::string& path, const std::vector<float>& samples, int sample_rate) {
-    std::vector<float> processed = samples;
-    const size_t tail_probe = std::min<size_t>(processed.size(), static_cast<size_t>(sample_rate / 100));  // 10 ms
-    float tail_peak = 0.0f;
-    for (size_t i = 0; i < tail_probe; ++i) {
-        const float v = std::abs(processed[processed.size() - tail_probe + i]);
-        if (v > tail_peak) tail_peak = v;
-    }
-
-    // Stronger default fade to suppress end-clicks.
-    size_t fade_ms = 40;
-    // If tail is still hot, apply an even stronger fade window.
-    if (tail_peak > 0.35f) fade_ms = 80;
-    const size_t fade_samples = std::min<size_t>(processed.size(), static_cast<size_t>((sample_rate * fade_ms) / 1000));
-    if (fade_samples > 1) {
-        const size_t start = processed.size() - fade_samples;
-        for (size_t i = 0; i < fade_samples; ++i) {
-            const float t = static_cast<float>(i) / static_cast<float>(fade_samples - 1);
-            const float gain = (1.0f - t) * (1.0f - t);  // Quadratic fade-out.
-            processed[start + i] *= gain;
+int64_t SelectFromTopK(
+    const float* values,
+    const int64_t* indices,
+    int64_t k,
+    bool do_sample,
+    float temperature,
+    int top_k,
+    const SampleKey& key,
+    int64_t masked_id) {
+    if (k <= 0) return -1;
+    if (!do_sample || temperature <= 0.0f) {
+        // TopK output is sorted, but don't rely on the exporter's `sorted` attribute.
+        int64_t best = -1;
+        for (int64_t i = 0; i < k; ++i) {
+            if (indices[i] != masked_id && (best < 0 || values[i] > values[best])) best = i;
         }
+        return best < 0 ? -1 : indices[best];
     }
-
-    // Add a short silence pad so players don't cut exactly on a non-zero edge.
-    const size_t pad_samples = static_cast<size_t>((sample_rate * 30) / 1000);  // 30 ms
-    processed.insert(processed.end(), pad_samples, 0.0f);
-
-    std::vector<int16_t> pcm(processed.size());
-    for (size_t i = 0; i < processed.size(); ++i) {
-        float v = std::max(-1.0f, std::min(1.0f, processed[i]));
-        pcm[i] = static_cast<int16_t>(v * 32767.0f);
+    std::vector<std::pair<float, int64_t>> candidates;
+    candidates.reserve(static_cast<size_t>(k));
+    for (int64_t i = 0; i < k; ++i) {
+        if (indices[i] != masked_id) candidates.emplace_back(values[i], indices[i]);
     }
+    if (candidates.empty()) return -1;
+    const int64_t m = static_cast<int64_t>(candidates.size());
+    const int64_t n = (top_k > 0) ? std::min<int64_t>(top_k, m) : m;
+    return SampleFromCandidates(candidates, temperature, static_cast<int>(n), key);
+}
 
-    const uint32_t data_bytes = static_cast<uint32_t>(pcm.size() * sizeof(int16_t));
-    const uint32_t riff_size = 36u + data_bytes;
-    const uint16_t audio_format = 1;
-    const uint16_t num_channels = 1;
-    const uint16_t bits_per_sample = 16;
-    const uint32_t byte_rate = sample_rate * num_channels * bits_per_sample / 8;
-    const uint16_t block_align = num_channels * bits_per_sample / 8;
-
-    std::ofstream out(path, std::ios::binary);
-    if (!out) {
-        std::cerr << "WriteWavPcm16 failed to open output wav: " << path << "\n";
-        return;
+void WriteWavPcm16(const std::string& path, const std::vector<float>& samples, int sample_rate) {
+    std::string err;
+    if (!WriteWavPcm16Safe(path, samples, sample_rate, &err)) {
+        QWEN3TTS_LOG_ERROR("wav") << "WriteWavPcm16 failed: " << err;
     }
-
-    out.write("RIFF", 4);
-    out.write(reinterpret_cast<const char*>(&riff_size), sizeof(riff_size));
-    out.write("WAVE", 4);
-    out.write("fmt ", 4);
-    const uint32_t fmt_size = 16;
-    out.write(reinterpret_cast<const char*>(&fmt_size), sizeof(fmt_size));
-    out.write(reinterpret_cast<const char*>(&audio_format), sizeof(audio_format));
-    out.write(reinterpret_cast<const char*>(&num_channels), sizeof(num_channels));
-    out.write(reinterpret_cast<const char*>(&sample_rate), sizeof(sample_rate));
-    out.write(reinterpret_cast<const char*>(&byte_rate), sizeof(byte_rate));
-    out.write(reinterpret_cast<const char*>(&block_align), sizeof(block_align));
-    out.write(reinterpret_cast<const char*>(&bits_per_sample), sizeof(bits_per_sample));
-    out.write("data", 4);
-    out.write(reinterpret_cast<const char*>(&data_bytes), sizeof(data_bytes));
-    out.write(reinterpret_cast<const char*>(pcm.data()), static_cast<std::streamsize>(data_bytes));
 }
 
 bool WriteWavPcm16Safe(
@@ -219,14 +290,14 @@ bool WriteWavPcm16Safe(
     const std::vector<float>& samples,
     int sample_rate,
     std::string* error) {
-    std::ofstream probe(path, std::ios::binary | std::ios::app);
-    if (!probe) {
-        if (error) *error = "Failed to open output wav: " + path;
+    WavStreamWriter writer;
+    if (!writer.Open(path, sample_rate, error)) return false;
+    const bool written = writer.Write(samples.data(), samples.size());
+    // Close() reports a failed Write() too, and always releases the file.
+    if (!writer.Close(error) || !written) {
+        if (error && error->empty()) *error = "Failed to write wav data: " + path;
         return false;
     }
-    probe.close();
-    WriteWavPcm16(path, samples, sample_rate);
-    if (error) error->clear();
     return true;
 }
 
@@ -252,6 +323,106 @@ bool HasExecutionProvider(const std::string &ep_name) {
     return uniq.find(ep_name) != uniq.end();
 }
 
+int64_t GetSessionInputDim(const Ort::Session& session, const std::string& name, int axis) {
+    return GetSessionDim(session, false, name, axis);
+}
+
+int64_t GetSessionOutputDim(const Ort::Session& session, const std::string& name, int axis) {
+    return GetSessionDim(session, true, name, axis);
+}
+
+bool SessionHasInput(const Ort::Session& session, const std::string& name) {
+    return FindSessionIo(session, false, name) >= 0;
+}
+
+bool SessionHasOutput(const Ort::Session& session, const std::string& name) {
+    return FindSessionIo(session, true, name) >= 0;
+}
+
+std::string GetSessionMetadata(const Ort::Session& session, const std::string& key) {
+    Ort::AllocatorWithDefaultOptions alloc;
+    auto value = session.GetModelMetadata().LookupCustomMetadataMapAllocated(key.c_str(), alloc);
+    return value.get() ? std::string(value.get()) : std::string();
+}
+
+int64_t GetSessionOutputBytesPerStep(const Ort::Session& session, const std::string& name) {
+    const int64_t i = FindSessionIo(session, true, name);
+    if (i < 0) return -1;
+    const auto info = session.GetOutputTypeInfo(static_cast<size_t>(i)).GetTensorTypeAndShapeInfo();
+    int64_t elem = 4;
+    switch (info.GetElementType()) {
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16:
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_BFLOAT16: elem = 2; break;
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64:
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_DOUBLE: elem = 8; break;
+        default: break;
+    }
+    int64_t bytes = elem;
+    bool symbolic = false;
+    for (const int64_t d : info.GetShape()) {
+        if (d > 0) {
+            bytes *= d;
+        } else {
+            symbolic = true;
+        }
+    }
+    return symbolic ? bytes : -1;
+}
+
+bool GetSessionArenaStats(const Ort::Session& session, const Ort::MemoryInfo& mi, ArenaStats* out) {
+    if (!out) return false;
+#if defined(ORT_API_VERSION) && ORT_API_VERSION >= 23
+    try {
+        Ort::Allocator alloc(session, mi);
+        OrtKeyValuePairs* kvps = nullptr;
+        Ort::ThrowOnError(Ort::GetApi().AllocatorGetStats(alloc, &kvps));
+        if (!kvps) return false;
+        const char* const* keys = nullptr;
+        const char* const* values = nullptr;
+        size_t n = 0;
+        Ort::GetApi().GetKeyValuePairs(kvps, &keys, &values, &n);
+        *out = ArenaStats{};
+        for (size_t k = 0; k < n; ++k) {
+            const std::string key = keys[k];
+            const int64_t v = std::strtoll(values[k], nullptr, 10);
+            if (key == "InUse") out->in_use = v;
+            else if (key == "MaxInUse") out->max_in_use = v;
+            else if (key == "TotalAllocated") out->total_allocated = v;
+        }
+        Ort::GetApi().ReleaseKeyValuePairs(kvps);
+        return true;
+    } catch (...) {
+        return false;
+    }
+#else
+    (void)session;
+    (void)mi;
+    return false;
+#endif
+}
+
+namespace {
+
+int64_t ProcStatusKb(const char* field) {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    const size_t len = std::char_traits<char>::length(field);
+    while (std::getline(status, line)) {
+        if (line.compare(0, len, field) == 0) return std::strtoll(line.c_str() + len, nullptr, 10);
+    }
+    return 0;
+}
+
+}  // namespace
+
+int64_t ProcessRssBytes() {
+    return ProcStatusKb("VmRSS:") * 1024;
+}
+
+int64_t ProcessPeakRssBytes() {
+    return ProcStatusKb("VmHWM:") * 1024;
+}
+
 std::vector<float> DecodeAudioCodes(
     Ort::Session& vocoder,
     const Ort::MemoryInfo& mi,
@@ -292,6 +463,248 @@ bool DecodeAudioCodesSafe(
     }
 }
 
+namespace {
+
+// Runs the vocoder on frames [begin, end); outputs stay alive in `voc_out`.
+const float* RunVocoderSpan(
+    Ort::Session& vocoder,
+    const Ort::MemoryInfo& mi,
+    const int64_t* audio_codes,
+    int begin,
+    int end,
+    int groups,
+    std::vector<int64_t>* scratch,
+    std::vector<Ort::Value>* voc_out,
+    size_t* n_samples) {
+    scratch->assign(audio_codes + static_cast<size_t>(begin) * groups, audio_codes + static_cast<size_t>(end) * groups);
+    auto audio_codes_tensor = MakeTensorI64(mi, *scratch, {1, static_cast<int64_t>(end - begin), groups});
+    const char* voc_in_names[] = {"audio_codes"};
+    const char* voc_out_names[] = {"audio_values", "audio_lengths"};
+    std::array<Ort::Value, 1> voc_inputs = {std::move(audio_codes_tensor)};
+    *voc_out = vocoder.Run(Ort::RunOptions{nullptr}, voc_in_names, voc_inputs.data(), 1, voc_out_names, 2);
+    const int64_t n = (*voc_out)[1].GetTensorMutableData<int64_t>()[0];
+    *n_samples = n > 0 ? static_cast<size_t>(n) : 0;
+    return (*voc_out)[0].GetTensorMutableData<float>();
+}
+
+}  // namespace
+
+VocoderSpanRunner MakeVocoderSpanRunner(Ort::Session& vocoder, const Ort::MemoryInfo& mi, int groups) {
+    auto scratch = std::make_shared<std::vector<int64_t>>();
+    auto voc_out = std::make_shared<std::vector<Ort::Value>>();
+    return [&vocoder, &mi, groups, scratch, voc_out](const int64_t* codes, int frames, size_t* n) {
+        return RunVocoderSpan(vocoder, mi, codes, 0, frames, groups, scratch.get(), voc_out.get(), n);
+    };
+}
+
+bool DecodeAudioCodesWindowed(
+    Ort::Session& vocoder,
+    const Ort::MemoryInfo& mi,
+    const int64_t* audio_codes,
+    int steps,
+    int groups,
+    const VocoderWindowConfig& cfg,
+    const std::function<void(const float*, size_t)>& emit,
+    std::string* error) {
+    return DecodeAudioCodesWindowed(MakeVocoderSpanRunner(vocoder, mi, groups), audio_codes, steps, groups, cfg, emit, error);
+}
+
+bool DecodeAudioCodesWindowed(
+    const VocoderSpanRunner& run,
+    const int64_t* audio_codes,
+    int steps,
+    int groups,
+    const VocoderWindowConfig& cfg,
+    const std::function<void(const float*, size_t)>& emit,
+    std::string* error) {
+    VocoderWindowStream stream(cfg, groups);
+    return stream.Finish(
+        run, audio_codes, steps,
+        [&](const float* samples, size_t n) {
+            emit(samples, n);
+            return true;
+        },
+        error);
+}
+
+VocoderWindowStream::VocoderWindowStream(const VocoderWindowConfig& cfg, int groups)
+    : cfg_(cfg), groups_(groups), win_(std::max(1, cfg.window_frames)) {}
+
+bool VocoderWindowStream::Push(
+    const VocoderSpanRunner& run,
+    const int64_t* audio_codes,
+    int final_frames,
+    const Emit& emit,
+    std::string* error) {
+    try {
+        // A window is final once its right context exists and enough frames follow it that
+        // Finish() cannot fold a short remainder into it.
+        const int hold = std::max(std::max(0, cfg_.right_context_frames), win_ / 2);
+        while (next_frame_ + win_ + hold < final_frames) {
+            if (!DecodeWindow(run, audio_codes, final_frames, next_frame_ + win_, false, emit, error)) return false;
+        }
+        if (error) error->clear();
+        return true;
+    } catch (const std::exception& e) {
+        if (error) *error = e.what();
+        return false;
+    } catch (...) {
+        if (error) *error = "unknown decode audio error";
+        return false;
+    }
+}
+
+bool VocoderWindowStream::Finish(
+    const VocoderSpanRunner& run,
+    const int64_t* audio_codes,
+    int steps,
+    const Emit& emit,
+    std::string* error) {
+    try {
+        if (steps < next_frame_) {
+            if (error) *error = "audio codes end before the frames already streamed";
+            return false;
+        }
+        while (next_frame_ < steps) {
+            int core_e = next_frame_ + win_;
+            // A short remainder joins the previous window so every core spans >= win/2 frames.
+            const bool last = core_e >= steps || steps - core_e < win_ / 2;
+            if (last) core_e = steps;
+            if (!DecodeWindow(run, audio_codes, steps, core_e, last, emit, error)) return false;
+        }
+        if (error) error->clear();
+        return true;
+    } catch (const std::exception& e) {
+        if (error) *error = e.what();
+        return false;
+    } catch (...) {
+        if (error) *error = "unknown decode audio error";
+        return false;
+    }
+}
+
+bool VocoderWindowStream::DecodeWindow(
+    const VocoderSpanRunner& run,
+    const int64_t* audio_codes,
+    int steps,
+    int core_e,
+    bool last,
+    const Emit& emit,
+    std::string* error) {
+    auto put = [&](const float* samples, size_t n) {
+        if (emit(samples, n)) return true;
+        aborted_ = true;
+        if (error) *error = "audio sink aborted";
+        return false;
+    };
+    const int core_b = next_frame_;
+    const int span_b = core_b - std::min(std::max(0, cfg_.left_context_frames), core_b);
+    const int span_e = core_e + std::min(std::max(0, cfg_.right_context_frames), steps - core_e);
+
+    size_t n = 0;
+    const float* a = run(audio_codes + static_cast<size_t>(span_b) * groups_, span_e - span_b, &n);
+    if (core_b == 0) {
+        spf_ = n / static_cast<size_t>(span_e - span_b);
+        if (spf_ == 0) {
+            if (error) *error = "vocoder returned no samples for window";
+            return false;
+        }
+        const int ctx = std::min({cfg_.left_context_frames, cfg_.right_context_frames, win_ / 4});
+        half_ = std::min(static_cast<size_t>(std::max(0, cfg_.crossfade_samples / 2)),
+                         static_cast<size_t>(std::max(0, ctx)) * spf_);
+    }
+    const size_t base = static_cast<size_t>(span_b) * spf_;
+    auto at = [&](size_t global) { return global - base < n ? a[global - base] : 0.0f; };
+    const size_t core_s = static_cast<size_t>(core_b) * spf_;
+    const size_t core_end = static_cast<size_t>(core_e) * spf_;
+
+    size_t pos = core_s;
+    if (core_b > 0 && half_ > 0) {
+        block_.resize(2 * half_);
+        for (size_t i = 0; i < 2 * half_; ++i) {
+            const float w = (static_cast<float>(i) + 0.5f) / static_cast<float>(2 * half_);
+            block_[i] = pending_[i] + at(core_s - half_ + i) * w;
+        }
+        if (!put(block_.data(), block_.size())) return false;
+        pos = core_s + half_;
+    }
+    const size_t mid_end = last ? core_end : core_end - half_;
+    if (mid_end > pos) {
+        const size_t off = pos - base;
+        const size_t avail = off < n ? std::min(n - off, mid_end - pos) : 0;
+        if (avail > 0 && !put(a + off, avail)) return false;
+        if (avail < mid_end - pos) {
+            block_.assign(mid_end - pos - avail, 0.0f);
+            if (!put(block_.data(), block_.size())) return false;
+        }
+    }
+    if (!last && half_ > 0) {
+        pending_.resize(2 * half_);
+        for (size_t i = 0; i < 2 * half_; ++i) {
+            const float w = 1.0f - (static_cast<float>(i) + 0.5f) / static_cast<float>(2 * half_);
+            pending_[i] = at(core_end - half_ + i) * w;
+        }
+    }
+    next_frame_ = core_e;
+    return true;
+}
+
+bool DecodeAudioCodesWindowedInto(
+    Ort::Session& vocoder,
+    const Ort::MemoryInfo& mi,
+    const int64_t* audio_codes,
+    int steps,
+    int groups,
+    const VocoderWindowConfig& cfg,
+    float* out,
+    size_t capacity,
+    size_t* out_samples,
+    std::string* error) {
+    size_t written = 0;
+    bool overflow = false;
+    const bool ok = DecodeAudioCodesWindowed(
+        vocoder, mi, audio_codes, steps, groups, cfg,
+        [&](const float* data, size_t n) {
+            const size_t room = capacity - written;
+            if (n > room) overflow = true;
+            const size_t take = std::min(n, room);
+            std::copy(data, data + take, out + written);
+            written += take;
+        },
+        error);
+    if (out_samples) *out_samples = written;
+    if (ok && overflow) {
+        if (error) *error = "output buffer too small for decoded audio";
+        return false;
+    }
+    return ok;
+}
+
+bool DecodeAudioCodesWindowedSafe(
+    Ort::Session& vocoder,
+    const Ort::MemoryInfo& mi,
+    const std::vector<int64_t>& audio_codes,
+    int steps,
+    int groups,
+    const VocoderWindowConfig& cfg,
+    std::vector<float>* out,
+    std::string* error) {
+    if (!out) {
+        if (error) *error = "output vector is null";
+        return false;
+    }
+    if (audio_codes.size() < static_cast<size_t>(steps) * static_cast<size_t>(groups)) {
+        if (error) *error = "audio codes shorter than steps * groups";
+        return false;
+    }
+    out->clear();
+    out->reserve(static_cast<size_t>(std::max(0, steps)) * static_cast<size_t>(std::max(1, cfg.samples_per_frame_hint)));
+    return DecodeAudioCodesWindowed(
+        vocoder, mi, audio_codes.data(), steps, groups, cfg,
+        [&](const float* data, size_t n) { out->insert(out->end(), data, data + n); },
+        error);
+}
+
 std::string ReadAll(const std::string& path) {
     std::ifstream in(path);
     if (!in) return {};
@@ -301,7 +714,7 @@ std::string ReadAll(const std::string& path) {
 void WriteCodesTxt(const std::string& path, const std::vector<int64_t>& codes, int steps, int groups) {
     std::ofstream out(path);
     if (!out) {
-        std::cerr << "WriteCodesTxt failed to open output codes: " << path << "\n";
+        QWEN3TTS_LOG_ERROR("codes") << "WriteCodesTxt failed to open output codes: " << path;
         return;
     }
     for (int s = 0; s < steps; ++s) {
@@ -330,6 +743,16 @@ bool WriteCodesTxtSafe(
     return true;
 }
 
+int ReadCodesTxt(const std::string& path, int groups, std::vector<int64_t>* codes) {
+    std::ifstream in(path);
+    if (!in || !codes || groups <= 0) return -1;
+    codes->clear();
+    int64_t v = 0;
+    while (in >> v) codes->push_back(v);
+    if (codes->empty() || codes->size() % static_cast<size_t>(groups) != 0) return -1;
+    return static_cast<int>(codes->size() / static_cast<size_t>(groups));
+}
+
 int TrimRepeatingTailFrames(std::vector<int64_t>* codes, int groups, int min_repeat, int keep_last) {
     if (min_repeat <= 0) return static_cast<int>(codes->size() / static_cast<size_t>(groups));
     const int steps = static_cast<int>(codes->size() / static_cast<size_t>(groups));
@@ -421,6 +844,74 @@ int64_t ParseIntScalar(const std::string& src, const std::string& key) {
     return neg ? -val : val;
 }
 
+double ParseFloatScalar(const std::string& src, const std::string& key) {
+    const std::string marker = "\"" + key + "\"";
+    const size_t pos = src.find(marker);
+    if (pos == std::string::npos) return 0.0;
+    const size_t colon = src.find(':', pos + marker.size());
+    if (colon == std::string::npos) return 0.0;
+    const char* begin = src.c_str() + colon + 1;
+    char* end = nullptr;
+    const double v = std::strtod(begin, &end);
+    return end == begin ? 0.0 : v;
+}
+
+std::string ParseStringScalar(const std::string& src, const std::string& key) {
+    const std::string marker = "\"" + key + "\"";
+    const size_t pos = src.find(marker);
+    if (pos == std::string::npos) return {};
+    size_t i = src.find(':', pos + marker.size());
+    if (i == std::string::npos) return {};
+    ++i;
+    while (i < src.size() && (src[i] == ' ' || src[i] == '\n' || src[i] == '\r' || src[i] == '\t')) ++i;
+    if (i >= src.size() || src[i] != '"') return {};
+    auto hex4 = [&](size_t at, uint32_t* cp) {
+        if (at + 4 > src.size()) return false;
+        *cp = 0;
+        for (size_t k = at; k < at + 4; ++k) {
+            const char c = src[k];
+            const uint32_t d = (c >= '0' && c <= '9') ? static_cast<uint32_t>(c - '0')
+                             : (c >= 'a' && c <= 'f') ? static_cast<uint32_t>(c - 'a' + 10)
+                             : (c >= 'A' && c <= 'F') ? static_cast<uint32_t>(c - 'A' + 10) : 16u;
+            if (d > 15) return false;
+            *cp = (*cp << 4) | d;
+        }
+        return true;
+    };
+    std::string out;
+    for (++i; i < src.size(); ++i) {
+        const char c = src[i];
+        if (c == '"') return out;
+        if (c != '\\') {
+            out.push_back(c);
+            continue;
+        }
+        if (++i >= src.size()) break;
+        switch (src[i]) {
+            case 'n': out.push_back('\n'); break;
+            case 't': out.push_back('\t'); break;
+            case 'r': out.push_back('\r'); break;
+            case 'b': out.push_back('\b'); break;
+            case 'f': out.push_back('\f'); break;
+            case 'u': {
+                uint32_t cp = 0;
+                if (!hex4(i + 1, &cp)) return {};
+                i += 4;
+                uint32_t lo = 0;
+                if (cp >= 0xD800 && cp <= 0xDBFF && i + 6 < src.size() && src[i + 1] == '\\' && src[i + 2] == 'u' &&
+                    hex4(i + 3, &lo) && lo >= 0xDC00 && lo <= 0xDFFF) {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                    i += 6;
+                }
+                AppendUtf8(cp, out);
+                break;
+            }
+            default: out.push_back(src[i]); break;  // \" \\ \/
+        }
+    }
+    return {};  // unterminated
+}
+
 void AppendUtf8(uint32_t cp, std::string& out) {
     if (cp <= 0x7F) {
         out.push_back(static_cast<char>(cp));
@@ -497,5 +988,79 @@ bool IsNumber(uint32_t cp) {
     return IsAsciiDigit(cp);
 }
 
+int64_t EstimateTokenCount(const std::string& text) {
+    // Qwen BPE averages roughly three code points per token on Latin/Cyrillic text.
+    int64_t code_points = 0;
+    for (unsigned char c : text) {
+        if ((c & 0xC0) != 0x80) ++code_points;
+    }
+    return std::max<int64_t>(1, (code_points + 2) / 3);
+}
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+bool MappedFile::Open(const std::string& path, std::string* error) {
+    Close();
+#if defined(__unix__) || defined(__APPLE__)
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        if (error) *error = "Failed to open model file: " + path;
+        return false;
+    }
+    struct stat st {};
+    if (::fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        if (error) *error = "Failed to stat model file: " + path;
+        return false;
+    }
+    void* p = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        if (error) *error = "Failed to mmap model file: " + path;
+        return false;
+    }
+    data_ = p;
+    size_ = static_cast<size_t>(st.st_size);
+    path_ = path;
+    if (error) error->clear();
+    return true;
+#else
+    if (error) *error = "mmap is not supported on this platform: " + path;
+    return false;
+#endif
+}
+
+void MappedFile::Close() {
+#if defined(__unix__) || defined(__APPLE__)
+    if (data_) ::munmap(data_, size_);
+#endif
+    data_ = nullptr;
+    size_ = 0;
+    path_.clear();
+}
+
+void MappedFile::Prefetch() const {
+    if (!data_) return;
+#if defined(__unix__) || defined(__APPLE__)
+    ::madvise(data_, size_, MADV_WILLNEED);
+    const long page = ::sysconf(_SC_PAGESIZE);
+    const size_t step = page > 0 ? static_cast<size_t>(page) : 4096;
+    const volatile unsigned char* bytes = static_cast<const unsigned char*>(data_);
+    unsigned char sink = 0;
+    for (size_t i = 0; i < size_; i += step) sink ^= bytes[i];
+    (void)sink;
+#endif
+}
+
+bool IsOrtFormatModel(const std::string& path) {
+    const size_t dot = path.rfind('.');
+    if (dot == std::string::npos) return false;
+    std::string ext = path.substr(dot);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return ext == ".ort";
+}
+
 
 } // namespace QWEN3TTSUTILS
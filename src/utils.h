@@ -6,9 +6,10 @@
 #else
 #error "onnxruntime_cxx_api.h not found. Set include path to ONNX Runtime headers."
 #endif
+#include <array>
 #include <cstdint>
+#include <functional>
 // #include <memory>
-#include <random>
 #include <string>
 #include <vector>
 
@@ -23,14 +24,36 @@ std::vector<int64_t> ParseIntArray(const std::string& src, const std::string& ke
 int64_t ParseIntScalar(const std::string& src, const std::string& key);
 
 
+// Argmax / selection kernels dispatch to compile-time-sized instantiations for the
+// bundled vocab sizes (2048, 3072) and fall back to a runtime-bounded loop otherwise.
 int64_t Argmax(const float* data, int64_t size);
 
 int64_t ArgmaxTalkerFirstCode(const float* data, int64_t talker_vocab, int64_t cp_vocab, int64_t codec_eos_id, bool allow_eos = true);
 
-int64_t SampleFromCandidates(const std::vector<std::pair<float, int64_t>>& candidates, float temperature, int top_k, std::mt19937_64* rng);
-int64_t SelectTalkerFirstCode(const float* data, int64_t talker_vocab,int64_t cp_vocab, int64_t codec_eos_id, bool allow_eos, bool do_sample, float temperature, int top_k, std::mt19937_64* rng);
+// Counter-based sampling randomness: every draw is a pure function of (seed, step, group),
+// so sampled codes do not depend on call order, batching or thread count.
+struct SampleKey {
+    uint64_t seed = 0;
+    uint64_t step = 0;    // generated frame index
+    uint32_t group = 0;   // 0 = talker first code, g = code predictor group g
+};
 
-int64_t SelectCpCode(const float* data, int64_t cp_vocab, bool do_sample, float temperature, int top_k, std::mt19937_64* rng);
+// Philox4x32-10 block function (Salmon et al., SC'11).
+std::array<uint32_t, 4> Philox4x32(const std::array<uint32_t, 4>& counter, const std::array<uint32_t, 2>& key);
+// Uniform double in [0, 1) with 53 random bits for the given key.
+double PhiloxUniform(const SampleKey& key);
+
+int64_t SampleFromCandidates(const std::vector<std::pair<float, int64_t>>& candidates, float temperature, int top_k, const SampleKey& key);
+int64_t SelectTalkerFirstCode(const float* data, int64_t talker_vocab,int64_t cp_vocab, int64_t codec_eos_id, bool allow_eos, bool do_sample, float temperature, int top_k, const SampleKey& key);
+
+int64_t SelectCpCode(const float* data, int64_t cp_vocab, bool do_sample, float temperature, int top_k, const SampleKey& key);
+
+// Picks from the K candidates of an on-graph TopK (already masked): the best one when greedy,
+// otherwise samples among the first min(top_k, K) with the given temperature. `masked_id`
+// (e.g. EOS on exports without an allow_eos input) is skipped; -1 if no candidate is left.
+int64_t SelectFromTopK(
+    const float* values, const int64_t* indices, int64_t k, bool do_sample, float temperature, int top_k, const SampleKey& key,
+    int64_t masked_id = -1);
 
 void WriteWavPcm16(const std::string& path, const std::vector<float>& samples, int sample_rate);
 bool WriteWavPcm16Safe(const std::string& path, const std::vector<float>& samples, int sample_rate, std::string* error);
@@ -42,6 +65,31 @@ GraphOptimizationLevel ParseGraphOptimizationLevel(const std::string& s);
 
 bool HasExecutionProvider(const std::string &ep_name);
 
+// Static size of `axis` (negative counts from the back) of a named graph input/output;
+// -1 when the name is missing or the dimension is symbolic.
+int64_t GetSessionInputDim(const Ort::Session& session, const std::string& name, int axis);
+int64_t GetSessionOutputDim(const Ort::Session& session, const std::string& name, int axis);
+bool SessionHasInput(const Ort::Session& session, const std::string& name);
+bool SessionHasOutput(const Ort::Session& session, const std::string& name);
+// Custom metadata_props entry of the model, empty when absent.
+std::string GetSessionMetadata(const Ort::Session& session, const std::string& key);
+// Bytes one position adds to a cache-like output: the product of its static dims times the
+// element size, with symbolic axes (batch, sequence) counted as 1. -1 when the output is
+// missing or has no symbolic axis.
+int64_t GetSessionOutputBytesPerStep(const Ort::Session& session, const std::string& name);
+
+// CPU arena counters of one session ("InUse", "MaxInUse", "TotalAllocated").
+struct ArenaStats {
+    int64_t in_use = 0;
+    int64_t max_in_use = 0;
+    int64_t total_allocated = 0;
+};
+// False when the allocator has no stats (non-arena allocator, ORT older than 1.23).
+bool GetSessionArenaStats(const Ort::Session& session, const Ort::MemoryInfo& mi, ArenaStats* out);
+// Current and peak resident set size of this process from /proc/self/status; 0 when unavailable.
+int64_t ProcessRssBytes();
+int64_t ProcessPeakRssBytes();
+
 std::vector<float> DecodeAudioCodes(Ort::Session& vocoder, const Ort::MemoryInfo& mi, std::vector<int64_t>& audio_codes, int steps, int groups);
 bool DecodeAudioCodesSafe(
     Ort::Session& vocoder,
@@ -52,10 +100,103 @@ bool DecodeAudioCodesSafe(
     std::vector<float>* out,
     std::string* error);
 
+// Windowed vocoder decode: frames are decoded in fixed windows with extra context
+// frames on both sides, so vocoder activations stay bounded by the window size.
+// Window cores are stitched with a linear overlap-add crossfade at the boundaries.
+struct VocoderWindowConfig {
+    int window_frames = 64;
+    int left_context_frames = 16;
+    int right_context_frames = 4;
+    int crossfade_samples = 480;
+    int samples_per_frame_hint = 1920;  // used to preallocate output (24 kHz / 12.5 Hz codec)
+};
+
+// Decodes `frames` frames starting at `audio_codes` and returns the samples, valid until the
+// next call; throws on failure. Lets windowed decode run through a shared VocoderBatcher.
+using VocoderSpanRunner = std::function<const float*(const int64_t* audio_codes, int frames, size_t* n_samples)>;
+
+// Emits finalized samples in order; peak memory is independent of `steps`.
+bool DecodeAudioCodesWindowed(
+    const VocoderSpanRunner& run,
+    const int64_t* audio_codes,
+    int steps,
+    int groups,
+    const VocoderWindowConfig& cfg,
+    const std::function<void(const float*, size_t)>& emit,
+    std::string* error);
+bool DecodeAudioCodesWindowed(
+    Ort::Session& vocoder,
+    const Ort::MemoryInfo& mi,
+    const int64_t* audio_codes,
+    int steps,
+    int groups,
+    const VocoderWindowConfig& cfg,
+    const std::function<void(const float*, size_t)>& emit,
+    std::string* error);
+// Runner over a plain vocoder session; the returned function owns its scratch buffers.
+VocoderSpanRunner MakeVocoderSpanRunner(Ort::Session& vocoder, const Ort::MemoryInfo& mi, int groups);
+
+// Incremental DecodeAudioCodesWindowed for codes that are still being generated. Push()
+// vocodes every window whose core and right context lie below `final_frames` (frames that
+// will not change or be trimmed away); Finish() decodes the rest once the utterance length
+// is known. The emitted samples equal one DecodeAudioCodesWindowed call over the final codes.
+// Returning false from emit stops decoding at once: the call fails and aborted() is set.
+class VocoderWindowStream {
+ public:
+  using Emit = std::function<bool(const float*, size_t)>;
+
+  VocoderWindowStream(const VocoderWindowConfig& cfg, int groups);
+
+  bool Push(const VocoderSpanRunner& run, const int64_t* audio_codes, int final_frames, const Emit& emit, std::string* error);
+  bool Finish(const VocoderSpanRunner& run, const int64_t* audio_codes, int steps, const Emit& emit, std::string* error);
+
+  // Frames whose samples (up to the pending crossfade) have been emitted.
+  int emittedFrames() const { return next_frame_; }
+  bool aborted() const { return aborted_; }
+
+ private:
+  bool DecodeWindow(const VocoderSpanRunner& run, const int64_t* audio_codes, int steps, int core_e, bool last, const Emit& emit, std::string* error);
+
+  VocoderWindowConfig cfg_;
+  int groups_ = 0;
+  int win_ = 1;
+  int next_frame_ = 0;
+  bool aborted_ = false;
+  size_t spf_ = 0;
+  size_t half_ = 0;
+  std::vector<float> pending_;
+  std::vector<float> block_;
+};
+
+// Writes into a caller-provided buffer; fails if `capacity` is too small.
+bool DecodeAudioCodesWindowedInto(
+    Ort::Session& vocoder,
+    const Ort::MemoryInfo& mi,
+    const int64_t* audio_codes,
+    int steps,
+    int groups,
+    const VocoderWindowConfig& cfg,
+    float* out,
+    size_t capacity,
+    size_t* out_samples,
+    std::string* error);
+// Resizes `out` once for the full utterance and decodes into it.
+bool DecodeAudioCodesWindowedSafe(
+    Ort::Session& vocoder,
+    const Ort::MemoryInfo& mi,
+    const std::vector<int64_t>& audio_codes,
+    int steps,
+    int groups,
+    const VocoderWindowConfig& cfg,
+    std::vector<float>* out,
+    std::string* error);
+
 std::string ReadAll(const std::string& path);
 
 void WriteCodesTxt(const std::string& path, const std::vector<int64_t>& codes, int steps, int groups);
 bool WriteCodesTxtSafe(const std::string& path, const std::vector<int64_t>& codes, int steps, int groups, std::string* error);
+// Reads the WriteCodesTxt format back; returns the number of frames or -1 on error.
+int ReadCodesTxt(const std::string& path, int groups, std::vector<int64_t>* codes);
 
 int TrimRepeatingTailFrames(std::vector<int64_t>* codes, int groups, int min_repeat, int keep_last);
 
@@ -63,6 +204,11 @@ std::vector<int64_t> ParseIntArray(const std::string& src, const std::string& ke
 
 int64_t ParseIntScalar(const std::string& src, const std::string& key);
 
+// Flat-key lookups like ParseIntScalar: the first "key": <value> anywhere in src.
+// Missing or mistyped values give 0.0 / "". Strings are unescaped (\uXXXX included).
+double ParseFloatScalar(const std::string& src, const std::string& key);
+std::string ParseStringScalar(const std::string& src, const std::string& key);
+
 void AppendUtf8(uint32_t cp, std::string& out);
 
 uint32_t DecodeUtf8At(const std::string& s, size_t i, size_t* next_i);
@@ -79,6 +225,35 @@ bool IsLetter(uint32_t cp);
 
 bool IsNumber(uint32_t cp);
 
+// Cheap token-count estimate for admission/cost decisions, without running the tokenizer.
+int64_t EstimateTokenCount(const std::string& text);
+
+// Read-only memory mapping of a model file. Pages come from the shared page cache,
+// so every process mapping the same file shares one physical copy.
+class MappedFile {
+ public:
+  MappedFile() = default;
+  ~MappedFile();
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool Open(const std::string& path, std::string* error);
+  void Close();
+  // Fault all pages in ahead of time (pre-fork warmup of the page cache).
+  void Prefetch() const;
+
+  const void* data() const { return data_; }
+  size_t size() const { return size_; }
+  const std::string& path() const { return path_; }
+
+ private:
+  void* data_ = nullptr;
+  size_t size_ = 0;
+  std::string path_;
+};
+
+bool IsOrtFormatModel(const std::string& path);
+
 
 
 
@@ -0,0 +1,188 @@
+#include "vocoder_batcher.h"
+#include "logger.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <array>
+
+using namespace QWEN3TTSUTILS;
+
+namespace QWEN3TTS {
+
+VocoderBatcher::VocoderBatcher(Ort::Session& vocoder, const Ort::MemoryInfo& mi, int groups, const VocoderBatcherConfig& cfg)
+    : _vocoder(vocoder), _mi(mi), _groups(groups), _config(cfg)
+{
+    _config.max_batch = std::max(1, _config.max_batch);
+    _config.max_wait_ms = std::max(0.0, _config.max_wait_ms);
+    _config.max_padding = std::clamp(_config.max_padding, 0.0, 1.0);
+    // Exports traced with a fixed batch of 1 cannot take a packed batch.
+    if (_config.max_batch > 1 && GetSessionInputDim(_vocoder, "audio_codes", 0) > 0) {
+        QWEN3TTS_LOG_WARN("vocoder-batch") << "audio_codes has a static batch axis; batching disabled";
+        _config.max_batch = 1;
+    }
+    _worker = std::thread(&VocoderBatcher::workerLoop, this);
+}
+
+VocoderBatcher::~VocoderBatcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _work_cv.notify_all();
+    if (_worker.joinable()) _worker.join();
+}
+
+bool VocoderBatcher::decode(const int64_t* audio_codes, int frames, std::vector<float>* pcm, std::string* error)
+{
+    if (!pcm) {
+        if (error) *error = "output vector is null";
+        return false;
+    }
+    if (frames <= 0) {
+        pcm->clear();
+        if (error) error->clear();
+        return true;
+    }
+    Window w;
+    w.codes = audio_codes;
+    w.frames = frames;
+    w.pcm = pcm;
+    w.enqueued = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_stopping) {
+            if (error) *error = "vocoder batcher is stopped";
+            return false;
+        }
+        _pending.push_back(&w);
+    }
+    _work_cv.notify_one();
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done_cv.wait(lock, [&] { return w.done; });
+    if (error) *error = w.error;
+    return w.ok;
+}
+
+VocoderBatcherStats VocoderBatcher::stats() const
+{
+    VocoderBatcherStats s;
+    s.runs = _runs.load(std::memory_order_relaxed);
+    s.windows = _windows.load(std::memory_order_relaxed);
+    s.frames = _frames.load(std::memory_order_relaxed);
+    s.padded_frames = _padded_frames.load(std::memory_order_relaxed);
+    s.max_batch_seen = _max_batch_seen.load(std::memory_order_relaxed);
+    if (s.windows > 0) s.avg_wait_ms = _wait_sum_us.load(std::memory_order_relaxed) / 1000.0 / static_cast<double>(s.windows);
+    return s;
+}
+
+void VocoderBatcher::workerLoop()
+{
+    const auto max_wait = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double, std::milli>(_config.max_wait_ms));
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _work_cv.wait(lock, [&] { return _stopping || !_pending.empty(); });
+        if (_pending.empty()) return;
+        // The oldest window bounds the wait; a full batch or shutdown cuts it short.
+        const auto deadline = _pending.front()->enqueued + max_wait;
+        _work_cv.wait_until(lock, deadline, [&] {
+            return _stopping || _pending.size() >= static_cast<size_t>(_config.max_batch);
+        });
+        const std::vector<Window*> batch = takeBatchLocked();
+        lock.unlock();
+        runBatch(batch);
+        lock.lock();
+        for (Window* w : batch) w->done = true;
+        _done_cv.notify_all();
+    }
+}
+
+// FIFO with skipping: the oldest window always runs; later ones join while the batch stays
+// within max_batch, max_batch_frames and the padding budget, the rest wait for the next run.
+std::vector<VocoderBatcher::Window*> VocoderBatcher::takeBatchLocked()
+{
+    std::vector<Window*> batch;
+    int64_t real = 0;
+    int64_t t = 0;
+    for (auto it = _pending.begin(); it != _pending.end() && batch.size() < static_cast<size_t>(_config.max_batch);) {
+        Window* w = *it;
+        const int64_t nt = std::max<int64_t>(t, w->frames);
+        const int64_t padded = nt * static_cast<int64_t>(batch.size() + 1);
+        const bool fits = batch.empty() ||
+            ((_config.max_batch_frames <= 0 || padded <= _config.max_batch_frames) &&
+             static_cast<double>(padded - real - w->frames) <= _config.max_padding * static_cast<double>(padded));
+        if (!fits) {
+            ++it;
+            continue;
+        }
+        batch.push_back(w);
+        real += w->frames;
+        t = nt;
+        it = _pending.erase(it);
+    }
+    return batch;
+}
+
+void VocoderBatcher::runBatch(const std::vector<Window*>& batch)
+{
+    const auto start = std::chrono::steady_clock::now();
+    const int64_t b = static_cast<int64_t>(batch.size());
+    int64_t t = 0;
+    for (Window* w : batch) {
+        t = std::max<int64_t>(t, w->frames);
+        _wait_sum_us.fetch_add(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(start - w->enqueued).count()), std::memory_order_relaxed);
+        _frames.fetch_add(static_cast<uint64_t>(w->frames), std::memory_order_relaxed);
+    }
+    _runs.fetch_add(1, std::memory_order_relaxed);
+    _windows.fetch_add(static_cast<uint64_t>(b), std::memory_order_relaxed);
+    _padded_frames.fetch_add(static_cast<uint64_t>(b * t), std::memory_order_relaxed);
+    int seen = _max_batch_seen.load(std::memory_order_relaxed);
+    while (b > seen && !_max_batch_seen.compare_exchange_weak(seen, static_cast<int>(b), std::memory_order_relaxed)) {
+    }
+
+    try {
+        // Row-major [B, T, groups]; short rows repeat their last frame. A non-causal vocoder
+        // lets that padding reach the row's last real frames, so this is only as good as the
+        // export: qwen3_tts_cpp_vocoder_window_example with batch_rows > 1 checks it against
+        // solo decodes. Keep max_padding at 0 (equal-length windows only) for unchecked exports.
+        const size_t row = static_cast<size_t>(t) * _groups;
+        std::vector<int64_t> codes(static_cast<size_t>(b) * row);
+        for (int64_t i = 0; i < b; ++i) {
+            const Window* w = batch[static_cast<size_t>(i)];
+            int64_t* dst = codes.data() + static_cast<size_t>(i) * row;
+            const size_t real = static_cast<size_t>(w->frames) * _groups;
+            std::copy(w->codes, w->codes + real, dst);
+            for (size_t off = real; off < row; off += _groups) {
+                std::copy(w->codes + real - _groups, w->codes + real, dst + off);
+            }
+        }
+        auto codes_tensor = MakeTensorI64(_mi, codes, {b, t, static_cast<int64_t>(_groups)});
+        const char* in_names[] = {"audio_codes"};
+        const char* out_names[] = {"audio_values", "audio_lengths"};
+        std::array<Ort::Value, 1> inputs = {std::move(codes_tensor)};
+        auto out = _vocoder.Run(Ort::RunOptions{nullptr}, in_names, inputs.data(), 1, out_names, 2);
+
+        const float* audio = out[0].GetTensorData<float>();
+        const int64_t* lengths = out[1].GetTensorData<int64_t>();
+        const size_t stride = out[0].GetTensorTypeAndShapeInfo().GetElementCount() / static_cast<size_t>(b);
+        const size_t spf = stride / static_cast<size_t>(t);
+        for (int64_t i = 0; i < b; ++i) {
+            Window* w = batch[static_cast<size_t>(i)];
+            // audio_lengths may count the padding; never hand out more than the real frames.
+            size_t n = static_cast<size_t>(w->frames) * spf;
+            if (lengths[i] > 0) n = std::min(n, static_cast<size_t>(lengths[i]));
+            n = std::min(n, stride);
+            const float* src = audio + static_cast<size_t>(i) * stride;
+            w->pcm->assign(src, src + n);
+            w->ok = true;
+        }
+    } catch (const std::exception& e) {
+        for (Window* w : batch) w->error = e.what();
+    } catch (...) {
+        for (Window* w : batch) w->error = "unknown vocoder batch error";
+    }
+}
+
+}
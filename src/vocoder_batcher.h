@@ -0,0 +1,95 @@
+#pragma once
+
+#if __has_include(<onnxruntime_cxx_api.h>)
+#include <onnxruntime_cxx_api.h>
+#elif __has_include(<onnxruntime/onnxruntime_cxx_api.h>)
+#include <onnxruntime/onnxruntime_cxx_api.h>
+#else
+#error "onnxruntime_cxx_api.h not found. Set include path to ONNX Runtime headers."
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace QWEN3TTS {
+
+  struct VocoderBatcherConfig {
+    int                     max_batch = 8;           // windows per vocoder run
+    double                  max_wait_ms = 2.0;       // how long the oldest window waits for company
+    int64_t                 max_batch_frames = 0;    // cap on B * T of one run, 0 = unlimited
+    double                  max_padding = 0.25;      // padded share of B * T a batch may contain
+  };
+
+  struct VocoderBatcherStats {
+    uint64_t                runs = 0;
+    uint64_t                windows = 0;
+    uint64_t                frames = 0;              // real frames decoded
+    uint64_t                padded_frames = 0;       // B * T actually sent to the vocoder
+    int                     max_batch_seen = 0;
+    double                  avg_wait_ms = 0.0;       // submit until the window's run started
+  };
+
+  // Cross-request vocoder batching. Concurrent decode() calls are collected for up to
+  // max_wait_ms and packed into one [B, T, groups] speech_tokenizer_decode run; shorter
+  // windows are padded by repeating their last frame and cut back using audio_lengths
+  // (not verified to be exact for every export; see the vocoder window example).
+  // The session is borrowed and must outlive the batcher.
+  class VocoderBatcher {
+  public:
+      VocoderBatcher(Ort::Session& vocoder, const Ort::MemoryInfo& mi, int groups,
+                     const VocoderBatcherConfig& cfg = VocoderBatcherConfig{});
+      ~VocoderBatcher();
+      VocoderBatcher(const VocoderBatcher&) = delete;
+      VocoderBatcher& operator=(const VocoderBatcher&) = delete;
+
+      // Blocks until `frames` frames at `audio_codes` are decoded into `pcm`. Thread-safe.
+      bool decode(const int64_t* audio_codes, int frames, std::vector<float>* pcm, std::string* error);
+
+      VocoderBatcherStats stats() const;
+      // 1 when the vocoder export has a static batch axis; every window then runs alone.
+      int maxBatch() const { return _config.max_batch; }
+
+  private:
+      struct Window {
+          const int64_t* codes = nullptr;
+          int frames = 0;
+          std::vector<float>* pcm = nullptr;
+          std::string error;
+          bool done = false;
+          bool ok = false;
+          std::chrono::steady_clock::time_point enqueued;
+      };
+
+      void workerLoop();
+      std::vector<Window*> takeBatchLocked();
+      void runBatch(const std::vector<Window*>& batch);
+
+  private:
+      Ort::Session&           _vocoder;
+      const Ort::MemoryInfo&  _mi;
+      int                     _groups;
+      VocoderBatcherConfig    _config;
+
+      mutable std::mutex      _mutex;
+      std::condition_variable _work_cv;
+      std::condition_variable _done_cv;
+      std::deque<Window*>     _pending;
+      bool                    _stopping = false;
+      std::thread             _worker;
+
+      std::atomic<uint64_t>   _runs{0};
+      std::atomic<uint64_t>   _windows{0};
+      std::atomic<uint64_t>   _frames{0};
+      std::atomic<uint64_t>   _padded_frames{0};
+      std::atomic<uint64_t>   _wait_sum_us{0};
+      std::atomic<int>        _max_batch_seen{0};
+  };
+
+}
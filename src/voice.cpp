@@ -1,20 +1,87 @@
 #include "voice.h"
+#include "generation_state.h"
+#include "logger.h"
+#include "metrics.h"
 #include "tokenizer.h"
 #include "utils.h"
+#include "vocoder_batcher.h"
+#include <algorithm>
 #include <filesystem>
-#include <iostream>
 #include <regex>
 #include <array>
 #include <chrono>
 #include <limits>
 #include <numeric>
 #include <random>
+#include <stdexcept>
 #include <thread>
+#include <unordered_map>
 
 using namespace QWEN3TTSUTILS;
 
 namespace QWEN3TTS {
 
+namespace {
+
+double MsSince(const std::chrono::steady_clock::time_point& t0)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// Calls fn `runs` times; the first call is reported on its own, the rest as their median.
+template <typename Fn>
+WarmupTiming TimeCalls(const char* session, int64_t size, int runs, Fn&& fn)
+{
+    WarmupTiming t;
+    t.session = session;
+    t.size = size;
+    std::vector<double> rest;
+    for (int i = 0; i < runs; ++i) {
+        const auto t0 = std::chrono::steady_clock::now();
+        fn();
+        const double ms = MsSince(t0);
+        if (i == 0) {
+            t.first_ms = ms;
+        } else {
+            rest.push_back(ms);
+        }
+    }
+    t.steady_ms = t.first_ms;
+    if (!rest.empty()) {
+        std::nth_element(rest.begin(), rest.begin() + static_cast<long>(rest.size() / 2), rest.end());
+        t.steady_ms = rest[rest.size() / 2];
+    }
+    QWEN3TTS_LOG_INFO("warmup") << session << Kv("size", size) << Kv("first_ms", t.first_ms)
+                                << Kv("steady_ms", t.steady_ms);
+    return t;
+}
+
+VocoderWindowConfig WindowConfig(const GenerationParams& params)
+{
+    VocoderWindowConfig cfg;
+    cfg.window_frames = params.vocoder_window_frames;
+    cfg.left_context_frames = params.vocoder_left_context_frames;
+    cfg.right_context_frames = params.vocoder_right_context_frames;
+    return cfg;
+}
+
+// Vocoder span runner for windowed decode; with a batcher each window waits briefly to
+// share a vocoder run with other requests.
+VocoderSpanRunner SpanRunner(
+    const std::shared_ptr<VocoderBatcher>& batcher, Ort::Session& vocoder, const Ort::MemoryInfo& mi, int groups)
+{
+    if (!batcher) return MakeVocoderSpanRunner(vocoder, mi, groups);
+    auto span_pcm = std::make_shared<std::vector<float>>();
+    return [batcher, span_pcm](const int64_t* codes, int frames, size_t* n) {
+        std::string span_err;
+        if (!batcher->decode(codes, frames, span_pcm.get(), &span_err)) throw std::runtime_error(span_err);
+        *n = span_pcm->size();
+        return static_cast<const float*>(span_pcm->data());
+    };
+}
+
+}  // namespace
+
 Voice::Voice() { }
 
 Voice::~Voice()
@@ -31,7 +98,8 @@ bool Voice::load(const TtsConfig &cfg)
     auto fail_load = [&](int code, const std::string& msg) -> bool {
         _last_error_code = code;
         _last_error_message = msg;
-        std::cerr << "Voice::load failed: " << msg << "\n";
+        QWEN3TTS_LOG_ERROR("voice") << "load failed: " << msg;
+        Metrics::instance().recordError(code);
         unload();
         return false;
     };
@@ -49,12 +117,18 @@ bool Voice::load(const TtsConfig &cfg)
     _config.model.cp_dynamic_file = cfg.model.cp_dynamic_file;
     _config.model.cp_step_pattern = cfg.model.cp_step_pattern;
     _config.model.merges_file = (base / cfg.model.merges_file).string();
+    _config.model.vocab_file = (base / cfg.model.vocab_file).string();
     _config.model.prefill_builder_file = (base / cfg.model.prefill_builder_file).string();
     _config.model.talker_prefill_file = (base / cfg.model.talker_prefill_file).string();
     _config.model.talker_decode_file = (base / cfg.model.talker_decode_file).string();
+    _config.model.talker_prefill_chunk_file = cfg.model.talker_prefill_chunk_file;
     _config.model.cuda_talker_decode_fallback_file = cfg.model.cuda_talker_decode_fallback_file;
     _config.model.cuda_talker_prefill_fallback_file = cfg.model.cuda_talker_prefill_fallback_file;
     _config.model.auto_cuda_talker_fp16_fallback = cfg.model.auto_cuda_talker_fp16_fallback;
+    _config.model.share_model_weights = cfg.model.share_model_weights;
+    _config.model.manifest_file = cfg.model.manifest_file.empty() ? std::string() : (base / cfg.model.manifest_file).string();
+    _config.model.step_predictor_file =
+        cfg.model.step_predictor_file.empty() ? std::string() : (base / cfg.model.step_predictor_file).string();
 
     _config.talker_device = cfg.talker_device;
     _config.cp_device = cfg.cp_device;
@@ -66,25 +140,80 @@ bool Voice::load(const TtsConfig &cfg)
     _config.inter_threads = cfg.inter_threads;
     _config.intra_threads = cfg.intra_threads;
     _config.ort_opt = cfg.ort_opt;
+    _config.xnnpack_threads = cfg.xnnpack_threads;
+    _config.dnnl_use_arena = cfg.dnnl_use_arena;
+    _config.openvino_device_type = cfg.openvino_device_type;
+    _config.openvino_threads = cfg.openvino_threads;
+    _config.openvino_precision = cfg.openvino_precision;
+    _config.profile_dir = cfg.profile_dir;
+
 
+    std::string tok_err;
+    tokenizer_ = VoiceTokenizer::LoadShared(_config.model.path,
+                                            std::filesystem::path(_config.model.vocab_file).filename().string(),
+                                            std::filesystem::path(_config.model.merges_file).filename().string(),
+                                            std::filesystem::path(_config.model.tokenizer_config_file).filename().string(),
+                                            &tok_err);
+    if (!tokenizer_) return fail_load(-1401, tok_err.empty() ? "tokenizer load failed" : tok_err);
 
     env_ = std::make_unique<Ort::Env>(ORT_LOGGING_LEVEL_WARNING, "qwen3_tts_smoke");
     mi_.emplace(Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault));
 
+    auto require_provider = [&](const char* provider) -> bool {
+        if (HasExecutionProvider(provider)) return true;
+        _last_error_code = -3004;
+        _last_error_message = std::string(provider) + " is not available in this onnxruntime build";
+        return false;
+    };
+    auto bad_device_option = [&](const std::string& msg) -> bool {
+        _last_error_code = -3007;
+        _last_error_message = msg;
+        return false;
+    };
     auto configure_device = [&](Ort::SessionOptions& so_local, const std::string& dev_name) -> bool {
-        if (dev_name != "cuda") return true;
-        if (!HasExecutionProvider("CUDAExecutionProvider")) {
-            _last_error_code = -3004;
-            _last_error_message = "CUDAExecutionProvider is not available in this onnxruntime build";
-            return false;
-        }
-        OrtCUDAProviderOptions cuda_opts{};
-        cuda_opts.device_id = _config.gpu_device_id;
-        if (_config.gpu_mem_limit_mb > 0) {
-            cuda_opts.gpu_mem_limit = static_cast<size_t>(_config.gpu_mem_limit_mb) * 1024ULL * 1024ULL;
-        }
-        Ort::ThrowOnError(Ort::GetApi().SessionOptionsAppendExecutionProvider_CUDA(so_local, &cuda_opts));
-        return true;
+        if (dev_name == "cpu") return true;
+        if (dev_name == "cuda") {
+            if (!require_provider("CUDAExecutionProvider")) return false;
+            OrtCUDAProviderOptions cuda_opts{};
+            cuda_opts.device_id = _config.gpu_device_id;
+            if (_config.gpu_mem_limit_mb > 0) {
+                cuda_opts.gpu_mem_limit = static_cast<size_t>(_config.gpu_mem_limit_mb) * 1024ULL * 1024ULL;
+            }
+            Ort::ThrowOnError(Ort::GetApi().SessionOptionsAppendExecutionProvider_CUDA(so_local, &cuda_opts));
+            return true;
+        }
+        if (dev_name == "xnnpack") {
+            if (!require_provider("XnnpackExecutionProvider")) return false;
+            if (_config.xnnpack_threads < 0) return bad_device_option("xnnpack_threads must be >= 0");
+            const int threads = _config.xnnpack_threads > 0 ? _config.xnnpack_threads : std::max(1, _config.intra_threads);
+            // XNNPACK runs its own pool; spinning ORT workers would compete with it for cores.
+            so_local.AddConfigEntry("session.intra_op.allow_spinning", "0");
+            so_local.AppendExecutionProvider("XNNPACK", {{"intra_op_num_threads", std::to_string(threads)}});
+            return true;
+        }
+        if (dev_name == "dnnl") {
+            if (!require_provider("DnnlExecutionProvider")) return false;
+            OrtDnnlProviderOptions dnnl_opts{};
+            dnnl_opts.use_arena = _config.dnnl_use_arena ? 1 : 0;
+            dnnl_opts.threadpool_args = nullptr;
+            Ort::ThrowOnError(Ort::GetApi().SessionOptionsAppendExecutionProvider_Dnnl(so_local, &dnnl_opts));
+            return true;
+        }
+        if (dev_name == "openvino") {
+            if (!require_provider("OpenVINOExecutionProvider")) return false;
+            if (_config.openvino_device_type.empty()) return bad_device_option("openvino_device_type must not be empty");
+            if (_config.openvino_threads < 0) return bad_device_option("openvino_threads must be >= 0");
+            const std::string& precision = _config.openvino_precision;
+            if (!precision.empty() && precision != "FP32" && precision != "FP16" && precision != "ACCURACY") {
+                return bad_device_option("openvino_precision must be FP32, FP16 or ACCURACY");
+            }
+            std::unordered_map<std::string, std::string> ov_opts = {{"device_type", _config.openvino_device_type}};
+            if (_config.openvino_threads > 0) ov_opts["num_of_threads"] = std::to_string(_config.openvino_threads);
+            if (!precision.empty()) ov_opts["precision"] = precision;
+            so_local.AppendExecutionProvider_OpenVINO_V2(ov_opts);
+            return true;
+        }
+        return bad_device_option("unknown device: " + dev_name + " (expected cpu, cuda, xnnpack, dnnl or openvino)");
     };
 
     const std::string prefill_device_resolved = (_config.prefill_device == "auto") ? _config.device : _config.prefill_device;
@@ -111,8 +240,8 @@ bool Voice::load(const TtsConfig &cfg)
         if (prefill_candidate == talker_prefill_path && decode_candidate == talker_path) return false;
         talker_prefill_path = prefill_candidate;
         talker_path = decode_candidate;
-        std::cout << "[warn] talker-device=cuda with fp16-like bundle detected; "
-                  << "falling back to fp32 talker models from: " << dir.string() << "\n";
+        QWEN3TTS_LOG_WARN("warn") << "talker-device=cuda with fp16-like bundle detected; "
+                                  << "falling back to fp32 talker models from: " << dir.string();
         return true;
     };
     if (_config.model.auto_cuda_talker_fp16_fallback &&
@@ -132,8 +261,8 @@ bool Voice::load(const TtsConfig &cfg)
             }
         }
         if (!fallback_applied) {
-            std::cout << "[warn] fp16-like talker bundle on CUDA detected but no fp32 fallback found; "
-                      << "continuing with configured talker files.\n";
+            QWEN3TTS_LOG_WARN("warn") << "fp16-like talker bundle on CUDA detected but no fp32 fallback found; "
+                                      << "continuing with configured talker files.";
         }
     }
 
@@ -169,30 +298,119 @@ bool Voice::load(const TtsConfig &cfg)
         return fail_load(_last_error_code, _last_error_message);
     }
 
-    prefill_builder_ = std::make_unique<Ort::Session>(*env_, _config.model.prefill_builder_file.c_str(), so_prefill);
-    talker_prefill_ = std::make_unique<Ort::Session>(*env_, talker_prefill_path.c_str(), so_talker);
-    talker_ = std::make_unique<Ort::Session>(*env_, talker_path.c_str(), so_talker);
+    if (_config.model.share_model_weights) {
+        // Prepacked weights are private heap copies; keep the shared mapped ones instead.
+        for (Ort::SessionOptions* so_shared : {&so_prefill, &so_talker, &so_cp, &so_vocoder}) {
+            so_shared->AddConfigEntry("session.disable_prepacking", "1");
+        }
+    }
+
+    if (!_config.profile_dir.empty()) {
+        std::error_code mkerr;
+        std::filesystem::create_directories(_config.profile_dir, mkerr);
+        if (mkerr) return fail_load(-3008, "failed to create profile_dir: " + mkerr.message());
+    }
+    auto make_session = [&](const std::string& path, const Ort::SessionOptions& so_base, const std::string& name) {
+        Ort::SessionOptions so_local = so_base.Clone();
+        if (!_config.profile_dir.empty()) {
+            // ORT appends "_<timestamp>.json" to the prefix.
+            const std::string prefix = (std::filesystem::path(_config.profile_dir) / name).string();
+            so_local.EnableProfiling(prefix.c_str());
+        }
+        if (!_config.model.share_model_weights) {
+            return std::make_unique<Ort::Session>(*env_, path.c_str(), so_local);
+        }
+        if (!IsOrtFormatModel(path)) {
+            // Nothing keeps .onnx initializers (external data included) in shared pages.
+            throw std::runtime_error("share_model_weights needs ORT-format (.ort) models, got " + path);
+        }
+        auto mapped = std::make_unique<MappedFile>();
+        std::string map_err;
+        if (!mapped->Open(path, &map_err)) throw std::runtime_error(map_err);
+        Ort::SessionOptions so_mapped = so_local.Clone();
+        so_mapped.AddConfigEntry("session.use_ort_model_bytes_directly", "1");
+        so_mapped.AddConfigEntry("session.use_ort_model_bytes_for_initializers", "1");
+        auto session = std::make_unique<Ort::Session>(*env_, mapped->data(), mapped->size(), so_mapped);
+        model_maps_.push_back(std::move(mapped));
+        return session;
+    };
+
+    prefill_builder_ = make_session(_config.model.prefill_builder_file, so_prefill, "prefill_builder");
+    talker_prefill_ = make_session(talker_prefill_path, so_talker, "talker_prefill");
+    talker_ = make_session(talker_path, so_talker, "talker_decode");
+    talker_prefill_chunk_.reset();
+    const std::string prefill_chunk_path =
+        (std::filesystem::path(_config.model.path) / _config.model.talker_prefill_chunk_file).string();
+    if (!_config.model.talker_prefill_chunk_file.empty() && std::filesystem::exists(prefill_chunk_path)) {
+        talker_prefill_chunk_ = make_session(prefill_chunk_path, so_talker, "talker_prefill_chunk");
+    }
 
     const std::string cp_dynamic_path = (std::filesystem::path(_config.model.path) / _config.model.cp_dynamic_file).string();
     has_cp_dynamic_ = std::filesystem::exists(cp_dynamic_path);
     if (has_cp_dynamic_) {
-        cp_dynamic_ = std::make_unique<Ort::Session>(*env_, cp_dynamic_path.c_str(), so_cp);
-        std::cout << "[cp] using shared dynamic model: " << cp_dynamic_path << "\n";
+        cp_dynamic_ = make_session(cp_dynamic_path, so_cp, "code_predictor");
+        QWEN3TTS_LOG_INFO("cp") << "using shared dynamic model: " << cp_dynamic_path;
     } else {
+        // One fixed-step model per residual group; the count follows the files present.
         cp_steps_.clear();
-        cp_steps_.reserve(static_cast<size_t>(kCodeGroups - 1));
-        for (int g = 0; g < kCodeGroups - 1; ++g) {
+        for (int g = 0;; ++g) {
             char suffix[64];
             std::snprintf(suffix, sizeof(suffix), _config.model.cp_step_pattern.c_str(), g);
             const std::string cp_path = (std::filesystem::path(_config.model.path) / suffix).string();
-            cp_steps_.emplace_back(std::make_unique<Ort::Session>(*env_, cp_path.c_str(), so_cp));
+            if (g > 0 && !std::filesystem::exists(cp_path)) break;
+            cp_steps_.emplace_back(make_session(cp_path, so_cp, "code_predictor_step_" + std::to_string(g)));
         }
-        std::cout << "[cp] using legacy fixed-step models from: " << _config.model.path << "\n";
+        QWEN3TTS_LOG_INFO("cp") << "using legacy fixed-step models from: " << _config.model.path;
     }
 
-    vocoder_ = std::make_unique<Ort::Session>(*env_, _config.model.speech_tokenizer_file.c_str(), so_vocoder);
-    use_kv_cache_ = (talker_prefill_->GetOutputCount() >= 4 && talker_->GetInputCount() >= 5);
+    vocoder_ = make_session(_config.model.speech_tokenizer_file, so_vocoder, "vocoder");
+    use_kv_cache_ = SessionHasOutput(*talker_prefill_, "present_k") && SessionHasInput(*talker_, "past_k");
 
+    // Augmented talker export: both talker graphs must expose the same top-k outputs.
+    talker_topk_ = 0;
+    talker_has_allow_eos_ = false;
+    talker_has_temperature_ = false;
+    if (cfg.model.talker_graph_select) {
+        const int64_t k_prefill = GetSessionOutputDim(*talker_prefill_, "topk_indices", -1);
+        const int64_t k_decode = GetSessionOutputDim(*talker_, "topk_indices", -1);
+        if (k_prefill > 0 && k_prefill == k_decode &&
+            SessionHasOutput(*talker_prefill_, "topk_values") && SessionHasOutput(*talker_, "topk_values")) {
+            talker_topk_ = k_decode;
+        }
+    }
+    // Selection inputs are fed whenever the graphs declare them, even in full-logits mode.
+    talker_has_allow_eos_ = SessionHasInput(*talker_prefill_, "allow_eos") && SessionHasInput(*talker_, "allow_eos");
+    talker_has_temperature_ = SessionHasInput(*talker_prefill_, "temperature") && SessionHasInput(*talker_, "temperature");
+    if (talker_prefill_chunk_) {
+        // The continuation graph must mirror talker_prefill's selection interface.
+        const Ort::Session& chunk = *talker_prefill_chunk_;
+        const bool ok = use_kv_cache_ && SessionHasInput(chunk, "past_k") && SessionHasInput(chunk, "cache_position") &&
+                        SessionHasOutput(chunk, "present_k") &&
+                        (talker_topk_ == 0 || GetSessionOutputDim(chunk, "topk_indices", -1) == talker_topk_) &&
+                        (!talker_has_allow_eos_ || SessionHasInput(chunk, "allow_eos")) &&
+                        (!talker_has_temperature_ || SessionHasInput(chunk, "temperature"));
+        if (ok) {
+            QWEN3TTS_LOG_INFO("talker") << "chunked prefill: " << prefill_chunk_path;
+        } else {
+            QWEN3TTS_LOG_WARN("talker") << "ignoring " << prefill_chunk_path << ": interface does not match the talker";
+            talker_prefill_chunk_.reset();
+        }
+    }
+    if (talker_topk_ > 0) {
+        QWEN3TTS_LOG_INFO("talker") << "on-graph selection: top-" << talker_topk_
+                                    << (talker_has_allow_eos_ ? ", eos mask" : "") << (talker_has_temperature_ ? ", temperature" : "");
+    }
+    if (!ResolveModelDims()) {
+        return fail_load(_last_error_code, _last_error_message);
+    }
+    _step_predictor = StepPredictor();
+    if (!_config.model.step_predictor_file.empty() && std::filesystem::exists(_config.model.step_predictor_file)) {
+        std::string predictor_err;
+        if (!_step_predictor.loadFile(_config.model.step_predictor_file, &predictor_err)) {
+            return fail_load(-3006, predictor_err);
+        }
+        QWEN3TTS_LOG_INFO("step-predictor") << "loaded " << _step_predictor.per_lang.size() << " language fits";
+    }
 
     _loaded = true;
     _last_error_code = 0;
@@ -206,16 +424,206 @@ bool Voice::load(const TtsConfig &cfg)
     return false;
 }
 
+bool Voice::ResolveModelDims()
+{
+    ModelDims dims;
+    std::string manifest;
+    if (!_config.model.manifest_file.empty() && std::filesystem::exists(_config.model.manifest_file)) {
+        manifest = ReadAll(_config.model.manifest_file);
+    }
+    // Manifest first (keys as in the HF talker config), then the graphs themselves.
+    auto from_manifest = [&](const char* key, int64_t* out) {
+        const int64_t v = manifest.empty() ? 0 : ParseIntScalar(manifest, key);
+        if (v > 0) *out = v;
+    };
+    from_manifest("hidden_size", &dims.hidden);
+    from_manifest("vocab_size", &dims.talker_vocab);
+    from_manifest("codec_vocab_size", &dims.cp_vocab);
+    from_manifest("num_code_groups", &dims.code_groups);
+    from_manifest("codec_eos_token_id", &dims.codec_eos_id);
+    from_manifest("kv_bytes_per_token", &dims.kv_bytes_per_token);
+    from_manifest("vocoder_bytes_per_frame", &dims.vocoder_bytes_per_frame);
+    int64_t sample_rate = dims.sample_rate;
+    from_manifest("sample_rate", &sample_rate);
+    dims.sample_rate = static_cast<int>(sample_rate);
+
+    const std::string eos_meta = GetSessionMetadata(*talker_, "codec_eos_token_id");
+    if (!eos_meta.empty()) dims.codec_eos_id = std::stoll(eos_meta);
+
+    // Static shapes in the graphs are authoritative; symbolic (-1) dims keep the value above.
+    std::string mismatch;
+    auto from_graph = [&](int64_t graph_dim, int64_t* out, const char* what) {
+        if (graph_dim <= 0) return;
+        if (!manifest.empty() && *out != graph_dim) {
+            mismatch += std::string(what) + ": manifest " + std::to_string(*out) + ", graph " + std::to_string(graph_dim) + "; ";
+        }
+        *out = graph_dim;
+    };
+    from_graph(GetSessionOutputDim(*talker_, "last_hidden", -1), &dims.hidden, "hidden");
+    from_graph(GetSessionOutputDim(*talker_, "logits", -1), &dims.talker_vocab, "talker_vocab");
+    Ort::Session& cp = has_cp_dynamic_ ? *cp_dynamic_ : *cp_steps_.front();
+    from_graph(GetSessionOutputDim(cp, "logits", -1), &dims.cp_vocab, "cp_vocab");
+    const int64_t prev_codes = GetSessionInputDim(cp, "prev_codes", -1);
+    from_graph(prev_codes > 0 ? prev_codes + 2 : -1, &dims.code_groups, "code_groups");
+    // present_k's static axes (layers, KV heads, head_dim) and dtype give one position's KV cost.
+    if (use_kv_cache_) {
+        const int64_t step_bytes = GetSessionOutputBytesPerStep(*talker_prefill_, "present_k");
+        if (step_bytes > 0) dims.kv_bytes_per_token = 2 * step_bytes;
+    }
+    if (!mismatch.empty()) {
+        _last_error_code = -3005;
+        _last_error_message = "model dimension mismatch between manifest and graphs: " + mismatch;
+        return false;
+    }
+
+    if (dims.hidden <= 0 || dims.code_groups < 2 || dims.cp_vocab <= 0 || dims.talker_vocab < dims.cp_vocab ||
+        dims.codec_eos_id < dims.cp_vocab || dims.codec_eos_id >= dims.talker_vocab || dims.sample_rate <= 0) {
+        _last_error_code = -3005;
+        _last_error_message = "invalid model dimensions";
+        return false;
+    }
+    if (!has_cp_dynamic_ && static_cast<int64_t>(cp_steps_.size()) < dims.code_groups - 1) {
+        _last_error_code = -3005;
+        _last_error_message = "expected " + std::to_string(dims.code_groups - 1) + " code predictor step models, found " +
+                              std::to_string(cp_steps_.size());
+        return false;
+    }
+    cp_fill_codes_ = manifest.empty() ? std::vector<int64_t>() : ParseIntArray(manifest, "cp_fill_codes");
+    if (cp_fill_codes_.empty()) {
+        cp_fill_codes_.assign(static_cast<size_t>(dims.code_groups - 1), 0);
+    } else if (static_cast<int64_t>(cp_fill_codes_.size()) != dims.code_groups - 1 ||
+               std::any_of(cp_fill_codes_.begin(), cp_fill_codes_.end(), [&](int64_t c) { return c < 0 || c >= dims.cp_vocab; })) {
+        _last_error_code = -3005;
+        _last_error_message = "manifest cp_fill_codes must hold " + std::to_string(dims.code_groups - 1) +
+                              " codes in [0, cp_vocab)";
+        return false;
+    }
+    _dims = dims;
+    QWEN3TTS_LOG_INFO("dims") << "hidden=" << _dims.hidden << " talker_vocab=" << _dims.talker_vocab
+                              << " cp_vocab=" << _dims.cp_vocab << " code_groups=" << _dims.code_groups
+                              << " codec_eos=" << _dims.codec_eos_id << Kv("kv_bytes_per_token", _dims.kv_bytes_per_token);
+    return true;
+}
+
+int Voice::FailGeneration(const char* where, int code, const std::string& msg)
+{
+    QWEN3TTS_LOG_ERROR("voice") << where << " failed: " << msg << Kv("req", _params.request_id) << Kv("code", code);
+    Metrics::instance().recordError(code);
+    _last_error_code = code;
+    _last_error_message = msg;
+    return code;
+}
+
+int Voice::FailFromException(const char* where, const std::string& msg)
+{
+    if (msg.find("input_ids") != std::string::npos || msg.find("instruct_ids") != std::string::npos) {
+        return FailGeneration(where, -1101, msg);
+    }
+    if (msg.find("temperature") != std::string::npos) return FailGeneration(where, -1102, msg);
+    if (msg.find("top_k") != std::string::npos) return FailGeneration(where, -1103, msg);
+    if (msg.find("tail_stop") != std::string::npos) return FailGeneration(where, -1104, msg);
+    if (msg.find("eos_min_steps") != std::string::npos) return FailGeneration(where, -1105, msg);
+    if (msg.find("No audio codes generated") != std::string::npos) return FailGeneration(where, -1201, msg);
+    if (msg.find("All generated frames were trimmed") != std::string::npos) return FailGeneration(where, -1202, msg);
+    if (msg.find("CUDA") != std::string::npos) return FailGeneration(where, -1301, msg);
+    if (msg.find("onnx") != std::string::npos || msg.find("Ort") != std::string::npos) {
+        return FailGeneration(where, -1302, msg);
+    }
+    return FailGeneration(where, -1999, msg);
+}
+
+bool Voice::UseGraphSelect() const
+{
+    // With an augmented talker export the EOS/cp-vocab mask and top-k run in the graph and
+    // only K candidates come back; full logits are requested only when K cannot cover top_k.
+    return talker_topk_ > 0 &&
+        (!_params.do_sample || _params.temperature <= 0.0f || (_params.top_k > 0 && _params.top_k <= talker_topk_));
+}
+
+std::vector<const char*> Voice::TalkerOutputNames(bool graph_select) const
+{
+    std::vector<const char*> names;
+    if (graph_select) {
+        names = {"topk_values", "topk_indices"};
+    } else {
+        names = {"logits"};
+    }
+    names.push_back("last_hidden");
+    if (use_kv_cache_) {
+        names.push_back("present_k");
+        names.push_back("present_v");
+    }
+    return names;
+}
+
+// Feeds the optional selection inputs of the augmented export after the regular ones.
+void Voice::AppendSelectInputs(GenerationState* state, std::vector<const char*>* names, std::vector<Ort::Value>* values, bool allow_eos)
+{
+    if (talker_has_allow_eos_) {
+        state->_allow_eos_vec[0] = allow_eos ? 1 : 0;
+        names->push_back("allow_eos");
+        values->push_back(MakeTensorI64(*mi_, state->_allow_eos_vec, {1}));
+    }
+    if (talker_has_temperature_) {
+        state->_temperature_vec[0] = _params.temperature > 0.0f ? _params.temperature : 1.0f;
+        names->push_back("temperature");
+        values->push_back(MakeTensorF32(*mi_, state->_temperature_vec, {1}));
+    }
+}
+
+int64_t Voice::SelectFirstCode(const GenerationState& state, std::vector<Ort::Value>& out, bool graph_select, bool allow_eos, int64_t frame)
+{
+    // Draws are keyed by (seed, frame, group) rather than a sequential stream.
+    SampleKey sample_key;
+    sample_key.seed = state._seed;
+    sample_key.step = static_cast<uint64_t>(frame);
+    sample_key.group = 0;
+    if (graph_select) {
+        const float* values = out[0].GetTensorMutableData<float>();
+        const int64_t* indices = out[1].GetTensorMutableData<int64_t>();
+        // Values already divided by temperature on-graph need no second scaling.
+        const float host_temperature = talker_has_temperature_ ? 1.0f : _params.temperature;
+        // Without an allow_eos input the graph never masks EOS, so eos_min_steps is applied here.
+        const int64_t masked_id = (allow_eos || talker_has_allow_eos_) ? -1 : _dims.codec_eos_id;
+        return SelectFromTopK(values, indices, talker_topk_, _params.do_sample && _params.temperature > 0.0f,
+                              host_temperature, _params.top_k, sample_key, masked_id);
+    }
+    return SelectTalkerFirstCode(
+        out[0].GetTensorMutableData<float>(),
+        _dims.talker_vocab,
+        _dims.cp_vocab,
+        _dims.codec_eos_id,
+        allow_eos,
+        _params.do_sample,
+        _params.temperature,
+        _params.top_k,
+        sample_key);
+}
+
 std::vector<float> Voice::generateVoice(GenerationParams &params)
 {
-    auto err_pcm = [](float code) { return std::vector<float>{code}; };
+    GenerationState state;
+    if (!beginGeneration(params, &state)) return {static_cast<float>(_last_error_code)};
+    const int rc = stepGeneration(&state, 0);
+    if (rc < 0) return {static_cast<float>(rc)};
+    return finishGeneration(&state);
+}
+
+bool Voice::beginGeneration(const GenerationParams &params, GenerationState* state)
+{
+    return beginGeneration(params, state, 0);
+}
+
+bool Voice::beginGeneration(const GenerationParams &params, GenerationState* state, int prefill_chunk_tokens)
+{
+    static constexpr const char* kWhere = "beginGeneration";
     auto fail_gen = [&](int code, const std::string& msg) {
-        std::cerr << "Voice::generateVoice failed: " << msg << "\n";
-        _last_error_code = code;
-        _last_error_message = msg;
-        return err_pcm(static_cast<float>(code));
+        FailGeneration(kWhere, code, msg);
+        return false;
     };
     try {
+    if (!state) return fail_gen(-1601, "generation state is null");
+    state->reset();
     if (!_loaded) {
         return fail_gen(-1001, "runtime is not loaded");
     }
@@ -231,21 +639,35 @@ std::vector<float> Voice::generateVoice(GenerationParams &params)
     if (_params.tail_stop_repeat_frames < 0) return fail_gen(-1104, "tail_stop_repeat_frames must be >= 0");
     if (_params.tail_stop_min_steps < 0) return fail_gen(-1104, "tail_stop_min_steps must be >= 0");
     if (_params.eos_min_steps < 0) return fail_gen(-1105, "eos_min_steps must be >= 0");
+    if (_params.cp_groups < 0) return fail_gen(-1107, "cp_groups must be >= 0");
+    if (_params.cp_fill_codes.empty()) {
+        _params.cp_fill_codes = cp_fill_codes_;
+    } else if (static_cast<int64_t>(_params.cp_fill_codes.size()) != _dims.code_groups - 1 ||
+               std::any_of(_params.cp_fill_codes.begin(), _params.cp_fill_codes.end(),
+                           [&](int64_t c) { return c < 0 || c >= _dims.cp_vocab; })) {
+        return fail_gen(-1107, "cp_fill_codes must hold " + std::to_string(_dims.code_groups - 1) + " codes in [0, cp_vocab)");
+    }
 
+    const int64_t text_tokens = std::max<int64_t>(1, static_cast<int64_t>(_input_ids.size()) - kVoiceDesignTemplateTokens);
+    const int64_t lang = _params.codec_lang.empty() ? -1 : _params.codec_lang[0];
+    const StepEstimate estimate = _step_predictor.predict(text_tokens, lang);
     int steps = _params.steps;
     if (steps <= 0) {
         if (_params.max_steps > 0) {
             steps = _params.max_steps;
-            std::cout << "[auto-steps] selected=max_steps=" << steps
-                      << " (EOS/tail-stop may finish earlier)\n";
+            QWEN3TTS_LOG_INFO("auto-steps") << "selected=max_steps" << Kv("req", _params.request_id)
+                                            << Kv("steps", steps);
         } else {
-            steps = 2000;
-            std::cout << "[auto-steps] selected=tail-mode, safety_cap=" << steps
-                      << " (set max_steps to limit)\n";
+            steps = estimate.cap;
+            QWEN3TTS_LOG_INFO("auto-steps") << "selected=predicted" << Kv("req", _params.request_id)
+                                            << Kv("expected", estimate.expected) << Kv("safety_cap", steps);
         }
     }
     if (steps <= 0) return fail_gen(-1106, "steps must be > 0");
 
+    const int64_t hidden = _dims.hidden;
+    const int64_t code_groups = _dims.code_groups;
+
     uint64_t seed = 0;
     if (_params.seed >= 0) {
         seed = static_cast<uint64_t>(_params.seed);
@@ -253,7 +675,12 @@ std::vector<float> Voice::generateVoice(GenerationParams &params)
         std::random_device rd;
         seed = (static_cast<uint64_t>(rd()) << 32) ^ static_cast<uint64_t>(rd());
     }
-    std::mt19937_64 rng(seed);
+    state->_params = _params;
+    state->_dims = _dims;
+    state->_use_kv_cache = use_kv_cache_;
+    state->_seed = seed;
+    state->_steps = steps;
+    state->_expected_frames = estimate.expected;
 
     std::vector<int64_t> input_ids = _input_ids;
     std::vector<int64_t> instruct_ids = _instruct_ids;
@@ -269,90 +696,223 @@ std::vector<float> Voice::generateVoice(GenerationParams &params)
     const char* pb_out_names[] = {"prefill_embeds", "tts_pad_embed"};
     std::array<Ort::Value, 3> pb_inputs = {
         std::move(input_ids_tensor), std::move(instruct_ids_tensor), std::move(lang_tensor)};
+    auto stage_t0 = std::chrono::steady_clock::now();
     auto pb_out = prefill_builder_->Run(
         Ort::RunOptions{nullptr}, pb_in_names, pb_inputs.data(), pb_inputs.size(), pb_out_names, 2);
+    state->_prefill_ms = MsSince(stage_t0);
 
     Ort::Value prefill_embeds = std::move(pb_out[0]);
     Ort::Value tts_pad_embed_val = std::move(pb_out[1]);
     float* tts_pad_ptr = tts_pad_embed_val.GetTensorMutableData<float>();
-    std::vector<float> trailing_step(tts_pad_ptr, tts_pad_ptr + kHidden);
+    state->_trailing_step.assign(tts_pad_ptr, tts_pad_ptr + hidden);
 
-    auto prefill_shape = prefill_embeds.GetTensorTypeAndShapeInfo().GetShape();
-    const int64_t prefill_len = prefill_shape[1];
+    state->_prefill_shape = prefill_embeds.GetTensorTypeAndShapeInfo().GetShape();
+    state->_prefill_len = state->_prefill_shape[1];
     const int64_t prefill_elems = std::accumulate(
-        prefill_shape.begin(), prefill_shape.end(), int64_t{1}, std::multiplies<int64_t>());
+        state->_prefill_shape.begin(), state->_prefill_shape.end(), int64_t{1}, std::multiplies<int64_t>());
     float* prefill_ptr = prefill_embeds.GetTensorMutableData<float>();
-    std::vector<float> prefill_copy(prefill_ptr, prefill_ptr + prefill_elems);
-    auto prefill_tensor = MakeTensorF32(*mi_, prefill_copy, prefill_shape);
+    state->_prefill_embeds.assign(prefill_ptr, prefill_ptr + prefill_elems);
+    state->_prefill_done = 0;
+    // Chunks need the KV cache and the continuation export; otherwise the prompt goes in one call.
+    state->_prefill_chunk = (use_kv_cache_ && talker_prefill_chunk_) ? std::max(0, prefill_chunk_tokens) : 0;
+
+    state->_all_codes.reserve(static_cast<size_t>(std::min(steps, estimate.cap) * code_groups));
+    state->_prev_generated_first_code = std::numeric_limits<int64_t>::min();
+    state->_same_first_code_run = 0;
+    state->_prev_frame.assign(static_cast<size_t>(code_groups), std::numeric_limits<int64_t>::min());
+    state->_same_frame_run = 0;
+    state->_next_step = 0;
+    state->_silence.configure(_params);
+    state->_started = true;
+    _last_error_code = 0;
+    _last_error_message.clear();
+    if (prefill_chunk_tokens > 0) return true;
+    if (prefillGeneration(state) < 0) {
+        state->reset();
+        return false;
+    }
+    return true;
+    } catch (const std::exception& e) {
+        if (state) state->reset();
+        FailFromException(kWhere, e.what());
+        return false;
+    } catch (...) {
+        if (state) state->reset();
+        FailGeneration(kWhere, -2000, "unknown exception");
+        return false;
+    }
+}
+
+// Runs talker_prefill on the first chunk, then talker_prefill_chunk on each following one
+// with the KV cache so far; the last chunk's logits pick the first code.
+int Voice::prefillGeneration(GenerationState* state)
+{
+    static constexpr const char* kWhere = "prefillGeneration";
+    auto fail_gen = [&](int code, const std::string& msg) { return FailGeneration(kWhere, code, msg); };
+    try {
+    if (!state || !state->_started) return fail_gen(-1601, "generation state is not started");
+    if (!_loaded) {
+        return fail_gen(-1001, "runtime is not loaded");
+    }
+    if (!mi_.has_value()) {
+        return fail_gen(-1002, "memory info is not initialized");
+    }
+    if (!state->prefilling()) return 1;
+    if (state->_dims.hidden != _dims.hidden || state->_use_kv_cache != use_kv_cache_ ||
+        (state->_prefill_done > 0 && !talker_prefill_chunk_)) {
+        return fail_gen(-1602, "generation state does not match the loaded model");
+    }
+    _params = state->_params;
+    const int64_t hidden = _dims.hidden;
+    const int64_t begin = state->_prefill_done;
+    const int64_t remaining = state->_prefill_len - begin;
+    const int64_t len = state->_prefill_chunk > 0 ? std::min<int64_t>(state->_prefill_chunk, remaining) : remaining;
+    const bool last = begin + len == state->_prefill_len;
 
-    const char* tp_in_names[] = {"prefill_embeds"};
-    std::vector<Ort::Value> tp_out;
-    std::array<Ort::Value, 1> tp_inputs = {std::move(prefill_tensor)};
+    const bool graph_select = UseGraphSelect();
+    const size_t sel_outputs = graph_select ? 2 : 1;
+    const bool allow_eos = 0 >= _params.eos_min_steps;
+    std::vector<float> chunk(state->_prefill_embeds.begin() + begin * hidden,
+                             state->_prefill_embeds.begin() + (begin + len) * hidden);
+    std::vector<int64_t> cache_pos(1, begin);
+    std::vector<const char*> tp_in_names = {"prefill_embeds"};
+    std::vector<Ort::Value> tp_inputs;
+    tp_inputs.push_back(MakeTensorF32(*mi_, chunk, {kBatch, len, hidden}));
+    if (begin > 0) {
+        tp_in_names.insert(tp_in_names.end(), {"past_k", "past_v", "cache_position"});
+        tp_inputs.push_back(std::move(state->_past_k));
+        tp_inputs.push_back(std::move(state->_past_v));
+        tp_inputs.push_back(MakeTensorI64(*mi_, cache_pos, {1}));
+    }
+    AppendSelectInputs(state, &tp_in_names, &tp_inputs, allow_eos);
+    const std::vector<const char*> tp_out_names = TalkerOutputNames(graph_select);
+    Ort::Session& session = begin > 0 ? *talker_prefill_chunk_ : *talker_prefill_;
+    const auto stage_t0 = std::chrono::steady_clock::now();
+    std::vector<Ort::Value> tp_out = session.Run(
+        Ort::RunOptions{nullptr}, tp_in_names.data(), tp_inputs.data(), tp_inputs.size(), tp_out_names.data(), tp_out_names.size());
+    state->_talker_ms += MsSince(stage_t0);
+    state->_prefill_done = begin + len;
     if (use_kv_cache_) {
-        const char* tp_out_names_cache[] = {"logits", "last_hidden", "present_k", "present_v"};
-        tp_out = talker_prefill_->Run(
-            Ort::RunOptions{nullptr}, tp_in_names, tp_inputs.data(), 1, tp_out_names_cache, 4);
-    } else {
-        const char* tp_out_names[] = {"logits", "last_hidden"};
-        tp_out = talker_prefill_->Run(
-            Ort::RunOptions{nullptr}, tp_in_names, tp_inputs.data(), 1, tp_out_names, 2);
-    }
-
-    float* prefill_logits_ptr = tp_out[0].GetTensorMutableData<float>();
-    int64_t first_code = SelectTalkerFirstCode(
-        prefill_logits_ptr,
-        kTalkerVocab,
-        kCpVocab,
-        kCodecEosId,
-        0 >= _params.eos_min_steps,
-        _params.do_sample,
-        _params.temperature,
-        _params.top_k,
-        &rng);
-    if (first_code < 0 || first_code >= kTalkerVocab) {
+        state->_past_k = std::move(tp_out[sel_outputs + 1]);
+        state->_past_v = std::move(tp_out[sel_outputs + 2]);
+    }
+    if (!last) return 0;
+    // Before the first decode step _talker_ms holds only the prefill chunks.
+    Metrics::instance().prefill_ms.observe(state->_prefill_ms + state->_talker_ms);
+
+    const int64_t first_code = SelectFirstCode(*state, tp_out, graph_select, allow_eos, 0);
+    if (first_code < 0 || first_code >= _dims.talker_vocab) {
         return fail_gen(-1204, "Failed to select first talker code");
     }
-    float* prefill_last_hidden_ptr = tp_out[1].GetTensorMutableData<float>();
+    float* prefill_last_hidden_ptr = tp_out[sel_outputs].GetTensorMutableData<float>();
+    state->_past_hidden.assign(prefill_last_hidden_ptr, prefill_last_hidden_ptr + hidden);
+    state->_current_first_code = first_code;
+    // The no-cache talker re-reads the prompt on every step; the cached one is done with it.
+    if (use_kv_cache_) {
+        state->_prefill_embeds.clear();
+        state->_prefill_embeds.shrink_to_fit();
+    }
+    _last_error_code = 0;
+    _last_error_message.clear();
+    return 1;
+    } catch (const std::exception& e) {
+        return FailFromException(kWhere, e.what());
+    } catch (...) {
+        return fail_gen(-2000, "unknown exception");
+    }
+}
+
+int Voice::stepGeneration(GenerationState* state, int max_frames)
+{
+    static constexpr const char* kWhere = "stepGeneration";
+    auto fail_gen = [&](int code, const std::string& msg) { return FailGeneration(kWhere, code, msg); };
+    try {
+    if (!state || !state->_started) return fail_gen(-1601, "generation state is not started");
+    if (!_loaded) {
+        return fail_gen(-1001, "runtime is not loaded");
+    }
+    if (!mi_.has_value()) {
+        return fail_gen(-1002, "memory info is not initialized");
+    }
+    const ModelDims& sd = state->_dims;
+    if (sd.hidden != _dims.hidden || sd.talker_vocab != _dims.talker_vocab || sd.cp_vocab != _dims.cp_vocab ||
+        sd.code_groups != _dims.code_groups || sd.codec_eos_id != _dims.codec_eos_id ||
+        state->_use_kv_cache != use_kv_cache_) {
+        return fail_gen(-1602, "generation state does not match the loaded model");
+    }
+    if (state->_finished) return 1;
+    if (state->prefilling()) {
+        // A chunked prefill the caller did not finish is completed before the first frame.
+        int rc = 0;
+        while ((rc = prefillGeneration(state)) == 0) {
+        }
+        if (rc < 0) return rc;
+    }
+    _params = state->_params;
 
-    std::vector<int64_t> codec_ids(kCodeGroups, 1);
-    std::vector<int64_t> all_codes;
-    all_codes.reserve(static_cast<size_t>(steps * kCodeGroups));
-    std::vector<int64_t> prev_codes(kCodeGroups - 2, 0);
+    const int64_t hidden = _dims.hidden;
+    const int64_t talker_vocab = _dims.talker_vocab;
+    const int64_t cp_vocab = _dims.cp_vocab;
+    const int64_t code_groups = _dims.code_groups;
+    const int64_t codec_eos_id = _dims.codec_eos_id;
+    const int steps = state->_steps;
+
+    // A restored snapshot carries the KV cache as host bytes; wrap them in place until the
+    // next talker step replaces them with fresh outputs.
+    if (use_kv_cache_ && !state->_past_k) {
+        GenerationState::HostTensor& hk = state->_past_k_host;
+        GenerationState::HostTensor& hv = state->_past_v_host;
+        if (hk.bytes.empty() || hv.bytes.empty()) return fail_gen(-1602, "generation state has no KV cache");
+        const OrtMemoryInfo* info = *mi_;
+        state->_past_k = Ort::Value::CreateTensor(
+            info, hk.bytes.data(), hk.bytes.size(), hk.shape.data(), hk.shape.size(),
+            static_cast<ONNXTensorElementDataType>(hk.elem_type));
+        state->_past_v = Ort::Value::CreateTensor(
+            info, hv.bytes.data(), hv.bytes.size(), hv.shape.data(), hv.shape.size(),
+            static_cast<ONNXTensorElementDataType>(hv.elem_type));
+    }
+
+    SampleKey sample_key;
+    sample_key.seed = state->_seed;
+    const bool graph_select = UseGraphSelect();
+    const size_t sel_outputs = graph_select ? 2 : 1;
+    const std::vector<const char*> talker_out_names = TalkerOutputNames(graph_select);
+
+    std::vector<int64_t> codec_ids(code_groups, 1);
+    std::vector<int64_t> prev_codes(code_groups - 2, 0);
     std::vector<int64_t> first_code_vec(1, 0);
-    std::vector<int64_t> codec_step_vec(kCodeGroups, 0);
-    std::vector<float> trailing_step_vec = trailing_step;
+    std::vector<int64_t> codec_step_vec(code_groups, 0);
     std::vector<int64_t> cache_pos_vec(1, 0);
     std::vector<int64_t> step_id_vec(1, 0);
     const char* cp_in_names[] = {"past_hidden", "first_code_id", "prev_codes"};
     const char* cp_out_names[] = {"logits"};
     const char* cp_dyn_in_names[] = {"past_hidden", "first_code_id", "prev_codes", "step_id"};
-
-    std::vector<float> current_past_hidden(prefill_last_hidden_ptr, prefill_last_hidden_ptr + kHidden);
-    Ort::Value past_k_cache{nullptr};
-    Ort::Value past_v_cache{nullptr};
-    if (use_kv_cache_) {
-        past_k_cache = std::move(tp_out[2]);
-        past_v_cache = std::move(tp_out[3]);
+    std::vector<int64_t>& all_codes = state->_all_codes;
+    // Preview tier: residual groups past cp_groups take their fill code without a CP call.
+    const int cp_run = _params.cp_groups > 0 ? std::min<int>(_params.cp_groups, static_cast<int>(code_groups - 1))
+                                             : static_cast<int>(code_groups - 1);
+    for (int g = cp_run; g < code_groups - 1; ++g) {
+        codec_ids[g + 1] = _params.cp_fill_codes[static_cast<size_t>(g)];
     }
-    int64_t current_first_code = first_code;
-    int64_t prev_generated_first_code = std::numeric_limits<int64_t>::min();
-    int same_first_code_run = 0;
-    std::vector<int64_t> prev_frame(kCodeGroups, std::numeric_limits<int64_t>::min());
-    int same_frame_run = 0;
-
 
-    for (int s = 0; s < steps; ++s) {
-        if (s > 0 && current_first_code == kCodecEosId && s >= _params.eos_min_steps) {
+    int produced = 0;
+    for (int s = state->_next_step; s < steps; ++s) {
+        if (max_frames > 0 && produced >= max_frames) {
+            return 0;
+        }
+        if (s > 0 && state->_current_first_code == codec_eos_id && s >= _params.eos_min_steps) {
+            state->_stop_reason = StopReason::Eos;
             break;
         }
-        codec_ids[0] = current_first_code;
+        codec_ids[0] = state->_current_first_code;
         std::fill(prev_codes.begin(), prev_codes.end(), 0);
 
-        for (int g = 0; g < kCodeGroups - 1; ++g) {
-            auto past_hidden_tensor = MakeTensorF32(*mi_, current_past_hidden, {kBatch, 1, kHidden});
+        const auto cp_t0 = std::chrono::steady_clock::now();
+        for (int g = 0; g < cp_run; ++g) {
+            auto past_hidden_tensor = MakeTensorF32(*mi_, state->_past_hidden, {kBatch, 1, hidden});
             first_code_vec[0] = codec_ids[0];
             auto first_code_tensor = MakeTensorI64(*mi_, first_code_vec, {kBatch, 1});
-            auto prev_codes_tensor = MakeTensorI64(*mi_, prev_codes, {kBatch, kCodeGroups - 2});
+            auto prev_codes_tensor = MakeTensorI64(*mi_, prev_codes, {kBatch, code_groups - 2});
             std::array<Ort::Value, 3> cp_inputs = {
                 std::move(past_hidden_tensor), std::move(first_code_tensor), std::move(prev_codes_tensor)};
             std::vector<Ort::Value> cp_out;
@@ -374,216 +934,715 @@ std::vector<float> Voice::generateVoice(GenerationParams &params)
             }
 
             float* cp_logits_ptr = cp_out[0].GetTensorMutableData<float>();
+            sample_key.step = static_cast<uint64_t>(s);
+            sample_key.group = static_cast<uint32_t>(g + 1);
             const int64_t pred = SelectCpCode(
-                cp_logits_ptr, kCpVocab, _params.do_sample, _params.temperature, _params.top_k, &rng);
-            if (pred < 0 || pred >= kCpVocab) return fail_gen(-1203, "Predicted cp code out of range");
+                cp_logits_ptr, cp_vocab, _params.do_sample, _params.temperature, _params.top_k, sample_key);
+            if (pred < 0 || pred >= cp_vocab) return fail_gen(-1203, "Predicted cp code out of range");
             codec_ids[g + 1] = pred;
-            if (g < kCodeGroups - 2) {
+            if (g < code_groups - 2) {
                 prev_codes[g] = pred;
             }
         }
 
+        const double cp_ms = MsSince(cp_t0);
+        state->_cp_ms += cp_ms;
+        Metrics::instance().cp_step_ms.observe(cp_ms);
         all_codes.insert(all_codes.end(), codec_ids.begin(), codec_ids.end());
-        if (codec_ids[0] == prev_generated_first_code) {
-            ++same_first_code_run;
+        ++produced;
+        state->_next_step = s + 1;
+        if (codec_ids[0] == state->_prev_generated_first_code) {
+            ++state->_same_first_code_run;
         } else {
-            same_first_code_run = 1;
-            prev_generated_first_code = codec_ids[0];
+            state->_same_first_code_run = 1;
+            state->_prev_generated_first_code = codec_ids[0];
         }
-        if (s > 0 && codec_ids == prev_frame) {
-            ++same_frame_run;
+        if (s > 0 && codec_ids == state->_prev_frame) {
+            ++state->_same_frame_run;
         } else {
-            same_frame_run = 1;
+            state->_same_frame_run = 1;
         }
-        prev_frame = codec_ids;
+        state->_prev_frame = codec_ids;
         const int generated_now = s + 1;
         if (_params.tail_stop_repeat_frames > 0 &&
             generated_now >= _params.tail_stop_min_steps &&
-            same_frame_run >= _params.tail_stop_repeat_frames) {
-            std::cout << "[tail-stop] repeated full frame " << same_frame_run
-                      << " times at step=" << generated_now << "\n";
+            state->_same_frame_run >= _params.tail_stop_repeat_frames) {
+            QWEN3TTS_LOG_INFO("stop") << "repeated full frame" << Kv("req", _params.request_id)
+                                      << Kv("reason", "tail_repeat") << Kv("step", generated_now)
+                                      << Kv("run", state->_same_frame_run);
+            state->_stop_reason = StopReason::TailRepeat;
             break;
         }
         if (_params.auto_stop_first_code_run > 0 &&
             generated_now >= _params.auto_stop_min_steps &&
-            same_first_code_run >= _params.auto_stop_first_code_run) {
-            std::cout << "[auto-stop] repeated first code " << same_first_code_run
-                      << " times at step=" << generated_now << "\n";
+            state->_same_first_code_run >= _params.auto_stop_first_code_run) {
+            QWEN3TTS_LOG_INFO("stop") << "repeated first code" << Kv("req", _params.request_id)
+                                      << Kv("reason", "first_code_repeat") << Kv("step", generated_now)
+                                      << Kv("run", state->_same_first_code_run);
+            state->_stop_reason = StopReason::FirstCodeRepeat;
+            break;
+        }
+        if (ProbeSilence(state)) {
+            QWEN3TTS_LOG_INFO("stop") << "trailing silence" << Kv("req", _params.request_id)
+                                      << Kv("reason", "silence") << Kv("step", generated_now)
+                                      << Kv("silent_frames", state->_silence.trailingSilentFrames())
+                                      << Kv("trimmed", state->_silence_trimmed);
+            state->_stop_reason = StopReason::Silence;
             break;
         }
+        if (_params.on_audio && _params.vocoder_window_frames > 0) {
+            std::string stream_err;
+            if (!StreamAudio(state, &stream_err)) {
+                if (state->_audio_stream->aborted()) return fail_gen(-1304, "audio sink aborted generation");
+                return fail_gen(-1302, stream_err.empty() ? "failed to decode audio codes" : stream_err);
+            }
+        }
 
         if (s == steps - 1) {
             break;
         }
 
+        const auto talker_t0 = std::chrono::steady_clock::now();
         std::vector<Ort::Value> talker_out;
+        const bool step_allow_eos = (s + 1) >= _params.eos_min_steps;
         if (use_kv_cache_) {
             codec_step_vec = codec_ids;
-            cache_pos_vec[0] = prefill_len + static_cast<int64_t>(s);
-            auto codec_step_tensor = MakeTensorI64(*mi_, codec_step_vec, {kBatch, 1, kCodeGroups});
-            auto trailing_step_tensor = MakeTensorF32(*mi_, trailing_step_vec, {kBatch, 1, kHidden});
+            cache_pos_vec[0] = state->_prefill_len + static_cast<int64_t>(s);
+            auto codec_step_tensor = MakeTensorI64(*mi_, codec_step_vec, {kBatch, 1, code_groups});
+            auto trailing_step_tensor = MakeTensorF32(*mi_, state->_trailing_step, {kBatch, 1, hidden});
             auto cache_pos_tensor = MakeTensorI64(*mi_, cache_pos_vec, {1});
-            const char* talker_in_names[] = {"codec_ids_step", "trailing_text_step", "past_k", "past_v", "cache_position"};
-            const char* talker_out_names[] = {"logits", "last_hidden", "present_k", "present_v"};
-            std::array<Ort::Value, 5> talker_inputs = {
-                std::move(codec_step_tensor),
-                std::move(trailing_step_tensor),
-                std::move(past_k_cache),
-                std::move(past_v_cache),
-                std::move(cache_pos_tensor),
-            };
+            std::vector<const char*> talker_in_names = {"codec_ids_step", "trailing_text_step", "past_k", "past_v", "cache_position"};
+            std::vector<Ort::Value> talker_inputs;
+            talker_inputs.reserve(talker_in_names.size() + 2);
+            talker_inputs.push_back(std::move(codec_step_tensor));
+            talker_inputs.push_back(std::move(trailing_step_tensor));
+            talker_inputs.push_back(std::move(state->_past_k));
+            talker_inputs.push_back(std::move(state->_past_v));
+            talker_inputs.push_back(std::move(cache_pos_tensor));
+            AppendSelectInputs(state, &talker_in_names, &talker_inputs, step_allow_eos);
             talker_out = talker_->Run(
-                Ort::RunOptions{nullptr}, talker_in_names, talker_inputs.data(), talker_inputs.size(), talker_out_names, 4);
+                Ort::RunOptions{nullptr}, talker_in_names.data(), talker_inputs.data(), talker_inputs.size(),
+                talker_out_names.data(), talker_out_names.size());
         } else {
             const int64_t hist_len = static_cast<int64_t>(s + 1);
             std::vector<int64_t> codec_hist(
-                all_codes.end() - static_cast<long>(hist_len * kCodeGroups), all_codes.end());
-            std::vector<float> trailing_hist(static_cast<size_t>(hist_len * kHidden), 0.0f);
+                all_codes.end() - static_cast<long>(hist_len * code_groups), all_codes.end());
+            std::vector<float> trailing_hist(static_cast<size_t>(hist_len * hidden), 0.0f);
             for (int64_t t = 0; t < hist_len; ++t) {
-                std::copy(trailing_step.begin(), trailing_step.end(), trailing_hist.begin() + t * kHidden);
+                std::copy(state->_trailing_step.begin(), state->_trailing_step.end(), trailing_hist.begin() + t * hidden);
             }
-            std::vector<float> prefill_run = prefill_copy;
-            auto prefill_hist_tensor = MakeTensorF32(*mi_, prefill_run, prefill_shape);
-            auto codec_tensor = MakeTensorI64(*mi_, codec_hist, {kBatch, hist_len, kCodeGroups});
-            auto trailing_tensor = MakeTensorF32(*mi_, trailing_hist, {kBatch, hist_len, kHidden});
-            const char* talker_in_names[] = {"prefill_embeds", "codec_ids", "trailing_text"};
-            const char* talker_out_names[] = {"logits", "last_hidden"};
-            std::array<Ort::Value, 3> talker_inputs = {
-                std::move(prefill_hist_tensor), std::move(codec_tensor), std::move(trailing_tensor)};
+            std::vector<float> prefill_run = state->_prefill_embeds;
+            auto prefill_hist_tensor = MakeTensorF32(*mi_, prefill_run, state->_prefill_shape);
+            auto codec_tensor = MakeTensorI64(*mi_, codec_hist, {kBatch, hist_len, code_groups});
+            auto trailing_tensor = MakeTensorF32(*mi_, trailing_hist, {kBatch, hist_len, hidden});
+            std::vector<const char*> talker_in_names = {"prefill_embeds", "codec_ids", "trailing_text"};
+            std::vector<Ort::Value> talker_inputs;
+            talker_inputs.reserve(talker_in_names.size() + 2);
+            talker_inputs.push_back(std::move(prefill_hist_tensor));
+            talker_inputs.push_back(std::move(codec_tensor));
+            talker_inputs.push_back(std::move(trailing_tensor));
+            AppendSelectInputs(state, &talker_in_names, &talker_inputs, step_allow_eos);
             talker_out = talker_->Run(
-                Ort::RunOptions{nullptr}, talker_in_names, talker_inputs.data(), talker_inputs.size(), talker_out_names, 2);
-        }
-
-        float* logits_ptr = talker_out[0].GetTensorMutableData<float>();
-        current_first_code = SelectTalkerFirstCode(
-            logits_ptr,
-            kTalkerVocab,
-            kCpVocab,
-            kCodecEosId,
-            (s + 1) >= _params.eos_min_steps,
-            _params.do_sample,
-            _params.temperature,
-            _params.top_k,
-            &rng);
-        if (current_first_code < 0 || current_first_code >= kTalkerVocab) {
-            return fail_gen(-1204, "Failed to select first talker code");
+                Ort::RunOptions{nullptr}, talker_in_names.data(), talker_inputs.data(), talker_inputs.size(),
+                talker_out_names.data(), talker_out_names.size());
         }
 
-        float* last_hidden_ptr = talker_out[1].GetTensorMutableData<float>();
-        current_past_hidden.assign(last_hidden_ptr, last_hidden_ptr + kHidden);
+        const double talker_ms = MsSince(talker_t0);
+        state->_talker_ms += talker_ms;
+        Metrics::instance().talker_step_ms.observe(talker_ms);
+        state->_current_first_code = SelectFirstCode(*state, talker_out, graph_select, step_allow_eos, s + 1);
+        if (state->_current_first_code < 0 || state->_current_first_code >= talker_vocab) {
+            return fail_gen(-1204, "Failed to select first talker code");
+        }
+        float* last_hidden_ptr = talker_out[sel_outputs].GetTensorMutableData<float>();
+        state->_past_hidden.assign(last_hidden_ptr, last_hidden_ptr + hidden);
         if (use_kv_cache_) {
-            past_k_cache = std::move(talker_out[2]);
-            past_v_cache = std::move(talker_out[3]);
+            state->_past_k = std::move(talker_out[sel_outputs + 1]);
+            state->_past_v = std::move(talker_out[sel_outputs + 2]);
+            state->_past_k_host = GenerationState::HostTensor{};
+            state->_past_v_host = GenerationState::HostTensor{};
         }
     }
+    if (state->_stop_reason == StopReason::None) state->_stop_reason = StopReason::FrameBudget;
+    state->_finished = true;
+    _last_error_code = 0;
+    _last_error_message.clear();
+    return 1;
+    } catch (const std::exception& e) {
+        return FailFromException(kWhere, e.what());
+    } catch (...) {
+        return fail_gen(-2000, "unknown exception");
+    }
+}
+
+// Vocodes the frames generated since the last probe (plus left context) and feeds them
+// to the silence policy; on a stop, cuts the silent tail down to keep_frames.
+bool Voice::ProbeSilence(GenerationState* state)
+{
+    SilenceStopPolicy& policy = state->_silence;
+    const int generated = state->framesGenerated();
+    const int fresh = generated - state->_probed_frames;
+    if (!policy.enabled() || fresh < policy.probeFrames()) return false;
+
+    const auto t0 = std::chrono::steady_clock::now();
+    const int groups = static_cast<int>(_dims.code_groups);
+    const int begin = std::max(0, state->_probed_frames - policy.contextFrames());
+    const int span = generated - begin;
+    std::vector<int64_t> span_codes(state->_all_codes.begin() + static_cast<long>(begin) * groups, state->_all_codes.end());
+    const std::vector<float> pcm = DecodeAudioCodes(*vocoder_, *mi_, span_codes, span, groups);
+    const size_t per_frame = pcm.size() / static_cast<size_t>(span);
+    policy.observe(pcm.data() + per_frame * static_cast<size_t>(span - fresh), per_frame * static_cast<size_t>(fresh), fresh);
+    state->_probed_frames = generated;
+    ++state->_silence_probes;
+    state->_silence_probe_ms += MsSince(t0);
+    if (!policy.shouldStop(generated)) return false;
+
+    const int drop = std::min(generated - 1, std::max(0, policy.trailingSilentFrames() - policy.keepFrames()));
+    state->_all_codes.resize(static_cast<size_t>(generated - drop) * static_cast<size_t>(groups));
+    state->_silence_trimmed = drop;
+    return true;
+}
+
+// Delivers the vocoder windows of frames that can no longer change. Frames a silence stop or
+// the tail-repeat trim may still cut are held back, and the stream keeps the right context
+// of the next window.
+bool Voice::StreamAudio(GenerationState* state, std::string* error)
+{
+    const int groups = static_cast<int>(_dims.code_groups);
+    const std::vector<int64_t>& codes = state->_all_codes;
+    int final_frames = state->framesGenerated();
+    const SilenceStopPolicy& policy = state->_silence;
+    if (policy.enabled()) {
+        final_frames = std::min(final_frames, state->_probed_frames - policy.trailingSilentFrames());
+    }
+    if (_params.trim_tail_repeat_min > 0 && final_frames > 0) {
+        // The trim only cuts inside the run of equal first codes that ends the utterance.
+        const int64_t tail_code = codes[static_cast<size_t>(final_frames - 1) * groups];
+        while (final_frames > 0 && codes[static_cast<size_t>(final_frames - 1) * groups] == tail_code) --final_frames;
+    }
+    if (!state->_audio_stream) {
+        state->_audio_stream = std::make_unique<VocoderWindowStream>(WindowConfig(_params), groups);
+    }
+    auto sink = [&](const float* samples, size_t n) {
+        state->_streamed_samples += n;
+        return _params.on_audio(samples, n);
+    };
+    const auto t0 = std::chrono::steady_clock::now();
+    const bool ok = state->_audio_stream->Push(
+        SpanRunner(vocoder_batcher_, *vocoder_, *mi_, groups), codes.data(), final_frames, sink, error);
+    state->_stream_vocoder_ms += MsSince(t0);
+    return ok;
+}
+
+std::vector<float> Voice::finishGeneration(GenerationState* state)
+{
+    static constexpr const char* kWhere = "finishGeneration";
+    auto err_pcm = [](float code) { return std::vector<float>{code}; };
+    auto fail_gen = [&](int code, const std::string& msg) {
+        return err_pcm(static_cast<float>(FailGeneration(kWhere, code, msg)));
+    };
+    try {
+    if (!state || !state->_started) return fail_gen(-1601, "generation state is not started");
+    if (!_loaded) {
+        return fail_gen(-1001, "runtime is not loaded");
+    }
+    if (!mi_.has_value()) {
+        return fail_gen(-1002, "memory info is not initialized");
+    }
+    if (state->_dims.code_groups != _dims.code_groups) {
+        return fail_gen(-1602, "generation state does not match the loaded model");
+    }
+    _params = state->_params;
+    const int64_t code_groups = _dims.code_groups;
+    _last_stats = GenerationStats{};
+    _last_stats.frames_generated = state->framesGenerated();
+    _last_stats.frame_budget = state->_steps;
+    _last_stats.predicted_frames = state->_expected_frames;
+    _last_stats.stop_reason = state->_stop_reason;
+    if (state->_stop_reason == StopReason::Silence) {
+        _last_stats.budget_frames_left = state->_steps - state->_next_step;
+        _last_stats.silence_trimmed_frames = state->_silence_trimmed;
+    }
+    _last_stats.silence_probes = state->_silence_probes;
+    _last_stats.silence_probe_ms = state->_silence_probe_ms;
+    _last_stats.prefill_ms = state->_prefill_ms;
+    _last_stats.talker_ms = state->_talker_ms;
+    _last_stats.cp_ms = state->_cp_ms;
+    _last_stats.estimated_peak_bytes = estimateMemory(state->_params).peak_bytes;
+    _last_stats.kv_cache_bytes = state->kvCacheBytes();
+    _last_stats.arena_in_use_bytes = memoryUsage().arena_in_use_bytes;
 
-    int generated_steps = static_cast<int>(all_codes.size() / static_cast<size_t>(kCodeGroups));
+    int generated_steps = state->framesGenerated();
     if (generated_steps <= 0) return fail_gen(-1201, "No audio codes generated (EOS too early or decoding failed)");
 
-    std::vector<int64_t> audio_codes = all_codes;
+    std::vector<int64_t> audio_codes = state->_all_codes;
     if (_params.trim_tail_repeat_min > 0) {
         const int before_steps = generated_steps;
         generated_steps = TrimRepeatingTailFrames(
-            &audio_codes, static_cast<int>(kCodeGroups), _params.trim_tail_repeat_min, _params.trim_tail_keep);
+            &audio_codes, static_cast<int>(code_groups), _params.trim_tail_repeat_min, _params.trim_tail_keep);
         if (generated_steps < before_steps) {
-            std::cout << "[trim] removed tail repeated frames=" << (before_steps - generated_steps)
-                      << ", remaining_steps=" << generated_steps << "\n";
+            QWEN3TTS_LOG_INFO("trim") << "removed tail repeated frames" << Kv("req", _params.request_id)
+                                      << Kv("removed", before_steps - generated_steps) << Kv("remaining", generated_steps);
         }
     }
     if (generated_steps <= 0) return fail_gen(-1202, "All generated frames were trimmed; adjust trim settings.");
-
     if (!_params.codes_out.empty()) {
         std::string write_codes_err;
-        if (!WriteCodesTxtSafe(_params.codes_out, audio_codes, generated_steps, static_cast<int>(kCodeGroups), &write_codes_err)) {
+        if (!WriteCodesTxtSafe(_params.codes_out, audio_codes, generated_steps, static_cast<int>(code_groups), &write_codes_err)) {
             return fail_gen(-1303, write_codes_err.empty() ? "failed to write codes" : write_codes_err);
         }
     }
     std::vector<float> wav;
     std::string decode_err;
-    if (!DecodeAudioCodesSafe(*vocoder_, *mi_, audio_codes, generated_steps, static_cast<int>(kCodeGroups), &wav, &decode_err)) {
+    const int groups = static_cast<int>(code_groups);
+    const VocoderSpanRunner run = SpanRunner(vocoder_batcher_, *vocoder_, *mi_, groups);
+    bool decoded = false;
+    bool sink_aborted = false;
+    const auto vocoder_t0 = std::chrono::steady_clock::now();
+    if (_params.on_audio && _params.vocoder_window_frames > 0) {
+        // Windows before emittedFrames() already went out from stepGeneration.
+        if (!state->_audio_stream) {
+            state->_audio_stream = std::make_unique<VocoderWindowStream>(WindowConfig(_params), groups);
+        }
+        auto sink = [&](const float* samples, size_t n) {
+            state->_streamed_samples += n;
+            return _params.on_audio(samples, n);
+        };
+        decoded = state->_audio_stream->Finish(run, audio_codes.data(), generated_steps, sink, &decode_err);
+        sink_aborted = state->_audio_stream->aborted();
+    } else if (_params.vocoder_window_frames > 0) {
+        if (vocoder_batcher_) {
+            auto append = [&](const float* samples, size_t n) { wav.insert(wav.end(), samples, samples + n); };
+            decoded = DecodeAudioCodesWindowed(run, audio_codes.data(), generated_steps, groups, WindowConfig(_params), append, &decode_err);
+        } else {
+            decoded = DecodeAudioCodesWindowedSafe(
+                *vocoder_, *mi_, audio_codes, generated_steps, groups, WindowConfig(_params), &wav, &decode_err);
+        }
+    } else {
+        if (vocoder_batcher_) {
+            decoded = vocoder_batcher_->decode(audio_codes.data(), generated_steps, &wav, &decode_err);
+        } else {
+            decoded = DecodeAudioCodesSafe(*vocoder_, *mi_, audio_codes, generated_steps, groups, &wav, &decode_err);
+        }
+        if (decoded && _params.on_audio) {
+            state->_streamed_samples += wav.size();
+            sink_aborted = !_params.on_audio(wav.data(), wav.size());
+            wav.clear();
+            wav.shrink_to_fit();
+        }
+    }
+    _last_stats.vocoder_ms = state->_stream_vocoder_ms + MsSince(vocoder_t0);
+    if (sink_aborted) {
+        return fail_gen(-1304, "audio sink aborted generation");
+    }
+    if (!decoded) {
         return fail_gen(-1302, decode_err.empty() ? "failed to decode audio codes" : decode_err);
     }
+    const size_t total_samples = _params.on_audio ? state->_streamed_samples : wav.size();
+
+    Metrics& metrics = Metrics::instance();
+    metrics.requests_completed.inc();
+    metrics.frames_generated.inc(static_cast<uint64_t>(_last_stats.frames_generated));
+    metrics.audio_samples.inc(total_samples);
+    metrics.recordStop(static_cast<int>(state->_stop_reason));
+    metrics.vocoder_ms.observe(_last_stats.vocoder_ms);
+    if (total_samples > 0) {
+        const double audio_ms = 1000.0 * static_cast<double>(total_samples) / _dims.sample_rate;
+        metrics.rtf.observe((_last_stats.prefill_ms + _last_stats.talker_ms + _last_stats.cp_ms + _last_stats.vocoder_ms) / audio_ms);
+    }
 
-    std::cout << "Samples: " << static_cast<int64_t>(wav.size()) << ", sample_rate: " << kSampleRate << "\n";
-    std::cout << "Decoder path: AR code predictor step model enabled"
-              << (use_kv_cache_ ? " + talker KV cache.\n" : ".\n");
+    QWEN3TTS_LOG_DEBUG("done") << "decoded" << Kv("req", _params.request_id) << Kv("samples", total_samples)
+                               << Kv("sample_rate", _dims.sample_rate) << Kv("frames", generated_steps)
+                               << Kv("stop", StopReasonName(state->_stop_reason)) << Kv("kv_cache", use_kv_cache_)
+                               << Kv("graph_select", UseGraphSelect()) << Kv("kv_bytes", _last_stats.kv_cache_bytes)
+                               << Kv("est_peak_bytes", _last_stats.estimated_peak_bytes)
+                               << Kv("arena_in_use_bytes", _last_stats.arena_in_use_bytes);
     _last_error_code = 0;
     _last_error_message.clear();
     return wav;
     } catch (const std::exception& e) {
-        std::cerr << "Voice::generateVoice failed: " << e.what() << "\n";
-        const std::string msg = e.what();
-        if (msg.find("input_ids") != std::string::npos || msg.find("instruct_ids") != std::string::npos) {
-            _last_error_code = -1101;
-            _last_error_message = msg;
-            return err_pcm(-1101.0f);
-        }
-        if (msg.find("temperature") != std::string::npos) {
-            _last_error_code = -1102;
-            _last_error_message = msg;
-            return err_pcm(-1102.0f);
-        }
-        if (msg.find("top_k") != std::string::npos) {
-            _last_error_code = -1103;
-            _last_error_message = msg;
-            return err_pcm(-1103.0f);
-        }
-        if (msg.find("tail_stop") != std::string::npos) {
-            _last_error_code = -1104;
-            _last_error_message = msg;
-            return err_pcm(-1104.0f);
-        }
-        if (msg.find("eos_min_steps") != std::string::npos) {
-            _last_error_code = -1105;
-            _last_error_message = msg;
-            return err_pcm(-1105.0f);
-        }
-        if (msg.find("No audio codes generated") != std::string::npos) {
-            _last_error_code = -1201;
-            _last_error_message = msg;
-            return err_pcm(-1201.0f);
-        }
-        if (msg.find("All generated frames were trimmed") != std::string::npos) {
-            _last_error_code = -1202;
-            _last_error_message = msg;
-            return err_pcm(-1202.0f);
-        }
-        if (msg.find("CUDA") != std::string::npos) {
-            _last_error_code = -1301;
-            _last_error_message = msg;
-            return err_pcm(-1301.0f);
-        }
-        if (msg.find("onnx") != std::string::npos || msg.find("Ort") != std::string::npos) {
-            _last_error_code = -1302;
-            _last_error_message = msg;
-            return err_pcm(-1302.0f);
-        }
-        _last_error_code = -1999;
-        _last_error_message = msg;
-        return err_pcm(-1999.0f);
+        return err_pcm(static_cast<float>(FailFromException(kWhere, e.what())));
+    } catch (...) {
+        return fail_gen(-2000, "unknown exception");
+    }
+}
+
+bool Voice::warmup(const WarmupProfile& profile, WarmupReport* report)
+{
+    static constexpr const char* kWhere = "warmup";
+    auto fail_gen = [&](int code, const std::string& msg) {
+        FailGeneration(kWhere, code, msg);
+        return false;
+    };
+    try {
+    if (!_loaded) {
+        return fail_gen(-1001, "runtime is not loaded");
+    }
+    if (!mi_.has_value()) {
+        return fail_gen(-1002, "memory info is not initialized");
+    }
+    auto positive = [](const std::vector<int>& v) { return std::all_of(v.begin(), v.end(), [](int x) { return x > 0; }); };
+    if (profile.runs <= 0 || !positive(profile.prompt_tokens) || !positive(profile.cache_lengths) ||
+        !positive(profile.vocoder_frames)) {
+        return fail_gen(-1701, "warmup runs and sizes must be > 0");
+    }
+    WarmupReport local;
+    WarmupReport& out = report ? *report : local;
+    out = WarmupReport{};
+    const auto total_t0 = std::chrono::steady_clock::now();
+
+    // Real template tokens around a repeated filler token give prompts of any text length.
+    _params = GenerationParams{};
+    _params.text = "Warmup.";
+    _params.instruct = "Speak clearly and naturally.";
+    if (!BuildVoiceDesignIds()) return fail_gen(_last_error_code, _last_error_message);
+    constexpr size_t kPrefix = 3;
+    constexpr size_t kSuffix = static_cast<size_t>(kVoiceDesignTemplateTokens) - kPrefix;
+    if (_input_ids.size() <= kPrefix + kSuffix) return fail_gen(-1101, "warmup prompt has no text tokens");
+    const int64_t filler = _input_ids[kPrefix];
+
+    const int64_t hidden = _dims.hidden;
+    const int64_t code_groups = _dims.code_groups;
+    const int runs = profile.runs;
+    GenerationState ws;
+    ws._dims = _dims;
+    const bool graph_select = UseGraphSelect();
+    const size_t sel_outputs = graph_select ? 2 : 1;
+    const std::vector<const char*> talker_out_names = TalkerOutputNames(graph_select);
+
+    struct KvSample {
+        int64_t len = 0;
+        GenerationState::HostTensor k;
+        GenerationState::HostTensor v;
+    };
+    std::vector<KvSample> kv;
+    std::vector<float> prefill_data;    // largest prompt, reused by the no-cache talker
+    std::vector<int64_t> prefill_shape;
+    for (int n : profile.prompt_tokens) {
+        std::vector<int64_t> ids(_input_ids.begin(), _input_ids.begin() + kPrefix);
+        ids.insert(ids.end(), static_cast<size_t>(n), filler);
+        ids.insert(ids.end(), _input_ids.end() - kSuffix, _input_ids.end());
+        std::vector<int64_t> instruct_ids = _instruct_ids;
+        std::vector<int64_t> lang = {-1};
+        const char* pb_in_names[] = {"input_ids", "instruct_ids", "codec_language_token_id"};
+        const char* pb_out_names[] = {"prefill_embeds", "tts_pad_embed"};
+        std::vector<Ort::Value> pb_out;
+        out.timings.push_back(TimeCalls("prefill_builder", n, runs, [&] {
+            std::array<Ort::Value, 3> in = {
+                MakeTensorI64(*mi_, ids, {1, static_cast<int64_t>(ids.size())}),
+                MakeTensorI64(*mi_, instruct_ids, {1, static_cast<int64_t>(instruct_ids.size())}),
+                MakeTensorI64(*mi_, lang, {1})};
+            pb_out = prefill_builder_->Run(Ort::RunOptions{nullptr}, pb_in_names, in.data(), in.size(), pb_out_names, 2);
+        }));
+
+        const auto info = pb_out[0].GetTensorTypeAndShapeInfo();
+        std::vector<int64_t> shape = info.GetShape();
+        const float* embeds_ptr = pb_out[0].GetTensorMutableData<float>();
+        std::vector<float> embeds(embeds_ptr, embeds_ptr + info.GetElementCount());
+        std::vector<Ort::Value> tp_out;
+        out.timings.push_back(TimeCalls("talker_prefill", n, runs, [&] {
+            std::vector<const char*> names = {"prefill_embeds"};
+            std::vector<Ort::Value> in;
+            in.push_back(MakeTensorF32(*mi_, embeds, shape));
+            AppendSelectInputs(&ws, &names, &in, true);
+            tp_out = talker_prefill_->Run(
+                Ort::RunOptions{nullptr}, names.data(), in.data(), in.size(), talker_out_names.data(), talker_out_names.size());
+        }));
+        if (use_kv_cache_) {
+            KvSample sample;
+            sample.len = shape[1];
+            if (GenerationState::CopyToHost(tp_out[sel_outputs + 1], &sample.k) &&
+                GenerationState::CopyToHost(tp_out[sel_outputs + 2], &sample.v)) {
+                kv.push_back(std::move(sample));
+            }
+        }
+        if (embeds.size() > prefill_data.size()) {
+            prefill_data = std::move(embeds);
+            prefill_shape = std::move(shape);
+        }
+    }
+
+    std::vector<int64_t> codec_step(static_cast<size_t>(code_groups), 0);
+    std::vector<float> trailing_step(static_cast<size_t>(hidden), 0.0f);
+    if (!profile.cache_lengths.empty() && use_kv_cache_) {
+        // The sequence axis is the one that differs between two prompt lengths, else the
+        // innermost non-feature axis equal to the prompt length.
+        int axis = -1;
+        for (size_t i = 1; i < kv.size() && axis < 0; ++i) {
+            if (kv[i].len == kv[0].len || kv[i].k.shape.size() != kv[0].k.shape.size()) continue;
+            for (size_t d = 0; d < kv[0].k.shape.size(); ++d) {
+                if (kv[i].k.shape[d] != kv[0].k.shape[d]) {
+                    axis = static_cast<int>(d);
+                    break;
+                }
+            }
+        }
+        for (int d = kv.empty() ? -1 : static_cast<int>(kv[0].k.shape.size()) - 2; axis < 0 && d >= 0; --d) {
+            if (kv[0].k.shape[static_cast<size_t>(d)] == kv[0].len) axis = d;
+        }
+        if (axis < 0) {
+            QWEN3TTS_LOG_WARN("warmup") << "talker_decode and talker_prefill_chunk skipped: KV cache layout not found (set prompt_tokens)";
+        } else {
+            const OrtMemoryInfo* mem = *mi_;
+            for (int len : profile.cache_lengths) {
+                GenerationState::HostTensor k = kv[0].k;
+                GenerationState::HostTensor v = kv[0].v;
+                const size_t elem = k.bytes.size() / static_cast<size_t>(std::max<int64_t>(
+                    1, std::accumulate(k.shape.begin(), k.shape.end(), int64_t{1}, std::multiplies<int64_t>())));
+                k.shape[static_cast<size_t>(axis)] = len;
+                v.shape[static_cast<size_t>(axis)] = len;
+                const size_t count = static_cast<size_t>(
+                    std::accumulate(k.shape.begin(), k.shape.end(), int64_t{1}, std::multiplies<int64_t>()));
+                k.bytes.assign(count * elem, 0);
+                v.bytes.assign(count * elem, 0);
+                auto kv_tensors = [&](std::vector<Ort::Value>* in) {
+                    in->push_back(Ort::Value::CreateTensor(mem, k.bytes.data(), k.bytes.size(), k.shape.data(), k.shape.size(),
+                                                           static_cast<ONNXTensorElementDataType>(k.elem_type)));
+                    in->push_back(Ort::Value::CreateTensor(mem, v.bytes.data(), v.bytes.size(), v.shape.data(), v.shape.size(),
+                                                           static_cast<ONNXTensorElementDataType>(v.elem_type)));
+                };
+                std::vector<int64_t> cache_pos = {len};
+                out.timings.push_back(TimeCalls("talker_decode", len, runs, [&] {
+                    std::vector<const char*> names = {"codec_ids_step", "trailing_text_step", "past_k", "past_v", "cache_position"};
+                    std::vector<Ort::Value> in;
+                    in.push_back(MakeTensorI64(*mi_, codec_step, {kBatch, 1, code_groups}));
+                    in.push_back(MakeTensorF32(*mi_, trailing_step, {kBatch, 1, hidden}));
+                    kv_tensors(&in);
+                    in.push_back(MakeTensorI64(*mi_, cache_pos, {1}));
+                    AppendSelectInputs(&ws, &names, &in, true);
+                    talker_->Run(Ort::RunOptions{nullptr}, names.data(), in.data(), in.size(), talker_out_names.data(),
+                                 talker_out_names.size());
+                }));
+                // Chunked prefill: a prompt chunk of each warmup length continuing this cache.
+                for (int n : talker_prefill_chunk_ ? profile.prompt_tokens : std::vector<int>{}) {
+                    std::vector<float> chunk(static_cast<size_t>(n * hidden), 0.0f);
+                    out.timings.push_back(TimeCalls("talker_prefill_chunk", n, runs, [&] {
+                        std::vector<const char*> names = {"prefill_embeds", "past_k", "past_v", "cache_position"};
+                        std::vector<Ort::Value> in;
+                        in.push_back(MakeTensorF32(*mi_, chunk, {kBatch, n, hidden}));
+                        kv_tensors(&in);
+                        in.push_back(MakeTensorI64(*mi_, cache_pos, {1}));
+                        AppendSelectInputs(&ws, &names, &in, true);
+                        talker_prefill_chunk_->Run(Ort::RunOptions{nullptr}, names.data(), in.data(), in.size(),
+                                                   talker_out_names.data(), talker_out_names.size());
+                    }));
+                    out.timings.back().cache_length = len;
+                }
+            }
+        }
+    } else if (!profile.cache_lengths.empty()) {
+        if (prefill_data.empty()) {
+            QWEN3TTS_LOG_WARN("warmup") << "talker_decode skipped: the no-cache talker needs prompt_tokens";
+        }
+        for (int len : prefill_data.empty() ? std::vector<int>{} : profile.cache_lengths) {
+            std::vector<int64_t> codec_hist(static_cast<size_t>(len * code_groups), 0);
+            std::vector<float> trailing_hist(static_cast<size_t>(len * hidden), 0.0f);
+            out.timings.push_back(TimeCalls("talker_decode", len, runs, [&] {
+                std::vector<const char*> names = {"prefill_embeds", "codec_ids", "trailing_text"};
+                std::vector<Ort::Value> in;
+                in.push_back(MakeTensorF32(*mi_, prefill_data, prefill_shape));
+                in.push_back(MakeTensorI64(*mi_, codec_hist, {kBatch, len, code_groups}));
+                in.push_back(MakeTensorF32(*mi_, trailing_hist, {kBatch, len, hidden}));
+                AppendSelectInputs(&ws, &names, &in, true);
+                talker_->Run(Ort::RunOptions{nullptr}, names.data(), in.data(), in.size(), talker_out_names.data(),
+                             talker_out_names.size());
+            }));
+        }
+    }
+
+    // One code-predictor pass is a frame's worth of residual groups.
+    std::vector<float> past_hidden(static_cast<size_t>(hidden), 0.0f);
+    std::vector<int64_t> first_code = {0};
+    std::vector<int64_t> prev_codes(static_cast<size_t>(code_groups - 2), 0);
+    std::vector<int64_t> step_id = {0};
+    const char* cp_in_names[] = {"past_hidden", "first_code_id", "prev_codes", "step_id"};
+    const char* cp_out_names[] = {"logits"};
+    out.timings.push_back(TimeCalls("code_predictor", code_groups - 1, runs, [&] {
+        for (int64_t g = 0; g < code_groups - 1; ++g) {
+            std::array<Ort::Value, 4> in = {
+                MakeTensorF32(*mi_, past_hidden, {kBatch, 1, hidden}),
+                MakeTensorI64(*mi_, first_code, {kBatch, 1}),
+                MakeTensorI64(*mi_, prev_codes, {kBatch, code_groups - 2}),
+                Ort::Value{nullptr}};
+            if (has_cp_dynamic_) {
+                step_id[0] = g;
+                in[3] = MakeTensorI64(*mi_, step_id, {1});
+                cp_dynamic_->Run(Ort::RunOptions{nullptr}, cp_in_names, in.data(), 4, cp_out_names, 1);
+            } else {
+                cp_steps_[static_cast<size_t>(g)]->Run(Ort::RunOptions{nullptr}, cp_in_names, in.data(), 3, cp_out_names, 1);
+            }
+        }
+    }));
+
+    for (int frames : profile.vocoder_frames) {
+        std::vector<int64_t> codes(static_cast<size_t>(frames * code_groups), 0);
+        out.timings.push_back(TimeCalls("vocoder", frames, runs, [&] {
+            DecodeAudioCodes(*vocoder_, *mi_, codes, frames, static_cast<int>(code_groups));
+        }));
+    }
+
+    out.total_ms = MsSince(total_t0);
+    QWEN3TTS_LOG_INFO("warmup") << "done" << Kv("total_ms", out.total_ms);
+    _last_error_code = 0;
+    _last_error_message.clear();
+    return true;
+    } catch (const std::exception& e) {
+        FailFromException(kWhere, e.what());
+        return false;
     } catch (...) {
-        std::cerr << "Voice::generateVoice failed: unknown exception\n";
-        _last_error_code = -2000;
-        _last_error_message = "unknown exception";
-        return err_pcm(-2000.0f);
+        return fail_gen(-2000, "unknown exception");
+    }
+}
+
+std::shared_ptr<VocoderBatcher> Voice::makeVocoderBatcher(const VocoderBatcherConfig& cfg)
+{
+    if (!_loaded || !vocoder_ || !mi_.has_value()) return nullptr;
+    return std::make_shared<VocoderBatcher>(*vocoder_, *mi_, static_cast<int>(_dims.code_groups), cfg);
+}
+
+void Voice::setVocoderBatcher(std::shared_ptr<VocoderBatcher> batcher)
+{
+    vocoder_batcher_ = std::move(batcher);
+}
+
+MemoryEstimate Voice::estimateMemory(const GenerationParams& params) const
+{
+    MemoryEstimate est;
+    const int64_t text_tokens = std::max<int64_t>(1, EstimateTokenCount(params.text));
+    const int64_t lang = params.codec_lang.empty() ? -1 : params.codec_lang[0];
+    est.prompt_tokens = text_tokens + EstimateTokenCount(params.instruct) + kVoiceDesignTemplateTokens;
+    // Same budget choice as beginGeneration: explicit steps, then max_steps, then the safety cap.
+    if (params.steps > 0) {
+        est.frames = params.steps;
+    } else if (params.max_steps > 0) {
+        est.frames = params.max_steps;
+    } else {
+        est.frames = _step_predictor.predict(text_tokens, lang).cap;
+    }
+    est.frames = std::max<int64_t>(1, est.frames);
+
+    // Without the KV cache the talker rebuilds K/V over the whole history each step, so the
+    // same figure bounds one decode call.
+    est.kv_bytes = _dims.kv_bytes_per_token * (est.prompt_tokens + est.frames);
+    est.cp_bytes = _dims.hidden * _dims.code_groups * static_cast<int64_t>(sizeof(float)) * 8;
+    const int64_t spf = static_cast<int64_t>(_dims.sample_rate) * 2 / 25;  // 12.5 Hz codec
+    const int64_t sample_bytes = static_cast<int64_t>(sizeof(float));
+    if (params.vocoder_window_frames > 0) {
+        const int64_t span = params.vocoder_window_frames + std::max(0, params.vocoder_left_context_frames) +
+                             std::max(0, params.vocoder_right_context_frames);
+        est.vocoder_bytes = _dims.vocoder_bytes_per_frame * std::min(est.frames, span);
+        est.pcm_bytes = (params.on_audio ? std::min<int64_t>(est.frames, span) : est.frames) * spf * sample_bytes;
+    } else {
+        est.vocoder_bytes = _dims.vocoder_bytes_per_frame * est.frames;
+        est.pcm_bytes = est.frames * spf * sample_bytes;
+    }
+    // Decoding holds the previous and the new KV at once; vocoding runs while the state's KV
+    // is still alive.
+    est.peak_bytes = est.kv_bytes + std::max(est.kv_bytes + est.cp_bytes, est.vocoder_bytes + est.pcm_bytes);
+    return est;
+}
+
+std::vector<ProfileTrace> Voice::endProfiling()
+{
+    std::vector<ProfileTrace> traces;
+    if (!_loaded || _config.profile_dir.empty()) return traces;
+    // The code predictor step models are reported as one session.
+    std::vector<std::pair<const char*, Ort::Session*>> sessions = {
+        {"prefill_builder", prefill_builder_.get()}, {"talker_prefill", talker_prefill_.get()},
+        {"talker_prefill_chunk", talker_prefill_chunk_.get()}, {"talker_decode", talker_.get()},
+        {"code_predictor", cp_dynamic_.get()}, {"vocoder", vocoder_.get()}};
+    for (const auto& cp : cp_steps_) sessions.emplace_back("code_predictor", cp.get());
+    Ort::AllocatorWithDefaultOptions alloc;
+    for (const auto& [name, session] : sessions) {
+        if (!session) continue;
+        try {
+            auto path = session->EndProfilingAllocated(alloc);
+            if (path.get() && *path.get()) traces.push_back(ProfileTrace{name, path.get()});
+        } catch (const std::exception& e) {
+            QWEN3TTS_LOG_WARN("profile") << "EndProfiling failed: " << e.what() << Kv("session", name);
+        }
+    }
+    _config.profile_dir.clear();
+    return traces;
+}
+
+MemoryUsage Voice::memoryUsage() const
+{
+    MemoryUsage usage;
+    if (_loaded && mi_.has_value()) {
+        std::vector<const Ort::Session*> sessions = {
+            prefill_builder_.get(), talker_prefill_.get(), talker_.get(), talker_prefill_chunk_.get(),
+            vocoder_.get(), cp_dynamic_.get()};
+        for (const auto& cp : cp_steps_) sessions.push_back(cp.get());
+        for (const Ort::Session* session : sessions) {
+            ArenaStats arena;
+            if (!session || !GetSessionArenaStats(*session, *mi_, &arena)) continue;
+            usage.arena_stats = true;
+            usage.arena_in_use_bytes += arena.in_use;
+            usage.arena_peak_bytes += arena.max_in_use;
+            usage.arena_reserved_bytes += arena.total_allocated;
+        }
     }
+    usage.rss_bytes = ProcessRssBytes();
+    usage.peak_rss_bytes = ProcessPeakRssBytes();
+    return usage;
 }
 
 void Voice::unload()
 {
+    vocoder_batcher_.reset();
     cp_steps_.clear();
     cp_dynamic_.reset();
     vocoder_.reset();
+    talker_prefill_chunk_.reset();
     talker_.reset();
     talker_prefill_.reset();
     prefill_builder_.reset();
+    model_maps_.clear();
+    tokenizer_.reset();
     env_.reset();
     has_cp_dynamic_ = false;
     use_kv_cache_ = false;
+    talker_topk_ = 0;
+    talker_has_allow_eos_ = false;
+    talker_has_temperature_ = false;
     mi_.reset();
     _loaded = false;
 }
 
+const ModelDims& Voice::dims() const
+{
+    return _dims;
+}
+
+const GenerationStats& Voice::lastStats() const
+{
+    return _last_stats;
+}
+
+const StepPredictor& Voice::stepPredictor() const
+{
+    return _step_predictor;
+}
+
+const char* StopReasonName(StopReason reason)
+{
+    switch (reason) {
+        case StopReason::FrameBudget: return "frame_budget";
+        case StopReason::Eos: return "eos";
+        case StopReason::TailRepeat: return "tail_repeat";
+        case StopReason::FirstCodeRepeat: return "first_code_repeat";
+        case StopReason::Silence: return "silence";
+        case StopReason::None: break;
+    }
+    return "none";
+}
+
+bool Voice::supportsChunkedPrefill() const
+{
+    return _loaded && talker_prefill_chunk_ != nullptr;
+}
+
 bool Voice::isLoaded() const
 {
         return _loaded;
@@ -601,18 +1660,13 @@ const std::string& Voice::lastErrorMessage() const
 
 bool Voice::BuildVoiceDesignIds()
 {
-    const auto vocab_file = std::filesystem::path(_config.model.vocab_file).filename().string();
-    const auto merges_file = std::filesystem::path(_config.model.merges_file).filename().string();
-    const auto tokenizer_config_file = std::filesystem::path(_config.model.tokenizer_config_file).filename().string();
-
-    VoiceTokenizer tok;
-    std::string tok_err;
-    if (!tok.LoadSafe(_config.model.path, vocab_file, merges_file, tokenizer_config_file, &tok_err)) {
+    if (!tokenizer_) {
         _last_error_code = -1401;
-        _last_error_message = tok_err.empty() ? "tokenizer load failed" : tok_err;
+        _last_error_message = "tokenizer not loaded";
         return false;
     }
-    if (!tok.BuildVoiceDesignIdsSafe(_params.text, _params.instruct, &_input_ids, &_instruct_ids, &tok_err)) {
+    std::string tok_err;
+    if (!tokenizer_->BuildVoiceDesignIdsSafe(_params.text, _params.instruct, &_input_ids, &_instruct_ids, &tok_err)) {
         _last_error_code = -1402;
         _last_error_message = tok_err.empty() ? "tokenizer build ids failed" : tok_err;
         return false;
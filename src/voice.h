@@ -9,11 +9,18 @@
 #endif
 
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <optional>
 #include <string>
 #include <vector>
 
+#include "step_predictor.h"
+
+namespace QWEN3TTSUTILS {
+  class MappedFile;
+}
+
 namespace QWEN3TTS {
 
   struct ModelConfig {
@@ -24,14 +31,41 @@ namespace QWEN3TTS {
     std::string prefill_builder_file = "prefill_builder.onnx";
     std::string talker_prefill_file = "talker_prefill_cache.onnx";
     std::string talker_decode_file = "talker_decode_cache.onnx";
+    // Optional talker_prefill continuation (past_k/past_v/cache_position inputs) for chunked prefill.
+    std::string talker_prefill_chunk_file = "talker_prefill_chunk.onnx";
     std::string speech_tokenizer_file = "speech_tokenizer_decode.onnx";
     std::string cp_dynamic_file = "code_predictor_dynamic.onnx";
     std::string cp_step_pattern = "code_predictor_step_%02d.onnx";
+    // Use on-graph top-k selection when the talker export provides topk_values/topk_indices.
+    bool talker_graph_select = true;
+    // Optional bundle manifest with model dimensions; session shapes take precedence.
+    std::string manifest_file = "model_config.json";
+    // Optional fitted frame-count model (see StepPredictor); built-in defaults when absent.
+    std::string step_predictor_file = "step_predictor.txt";
  
     bool auto_cuda_talker_fp16_fallback = true;
     std::string cuda_talker_fallback_onnx_dir;
     std::string cuda_talker_prefill_fallback_file = "talker_prefill_cache.onnx";
     std::string cuda_talker_decode_fallback_file = "talker_decode_cache.onnx";
+
+    // Keep weights in read-only shared pages so forked workers don't multiply RSS:
+    // ORT-format (.ort) files are mmap-ed and used in place, weight prepacking is disabled.
+    // Only .ort bundles can share; load() fails with -3002 on any other model file.
+    bool share_model_weights = false;
+  };
+
+  // Model dimensions resolved at load(). Defaults match the 1.7B VoiceDesign bundle.
+  struct ModelDims {
+    int64_t                 hidden = 2048;
+    int64_t                 talker_vocab = 3072;
+    int64_t                 cp_vocab = 2048;
+    int64_t                 code_groups = 16;
+    int64_t                 codec_eos_id = 2150;
+    int                     sample_rate = 24000;
+    // Memory model for admission: talker K+V bytes per cached position (28 layers x 8 KV
+    // heads x 128 x fp32 x 2) and vocoder activation bytes per decoded frame.
+    int64_t                 kv_bytes_per_token = 229376;
+    int64_t                 vocoder_bytes_per_frame = 2 << 20;
   };
 
   struct TtsConfig {
@@ -46,10 +80,20 @@ namespace QWEN3TTS {
     std::string             vocoder_device = "auto";
     int                     gpu_device_id = 0;
     int64_t                 gpu_mem_limit_mb = 0;
-
+    // Device strings per stage: cpu | cuda | xnnpack | dnnl | openvino. Options below apply
+    // to every stage placed on that provider.
+    int                     xnnpack_threads = 0;              // 0 = intra_threads
+    bool                    dnnl_use_arena = true;
+    std::string             openvino_device_type = "CPU";     // CPU, GPU, NPU, AUTO:GPU,CPU, ...
+    int                     openvino_threads = 0;             // 0 = OpenVINO default
+    std::string             openvino_precision;               // "" = device default, FP32, FP16, ACCURACY
+    // Non-empty: ORT per-operator profiling on every session, traces written to this
+    // directory as <session>_<timestamp>.json (see Voice::endProfiling, ProfileAggregator).
+    std::string             profile_dir;
   };
 
   struct GenerationParams {
+    uint64_t                request_id = 0;   // tag for log lines; RequestQueue assigns one when 0
     std::string             text = "";
     std::string             instruct = "";
     std::vector<int64_t>    codec_lang = {-1};
@@ -68,8 +112,124 @@ namespace QWEN3TTS {
     float                   temperature = 1.0f;
     int                     top_k = 0;
     int64_t                 seed = -1;
+    int                     vocoder_window_frames = 0;   // 0 = decode all frames in one vocoder call
+    int                     vocoder_left_context_frames = 16;
+    int                     vocoder_right_context_frames = 4;
+    // Trailing-silence stop: every silence_probe_frames frames the newest frames are vocoded
+    // (with silence_probe_context_frames of left context) and scored by RMS and spectral
+    // flatness; generation stops after silence_stop_frames consecutive silent frames and
+    // the silent tail is cut down to silence_keep_frames.
+    int                     silence_stop_frames = 0;     // 0 = disabled
+    int                     silence_stop_min_steps = 16;
+    int                     silence_probe_frames = 8;
+    int                     silence_probe_context_frames = 4;
+    int                     silence_keep_frames = 2;
+    float                   silence_rms_db = -48.0f;
+    float                   silence_flatness = 0.45f;
+    // Preview tier: predict only the first cp_groups residual groups per frame (0 = all) and
+    // fill the rest with cp_fill_codes (one per residual group); empty uses the model's
+    // learned fill (manifest "cp_fill_codes") or code 0.
+    int                     cp_groups = 0;
+    std::vector<int64_t>    cp_fill_codes;
+    // Streaming sink: when set, decoded audio is delivered here in order and generateVoice
+    // returns an empty vector. With vocoder_window_frames > 0 each window is sent from
+    // stepGeneration as soon as its frames can no longer be trimmed; otherwise the whole
+    // utterance arrives once from finishGeneration. Returning false stops decoding and
+    // generation with -1304.
+    std::function<bool(const float* samples, size_t count)> on_audio;
   };
 
+  enum class StopReason {
+    None,
+    FrameBudget,
+    Eos,
+    TailRepeat,
+    FirstCodeRepeat,
+    Silence,
+  };
+
+  const char* StopReasonName(StopReason reason);
+
+  // Outcome of the last generateVoice / finishGeneration call.
+  struct GenerationStats {
+    int                     frames_generated = 0;
+    int                     frame_budget = 0;
+    int                     predicted_frames = 0;     // StepPredictor expectation for the prompt
+    StopReason              stop_reason = StopReason::None;
+    // Silence stop only: frame budget left unrun when the policy fired (headroom, not a
+    // measure of frames the stop avoided), and silent tail frames dropped before vocoding.
+    int                     budget_frames_left = 0;
+    int                     silence_trimmed_frames = 0;
+    int                     silence_probes = 0;
+    double                  silence_probe_ms = 0.0;
+    // Wall time per stage (session device): prefill builder, talker prefill + decode,
+    // code predictor, vocoder (including on_audio). Not carried across a snapshot restore.
+    double                  prefill_ms = 0.0;
+    double                  talker_ms = 0.0;
+    double                  cp_ms = 0.0;
+    double                  vocoder_ms = 0.0;
+    // Memory: estimateMemory's peak for the request, the KV cache actually held when decoding
+    // ended, and the sessions' CPU arena bytes in use at that point (0 without arena stats).
+    int64_t                 estimated_peak_bytes = 0;
+    int64_t                 kv_cache_bytes = 0;
+    int64_t                 arena_in_use_bytes = 0;
+  };
+
+  // Voice::estimateMemory: bytes a request is expected to hold at its peak. The KV cache
+  // lives through decoding and vocoding; code predictor and vocoder activations come and go.
+  struct MemoryEstimate {
+    int64_t                 prompt_tokens = 0;
+    int64_t                 frames = 0;               // frame budget beginGeneration would pick
+    int64_t                 kv_bytes = 0;
+    int64_t                 cp_bytes = 0;
+    int64_t                 vocoder_bytes = 0;        // one whole-utterance run or one window with context
+    int64_t                 pcm_bytes = 0;            // output samples held at once
+    int64_t                 peak_bytes = 0;
+  };
+
+  // Voice::memoryUsage: measured counterparts, summed over this Voice's sessions.
+  struct MemoryUsage {
+    bool                    arena_stats = false;      // false: ORT < 1.23 or arenas disabled
+    int64_t                 arena_in_use_bytes = 0;
+    int64_t                 arena_peak_bytes = 0;     // high-water mark since load
+    int64_t                 arena_reserved_bytes = 0;
+    int64_t                 rss_bytes = 0;            // whole process
+    int64_t                 peak_rss_bytes = 0;
+  };
+
+  // Synthetic shapes for Voice::warmup; an empty list skips that stage.
+  struct WarmupProfile {
+    std::vector<int>        prompt_tokens = {16, 64, 160};    // text tokens: prefill builder, talker prefill and its chunks
+    std::vector<int>        cache_lengths = {64, 256, 768};   // talker decode / prefill chunk KV length (history frames without KV cache)
+    std::vector<int>        vocoder_frames = {8, 48, 200};
+    int                     runs = 4;                         // calls per shape
+  };
+
+  struct WarmupTiming {
+    std::string             session;        // prefill_builder, talker_prefill, talker_prefill_chunk, talker_decode,
+                                            // code_predictor, vocoder
+    int64_t                 size = 0;       // prompt tokens, cache length, residual groups or vocoder frames
+    int64_t                 cache_length = 0;  // talker_prefill_chunk: KV length the chunk continues
+    double                  first_ms = 0.0; // first call at this shape
+    double                  steady_ms = 0.0;  // median of the remaining calls
+  };
+
+  struct WarmupReport {
+    std::vector<WarmupTiming> timings;      // in run order; the first entry per session is its cold call
+    double                  total_ms = 0.0;
+  };
+
+  // Voice::endProfiling: one ORT trace file per session.
+  struct ProfileTrace {
+    std::string             session;        // prefill_builder, talker_prefill, talker_decode, code_predictor, vocoder
+    std::string             path;
+  };
+
+  class GenerationState;
+  class VocoderBatcher;
+  class VoiceTokenizer;
+  struct VocoderBatcherConfig;
+
   class Voice {
     protected:
 
@@ -78,14 +238,55 @@ namespace QWEN3TTS {
         ~Voice();
       bool load(const TtsConfig& cfg);
       std::vector<float> generateVoice(GenerationParams &params);
+      // Step-wise form of generateVoice for schedulers that preempt or migrate requests:
+      // beginGeneration runs the prefill, stepGeneration decodes up to max_frames frames
+      // (0 = until a stop condition; returns 1 when done, 0 when paused, < 0 on error) and
+      // finishGeneration trims, writes codes and vocodes like generateVoice.
+      bool beginGeneration(const GenerationParams &params, GenerationState* state);
+      // Chunked prefill: with prefill_chunk_tokens > 0 only the prompt embeddings are built here;
+      // each prefillGeneration call then extends the KV cache by up to that many tokens
+      // (1 = prompt done, 0 = chunks left, < 0 on error), so a scheduler can run other requests'
+      // decode steps in between. Without talker_prefill_chunk.onnx the prompt goes in one call.
+      bool beginGeneration(const GenerationParams &params, GenerationState* state, int prefill_chunk_tokens);
+      int prefillGeneration(GenerationState* state);
+      bool supportsChunkedPrefill() const;
+      int stepGeneration(GenerationState* state, int max_frames = 0);
+      std::vector<float> finishGeneration(GenerationState* state);
+      // Runs synthetic inputs through every session at the profile's shapes so ORT lazy
+      // initialization, kernel selection and arena growth happen before real traffic.
+      bool warmup(const WarmupProfile& profile = WarmupProfile{}, WarmupReport* report = nullptr);
+      // Batcher over this Voice's vocoder session; the Voice must stay loaded while it is used.
+      std::shared_ptr<VocoderBatcher> makeVocoderBatcher(const VocoderBatcherConfig& cfg);
+      // Routes finishGeneration's vocoder runs through a shared batcher; nullptr restores
+      // direct runs on this Voice's own session.
+      void setVocoderBatcher(std::shared_ptr<VocoderBatcher> batcher);
+      // Predicted peak memory of a request from its prompt, frame budget and vocoder windowing;
+      // cheap and usable from any thread on a loaded Voice.
+      MemoryEstimate estimateMemory(const GenerationParams& params) const;
+      MemoryUsage memoryUsage() const;
+      // With TtsConfig::profile_dir set: stops ORT profiling on every session and returns the
+      // written traces. Profiling stays off until the next load().
+      std::vector<ProfileTrace> endProfiling();
       void unload();
 
       bool isLoaded() const;
+      const ModelDims& dims() const;
+      const GenerationStats& lastStats() const;
+      const StepPredictor& stepPredictor() const;
       int lastErrorCode() const;
       const std::string& lastErrorMessage() const;
 
   protected:
       bool BuildVoiceDesignIds();
+      bool ResolveModelDims();
+      int FailGeneration(const char* where, int code, const std::string& msg);
+      int FailFromException(const char* where, const std::string& msg);
+      bool UseGraphSelect() const;
+      std::vector<const char*> TalkerOutputNames(bool graph_select) const;
+      void AppendSelectInputs(GenerationState* state, std::vector<const char*>* names, std::vector<Ort::Value>* values, bool allow_eos);
+      bool ProbeSilence(GenerationState* state);
+      bool StreamAudio(GenerationState* state, std::string* error);
+      int64_t SelectFirstCode(const GenerationState& state, std::vector<Ort::Value>& out, bool graph_select, bool allow_eos, int64_t frame);
 
     private:
         TtsConfig               _config;
@@ -93,18 +294,15 @@ namespace QWEN3TTS {
         bool                    _loaded = false;
         int                     _last_error_code = 0;
         std::string             _last_error_message;
+        GenerationStats         _last_stats;
+        StepPredictor           _step_predictor;
         std::vector<int64_t>    _input_ids;
         std::vector<int64_t>    _instruct_ids;
 
 
     private:
         static constexpr int64_t kBatch = 1;
-        static constexpr int64_t kCodeGroups = 16;
-        static constexpr int64_t kHidden = 2048;
-        static constexpr int64_t kTalkerVocab = 3072;
-        static constexpr int64_t kCpVocab = 2048;
-        static constexpr int64_t kCodecEosId = 2150;
-        static constexpr int kSampleRate = 24000;
+        ModelDims               _dims;
 
         std::unique_ptr<Ort::Env> env_;
         std::optional<Ort::MemoryInfo> mi_;
@@ -112,11 +310,19 @@ namespace QWEN3TTS {
         std::unique_ptr<Ort::Session> prefill_builder_;
         std::unique_ptr<Ort::Session> talker_prefill_;
         std::unique_ptr<Ort::Session> talker_;
+        std::unique_ptr<Ort::Session> talker_prefill_chunk_;
         std::unique_ptr<Ort::Session> vocoder_;
         std::unique_ptr<Ort::Session> cp_dynamic_;
         std::vector<std::unique_ptr<Ort::Session>> cp_steps_;
+        std::vector<std::unique_ptr<QWEN3TTSUTILS::MappedFile>> model_maps_;
+        std::shared_ptr<VocoderBatcher> vocoder_batcher_;
+        std::shared_ptr<const VoiceTokenizer> tokenizer_;   // VoiceTokenizer::LoadShared, one per bundle
         bool has_cp_dynamic_ = false;
         bool use_kv_cache_ = false;
+        int64_t talker_topk_ = 0;              // K of the augmented talker export, 0 = full logits only
+        bool talker_has_allow_eos_ = false;
+        bool talker_has_temperature_ = false;
+        std::vector<int64_t> cp_fill_codes_;    // default codes for skipped residual groups
 
     };
 
@@ -0,0 +1,458 @@
+#include "worker_server.h"
+#include "audio_sink.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace QWEN3TTSUTILS;
+
+namespace QWEN3TTS {
+
+namespace {
+
+volatile std::sig_atomic_t g_stop_requested = 0;
+
+void OnStopSignal(int) {
+    g_stop_requested = 1;
+}
+
+bool WriteAllFd(int fd, const void* data, size_t len) {
+    const char* p = static_cast<const char*>(data);
+    while (len > 0) {
+        const ssize_t n = ::send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool ReadAllFd(int fd, void* data, size_t len) {
+    char* p = static_cast<char*>(data);
+    while (len > 0) {
+        const ssize_t n = ::recv(fd, p, len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+template <typename T>
+void PutPod(std::vector<uint8_t>& buf, const T& v) {
+    const auto* p = reinterpret_cast<const uint8_t*>(&v);
+    buf.insert(buf.end(), p, p + sizeof(T));
+}
+
+void PutStr(std::vector<uint8_t>& buf, const std::string& s) {
+    PutPod(buf, static_cast<uint32_t>(s.size()));
+    buf.insert(buf.end(), s.begin(), s.end());
+}
+
+template <typename T>
+bool GetPod(int fd, T* v) {
+    return ReadAllFd(fd, v, sizeof(T));
+}
+
+bool GetStr(int fd, std::string* s) {
+    // Bounded so a broken client cannot make a worker allocate unbounded memory.
+    constexpr uint32_t kMaxStringBytes = 1u << 20;
+    uint32_t len = 0;
+    if (!GetPod(fd, &len) || len > kMaxStringBytes) return false;
+    s->resize(len);
+    return len == 0 || ReadAllFd(fd, &(*s)[0], len);
+}
+
+int ConnectUnix(const std::string& path) {
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int ListenUnix(const std::string& path, int backlog, std::string* error) {
+    sockaddr_un addr{};
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        *error = "invalid unix socket path: " + path;
+        return -1;
+    }
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        *error = std::string("socket() failed: ") + std::strerror(errno);
+        return -1;
+    }
+    ::unlink(path.c_str());
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(fd, backlog) != 0) {
+        *error = "bind/listen failed on " + path + ": " + std::strerror(errno);
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+}  // namespace
+
+bool WriteWorkerRequest(int fd, const WorkerRequest& req, std::string* error) {
+    std::vector<uint8_t> buf;
+    buf.reserve(64 + req.text.size() + req.instruct.size());
+    PutPod(buf, kWorkerProtocolMagic);
+    PutPod(buf, kWorkerProtocolVersion);
+    PutStr(buf, req.text);
+    PutStr(buf, req.instruct);
+    PutPod(buf, req.lang);
+    PutPod(buf, static_cast<int32_t>(req.max_steps));
+    PutPod(buf, static_cast<int32_t>(req.eos_min_steps));
+    PutPod(buf, static_cast<uint8_t>(req.do_sample ? 1 : 0));
+    PutPod(buf, req.temperature);
+    PutPod(buf, static_cast<int32_t>(req.top_k));
+    PutPod(buf, req.seed);
+    if (!WriteAllFd(fd, buf.data(), buf.size())) {
+        if (error) *error = "failed to send request";
+        return false;
+    }
+    if (error) error->clear();
+    return true;
+}
+
+bool ReadWorkerRequest(int fd, WorkerRequest* req, std::string* error) {
+    uint32_t magic = 0;
+    uint16_t version = 0;
+    int32_t max_steps = 0;
+    int32_t eos_min_steps = 0;
+    uint8_t do_sample = 0;
+    int32_t top_k = 0;
+    if (!GetPod(fd, &magic) || magic != kWorkerProtocolMagic ||
+        !GetPod(fd, &version) || version != kWorkerProtocolVersion) {
+        if (error) *error = "bad request header";
+        return false;
+    }
+    if (!GetStr(fd, &req->text) || !GetStr(fd, &req->instruct) || !GetPod(fd, &req->lang) ||
+        !GetPod(fd, &max_steps) || !GetPod(fd, &eos_min_steps) || !GetPod(fd, &do_sample) ||
+        !GetPod(fd, &req->temperature) || !GetPod(fd, &top_k) || !GetPod(fd, &req->seed)) {
+        if (error) *error = "truncated request";
+        return false;
+    }
+    req->max_steps = max_steps;
+    req->eos_min_steps = eos_min_steps;
+    req->do_sample = do_sample != 0;
+    req->top_k = top_k;
+    if (error) error->clear();
+    return true;
+}
+
+bool WriteResponseFrame(int fd, uint8_t type, const void* payload, uint32_t len) {
+    uint8_t head[5];
+    head[0] = type;
+    std::memcpy(head + 1, &len, sizeof(len));
+    if (!WriteAllFd(fd, head, sizeof(head))) return false;
+    return len == 0 || WriteAllFd(fd, payload, len);
+}
+
+bool ReadResponseFrame(int fd, uint8_t* type, std::vector<uint8_t>* payload) {
+    uint8_t head[5];
+    if (!ReadAllFd(fd, head, sizeof(head))) return false;
+    uint32_t len = 0;
+    std::memcpy(&len, head + 1, sizeof(len));
+    *type = head[0];
+    payload->resize(len);
+    return len == 0 || ReadAllFd(fd, payload->data(), len);
+}
+
+int RequestSpeech(const std::string& socket_path, const WorkerRequest& req,
+                  std::vector<int16_t>* pcm, int* sample_rate, std::string* error) {
+    const int fd = ConnectUnix(socket_path);
+    if (fd < 0) {
+        if (error) *error = "failed to connect to " + socket_path;
+        return -3103;
+    }
+    if (!WriteWorkerRequest(fd, req, error)) {
+        ::close(fd);
+        return -3103;
+    }
+    pcm->clear();
+    std::vector<uint8_t> payload;
+    uint8_t type = 0;
+    int rc = -3103;
+    if (error) *error = "connection closed before end of stream";
+    while (ReadResponseFrame(fd, &type, &payload)) {
+        if (type == kFrameFormat && payload.size() >= sizeof(uint32_t)) {
+            uint32_t sr = 0;
+            std::memcpy(&sr, payload.data(), sizeof(sr));
+            if (sample_rate) *sample_rate = static_cast<int>(sr);
+        } else if (type == kFramePcm) {
+            const size_t n = payload.size() / sizeof(int16_t);
+            const size_t off = pcm->size();
+            pcm->resize(off + n);
+            std::memcpy(pcm->data() + off, payload.data(), n * sizeof(int16_t));
+        } else if (type == kFrameEnd) {
+            rc = 0;
+            if (error) error->clear();
+            break;
+        } else if (type == kFrameError) {
+            int32_t code = -3103;
+            if (payload.size() >= sizeof(code)) std::memcpy(&code, payload.data(), sizeof(code));
+            if (error) error->assign(payload.begin() + std::min(payload.size(), sizeof(code)), payload.end());
+            rc = code;
+            break;
+        }
+    }
+    ::close(fd);
+    return rc;
+}
+
+bool WorkerServer::prefetchModelFiles()
+{
+    // Warm the page cache once in the parent; every forked worker then maps the
+    // same physical pages instead of reading its own copy.
+    _prefetched.clear();
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(_config.tts.model.path, ec)) {
+        if (!entry.is_regular_file()) continue;
+        const std::string ext = entry.path().extension().string();
+        if (ext == ".json" || ext == ".txt") continue;
+        auto mapped = std::make_unique<MappedFile>();
+        std::string map_err;
+        if (!mapped->Open(entry.path().string(), &map_err)) {
+            QWEN3TTS_LOG_WARN("server") << "prefetch skipped: " << map_err;
+            continue;
+        }
+        mapped->Prefetch();
+        _prefetched.push_back(std::move(mapped));
+    }
+    if (ec) {
+        _last_error_code = -3001;
+        _last_error_message = "cannot list model dir: " + _config.tts.model.path;
+        return false;
+    }
+    return true;
+}
+
+void WorkerServer::serveConnection(Voice& voice, int conn_fd)
+{
+    WorkerRequest req;
+    std::string err;
+    if (!ReadWorkerRequest(conn_fd, &req, &err)) {
+        const int32_t code = -3104;
+        std::vector<uint8_t> payload;
+        PutPod(payload, code);
+        payload.insert(payload.end(), err.begin(), err.end());
+        WriteResponseFrame(conn_fd, kFrameError, payload.data(), static_cast<uint32_t>(payload.size()));
+        return;
+    }
+
+    GenerationParams params;
+    params.text = req.text;
+    params.instruct = req.instruct;
+    params.codec_lang = {req.lang};
+    params.max_steps = req.max_steps;
+    params.eos_min_steps = req.eos_min_steps;
+    params.do_sample = req.do_sample;
+    params.temperature = req.temperature;
+    params.top_k = req.top_k;
+    params.seed = req.seed;
+
+    params.vocoder_window_frames = _config.vocoder_window_frames;
+
+    const int sample_rate = voice.dims().sample_rate;
+    std::vector<uint8_t> fmt;
+    PutPod(fmt, static_cast<uint32_t>(sample_rate));
+    PutPod(fmt, static_cast<uint16_t>(1));
+    PutPod(fmt, static_cast<uint16_t>(16));
+    if (!WriteResponseFrame(conn_fd, kFrameFormat, fmt.data(), static_cast<uint32_t>(fmt.size()))) return;
+
+    // With vocoder_window_frames > 0, PCM leaves the worker window by window while frames are
+    // still being generated; a dropped client aborts generation at the next window.
+    const size_t chunk = std::max<size_t>(1, static_cast<size_t>(sample_rate) * static_cast<size_t>(std::max(1, _config.pcm_chunk_ms)) / 1000);
+    std::vector<int16_t> block(chunk);
+    uint64_t total = 0;
+    params.on_audio = [&](const float* samples, size_t n) {
+        for (size_t off = 0; off < n; off += chunk) {
+            const size_t m = std::min(chunk, n - off);
+            FloatToPcm16(samples + off, block.data(), m);
+            if (!WriteResponseFrame(conn_fd, kFramePcm, block.data(), static_cast<uint32_t>(m * sizeof(int16_t)))) return false;
+        }
+        total += n;
+        return true;
+    };
+
+    voice.generateVoice(params);
+    if (voice.lastErrorCode() != 0) {
+        const int32_t code = voice.lastErrorCode();
+        const std::string& msg = voice.lastErrorMessage();
+        std::vector<uint8_t> payload;
+        PutPod(payload, code);
+        payload.insert(payload.end(), msg.begin(), msg.end());
+        WriteResponseFrame(conn_fd, kFrameError, payload.data(), static_cast<uint32_t>(payload.size()));
+        return;
+    }
+    WriteResponseFrame(conn_fd, kFrameEnd, &total, sizeof(total));
+}
+
+void WorkerServer::workerMain(int listen_fd)
+{
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    TtsConfig cfg = _config.tts;
+    cfg.model.share_model_weights = _config.share_model_weights;
+    Voice voice;
+    if (!voice.load(cfg)) {
+        QWEN3TTS_LOG_ERROR("server") << "worker load failed: " << voice.lastErrorMessage() << Kv("pid", ::getpid());
+        Logger::instance().flush();
+        ::_exit(3);
+    }
+    if (_config.warmup && !voice.warmup()) {
+        QWEN3TTS_LOG_ERROR("server") << "worker warmup failed: " << voice.lastErrorMessage() << Kv("pid", ::getpid());
+        Logger::instance().flush();
+        ::_exit(3);
+    }
+    QWEN3TTS_LOG_INFO("server") << "worker ready" << Kv("pid", ::getpid());
+
+    while (true) {
+        const int conn_fd = ::accept(listen_fd, nullptr, nullptr);
+        if (conn_fd < 0) {
+            if (errno == EINTR) continue;
+            QWEN3TTS_LOG_ERROR("server") << "worker accept failed: " << std::strerror(errno) << Kv("pid", ::getpid());
+            Logger::instance().flush();
+            ::_exit(4);
+        }
+        serveConnection(voice, conn_fd);
+        ::close(conn_fd);
+    }
+}
+
+pid_t WorkerServer::spawnWorker(int listen_fd)
+{
+    std::cout.flush();
+    std::cerr.flush();
+    const pid_t pid = ::fork();
+    if (pid == 0) workerMain(listen_fd);
+    return pid;
+}
+
+bool WorkerServer::run(const WorkerServerConfig& cfg)
+{
+    _config = cfg;
+    _last_error_code = 0;
+    _last_error_message.clear();
+    g_stop_requested = 0;
+
+    if (_config.tts.model.path.empty()) {
+        _last_error_code = -3001;
+        _last_error_message = "model path must not be empty";
+        return false;
+    }
+    int workers = _config.workers;
+    if (workers <= 0) {
+        const int hw = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+        workers = std::max(1, hw / std::max(1, _config.tts.intra_threads));
+    }
+    if (_config.share_model_weights) {
+        // Checked here so a wrong bundle fails once instead of in every forked worker.
+        const ModelConfig& m = _config.tts.model;
+        for (const std::string* file : {&m.prefill_builder_file, &m.talker_prefill_file, &m.talker_decode_file,
+                                        &m.speech_tokenizer_file}) {
+            if (!IsOrtFormatModel(*file)) {
+                _last_error_code = -3105;
+                _last_error_message = "share_model_weights needs ORT-format (.ort) models, got " + *file;
+                return false;
+            }
+        }
+    }
+    if (!prefetchModelFiles()) return false;
+
+    std::string err;
+    const int listen_fd = ListenUnix(_config.socket_path, _config.listen_backlog, &err);
+    if (listen_fd < 0) {
+        _last_error_code = -3101;
+        _last_error_message = err;
+        return false;
+    }
+
+    std::signal(SIGINT, OnStopSignal);
+    std::signal(SIGTERM, OnStopSignal);
+
+    std::vector<pid_t> children;
+    for (int i = 0; i < workers; ++i) {
+        const pid_t pid = spawnWorker(listen_fd);
+        if (pid < 0) {
+            _last_error_code = -3102;
+            _last_error_message = std::string("fork failed: ") + std::strerror(errno);
+            break;
+        }
+        children.push_back(pid);
+    }
+    QWEN3TTS_LOG_INFO("server") << "listening on " << _config.socket_path << Kv("workers", children.size());
+
+    while (!g_stop_requested && !children.empty()) {
+        int status = 0;
+        const pid_t dead = ::waitpid(-1, &status, 0);
+        if (dead < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        children.erase(std::remove(children.begin(), children.end(), dead), children.end());
+        // Load failures exit with 3: respawning would just loop on the same error, and the
+        // other workers load the same bundle, so the server stops.
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 3) {
+            _last_error_code = -3105;
+            _last_error_message = "worker failed to load or warm up the model";
+            QWEN3TTS_LOG_ERROR("server") << _last_error_message << Kv("pid", dead);
+            break;
+        }
+        if (g_stop_requested || !_config.respawn_workers) continue;
+        QWEN3TTS_LOG_WARN("server") << "worker exited, respawning" << Kv("pid", dead);
+        const pid_t pid = spawnWorker(listen_fd);
+        if (pid > 0) children.push_back(pid);
+    }
+
+    if (!g_stop_requested && children.empty() && _last_error_code == 0) {
+        _last_error_code = -3106;
+        _last_error_message = "no worker left alive";
+    }
+    for (pid_t pid : children) ::kill(pid, SIGTERM);
+    for (pid_t pid : children) ::waitpid(pid, nullptr, 0);
+    ::close(listen_fd);
+    ::unlink(_config.socket_path.c_str());
+    _prefetched.clear();
+    return _last_error_code == 0;
+}
+
+void WorkerServer::stop()
+{
+    g_stop_requested = 1;
+}
+
+int WorkerServer::lastErrorCode() const
+{
+    return _last_error_code;
+}
+
+const std::string& WorkerServer::lastErrorMessage() const
+{
+    return _last_error_message;
+}
+
+}
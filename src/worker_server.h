@@ -0,0 +1,91 @@
+#pragma once
+
+#include "voice.h"
+#include "utils.h"
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace QWEN3TTS {
+
+  // Pre-fork worker server: the parent maps the model files once, forks `workers`
+  // children that share those pages, and every child serves requests from one
+  // listening Unix socket.
+  struct WorkerServerConfig {
+    TtsConfig               tts;
+    std::string             socket_path = "/tmp/qwen3_tts.sock";
+    int                     workers = 0;            // 0 = hardware threads / intra_threads
+    int                     listen_backlog = 64;
+    int                     pcm_chunk_ms = 100;     // size of each streamed PCM frame
+    int                     vocoder_window_frames = 48;  // stream per vocoder window, 0 = after full decode
+    bool                    share_model_weights = false; // true needs an .ort bundle; false = private weights per worker
+    bool                    respawn_workers = true;
+    bool                    warmup = true;          // Voice::warmup before a worker starts accepting
+  };
+
+  // Wire protocol (host byte order, local socket only).
+  //
+  // Request:  u32 magic | u16 version | str text | str instruct | i64 lang |
+  //           i32 max_steps | i32 eos_min_steps | u8 do_sample | f32 temperature |
+  //           i32 top_k | i64 seed            (str = u32 length + bytes)
+  // Response: sequence of frames, each u8 type | u32 payload_len | payload
+  //           'F' format  : u32 sample_rate | u16 channels | u16 bits_per_sample
+  //           'P' pcm     : s16le samples
+  //           'E' end     : u64 total_samples
+  //           'X' error   : i32 code | message bytes
+  struct WorkerRequest {
+    std::string             text;
+    std::string             instruct;
+    int64_t                 lang = -1;
+    int                     max_steps = 0;
+    int                     eos_min_steps = 0;
+    bool                    do_sample = false;
+    float                   temperature = 1.0f;
+    int                     top_k = 0;
+    int64_t                 seed = -1;
+  };
+
+  static constexpr uint32_t kWorkerProtocolMagic = 0x53545133;  // "3QTS"
+  static constexpr uint16_t kWorkerProtocolVersion = 1;
+  static constexpr uint8_t  kFrameFormat = 'F';
+  static constexpr uint8_t  kFramePcm = 'P';
+  static constexpr uint8_t  kFrameEnd = 'E';
+  static constexpr uint8_t  kFrameError = 'X';
+
+  bool WriteWorkerRequest(int fd, const WorkerRequest& req, std::string* error);
+  bool ReadWorkerRequest(int fd, WorkerRequest* req, std::string* error);
+  bool WriteResponseFrame(int fd, uint8_t type, const void* payload, uint32_t len);
+  bool ReadResponseFrame(int fd, uint8_t* type, std::vector<uint8_t>* payload);
+
+  // Client helper: sends one request and collects the streamed PCM into `pcm`.
+  // Returns 0 on success, the server error code, or -3103 on transport errors.
+  int RequestSpeech(const std::string& socket_path, const WorkerRequest& req,
+                    std::vector<int16_t>* pcm, int* sample_rate, std::string* error);
+
+  class WorkerServer {
+  public:
+      // Blocks until stop() is requested (SIGINT/SIGTERM are hooked by run()).
+      bool run(const WorkerServerConfig& cfg);
+      static void stop();
+
+      int lastErrorCode() const;
+      const std::string& lastErrorMessage() const;
+
+  private:
+      bool prefetchModelFiles();
+      pid_t spawnWorker(int listen_fd);
+      [[noreturn]] void workerMain(int listen_fd);
+      void serveConnection(Voice& voice, int conn_fd);
+
+  private:
+      WorkerServerConfig      _config;
+      int                     _last_error_code = 0;
+      std::string             _last_error_message;
+      std::vector<std::unique_ptr<QWEN3TTSUTILS::MappedFile>> _prefetched;
+  };
+
+}